@@ -0,0 +1,14 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// replaces the file at path with data through a temporary file which is flushed to disk and then renamed over it
+// a crash leaves either the old or the new content, never a truncated file
+bool AtomicWriteFile(const std::filesystem::path& path, std::string_view data);
+
+// the whole file at path, read with plain system calls so that no stream machinery is pulled in
+// nullopt if it cannot be opened or read
+std::optional<std::string> ReadWholeFile(const std::filesystem::path& path);
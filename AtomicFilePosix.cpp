@@ -0,0 +1,110 @@
+#include "AtomicFile.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+  // read size for files whose size is not known up front, e.g. in /proc
+  constexpr std::size_t ReadChunkSize = 4096;
+}
+
+bool AtomicWriteFile(const std::filesystem::path& path, std::string_view data) {
+  // a symlinked file is replaced where it really lives, so that the link stays a link
+  auto target = path;
+  std::error_code error;
+  if (std::filesystem::is_symlink(path, error)) {
+    if (auto resolved = std::filesystem::weakly_canonical(path, error); !error) {
+      target = std::move(resolved);
+    }
+  }
+  const std::string tempPath = target.native() + ".tmp";
+
+  // the replacement keeps the mode and owner of the file it replaces; new files get 0644
+  struct stat st{};
+  const bool exists = stat(target.c_str(), &st) == 0;
+  const mode_t mode = exists ? st.st_mode & 07777 : 0644;
+  const int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode & 0600);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (exists) {
+    // best effort, since only root may hand a file to another user; the owner goes first, as it clears set-id bits
+    [[maybe_unused]] const auto chowned = fchown(fd, st.st_uid, st.st_gid);
+  }
+  // created without group and other bits, so that a private file is never readable through its replacement
+  bool succeeded = fchmod(fd, mode) == 0;
+  while (!data.empty()) {
+    const auto written = write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      succeeded = false;
+      break;
+    }
+    data.remove_prefix(static_cast<std::size_t>(written));
+  }
+
+  succeeded = succeeded && fsync(fd) == 0;
+  succeeded = close(fd) == 0 && succeeded;
+  if (!succeeded || rename(tempPath.c_str(), target.c_str()) != 0) {
+    unlink(tempPath.c_str());
+    return false;
+  }
+
+  // make the rename itself durable
+  auto dirPath = target.parent_path();
+  if (dirPath.empty()) {
+    dirPath = ".";
+  }
+  if (const int dirFd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); dirFd >= 0) {
+    fsync(dirFd);
+    close(dirFd);
+  }
+
+  return true;
+}
+
+std::optional<std::string> ReadWholeFile(const std::filesystem::path& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  // sized from fstat, so a regular file takes a single allocation and read
+  struct stat st{};
+  std::string data;
+  data.resize(fstat(fd, &st) == 0 && st.st_size > 0 ? static_cast<std::size_t>(st.st_size) : ReadChunkSize);
+  std::size_t size = 0;
+  while (true) {
+    if (size == data.size()) {
+      data.resize(data.size() + ReadChunkSize);
+    }
+    const auto length = read(fd, data.data() + size, data.size() - size);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return std::nullopt;
+    }
+    if (length == 0) {
+      break;
+    }
+    size += static_cast<std::size_t>(length);
+  }
+  close(fd);
+  data.resize(size);
+  return data;
+}
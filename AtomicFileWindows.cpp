@@ -0,0 +1,66 @@
+#include "AtomicFile.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <Windows.h>
+
+bool AtomicWriteFile(const std::filesystem::path& path, std::string_view data) {
+  const std::wstring tempPath = path.native() + L".tmp";
+
+  const HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  bool succeeded = true;
+  while (!data.empty()) {
+    DWORD written = 0;
+    if (!WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &written, NULL)) {
+      succeeded = false;
+      break;
+    }
+    data.remove_prefix(written);
+  }
+
+  succeeded = succeeded && FlushFileBuffers(hFile);
+  CloseHandle(hFile);
+  if (!succeeded || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    DeleteFileW(tempPath.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+std::optional<std::string> ReadWholeFile(const std::filesystem::path& path) {
+  const HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return std::nullopt;
+  }
+
+  LARGE_INTEGER fileSize{};
+  if (!GetFileSizeEx(hFile, &fileSize)) {
+    CloseHandle(hFile);
+    return std::nullopt;
+  }
+  std::string data(static_cast<std::size_t>(fileSize.QuadPart), '\0');
+  std::size_t size = 0;
+  while (size < data.size()) {
+    DWORD read = 0;
+    if (!ReadFile(hFile, data.data() + size, static_cast<DWORD>(data.size() - size), &read, NULL)) {
+      CloseHandle(hFile);
+      return std::nullopt;
+    }
+    if (read == 0) {
+      break;
+    }
+    size += read;
+  }
+  CloseHandle(hFile);
+  data.resize(size);
+  return data;
+}
@@ -0,0 +1,167 @@
+// measures how many backend calls bursts of state changes cost, against a backend as slow as a D-Bus round trip
+// first the same state is applied over and over, which must reach the backend once; then bursts of on/off toggles
+// run with and without a coalescing window, the flushes driven by a TimerQueue as in the daemon
+// with the window each burst must cost two backend calls at most, end in the state last asked for, and have the last
+// change reach the backend no later than the window (plus FlushSlack) after it was made
+// exits with 1 when a check fails
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+#include <poll.h>
+
+#include "Metrics.hpp"
+#include "Preventer.hpp"
+#include "TimerQueue.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto Window = 20ms;
+  constexpr auto FlushSlack = 10ms;
+  // about a logind Inhibit or a lock being closed
+  constexpr auto BackendCost = 200us;
+  constexpr int DefaultBurstSize = 1000;
+  constexpr int Bursts = 5;
+  constexpr int RepeatedApplies = 10000;
+
+  class CountingBackend : public Preventer::Backend {
+  public:
+    int applies = 0;
+    bool systemRequired = false;
+    std::chrono::steady_clock::time_point lastApply;
+
+    bool Apply(bool system, bool) override {
+      std::this_thread::sleep_for(BackendCost);
+      applies++;
+      systemRequired = system;
+      lastApply = std::chrono::steady_clock::now();
+      return true;
+    }
+
+    void Release() override {}
+  };
+
+  struct BurstResult {
+    int applies = 0;
+    std::chrono::nanoseconds elapsed{};
+    // from the last change to the backend call which applied it
+    std::chrono::nanoseconds latency{};
+    bool correct = true;
+  };
+
+  // toggles on and off burstSize times, starting from off with on, and waits until nothing is left to flush
+  // with an even burstSize the burst ends where the first change left the backend, the worst case for coalescing
+  BurstResult RunBurst(const CountingBackend& backend, TimerQueue& timerQueue, int burstSize) {
+    BurstResult result;
+    const int appliesBefore = backend.applies;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < burstSize; i++) {
+      Preventer::ApplyStateFromIPCFlags(i % 2 == 0 ? Preventer::IPCFlags::Enable : Preventer::IPCFlags::Disable);
+    }
+    const auto lastChange = std::chrono::steady_clock::now();
+    result.elapsed = lastChange - start;
+
+    while (timerQueue.GetCount() > 0) {
+      pollfd pfd{timerQueue.GetFd(), POLLIN, 0};
+      poll(&pfd, 1, 1000);
+      timerQueue.ReadEvents();
+    }
+    result.applies = backend.applies - appliesBefore;
+    result.latency = backend.lastApply > lastChange ? backend.lastApply - lastChange : 0ns;
+    result.correct = backend.systemRequired == (burstSize % 2 == 1);
+
+    // off again, and out of the window before the next burst
+    Preventer::gEnable = false;
+    Preventer::ApplyState();
+    while (timerQueue.GetCount() > 0) {
+      pollfd pfd{timerQueue.GetFd(), POLLIN, 0};
+      poll(&pfd, 1, 1000);
+      timerQueue.ReadEvents();
+    }
+    std::this_thread::sleep_for(Window);
+    return result;
+  }
+
+  double ToMilliseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int burstSize = argc > 1 ? std::atoi(argv[1]) : DefaultBurstSize;
+  if (burstSize <= 0) {
+    return 2;
+  }
+
+  auto backend = std::make_unique<CountingBackend>();
+  const auto& counter = *backend;
+  Preventer::SetBackend(std::move(backend));
+  Preventer::gSystemFlag = true;
+  TimerQueue timerQueue;
+  bool ok = true;
+
+  {
+    Preventer::gEnable = true;
+    const int appliesBefore = counter.applies;
+    const auto elidedBefore = Metrics::gBackendCallsElided.Get();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < RepeatedApplies; i++) {
+      Preventer::ApplyState();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const int applies = counter.applies - appliesBefore;
+    std::printf("same state %d times: backend calls %d, elided %llu, %.0f ns per apply\n",
+      RepeatedApplies,
+      applies,
+      static_cast<unsigned long long>(Metrics::gBackendCallsElided.Get() - elidedBefore),
+      std::chrono::duration<double, std::nano>(elapsed).count() / RepeatedApplies);
+    ok &= applies <= 1;
+    Preventer::gEnable = false;
+    Preventer::ApplyState();
+  }
+
+  for (const auto window : {0ms, std::chrono::duration_cast<std::chrono::milliseconds>(Window)}) {
+    Preventer::SetCoalescing(window, [&timerQueue](std::chrono::milliseconds delay) {
+      timerQueue.Schedule(TimerQueue::Clock::now() + delay, [](TimerQueue::TimerId) {
+        Preventer::FlushState();
+      });
+    });
+    std::this_thread::sleep_for(Window);
+
+    int maxApplies = 0;
+    std::chrono::nanoseconds maxElapsed{};
+    std::chrono::nanoseconds maxLatency{};
+    bool correct = true;
+    for (int burst = 0; burst < Bursts; burst++) {
+      const auto result = RunBurst(counter, timerQueue, burstSize);
+      maxApplies = std::max(maxApplies, result.applies);
+      maxElapsed = std::max(maxElapsed, result.elapsed);
+      maxLatency = std::max(maxLatency, result.latency);
+      correct &= result.correct;
+    }
+    std::printf("window %lld ms: bursts %d of %d toggles, backend calls per burst %d, burst %.2f ms, last change applied after %.2f ms\n",
+      static_cast<long long>(window.count()),
+      Bursts,
+      burstSize,
+      maxApplies,
+      ToMilliseconds(maxElapsed),
+      ToMilliseconds(maxLatency));
+    if (!correct) {
+      std::puts("a burst did not end in the state last asked for");
+      ok = false;
+    }
+    if (window > 0ms) {
+      ok &= maxApplies <= 2;
+      ok &= maxLatency <= window + FlushSlack;
+    }
+  }
+
+  Preventer::SetCoalescing(0ms, {});
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// counts bytes written and I/O syscalls for 1,000 config toggles
+// compares the old truncate-and-rewrite on every toggle, an immediate atomic write on every toggle and the write-behind path
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "ConfigFile.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int DefaultToggles = 1000;
+
+  struct IOCounters {
+    std::uint64_t bytes = 0;
+    std::uint64_t writeSyscalls = 0;
+  };
+
+  // wchar and syscw of /proc/self/io; only read and write calls are counted, open/fsync/rename are not
+  IOCounters ReadIOCounters() {
+    IOCounters counters;
+    std::ifstream ifs("/proc/self/io");
+    for (std::string key; ifs >> key; ) {
+      std::uint64_t value = 0;
+      ifs >> value;
+      if (key == "wchar:"sv) {
+        counters.bytes = value;
+      } else if (key == "syscw:"sv) {
+        counters.writeSyscalls = value;
+      }
+    }
+    return counters;
+  }
+
+  void Report(const char* name, int toggles, const IOCounters& before, const IOCounters& after, std::uint64_t fileWrites, std::chrono::nanoseconds elapsed) {
+    std::printf("%s: toggles %d, file writes %llu, bytes written %llu, write syscalls %llu, elapsed %lld us\n",
+      name,
+      toggles,
+      static_cast<unsigned long long>(fileWrites),
+      static_cast<unsigned long long>(after.bytes - before.bytes),
+      static_cast<unsigned long long>(after.writeSyscalls - before.writeSyscalls),
+      static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int toggles = argc > 1 ? std::atoi(argv[1]) : DefaultToggles;
+  const auto path = std::filesystem::temp_directory_path() / ("SleepPreventer.ConfigBenchmark."s + std::to_string(getpid()) + ".cfg"s);
+
+  // the pre write-behind behavior: truncate and rewrite through wfstream with std::endl on every toggle
+  {
+    const auto before = ReadIOCounters();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < toggles; i++) {
+      std::wfstream wfs;
+      wfs.open(path, std::ios_base::out | std::ios_base::trunc);
+      wfs << L"display"sv << L" = "sv << 0 << std::endl;
+      wfs << L"enable"sv << L" = "sv << (i % 2) << std::endl;
+      wfs << L"system"sv << L" = "sv << 0 << std::endl;
+      wfs << std::flush;
+    }
+    Report("legacy rewrite", toggles, before, ReadIOCounters(), toggles, std::chrono::steady_clock::now() - start);
+  }
+
+  // atomic write on every toggle
+  {
+    ConfigFile configFile(path);
+    const auto before = ReadIOCounters();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < toggles; i++) {
+      configFile.SetBool(Config::Key::Enable, i % 2 != 0);
+      configFile.Flush();
+    }
+    Report("immediate atomic", toggles, before, ReadIOCounters(), configFile.GetWriteStats().flushes, std::chrono::steady_clock::now() - start);
+  }
+
+  // write-behind: the whole burst coalesces into deferred writes
+  {
+    const auto before = ReadIOCounters();
+    const auto start = std::chrono::steady_clock::now();
+    std::uint64_t fileWrites = 0;
+    {
+      ConfigFile configFile(path);
+      for (int i = 0; i < toggles; i++) {
+        configFile.SetBool(Config::Key::Enable, i % 2 == 0);
+        configFile.Save();
+      }
+      configFile.Flush();
+      fileWrites = configFile.GetWriteStats().flushes;
+    }
+    Report("write-behind", toggles, before, ReadIOCounters(), fileWrites, std::chrono::steady_clock::now() - start);
+  }
+
+  // unchanged state is never written
+  {
+    const auto before = ReadIOCounters();
+    std::uint64_t fileWrites = 0;
+    {
+      ConfigFile configFile(path);
+      const auto value = configFile.GetBool(Config::Key::Enable);
+      for (int i = 0; i < toggles; i++) {
+        configFile.SetBool(Config::Key::Enable, value);
+        configFile.Save();
+      }
+      fileWrites = configFile.GetWriteStats().flushes;
+    }
+    Report("no-op sets", toggles, before, ReadIOCounters(), fileWrites, std::chrono::nanoseconds{});
+  }
+
+  std::filesystem::remove(path);
+  return 0;
+}
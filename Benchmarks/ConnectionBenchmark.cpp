@@ -0,0 +1,335 @@
+// opens a large number of loopback TCP sockets (100k by default, half of them accepted ends) on unwatched ports, spread
+// over child processes so that none needs more descriptors than its limit, plus a few connections on watched IPv4 and IPv6 ports, then times a query of the connection watcher against reading and
+// parsing /proc/net/tcp and tcp6 for the same answer
+// exits with 1 when the two disagree, when a query allocates or misses the connections going away, or when the median
+// query goes over QueryBudget or is not faster than the text; exits with 2 if the sockets cannot be opened
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ConnectionWatcher.hpp"
+
+using namespace std::literals;
+
+namespace {
+  std::atomic<std::uint64_t> gAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+  gAllocations++;
+  if (const auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+  constexpr auto QueryBudget = 100ms;
+  constexpr int DefaultSockets = 100000;
+  constexpr int Queries = 20;
+  constexpr int WatchedConnections = 3;
+  // per child, well within the ephemeral ports a single destination can be reached from
+  constexpr int MaxConnectionsPerHolder = 20000;
+  // descriptors a holder needs besides its connections
+  constexpr int HolderReserve = 64;
+  constexpr std::size_t ProcBufferSize = 256 * 1024;
+
+  struct Listener {
+    int fd = -1;
+    sockaddr_storage address{};
+    socklen_t addressLength = 0;
+    std::uint16_t port = 0;
+  };
+
+  std::optional<Listener> Listen(int family) {
+    Listener listener;
+    listener.fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener.fd < 0) {
+      return std::nullopt;
+    }
+    if (family == AF_INET) {
+      auto& address = reinterpret_cast<sockaddr_in&>(listener.address);
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      listener.addressLength = sizeof(sockaddr_in);
+    } else {
+      auto& address = reinterpret_cast<sockaddr_in6&>(listener.address);
+      address.sin6_family = AF_INET6;
+      address.sin6_addr = in6addr_loopback;
+      listener.addressLength = sizeof(sockaddr_in6);
+    }
+    if (bind(listener.fd, reinterpret_cast<const sockaddr*>(&listener.address), listener.addressLength) != 0 ||
+      listen(listener.fd, SOMAXCONN) != 0 ||
+      getsockname(listener.fd, reinterpret_cast<sockaddr*>(&listener.address), &listener.addressLength) != 0) {
+      close(listener.fd);
+      return std::nullopt;
+    }
+    listener.port = ntohs(family == AF_INET ? reinterpret_cast<const sockaddr_in&>(listener.address).sin_port : reinterpret_cast<const sockaddr_in6&>(listener.address).sin6_port);
+    return listener;
+  }
+
+  // opens count connections to listener and accepts them; appends both ends to fds
+  bool Connect(const Listener& listener, int count, std::vector<int>& fds) {
+    for (int i = 0; i < count; i++) {
+      const int client = socket(listener.address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (client < 0) {
+        return false;
+      }
+      fds.push_back(client);
+      if (connect(client, reinterpret_cast<const sockaddr*>(&listener.address), listener.addressLength) != 0) {
+        return false;
+      }
+      const int server = accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (server < 0) {
+        return false;
+      }
+      fds.push_back(server);
+    }
+    return true;
+  }
+
+  // a child process which opens count connections to a listener of its own and keeps them until the write end of the
+  // release pipe is closed; returns its pid after it has reported back, or -1
+  pid_t SpawnHolder(int count, const int release[2]) {
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+      return -1;
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(ready[0]);
+      close(release[1]);
+      std::vector<int> fds;
+      fds.reserve(static_cast<std::size_t>(count) * 2);
+      const auto listener = Listen(AF_INET);
+      const char result = listener && Connect(listener.value(), count, fds) ? 1 : 0;
+      write(ready[1], &result, 1);
+      char byte;
+      while (read(release[0], &byte, 1) < 0 && errno == EINTR) {
+      }
+      _exit(0);
+    }
+    close(ready[1]);
+    char result = 0;
+    if (pid < 0 || read(ready[0], &result, 1) != 1 || result != 1) {
+      close(ready[0]);
+      return -1;
+    }
+    close(ready[0]);
+    return pid;
+  }
+
+  std::uint64_t ParseHex(std::string_view text) {
+    std::uint64_t value = 0;
+    for (const auto c : text) {
+      value = value * 16 + static_cast<std::uint64_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return value;
+  }
+
+  // the text way: "sl local_address rem_address st ...", with addresses as hex "address:port" and st 01 for established
+  std::size_t CountFromProc(const char* path, const std::vector<ConnectionWatcher::PortRange>& ranges, char* buffer) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return 0;
+    }
+    std::size_t count = 0;
+    std::size_t kept = 0;
+    bool header = true;
+    ssize_t length;
+    while ((length = read(fd, buffer + kept, ProcBufferSize - kept)) > 0) {
+      std::string_view data(buffer, kept + static_cast<std::size_t>(length));
+      std::size_t newline;
+      while ((newline = data.find('\n')) != std::string_view::npos) {
+        auto line = data.substr(0, newline);
+        data.remove_prefix(newline + 1);
+        if (header) {
+          header = false;
+          continue;
+        }
+        std::string_view fields[4];
+        for (auto& field : fields) {
+          const auto begin = line.find_first_not_of(' ');
+          line.remove_prefix(std::min(begin, line.size()));
+          const auto end = std::min(line.find(' '), line.size());
+          field = line.substr(0, end);
+          line.remove_prefix(end);
+        }
+        const auto colon = fields[1].rfind(':');
+        if (colon == std::string_view::npos || fields[3] != "01"sv) {
+          continue;
+        }
+        const auto port = ParseHex(fields[1].substr(colon + 1));
+        for (const auto& range : ranges) {
+          if (port >= range.first && port <= range.last) {
+            count++;
+            break;
+          }
+        }
+      }
+      kept = data.size();
+      std::copy(data.begin(), data.end(), buffer);
+    }
+    close(fd);
+    return count;
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  void Report(const char* name, std::vector<std::chrono::nanoseconds>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s: iterations %zu, p50 %lld us, p99 %lld us, max %lld us\n", name, samples.size(), Percentile(samples, 0.5) / 1000, Percentile(samples, 0.99) / 1000, Percentile(samples, 1.0) / 1000);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int sockets = argc > 1 ? std::atoi(argv[1]) : DefaultSockets;
+  const int connections = sockets / 2;
+
+  // the soft limit may always be raised to the hard one
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  const int perHolder = std::min<int>(MaxConnectionsPerHolder, static_cast<int>(std::min<rlim_t>(limit.rlim_cur, 1 << 20) - HolderReserve) / 2);
+
+  // the bulk, on ports nobody watches
+  int release[2];
+  if (perHolder <= 0 || pipe2(release, O_CLOEXEC) != 0) {
+    std::puts("too few descriptors allowed");
+    return 2;
+  }
+  std::vector<pid_t> holders;
+  const auto setupStart = std::chrono::steady_clock::now();
+  for (int remaining = connections; remaining > 0; remaining -= perHolder) {
+    const auto pid = SpawnHolder(std::min(remaining, perHolder), release);
+    if (pid < 0) {
+      std::printf("opening the bulk sockets failed after %d\n", (connections - remaining) * 2);
+      close(release[1]);
+      return 2;
+    }
+    holders.push_back(pid);
+  }
+  close(release[0]);
+  const auto setupTime = std::chrono::steady_clock::now() - setupStart;
+
+  // the watched ones, with an empty range in between so that the filter has more than one jump
+  std::vector<Listener> listeners;
+  std::vector<int> watchedFds;
+  std::vector<ConnectionWatcher::PortRange> ranges;
+  std::size_t expected = 0;
+  for (const int family : {AF_INET, AF_INET6}) {
+    const auto listener = Listen(family);
+    if (!listener) {
+      std::printf("%s: no loopback, left out\n", family == AF_INET ? "IPv4" : "IPv6");
+      continue;
+    }
+    if (!Connect(listener.value(), WatchedConnections, watchedFds)) {
+      std::perror("connect");
+      return 2;
+    }
+    listeners.push_back(listener.value());
+    ranges.push_back({listener.value().port, listener.value().port});
+    ranges.push_back({1, 1});
+    expected += WatchedConnections;
+  }
+
+  std::size_t errors = 0;
+  std::optional<ConnectionWatcher> watcher;
+  try {
+    watcher.emplace(ranges, 1h);
+  } catch (const std::system_error& error) {
+    std::printf("sock_diag unavailable: %s\n", error.what());
+    return 2;
+  }
+
+  std::vector<std::chrono::nanoseconds> querySamples;
+  querySamples.reserve(Queries);
+  std::uint64_t allocations = 0;
+  for (int i = 0; i < Queries; i++) {
+    const auto allocationsBefore = gAllocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    watcher.value().Update();
+    querySamples.push_back(std::chrono::steady_clock::now() - start);
+    allocations += gAllocations.load() - allocationsBefore;
+    if (watcher.value().GetConnectionCount() != expected) {
+      errors++;
+    }
+  }
+
+  std::vector<char> procBuffer(ProcBufferSize);
+  std::vector<std::chrono::nanoseconds> procSamples;
+  std::size_t procCount = 0;
+  for (int i = 0; i < Queries; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    procCount = CountFromProc("/proc/net/tcp", ranges, procBuffer.data()) + CountFromProc("/proc/net/tcp6", ranges, procBuffer.data());
+    procSamples.push_back(std::chrono::steady_clock::now() - start);
+  }
+  if (procCount != expected) {
+    std::printf("/proc/net/tcp finds %zu connections, %zu expected\n", procCount, expected);
+    errors++;
+  }
+
+  const bool wasActive = watcher.value().IsActive();
+  for (const int fd : watchedFds) {
+    close(fd);
+  }
+  const bool changed = watcher.value().Update();
+  if (!wasActive || !changed || watcher.value().IsActive()) {
+    std::puts("the watcher did not follow the connections closing");
+    errors++;
+  }
+
+  std::printf("sockets %zu in %zu processes, opened in %lld ms, watched connections %zu\n",
+    static_cast<std::size_t>(connections) * 2 + watchedFds.size(),
+    holders.size(),
+    static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(setupTime).count()),
+    expected);
+  Report("sock_diag query", querySamples);
+  Report("/proc/net/tcp{,6} read and parse", procSamples);
+  std::printf("allocations per query %.2f, errors %zu, budget (p50) %lld us\n",
+    static_cast<double>(allocations) / Queries,
+    errors,
+    static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(QueryBudget).count()));
+
+  for (const auto& listener : listeners) {
+    close(listener.fd);
+  }
+  close(release[1]);
+  for (const auto pid : holders) {
+    waitpid(pid, nullptr, 0);
+  }
+
+  const auto queryMedian = Percentile(querySamples, 0.5);
+  return errors == 0 && allocations == 0 && queryMedian <= std::chrono::nanoseconds(QueryBudget).count() && queryMedian < Percentile(procSamples, 0.5) ? 0 : 1;
+}
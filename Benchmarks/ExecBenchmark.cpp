@@ -0,0 +1,70 @@
+// compares running a command directly with running it through "sleeppreventer exec --"
+// the daemon binary runs with the null backend, so the numbers show the wrapper's own overhead without D-Bus
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr int DefaultIterations = 200;
+
+  std::chrono::nanoseconds RunOnce(std::vector<char*>& argv) {
+    const auto start = std::chrono::steady_clock::now();
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) {
+      std::perror("posix_spawn");
+      std::exit(2);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::fputs("command failed\n", stderr);
+      std::exit(2);
+    }
+    return std::chrono::steady_clock::now() - start;
+  }
+
+  std::vector<std::chrono::nanoseconds> Measure(std::vector<char*> argv, int iterations) {
+    std::vector<std::chrono::nanoseconds> samples;
+    for (int i = 0; i < iterations; i++) {
+      samples.push_back(RunOnce(argv));
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(samples[static_cast<std::size_t>(p * (samples.size() - 1))]).count());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string daemonPath = argc > 1 ? argv[1] : SLEEPPREVENTER_DAEMON_PATH;
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : DefaultIterations;
+  std::string command = "/bin/true"s;
+  std::string execVerb = "exec"s;
+  std::string separator = "--"s;
+
+  setenv("SLEEPPREVENTER_BACKEND", "null", 1);
+
+  const auto direct = Measure({command.data(), nullptr}, iterations);
+  const auto wrapped = Measure({daemonPath.data(), execVerb.data(), separator.data(), command.data(), nullptr}, iterations);
+
+  std::printf("direct: iterations %d, p50 %lld us, p99 %lld us\n", iterations, Percentile(direct, 0.5), Percentile(direct, 0.99));
+  std::printf("exec wrapper: iterations %d, p50 %lld us, p99 %lld us\n", iterations, Percentile(wrapped, 0.5), Percentile(wrapped, 0.99));
+  std::printf("overhead: p50 %lld us\n", Percentile(wrapped, 0.5) - Percentile(direct, 0.5));
+
+  return 0;
+}
@@ -0,0 +1,246 @@
+// fans state changes out to a fleet of real daemons on loopback, as `sleeppreventer fleet` does
+// every daemon gets a no-op backend and a fleet listener on an address of its own in 127.0.0.0/8, all with one key;
+// each round enables sleep prevention everywhere, then disables it again, and checks the state every host reports
+// a round with a wrong key must be refused by every host
+// exits with 1 when a host fails or the slowest change takes longer than ChangeBudget, with 2 when the daemons
+// cannot be run
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "FleetSocket.hpp"
+#include "IPCProtocol.hpp"
+#include "Preventer.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto ChangeBudget = 500ms;
+  constexpr int DefaultHostCount = 500;
+  constexpr int Rounds = 5;
+  constexpr auto ReadyTimeout = 30s;
+  constexpr auto HostTimeout = 5s;
+  constexpr std::size_t MaxConnections = 4096;
+
+  // 127.1.0.1 and up, skipping the .0 and .255 of each /24
+  std::string GetHostAddress(int index, std::uint16_t port) {
+    return "127.1."s + std::to_string(index / 254) + "."s + std::to_string(index % 254 + 1) + ":"s + std::to_string(port);
+  }
+
+  std::string BuildRequest(std::uint32_t flags) {
+    std::string request;
+    IPC::FrameWriter writer(request, IPC::FrameType::Request);
+    std::string payload;
+    IPC::AppendU32(payload, flags);
+    writer.Add(IPC::Opcode::ApplyFlags, IPC::Status::Ok, payload);
+    writer.Finish();
+    return request;
+  }
+
+  // spawns a daemon with config at configPath; its stderr goes to /dev/null, since hundreds of them may run short of
+  // inotify instances and warn about it
+  pid_t SpawnDaemon(const std::string& daemonPath, const std::string& notifyName, const std::string& name, const std::string& configPath) {
+    std::vector<std::string> envStrings;
+    for (auto env = environ; *env != nullptr; env++) {
+      if (std::strncmp(*env, "NOTIFY_SOCKET=", 14) != 0 && std::strncmp(*env, "SLEEPPREVENTER_", 15) != 0) {
+        envStrings.emplace_back(*env);
+      }
+    }
+    envStrings.push_back("NOTIFY_SOCKET=@"s + notifyName);
+    envStrings.push_back("SLEEPPREVENTER_CONFIG="s + configPath);
+    envStrings.push_back("SLEEPPREVENTER_JOURNAL="s + configPath + ".journal"s);
+    envStrings.push_back("SLEEPPREVENTER_STATUS="s + configPath + ".status"s);
+    envStrings.push_back("SLEEPPREVENTER_SOCKET="s + name);
+    envStrings.push_back("SLEEPPREVENTER_BACKEND=null"s);
+    std::vector<char*> envp;
+    for (auto& env : envStrings) {
+      envp.push_back(env.data());
+    }
+    envp.push_back(nullptr);
+    std::vector<char*> childArgv{const_cast<char*>(daemonPath.c_str()), nullptr};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid = 0;
+    const int error = posix_spawn(&pid, daemonPath.c_str(), &actions, nullptr, childArgv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+      std::fprintf(stderr, "posix_spawn failed with code %d\n", error);
+      return 0;
+    }
+    return pid;
+  }
+
+  // waits for count readiness datagrams on notifyFd
+  bool WaitReady(int notifyFd, int count) {
+    const auto deadline = std::chrono::steady_clock::now() + ReadyTimeout;
+    for (int ready = 0; ready < count;) {
+      const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      pollfd pfd{notifyFd, POLLIN, 0};
+      if (remaining <= 0ms || poll(&pfd, 1, static_cast<int>(remaining.count())) != 1) {
+        std::printf("%d of %d daemons became ready\n", ready, count);
+        return false;
+      }
+      char buffer[64];
+      while (recv(notifyFd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+        ready++;
+      }
+    }
+    return true;
+  }
+
+  // sends request to every host; returns the number of hosts which failed or reported another state than expected
+  std::size_t RunChange(const char* name, const std::vector<std::string>& hosts, const std::string& key, const std::string& request, std::uint8_t expectedBits, std::chrono::nanoseconds& elapsed) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = SendToFleet(hosts, key, request, HostTimeout, MaxConnections);
+    elapsed = std::chrono::steady_clock::now() - start;
+
+    std::size_t failed = 0;
+    std::vector<std::chrono::nanoseconds> latencies;
+    for (const auto& result : results) {
+      latencies.push_back(result.latency);
+      if (!result.error.empty() || !result.state || (result.state.value() & expectedBits) != expectedBits) {
+        if (failed == 0) {
+          std::printf("%s: %s\n", result.host.c_str(), result.error.empty() ? "unexpected state" : result.error.c_str());
+        }
+        failed++;
+      }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%s: hosts %zu, failed %zu, host p50 %.2f ms, host max %.2f ms, total %.2f ms\n",
+      name,
+      results.size(),
+      failed,
+      std::chrono::duration<double, std::milli>(latencies[latencies.size() / 2]).count(),
+      std::chrono::duration<double, std::milli>(latencies.back()).count(),
+      std::chrono::duration<double, std::milli>(elapsed).count());
+    return failed;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int hostCount = argc > 1 ? std::atoi(argv[1]) : DefaultHostCount;
+  const std::string daemonPath = argc > 2 ? argv[2] : SLEEPPREVENTER_DAEMON_PATH;
+  if (hostCount <= 0) {
+    return 2;
+  }
+
+  // a daemon and a controller connection per host
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  const auto name = "SleepPreventer.FleetBenchmark."s + std::to_string(getpid());
+  const auto port = static_cast<std::uint16_t>(20000 + getpid() % 20000);
+  const auto keyPath = "/tmp/"s + name + ".key"s;
+  const std::string key = "fleet-benchmark-key-"s + std::to_string(getpid());
+  {
+    std::ofstream keyFile(keyPath);
+    keyFile << key << '\n';
+  }
+  chmod(keyPath.c_str(), 0600);
+
+  const int notifyFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path + 1, name.data(), name.size());
+  if (notifyFd < 0 || bind(notifyFd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0) {
+    std::perror("bind");
+    unlink(keyPath.c_str());
+    return 2;
+  }
+
+  std::vector<std::string> hosts;
+  std::vector<std::string> configPaths;
+  std::vector<pid_t> pids;
+  bool spawned = true;
+  for (int i = 0; i < hostCount && spawned; i++) {
+    hosts.push_back(GetHostAddress(i, port));
+    configPaths.push_back("/tmp/"s + name + "."s + std::to_string(i) + ".cfg"s);
+    {
+      std::ofstream config(configPaths.back());
+      config << "fleet_listen = " << hosts.back() << "\n";
+      config << "fleet_key_file = " << keyPath << "\n";
+      config << "journal_records = 0\nstatus_page = 0\n";
+    }
+    const pid_t pid = SpawnDaemon(daemonPath, name, name + "."s + std::to_string(i), configPaths.back());
+    spawned = pid != 0;
+    if (spawned) {
+      pids.push_back(pid);
+    }
+  }
+  spawned = spawned && WaitReady(notifyFd, hostCount);
+  close(notifyFd);
+
+  std::size_t failed = 0;
+  std::chrono::nanoseconds slowest{};
+  if (spawned) {
+    try {
+      const auto enable = BuildRequest(Preventer::IPCFlags::Enable | Preventer::IPCFlags::SetSystemFlag);
+      const auto disable = BuildRequest(Preventer::IPCFlags::Disable);
+      std::chrono::nanoseconds elapsed{};
+      for (int round = 0; round < Rounds; round++) {
+        failed += RunChange("enable", hosts, key, enable, IPC::StateBits::Enable | IPC::StateBits::ActiveSystem, elapsed);
+        slowest = std::max(slowest, elapsed);
+        failed += RunChange("disable", hosts, key, disable, 0, elapsed);
+        slowest = std::max(slowest, elapsed);
+      }
+
+      // every host must refuse a controller with another key
+      const auto refused = RunChange("wrong key", hosts, key + "x"s, enable, 0, elapsed);
+      if (refused != hosts.size()) {
+        std::printf("%zu hosts accepted a wrong key\n", hosts.size() - refused);
+        failed++;
+      }
+    } catch (const std::exception& exception) {
+      std::printf("fan-out failed: %s\n", exception.what());
+      spawned = false;
+    }
+  }
+
+  for (const pid_t pid : pids) {
+    kill(pid, SIGTERM);
+  }
+  for (const pid_t pid : pids) {
+    waitpid(pid, nullptr, 0);
+  }
+  for (const auto& configPath : configPaths) {
+    unlink(configPath.c_str());
+  }
+  unlink(keyPath.c_str());
+  if (!spawned) {
+    return 2;
+  }
+
+  std::printf("hosts %d, rounds %d, failures %zu, slowest change %.2f ms, budget %lld ms\n",
+    hostCount,
+    Rounds,
+    failed,
+    std::chrono::duration<double, std::milli>(slowest).count(),
+    static_cast<long long>(std::chrono::milliseconds(ChangeBudget).count()));
+  return failed == 0 && slowest <= ChangeBudget ? 0 : 1;
+}
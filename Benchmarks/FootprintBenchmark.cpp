@@ -0,0 +1,281 @@
+// checks the memory and disk footprint of the headless daemon against documented budgets
+// a spawned daemon runs rounds of an IPC workload (flags, holds, leases and stats over fresh connections); after the
+// first round its resident size, resident high-water mark and heap are read from /proc, and further rounds must not
+// grow the heap, since the daemon's paths are allocation-free once warm or give back what they take
+// the stripped size of the binary is what its loadable segments take in the file, which is what `strip` leaves
+// exits with 1 when a budget is exceeded or the heap grows, with 2 when the daemon cannot be run
+//
+// budgets, for a Release build against a shared libstdc++ (measured: 5.1 MiB resident, most of it shared libraries,
+// 236 KiB heap, 281 KiB binary, 275 KiB with SLEEPPREVENTER_LOW_FOOTPRINT; the fleet listener and controller take
+// about 32 KiB of it, the sources off the hot paths are built with -Os, and most of the heap is the stats text
+// buffered for each connection of a round):
+//   RssBudget          resident set after the workload
+//   RssPeakBudget      VmHWM, the most that was ever resident
+//   HeapBudget         the [heap] mapping, i.e. the most the allocator has taken from brk
+//   BinaryBudget       loadable bytes of the executable
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+#include "LeaseTable.hpp"
+#include "Preventer.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr std::uint64_t RssBudget = 6 * 1024 * 1024;
+  constexpr std::uint64_t RssPeakBudget = 6 * 1024 * 1024;
+  constexpr std::uint64_t HeapBudget = 256 * 1024;
+  constexpr std::uint64_t BinaryBudget = 320 * 1024;
+
+  constexpr int ReadyTimeoutMs = 5000;
+  constexpr int Rounds = 5;
+  constexpr int ConnectionsPerRound = 50;
+  constexpr int LeasesPerConnection = 20;
+
+  struct Footprint {
+    std::uint64_t rss = 0;
+    std::uint64_t rssPeak = 0;
+    std::uint64_t heap = 0;
+  };
+
+  // "Key:   1234 kB" to bytes
+  std::uint64_t ParseKilobytes(const std::string& line) {
+    return std::strtoull(line.c_str() + line.find(':') + 1, nullptr, 10) * 1024;
+  }
+
+  Footprint ReadFootprint(pid_t pid) {
+    Footprint footprint;
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+      if (line.rfind("VmRSS:", 0) == 0) {
+        footprint.rss = ParseKilobytes(line);
+      } else if (line.rfind("VmHWM:", 0) == 0) {
+        footprint.rssPeak = ParseKilobytes(line);
+      }
+    }
+
+    // the Size of the mapping that follows the [heap] header
+    std::ifstream smaps("/proc/" + std::to_string(pid) + "/smaps");
+    bool inHeap = false;
+    while (std::getline(smaps, line)) {
+      if (line.find(" [heap]") != std::string::npos) {
+        inHeap = true;
+      } else if (inHeap && line.rfind("Size:", 0) == 0) {
+        footprint.heap = ParseKilobytes(line);
+        break;
+      }
+    }
+    return footprint;
+  }
+
+  // bytes of the file covered by PT_LOAD segments; 0 if it is not a 64-bit ELF file
+  std::uint64_t GetLoadableSize(const std::string& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    Elf64_Ehdr header{};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_ident[EI_CLASS] != ELFCLASS64) {
+      return 0;
+    }
+    std::uint64_t end = 0;
+    for (std::uint16_t i = 0; i < header.e_phnum; i++) {
+      Elf64_Phdr segment{};
+      file.seekg(static_cast<std::streamoff>(header.e_phoff + static_cast<std::uint64_t>(i) * header.e_phentsize));
+      if (!file.read(reinterpret_cast<char*>(&segment), sizeof(segment))) {
+        return 0;
+      }
+      if (segment.p_type == PT_LOAD) {
+        end = std::max<std::uint64_t>(end, segment.p_offset + segment.p_filesz);
+      }
+    }
+    return end;
+  }
+
+  std::string BuildRequest(int connection) {
+    std::string request;
+    IPC::FrameWriter writer(request, IPC::FrameType::Request);
+    std::string payload;
+    IPC::AppendU32(payload, Preventer::IPCFlags::Enable | Preventer::IPCFlags::SetSystemFlag);
+    writer.Add(IPC::Opcode::ApplyFlags, IPC::Status::Ok, payload);
+
+    payload.clear();
+    IPC::AppendU32(payload, Preventer::IPCFlags::SetDisplayFlag);
+    IPC::AppendU64(payload, 60000);
+    writer.Add(IPC::Opcode::HoldFor, IPC::Status::Ok, payload);
+
+    for (int i = 0; i < LeasesPerConnection; i++) {
+      payload.clear();
+      payload.push_back(static_cast<char>(LeaseModes::System));
+      IPC::AppendU64(payload, 0);
+      payload += "footprint-"s + std::to_string(connection) + "-"s + std::to_string(i);
+      writer.Add(IPC::Opcode::AcquireLease, IPC::Status::Ok, payload);
+    }
+    for (int i = 0; i < LeasesPerConnection; i++) {
+      writer.Add(IPC::Opcode::ReleaseLease, IPC::Status::Ok, "footprint-"s + std::to_string(connection) + "-"s + std::to_string(i));
+    }
+
+    writer.Add(IPC::Opcode::CancelHolds, IPC::Status::Ok);
+    writer.Add(IPC::Opcode::GetStats, IPC::Status::Ok);
+    payload.clear();
+    IPC::AppendU32(payload, Preventer::IPCFlags::Disable);
+    writer.Add(IPC::Opcode::ApplyFlags, IPC::Status::Ok, payload);
+    writer.Add(IPC::Opcode::GetState, IPC::Status::Ok);
+    writer.Finish();
+    return request;
+  }
+
+  // the requests are built up front, so that a round costs the daemon the same every time
+  bool RunRound(const std::string& socketName, const std::vector<std::string>& requests) {
+    for (const auto& request : requests) {
+      IPCClient client(socketName);
+      for (const auto& entry : client.Call(request).entries) {
+        if (entry.status != IPC::Status::Ok) {
+          std::printf("opcode %u failed with status %u\n", static_cast<unsigned>(entry.opcode), static_cast<unsigned>(entry.status));
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // spawns the daemon on a private socket and config, and waits for its readiness datagram; returns 0 on failure
+  pid_t SpawnDaemon(const std::string& daemonPath, const std::string& name, const std::string& configPath, const std::string& journalPath) {
+    const int notifyFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    if (notifyFd < 0 || bind(notifyFd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0) {
+      std::perror("bind");
+      return 0;
+    }
+
+    std::vector<std::string> envStrings;
+    for (auto env = environ; *env != nullptr; env++) {
+      if (std::strncmp(*env, "NOTIFY_SOCKET=", 14) != 0 && std::strncmp(*env, "SLEEPPREVENTER_", 15) != 0) {
+        envStrings.emplace_back(*env);
+      }
+    }
+    envStrings.push_back("NOTIFY_SOCKET=@"s + name);
+    envStrings.push_back("SLEEPPREVENTER_CONFIG="s + configPath);
+    envStrings.push_back("SLEEPPREVENTER_JOURNAL="s + journalPath);
+    envStrings.push_back("SLEEPPREVENTER_STATUS="s + journalPath + ".status"s);
+    envStrings.push_back("SLEEPPREVENTER_SOCKET="s + name + ".daemon"s);
+    envStrings.push_back("SLEEPPREVENTER_BACKEND=null"s);
+    std::vector<char*> envp;
+    for (auto& env : envStrings) {
+      envp.push_back(env.data());
+    }
+    envp.push_back(nullptr);
+    std::vector<char*> childArgv{const_cast<char*>(daemonPath.c_str()), nullptr};
+
+    pid_t pid = 0;
+    if (const int error = posix_spawn(&pid, daemonPath.c_str(), nullptr, nullptr, childArgv.data(), envp.data()); error != 0) {
+      std::fprintf(stderr, "posix_spawn failed with code %d\n", error);
+      close(notifyFd);
+      return 0;
+    }
+
+    pollfd pfd{notifyFd, POLLIN, 0};
+    const bool ready = poll(&pfd, 1, ReadyTimeoutMs) == 1;
+    close(notifyFd);
+    if (!ready) {
+      std::fputs("daemon did not become ready\n", stderr);
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return 0;
+    }
+    return pid;
+  }
+
+  bool Check(const char* name, std::uint64_t value, std::uint64_t budget) {
+    std::printf("%s: %llu KiB, budget %llu KiB\n", name, static_cast<unsigned long long>(value / 1024), static_cast<unsigned long long>(budget / 1024));
+    return value <= budget;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const std::string daemonPath = argc > 1 ? argv[1] : SLEEPPREVENTER_DAEMON_PATH;
+
+  const auto name = "SleepPreventer.FootprintBenchmark."s + std::to_string(getpid());
+  const auto configPath = "/tmp/"s + name + ".cfg"s;
+  const auto journalPath = "/tmp/"s + name + ".journal"s;
+  const auto cleanup = [&] {
+    unlink(configPath.c_str());
+    unlink(journalPath.c_str());
+    unlink((journalPath + ".status"s).c_str());
+  };
+
+  const auto binarySize = GetLoadableSize(daemonPath);
+  if (binarySize == 0) {
+    std::printf("%s is not a 64-bit ELF executable\n", daemonPath.c_str());
+    return 2;
+  }
+
+  const pid_t pid = SpawnDaemon(daemonPath, name, configPath, journalPath);
+  if (pid == 0) {
+    cleanup();
+    return 2;
+  }
+
+  std::vector<std::string> requests;
+  for (int i = 0; i < ConnectionsPerRound; i++) {
+    requests.push_back(BuildRequest(i));
+  }
+
+  bool ok = true;
+  Footprint warm;
+  Footprint last;
+  try {
+    const auto socketName = name + ".daemon"s;
+    ok = RunRound(socketName, requests);
+    warm = ReadFootprint(pid);
+    for (int round = 1; ok && round < Rounds; round++) {
+      ok = RunRound(socketName, requests);
+    }
+    last = ReadFootprint(pid);
+  } catch (const std::exception& exception) {
+    std::printf("workload failed: %s\n", exception.what());
+    ok = false;
+  }
+
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+  cleanup();
+  if (!ok) {
+    return 2;
+  }
+
+  std::printf("rounds %d, connections per round %d, commands per connection %d\n", Rounds, ConnectionsPerRound, 2 * LeasesPerConnection + 6);
+  std::printf("heap after the first round %llu KiB, after the last %llu KiB\n", static_cast<unsigned long long>(warm.heap / 1024), static_cast<unsigned long long>(last.heap / 1024));
+  bool withinBudget = true;
+  withinBudget &= Check("resident", last.rss, RssBudget);
+  withinBudget &= Check("resident peak", last.rssPeak, RssPeakBudget);
+  withinBudget &= Check("heap", last.heap, HeapBudget);
+  withinBudget &= Check("stripped binary", binarySize, BinaryBudget);
+  if (last.heap > warm.heap) {
+    std::puts("the heap grew after the first round");
+    withinBudget = false;
+  }
+  return withinBudget ? 0 : 1;
+}
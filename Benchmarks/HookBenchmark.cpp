@@ -0,0 +1,128 @@
+// measures what transition hooks cost the thread that queues them, with every worker stuck in a hung hook
+// a HookPool with two workers gets two hooks that sleep far past their timeout, then a burst of hooks under a few
+// names, as a storm of on/off transitions would queue them; each Submit is timed, and the hung hooks must be killed
+// at their timeout while the queue stays bounded
+// then hooks running `true` one after another give the run time of a hook, from spawn to exit
+// exits with 1 when the p99 of Submit exceeds SubmitBudget, when a hung hook outlives its timeout by more than
+// KillSlack, or when the burst is not coalesced
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HookPool.hpp"
+#include "Metrics.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto SubmitBudget = 20us;
+  constexpr auto HungTimeout = 300ms;
+  constexpr auto KillSlack = 200ms;
+  constexpr std::size_t Workers = 2;
+  constexpr int DefaultBurstSize = 10000;
+  constexpr int NameCount = 4;
+  constexpr int FastHooks = 50;
+
+  long long Percentile(std::vector<std::chrono::nanoseconds>& samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  // waits until counter reaches target or deadline passes
+  bool WaitFor(const Metrics::Counter& counter, std::uint64_t target, std::chrono::steady_clock::time_point deadline) {
+    while (counter.Get() < target) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+    return true;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int burstSize = argc > 1 ? std::atoi(argv[1]) : DefaultBurstSize;
+  bool ok = true;
+
+  {
+    HookPool pool(Workers);
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < Workers; i++) {
+      pool.Submit("hung-"s + std::to_string(i), "sleep 30", {}, std::chrono::duration_cast<std::chrono::milliseconds>(HungTimeout));
+    }
+    // let the workers take the hung hooks before the burst queues behind them
+    std::this_thread::sleep_for(50ms);
+
+    std::vector<std::chrono::nanoseconds> samples;
+    samples.reserve(static_cast<std::size_t>(burstSize));
+    const std::string names[NameCount] = {"on", "off", "audit", "backup"};
+    for (int i = 0; i < burstSize; i++) {
+      std::vector<std::string> environment{"SLEEPPREVENTER_EVENT="s + names[i % NameCount], "SLEEPPREVENTER_STATE=ESD/sd"s};
+      const auto submitStart = std::chrono::steady_clock::now();
+      pool.Submit(names[i % NameCount], "true", std::move(environment), 1000ms);
+      samples.push_back(std::chrono::steady_clock::now() - submitStart);
+    }
+    const auto p50 = Percentile(samples, 0.5);
+    const auto p99 = Percentile(samples, 0.99);
+    const auto max = Percentile(samples, 1.0);
+    std::printf("submit with every worker hung: burst %d, p50 %lld ns, p99 %lld ns, max %lld ns, budget (p99) %lld ns\n",
+      burstSize,
+      p50,
+      p99,
+      max,
+      static_cast<long long>(std::chrono::nanoseconds(SubmitBudget).count()));
+    ok &= p99 <= std::chrono::nanoseconds(SubmitBudget).count();
+
+    const auto coalesced = Metrics::gHookCoalesced.Get();
+    std::printf("coalesced %llu of %d\n", static_cast<unsigned long long>(coalesced), burstSize);
+    if (coalesced < static_cast<std::uint64_t>(burstSize - NameCount)) {
+      std::puts("the burst was not coalesced");
+      ok = false;
+    }
+
+    if (!WaitFor(Metrics::gHookTimeouts, Workers, start + HungTimeout + KillSlack)) {
+      std::printf("hung hooks still running %lld ms after their timeout\n", static_cast<long long>(std::chrono::milliseconds(KillSlack).count()));
+      ok = false;
+    }
+    const auto killed = std::chrono::steady_clock::now() - start;
+    std::printf("hung hooks killed after %lld ms, timeout %lld ms\n",
+      static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(killed).count()),
+      static_cast<long long>(std::chrono::milliseconds(HungTimeout).count()));
+  }
+
+  {
+    HookPool pool(Workers);
+    const auto runsBefore = Metrics::gHookRuns.Get();
+    const auto failuresBefore = Metrics::gHookFailures.Get();
+    const auto durationsBefore = Metrics::gHookLatency.GetSnapshot();
+    for (int i = 0; i < FastHooks; i++) {
+      pool.Submit("fast", "true", {}, 1000ms);
+      // one at a time, so that none is coalesced
+      const auto runs = runsBefore + static_cast<std::uint64_t>(i) + 1;
+      WaitFor(Metrics::gHookRuns, runs, std::chrono::steady_clock::now() + 1s);
+      while (Metrics::gHookLatency.GetSnapshot().count < durationsBefore.count + static_cast<std::uint64_t>(i) + 1) {
+        std::this_thread::sleep_for(100us);
+      }
+    }
+    auto durations = Metrics::gHookLatency.GetSnapshot();
+    for (std::size_t i = 0; i < durations.counts.size(); i++) {
+      durations.counts[i] -= durationsBefore.counts[i];
+    }
+    durations.count -= durationsBefore.count;
+    std::printf("hook run time: hooks %d, failures %llu, p50 %llu us, p99 %llu us\n",
+      FastHooks,
+      static_cast<unsigned long long>(Metrics::gHookFailures.Get() - failuresBefore),
+      static_cast<unsigned long long>(durations.GetQuantile(0.5) / 1000),
+      static_cast<unsigned long long>(durations.GetQuantile(0.99) / 1000));
+    ok &= Metrics::gHookFailures.Get() == failuresBefore;
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+// measures IPC round trips against an in-process IPCServer backed by a no-op Preventer backend
+// exits with 1 when the 99th percentile of single-command round trips goes over RoundTripBudget
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "IPCCommands.hpp"
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+#include "NullBackend.hpp"
+#include "Preventer.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto RoundTripBudget = 50us;
+  constexpr int DefaultIterations = 20000;
+  constexpr int BatchSize = 16;
+
+  std::string BuildRequest(int numCommands) {
+    std::string request;
+    IPC::FrameWriter writer(request, IPC::FrameType::Request);
+    for (int i = 0; i < numCommands; i++) {
+      std::string payload;
+      IPC::AppendU32(payload, i % 2 == 0 ? Preventer::IPCFlags::Enable : Preventer::IPCFlags::Disable);
+      writer.Add(IPC::Opcode::ApplyFlags, IPC::Status::Ok, payload);
+    }
+    writer.Finish();
+    return request;
+  }
+
+  std::vector<std::chrono::nanoseconds> Measure(IPCClient& client, const std::string& request, int iterations) {
+    std::vector<std::chrono::nanoseconds> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      client.Call(request);
+      samples.push_back(std::chrono::steady_clock::now() - start);
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  void Report(const char* name, const std::vector<std::chrono::nanoseconds>& samples) {
+    std::printf("%s: iterations %zu, p50 %lld ns, p99 %lld ns, max %lld ns\n", name, samples.size(), Percentile(samples, 0.5), Percentile(samples, 0.99), Percentile(samples, 1.0));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+
+  Preventer::SetBackend(std::make_unique<Preventer::NullBackend>());
+
+  const std::string socketName = "SleepPreventer.IPCBenchmark."s + std::to_string(getpid());
+  IPCServer server(socketName, IPC::ExecuteCommand);
+
+  std::atomic<bool> stop = false;
+  std::thread serverThread([&] {
+    pollfd pfd{server.GetFd(), POLLIN, 0};
+    while (!stop) {
+      if (poll(&pfd, 1, 100) > 0) {
+        server.Dispatch();
+      }
+    }
+  });
+
+  IPCClient client(socketName);
+
+  // warm up
+  Measure(client, BuildRequest(1), 1000);
+
+  const auto single = Measure(client, BuildRequest(1), iterations);
+  const auto batched = Measure(client, BuildRequest(BatchSize), iterations);
+
+  stop = true;
+  serverThread.join();
+
+  Report("round trip (1 command)", single);
+  Report("round trip (16 commands)", batched);
+
+  const auto budget = std::chrono::duration_cast<std::chrono::nanoseconds>(RoundTripBudget).count();
+  std::printf("budget (p99, 1 command): %lld ns\n", static_cast<long long>(budget));
+
+  return Percentile(single, 0.99) <= budget ? 0 : 1;
+}
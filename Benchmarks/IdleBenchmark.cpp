@@ -0,0 +1,191 @@
+// checks that an idle daemon never wakes up, over a quiet minute by default
+// in process, a Reactor carries the daemon's IPC server, config watcher, timer queue and signalfd, and the number
+// of epoll_wait returns is counted; only the timer ending the quiet period may wake it
+// alongside, a spawned daemon's context switches are read from /proc; a blocked process has none
+// exits with 1 on any unexpected wakeup
+
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ConfigWatcher.hpp"
+#include "IPCSocket.hpp"
+#include "Reactor.hpp"
+#include "TimerQueue.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr int DefaultQuietSeconds = 60;
+  constexpr int ReadyTimeoutMs = 5000;
+  // readiness is notified just before the daemon's first epoll_wait
+  constexpr auto SettleTime = 200ms;
+  // the timer that ends the quiet period
+  constexpr std::uint64_t ExpectedWakeups = 1;
+
+  // voluntary plus involuntary context switches of pid, or -1
+  long long GetContextSwitches(pid_t pid) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    long long total = -1;
+    std::string line;
+    while (std::getline(status, line)) {
+      if (line.rfind("voluntary_ctxt_switches:", 0) == 0 || line.rfind("nonvoluntary_ctxt_switches:", 0) == 0) {
+        total = (total < 0 ? 0 : total) + std::atoll(line.c_str() + line.find(':') + 1);
+      }
+    }
+    return total;
+  }
+
+  // spawns the daemon on a private socket and config, and waits for its readiness datagram; returns 0 on failure
+  pid_t SpawnDaemon(const std::string& daemonPath, const std::string& name, const std::string& configPath, const std::string& journalPath) {
+    const int notifyFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    if (notifyFd < 0 || bind(notifyFd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0) {
+      std::perror("bind");
+      return 0;
+    }
+
+    std::vector<std::string> envStrings;
+    for (auto env = environ; *env != nullptr; env++) {
+      if (std::strncmp(*env, "NOTIFY_SOCKET=", 14) != 0 && std::strncmp(*env, "SLEEPPREVENTER_", 15) != 0) {
+        envStrings.emplace_back(*env);
+      }
+    }
+    envStrings.push_back("NOTIFY_SOCKET=@"s + name);
+    envStrings.push_back("SLEEPPREVENTER_CONFIG="s + configPath);
+    envStrings.push_back("SLEEPPREVENTER_JOURNAL="s + journalPath);
+    envStrings.push_back("SLEEPPREVENTER_STATUS="s + journalPath + ".status"s);
+    envStrings.push_back("SLEEPPREVENTER_SOCKET="s + name + ".daemon"s);
+    envStrings.push_back("SLEEPPREVENTER_BACKEND=null"s);
+    std::vector<char*> envp;
+    for (auto& env : envStrings) {
+      envp.push_back(env.data());
+    }
+    envp.push_back(nullptr);
+    std::vector<char*> childArgv{const_cast<char*>(daemonPath.c_str()), nullptr};
+
+    pid_t pid = 0;
+    if (const int error = posix_spawn(&pid, daemonPath.c_str(), nullptr, nullptr, childArgv.data(), envp.data()); error != 0) {
+      std::fprintf(stderr, "posix_spawn failed with code %d\n", error);
+      close(notifyFd);
+      return 0;
+    }
+
+    pollfd pfd{notifyFd, POLLIN, 0};
+    const bool ready = poll(&pfd, 1, ReadyTimeoutMs) == 1;
+    close(notifyFd);
+    if (!ready) {
+      std::fputs("daemon did not become ready\n", stderr);
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return 0;
+    }
+    return pid;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const std::string daemonPath = argc > 1 ? argv[1] : SLEEPPREVENTER_DAEMON_PATH;
+  const int quietSeconds = argc > 2 ? std::atoi(argv[2]) : DefaultQuietSeconds;
+
+  const auto name = "SleepPreventer.IdleBenchmark."s + std::to_string(getpid());
+  const auto configPath = "/tmp/"s + name + ".cfg"s;
+  const auto daemonConfigPath = "/tmp/"s + name + ".daemon.cfg"s;
+  const auto daemonJournalPath = "/tmp/"s + name + ".daemon.journal"s;
+  std::ofstream(configPath) << "enable = 1\n";
+
+  const pid_t daemonPid = SpawnDaemon(daemonPath, name, daemonConfigPath, daemonJournalPath);
+  if (daemonPid == 0) {
+    unlink(configPath.c_str());
+    return 2;
+  }
+
+  std::uint64_t wakeups = 0;
+  std::size_t registrations = 0;
+  long long daemonSwitches = -1;
+  try {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    const int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    Reactor reactor;
+    IPCServer server(name, [](const IPC::Entry&, std::string&) {
+      return IPC::Status::Ok;
+    });
+    ConfigWatcher watcher(configPath);
+    TimerQueue timers;
+
+    reactor.Add(signalFd, EPOLLIN, [&](std::uint32_t) {
+      signalfd_siginfo info;
+      while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+      }
+    });
+    reactor.Add(server.GetFd(), EPOLLIN, [&](std::uint32_t) {
+      server.Dispatch();
+    });
+    reactor.Add(watcher.GetFd(), EPOLLIN, [&](std::uint32_t) {
+      watcher.ReadEvents();
+    });
+    reactor.Add(timers.GetFd(), EPOLLIN, [&](std::uint32_t) {
+      timers.ReadEvents();
+    });
+    registrations = reactor.GetRegistrationCount();
+
+    std::this_thread::sleep_for(SettleTime);
+    const auto daemonSwitchesBefore = GetContextSwitches(daemonPid);
+    timers.Schedule(TimerQueue::Clock::now() + std::chrono::seconds(quietSeconds), [&](TimerQueue::TimerId) {
+      reactor.Stop();
+    });
+    reactor.Run();
+    const auto daemonSwitchesAfter = GetContextSwitches(daemonPid);
+    if (daemonSwitchesBefore >= 0 && daemonSwitchesAfter >= 0) {
+      daemonSwitches = daemonSwitchesAfter - daemonSwitchesBefore;
+    }
+
+    wakeups = reactor.GetWakeupCount();
+    close(signalFd);
+  } catch (const std::exception& exception) {
+    std::fprintf(stderr, "setup failed: %s\n", exception.what());
+    wakeups = ~std::uint64_t{0};
+  }
+
+  kill(daemonPid, SIGTERM);
+  waitpid(daemonPid, nullptr, 0);
+  unlink(configPath.c_str());
+  unlink(daemonConfigPath.c_str());
+  unlink(daemonJournalPath.c_str());
+
+  std::printf("idle %d s: reactor with %zu fds woke up %llu times (expected %llu), daemon context switches %lld\n",
+    quietSeconds,
+    registrations,
+    static_cast<unsigned long long>(wakeups),
+    static_cast<unsigned long long>(ExpectedWakeups),
+    daemonSwitches);
+
+  return wakeups == ExpectedWakeups && daemonSwitches == 0 ? 0 : 1;
+}
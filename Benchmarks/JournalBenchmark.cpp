@@ -0,0 +1,193 @@
+// measures appending to the transition journal, and checks that it neither allocates nor calls write()
+// then reopens the wrapped ring, churns leases through Preventer with the journal attached, and checks that the leases
+// rebuilt from the journal are the ones Preventer holds, with the same references
+// exits with 1 on an allocation, a write syscall, a wrong rebuild or when an append goes over AppendBudget
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "Journal.hpp"
+#include "LeaseTable.hpp"
+#include "NullBackend.hpp"
+#include "Preventer.hpp"
+
+using namespace std::literals;
+
+namespace {
+  std::atomic<std::uint64_t> gAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+  gAllocations++;
+  if (const auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+  constexpr auto AppendBudget = 200ns;
+  constexpr int DefaultIterations = 1000000;
+  constexpr std::size_t Capacity = 4096;
+  // the records of the lease churn, which the rebuild needs, must fit in the ring
+  constexpr int LeaseNames = 64;
+  constexpr int ChurnOperations = 2400;
+  constexpr int ChurnRounds = 8;
+
+  std::uint64_t gRandomState = 0x9E3779B97F4A7C15;
+
+  std::uint64_t NextRandom() {
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return gRandomState;
+  }
+
+  // syscw of /proc/self/io
+  std::uint64_t ReadWriteSyscalls() {
+    std::ifstream ifs("/proc/self/io");
+    for (std::string key; ifs >> key; ) {
+      std::uint64_t value = 0;
+      ifs >> value;
+      if (key == "syscw:"sv) {
+        return value;
+      }
+    }
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+  const auto path = std::filesystem::temp_directory_path() / ("SleepPreventer.JournalBenchmark."s + std::to_string(getpid()) + ".journal"s);
+
+  std::size_t errors = 0;
+  double appendAverage = 0;
+  std::uint64_t allocations = 0;
+  std::uint64_t writeSyscalls = 0;
+  {
+    auto journal = Journal::Writer::Open(path, Capacity);
+    // fault every page in first, as a long running daemon has
+    for (std::size_t i = 0; i < Capacity; i++) {
+      journal->AppendState(0, 1);
+    }
+
+    Journal::OriginScope origin(Journal::Source::IPC, 1234, 1000);
+    // reading /proc allocates, so the allocation count is sampled inside the syscall count
+    const auto writeSyscallsBefore = ReadWriteSyscalls();
+    const auto allocationsBefore = gAllocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      switch (i % 3) {
+        case 0:
+          journal->AppendState(static_cast<std::uint8_t>(i & 0x1F), static_cast<std::uint8_t>((i + 1) & 0x1F));
+          break;
+        case 1:
+          journal->AppendLease(Journal::Kind::LeaseAcquire, "client:a-fairly-long-lease-name-for-the-copy"sv, LeaseModes::System, std::chrono::system_clock::now() + 1h);
+          break;
+        default:
+          journal->AppendLease(Journal::Kind::LeaseRelease, "client:a-fairly-long-lease-name-for-the-copy"sv);
+          break;
+      }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    allocations = gAllocations.load() - allocationsBefore;
+    writeSyscalls = ReadWriteSyscalls() - writeSyscallsBefore;
+    appendAverage = iterations == 0 ? 0.0 : static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+
+    const auto records = journal->ReadRecords();
+    const auto expectedLast = Capacity + static_cast<std::uint64_t>(iterations);
+    if (records.size() != Capacity || records.back().sequence != expectedLast || records.front().sequence != expectedLast - Capacity + 1) {
+      std::puts("the ring does not hold the last records");
+      errors++;
+    }
+    if (records.back().source != Journal::Source::IPC || records.back().pid != 1234 || records.back().uid != 1000) {
+      std::puts("the origin was not recorded");
+      errors++;
+    }
+  }
+
+  // lease churn through Preventer; the journal is reopened, as the daemon does at startup
+  std::size_t rebuiltLeases = 0;
+  {
+    auto journal = Journal::Writer::Open(path, Capacity);
+    journal->AppendMarker(Journal::Kind::Start, 0);
+    Preventer::SetBackend(std::make_unique<Preventer::NullBackend>());
+    Preventer::SetJournal(journal.get());
+
+    auto virtualNow = LeaseTable::Clock::now();
+    for (int round = 0; round < ChurnRounds; round++) {
+      for (int i = 0; i < ChurnOperations / ChurnRounds; i++) {
+        const auto name = "client:"s + std::to_string(NextRandom() % LeaseNames);
+        const auto choice = NextRandom() % 8;
+        if (choice < 4) {
+          // expiries lie far ahead of the wall clock, so only the virtual expiry below ends them
+          const auto expiry = choice == 0 ? std::optional(virtualNow + 24h + std::chrono::minutes(NextRandom() % 60)) : std::nullopt;
+          Preventer::AcquireLease(name, static_cast<std::uint8_t>(1 + NextRandom() % 3), expiry);
+        } else if (choice < 7) {
+          Preventer::ReleaseLease(name);
+        } else {
+          Preventer::ReleaseLeases("client:1"sv);
+        }
+      }
+      virtualNow += 10min;
+      Preventer::ExpireLeases(virtualNow + 24h);
+    }
+    Preventer::SetJournal(nullptr);
+
+    const auto leases = Journal::RebuildLeases(journal->ReadRecords(), std::chrono::system_clock::now());
+    rebuiltLeases = leases.size();
+    if (leases.size() != Preventer::GetLeaseCount()) {
+      std::printf("rebuilt %zu leases, Preventer holds %zu\n", leases.size(), Preventer::GetLeaseCount());
+      errors++;
+    }
+    // each rebuilt lease must end on exactly its last rebuilt reference
+    for (const auto& [name, lease] : leases) {
+      for (std::size_t i = 1; i < lease.unbounded + lease.expiries.size(); i++) {
+        Preventer::ReleaseLease(name);
+      }
+    }
+    if (Preventer::GetLeaseCount() != leases.size()) {
+      std::puts("a lease has fewer references than rebuilt");
+      errors++;
+    }
+    for (const auto& [name, lease] : leases) {
+      Preventer::ReleaseLease(name);
+    }
+    if (Preventer::GetLeaseCount() != 0) {
+      std::printf("%zu leases left after releasing the rebuilt references\n", Preventer::GetLeaseCount());
+      errors++;
+    }
+  }
+  std::filesystem::remove(path);
+
+  std::printf("append: iterations %d, %.1f ns/op, allocations %llu, write syscalls %llu\n",
+    iterations,
+    appendAverage,
+    static_cast<unsigned long long>(allocations),
+    static_cast<unsigned long long>(writeSyscalls));
+  std::printf("rebuild: %zu leases, errors %zu, budget %lld ns/op\n", rebuiltLeases, errors, static_cast<long long>(AppendBudget.count()));
+
+  return errors == 0 && allocations == 0 && writeSyscalls == 0 && appendAverage <= static_cast<double>(AppendBudget.count()) ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+// churns a LeaseTable holding about 10k leases on a virtual clock: new leases, extra references, releases
+// and expirations, a third of the references with a TTL of their own and a rare one holding the display, so that its bit comes and goes
+// the same operations are first run against a plain map model, whose effective modes and lease count
+// are compared with the table's at regular checkpoints
+// exits with 1 on a mismatch or when the average cost per operation goes over OperationBudget
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LeaseTable.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto OperationBudget = 2us;
+  constexpr int DefaultLeaseCount = 10000;
+  constexpr int OperationsPerLease = 20;
+  // the virtual clock advances and expires leases every ExpireEvery operations
+  constexpr int ExpireEvery = 64;
+  constexpr auto Step = 50ms;
+  constexpr auto MaxTTL = 60s;
+  constexpr int CheckEvery = 256;
+
+  std::uint64_t gRandomState = 0x9E3779B97F4A7C15;
+
+  std::uint64_t NextRandom() {
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return gRandomState;
+  }
+
+  enum class OperationType {
+    Acquire,
+    Release,
+    Expire,
+  };
+
+  struct Operation {
+    OperationType type;
+    std::size_t name;
+    std::uint8_t modes;
+    std::optional<LeaseTable::Clock::time_point> time;
+  };
+
+  struct Checkpoint {
+    // number of operations run before it
+    std::size_t after;
+    std::uint8_t modes;
+    std::size_t count;
+  };
+
+  struct ModelLease {
+    std::uint32_t unbounded;
+    std::uint8_t modes;
+    // unsorted
+    std::vector<LeaseTable::Clock::time_point> expiries;
+  };
+
+  // the reference the table is checked against; expiry and the effective modes are full scans
+  class Model {
+    std::unordered_map<std::size_t, ModelLease> mLeases;
+
+  public:
+    void Acquire(std::size_t name, std::uint8_t modes, std::optional<LeaseTable::Clock::time_point> expiry) {
+      auto& lease = mLeases[name];
+      lease.modes |= modes;
+      if (expiry) {
+        lease.expiries.push_back(expiry.value());
+      } else {
+        lease.unbounded++;
+      }
+    }
+
+    void Release(std::size_t name) {
+      const auto itr = mLeases.find(name);
+      if (itr == mLeases.end()) {
+        return;
+      }
+      auto& lease = itr->second;
+      if (lease.unbounded != 0) {
+        lease.unbounded--;
+      } else {
+        lease.expiries.erase(std::min_element(lease.expiries.begin(), lease.expiries.end()));
+      }
+      if (lease.unbounded == 0 && lease.expiries.empty()) {
+        mLeases.erase(itr);
+      }
+    }
+
+    void Expire(LeaseTable::Clock::time_point now) {
+      for (auto itr = mLeases.begin(); itr != mLeases.end(); ) {
+        auto& expiries = itr->second.expiries;
+        expiries.erase(std::remove_if(expiries.begin(), expiries.end(), [&](auto expiry) {
+          return expiry <= now;
+        }), expiries.end());
+        if (itr->second.unbounded == 0 && expiries.empty()) {
+          itr = mLeases.erase(itr);
+        } else {
+          itr++;
+        }
+      }
+    }
+
+    bool IsHeld(std::size_t name) const {
+      return mLeases.count(name) != 0;
+    }
+
+    std::size_t GetCount() const {
+      return mLeases.size();
+    }
+
+    std::uint8_t GetModes() const {
+      std::uint8_t modes = 0;
+      for (const auto& [name, lease] : mLeases) {
+        modes |= lease.modes;
+      }
+      return modes;
+    }
+  };
+
+  double NanosecondsPerOperation(std::chrono::nanoseconds elapsed, std::size_t operations) {
+    return operations == 0 ? 0.0 : static_cast<double>(elapsed.count()) / static_cast<double>(operations);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int leaseCount = argc > 1 ? std::atoi(argv[1]) : DefaultLeaseCount;
+  const auto operationCount = static_cast<std::size_t>(leaseCount) * OperationsPerLease;
+
+  // names are drawn from a pool three times the target size, so ended leases come back now and then
+  const auto poolSize = static_cast<std::size_t>(leaseCount) * 3;
+  std::vector<std::string> names;
+  names.reserve(poolSize);
+  for (std::size_t i = 0; i < poolSize; i++) {
+    names.push_back("client:job-" + std::to_string(i));
+  }
+
+  // build the operations and the expected checkpoints with the model
+  const auto origin = LeaseTable::Clock::now() + 24h;
+  auto now = origin;
+  Model model;
+  std::vector<Operation> operations;
+  operations.reserve(operationCount + operationCount / ExpireEvery + static_cast<std::size_t>(leaseCount));
+  std::vector<Checkpoint> expected;
+  std::vector<std::size_t> live;
+  live.reserve(poolSize);
+
+  const auto addAcquire = [&](std::size_t name) {
+    const auto random = NextRandom();
+    std::uint8_t modes = LeaseModes::System;
+    if (random % 20000 == 0) {
+      modes = LeaseModes::Display;
+    } else if (random % 20000 == 1) {
+      modes |= LeaseModes::Display;
+    }
+    std::optional<LeaseTable::Clock::time_point> expiry;
+    if ((random >> 16) % 3 == 0) {
+      expiry = now + std::chrono::milliseconds((random >> 24) % std::chrono::milliseconds(MaxTTL).count() + 1);
+    }
+    operations.push_back({OperationType::Acquire, name, modes, expiry});
+    if (!model.IsHeld(name)) {
+      live.push_back(name);
+    }
+    model.Acquire(name, modes, expiry);
+  };
+
+  for (int i = 0; i < leaseCount; i++) {
+    addAcquire(static_cast<std::size_t>(i));
+  }
+  for (std::size_t i = 0; i < operationCount; i++) {
+    if (i % ExpireEvery == 0) {
+      now += Step;
+      operations.push_back({OperationType::Expire, 0, 0, now});
+      model.Expire(now);
+    }
+
+    // forget the names the model no longer holds before picking one
+    const auto pickLive = [&]() -> std::optional<std::size_t> {
+      while (!live.empty()) {
+        const auto index = NextRandom() % live.size();
+        if (model.IsHeld(live[index])) {
+          return live[index];
+        }
+        live[index] = live.back();
+        live.pop_back();
+      }
+      return std::nullopt;
+    };
+
+    const auto random = NextRandom() % 10;
+    if (random < 2) {
+      if (const auto name = pickLive()) {
+        addAcquire(name.value());
+      }
+    } else if (model.GetCount() < static_cast<std::size_t>(leaseCount) || random < 5) {
+      addAcquire(NextRandom() % poolSize);
+    } else if (const auto name = pickLive()) {
+      operations.push_back({OperationType::Release, name.value(), 0, std::nullopt});
+      model.Release(name.value());
+    }
+
+    if (i % CheckEvery == CheckEvery - 1) {
+      expected.push_back({operations.size(), model.GetModes(), model.GetCount()});
+    }
+  }
+
+  // replay against the table; only this part is timed
+  LeaseTable table;
+  std::vector<Checkpoint> actual;
+  actual.reserve(expected.size());
+  std::size_t modeChanges = 0;
+  std::size_t operationIndex = 0;
+  std::size_t nextCheckpoint = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& operation : operations) {
+    bool changed = false;
+    switch (operation.type) {
+      case OperationType::Acquire:
+        changed = table.Acquire(names[operation.name], operation.modes, operation.time);
+        break;
+      case OperationType::Release:
+        changed = table.Release(names[operation.name]);
+        break;
+      case OperationType::Expire:
+        changed = table.Expire(operation.time.value());
+        break;
+    }
+    if (changed) {
+      modeChanges++;
+    }
+    if (++operationIndex == (nextCheckpoint < expected.size() ? expected[nextCheckpoint].after : 0)) {
+      actual.push_back({operationIndex, table.GetModes(), table.GetCount()});
+      nextCheckpoint++;
+    }
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::size_t errors = 0;
+  const auto checkpoints = std::min(expected.size(), actual.size());
+  for (std::size_t i = 0; i < checkpoints; i++) {
+    if (expected[i].modes != actual[i].modes || expected[i].count != actual[i].count) {
+      errors++;
+    }
+  }
+  if (expected.size() != actual.size()) {
+    errors++;
+  }
+
+  const double average = NanosecondsPerOperation(elapsed, operations.size());
+  std::printf("leases %d: %zu operations, %.0f ns/op, %zu mode changes, %zu live at the end, %zu checkpoints\n",
+    leaseCount,
+    operations.size(),
+    average,
+    modeChanges,
+    table.GetCount(),
+    checkpoints);
+  std::printf("errors %zu, budget %lld ns/op\n", errors, static_cast<long long>(std::chrono::nanoseconds(OperationBudget).count()));
+
+  return errors == 0 && average <= static_cast<double>(std::chrono::nanoseconds(OperationBudget).count()) ? 0 : 1;
+}
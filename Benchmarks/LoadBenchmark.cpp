@@ -0,0 +1,195 @@
+// measures one sample of the load monitor, against a generated proc root the size of a large host and against /proc,
+// and replays a CPU load profile through the fake root to count how often the monitor switches
+// exits with 1 when sampling allocates, when the 99th percentile against /proc goes over SampleBudget,
+// or when the noisy part of the profile makes the monitor flap
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "LoadMonitor.hpp"
+
+using namespace std::literals;
+
+namespace {
+  std::atomic<std::uint64_t> gAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+  gAllocations++;
+  if (const auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+  constexpr auto SampleBudget = 100us;
+  constexpr int DefaultIterations = 2000;
+  constexpr int FakeCpuCount = 256;
+  constexpr int FakeDiskCount = 512;
+  constexpr int FakeInterfaceCount = 128;
+
+  void WriteFile(const std::filesystem::path& path, const std::string& content) {
+    const auto file = std::fopen(path.c_str(), "w");
+    std::fwrite(content.data(), 1, content.size(), file);
+    std::fclose(file);
+  }
+
+  // busy and idle are cumulative jiffies of the aggregate line
+  void WriteStat(const std::filesystem::path& root, std::uint64_t busy, std::uint64_t idle) {
+    std::string content = "cpu  "s + std::to_string(busy) + " 0 0 "s + std::to_string(idle) + " 0 0 0 0 0 0\n"s;
+    for (int i = 0; i < FakeCpuCount; i++) {
+      content += "cpu"s + std::to_string(i) + " 1 0 0 1 0 0 0 0 0 0\n"s;
+    }
+    content += "intr 1";
+    for (int i = 0; i < 2000; i++) {
+      content += " 0"sv;
+    }
+    content += "\nctxt 1\nbtime 1\nprocesses 1\nprocs_running 1\nprocs_blocked 0\n"sv;
+    WriteFile(root / "stat", content);
+  }
+
+  void WriteFakeRoot(const std::filesystem::path& root, std::uint64_t counter) {
+    std::filesystem::create_directories(root / "net");
+    WriteStat(root, counter, counter);
+
+    std::string disks;
+    for (int i = 0; i < FakeDiskCount; i++) {
+      disks += "   8       "s + std::to_string(i) + " sd"s + static_cast<char>('a' + i / 26 % 26) + static_cast<char>('a' + i % 26) + " "s;
+      disks += std::to_string(counter) + " 0 "s + std::to_string(counter * 8) + " 0 "s + std::to_string(counter) + " 0 "s + std::to_string(counter * 8) + " 0 0 0 0 0 0 0 0 0 0\n"s;
+    }
+    WriteFile(root / "diskstats", disks);
+
+    std::string net = "Inter-|   Receive                                                |  Transmit\n"
+      " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n";
+    for (int i = 0; i < FakeInterfaceCount; i++) {
+      net += "  eth"s + std::to_string(i) + ": "s + std::to_string(counter * 1000) + " 1 0 0 0 0 0 0 "s + std::to_string(counter * 1000) + " 1 0 0 0 0 0 0\n"s;
+    }
+    WriteFile(root / "net" / "dev", net);
+  }
+
+  struct Result {
+    std::vector<std::chrono::nanoseconds> samples;
+    std::uint64_t allocations;
+  };
+
+  Result Measure(LoadMonitor& monitor, int iterations) {
+    Result result;
+    result.samples.reserve(iterations);
+    auto now = std::chrono::steady_clock::now();
+    monitor.Sample(now);
+
+    const auto allocationsBefore = gAllocations.load();
+    for (int i = 0; i < iterations; i++) {
+      now += 1s;
+      const auto start = std::chrono::steady_clock::now();
+      monitor.Sample(now);
+      result.samples.push_back(std::chrono::steady_clock::now() - start);
+    }
+    result.allocations = gAllocations.load() - allocationsBefore;
+    std::sort(result.samples.begin(), result.samples.end());
+    return result;
+  }
+
+  long long PercentileUs(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(samples[static_cast<std::size_t>(p * (samples.size() - 1))]).count());
+  }
+
+  void Report(const char* name, const Result& result) {
+    std::printf("%s: iterations %zu, p50 %lld us, p99 %lld us, max %lld us, allocations %llu\n",
+      name,
+      result.samples.size(),
+      PercentileUs(result.samples, 0.5),
+      PercentileUs(result.samples, 0.99),
+      PercentileUs(result.samples, 1.0),
+      static_cast<unsigned long long>(result.allocations));
+  }
+
+  // 60s idle, 60s at 90%, 120s alternating 95% and 5% (averaging right at the threshold), 120s idle
+  // the monitor should switch on once during the busy part and off once in the idle tail
+  int CountTransitions(const std::filesystem::path& root) {
+    WriteStat(root, 0, 0);
+    LoadMonitor::Thresholds thresholds;
+    thresholds.cpuPercent = 50;
+    LoadMonitor monitor(thresholds, 1s, 10s, root);
+
+    auto now = std::chrono::steady_clock::now();
+    monitor.Sample(now);
+
+    std::uint64_t busy = 0;
+    std::uint64_t idle = 0;
+    int transitions = 0;
+    for (int second = 0; second < 360; second++) {
+      int percent = 0;
+      if (second >= 60 && second < 120) {
+        percent = 90;
+      } else if (second >= 120 && second < 240) {
+        percent = second % 2 == 0 ? 95 : 5;
+      }
+      busy += static_cast<std::uint64_t>(percent);
+      idle += static_cast<std::uint64_t>(100 - percent);
+      WriteStat(root, busy, idle);
+
+      now += 1s;
+      if (monitor.Sample(now)) {
+        transitions++;
+      }
+    }
+    return transitions;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+
+  const auto root = std::filesystem::temp_directory_path() / ("SleepPreventer.LoadBenchmark."s + std::to_string(getpid()));
+  WriteFakeRoot(root, 1000);
+
+  LoadMonitor::Thresholds thresholds;
+  thresholds.cpuPercent = 50;
+  thresholds.diskBytesPerSecond = 1024 * 1024;
+  thresholds.netBytesPerSecond = 1024 * 1024;
+
+  bool ok = true;
+  {
+    LoadMonitor fake(thresholds, 1s, 30s, root);
+    const auto result = Measure(fake, iterations);
+    Report("sample (fake root, 256 cpus, 512 disks, 128 interfaces)", result);
+    ok = ok && result.allocations == 0;
+  }
+  {
+    LoadMonitor real(thresholds, 1s, 30s);
+    const auto result = Measure(real, iterations);
+    Report("sample (/proc)", result);
+    ok = ok && result.allocations == 0;
+    ok = ok && PercentileUs(result.samples, 0.99) <= std::chrono::duration_cast<std::chrono::microseconds>(SampleBudget).count();
+  }
+
+  const int transitions = CountTransitions(root);
+  std::printf("load profile: %d transitions (expected 2)\n", transitions);
+  ok = ok && transitions == 2;
+
+  std::filesystem::remove_all(root);
+
+  std::printf("budget: p99 %lld us per sample against /proc, no allocations\n", static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(SampleBudget).count()));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,656 @@
+// runs LogindBackend against a private dbus-daemon with a stub org.freedesktop.login1, as SLEEPPREVENTER_LOGIND_BUS
+// allows for the daemon
+// the stub answers every Inhibit with one end of a pipe and keeps the other, so it sees a lock go away as soon as the
+// backend closes it; rounds of state changes then check that each lock taken costs exactly one Inhibit, that a state
+// applied again costs no bus call at all, and that the locks the stub sees held match the state
+// a second backend then runs as the daemon runs it, with its fd handed to an event loop: with the stub's replies
+// delayed, Apply must return without waiting for them, and a lock released while its call is on its way must be
+// dropped when the reply arrives
+// exits with 1 on a wrong call count or lock, with 2 when dbus-daemon cannot be run
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "LogindBackend.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr int Rounds = 20;
+  constexpr auto ReadyTimeout = 5s;
+  constexpr auto LockTimeout = 1s;
+  constexpr auto AsyncReplyDelay = 100ms;
+  // an async Apply only sends; anything close to the reply delay means it waited
+  constexpr auto AsyncApplyBudget = 20ms;
+
+  // system, display
+  constexpr bool States[][2] = {
+    {true, false},
+    {true, false},
+    {true, true},
+    {true, true},
+    {false, true},
+    {false, true},
+    {false, false},
+    {false, false},
+    {true, true},
+    {false, false},
+  };
+
+  constexpr std::uint8_t MessageTypeMethodCall = 1;
+  constexpr std::uint8_t MessageTypeMethodReturn = 2;
+  constexpr std::uint8_t HeaderFieldPath = 1;
+  constexpr std::uint8_t HeaderFieldInterface = 2;
+  constexpr std::uint8_t HeaderFieldMember = 3;
+  constexpr std::uint8_t HeaderFieldReplySerial = 5;
+  constexpr std::uint8_t HeaderFieldDestination = 6;
+  constexpr std::uint8_t HeaderFieldSender = 7;
+  constexpr std::uint8_t HeaderFieldSignature = 8;
+  constexpr std::uint8_t HeaderFieldUnixFds = 9;
+
+  // little-endian marshalling of just what the stub sends
+  class Writer {
+    std::string& mBuffer;
+
+  public:
+    explicit Writer(std::string& buffer) :
+      mBuffer(buffer)
+    {}
+
+    void Align(std::size_t alignment) {
+      while (mBuffer.size() % alignment != 0) {
+        mBuffer.push_back('\0');
+      }
+    }
+
+    void U8(std::uint8_t value) {
+      mBuffer.push_back(static_cast<char>(value));
+    }
+
+    void U32(std::uint32_t value) {
+      Align(4);
+      for (int i = 0; i < 4; i++) {
+        mBuffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+      }
+    }
+
+    void String(std::string_view value) {
+      U32(static_cast<std::uint32_t>(value.size()));
+      mBuffer.append(value);
+      mBuffer.push_back('\0');
+    }
+
+    void Signature(std::string_view value) {
+      U8(static_cast<std::uint8_t>(value.size()));
+      mBuffer.append(value);
+      mBuffer.push_back('\0');
+    }
+
+    void Field(std::uint8_t code, char type, std::string_view value) {
+      Align(8);
+      U8(code);
+      Signature(std::string_view(&type, 1));
+      if (type == 'g') {
+        Signature(value);
+      } else {
+        String(value);
+      }
+    }
+
+    void Field(std::uint8_t code, std::uint32_t value) {
+      Align(8);
+      U8(code);
+      Signature("u"sv);
+      U32(value);
+    }
+  };
+
+  std::uint32_t ReadU32(std::string_view data, std::size_t pos) {
+    if (pos + 4 > data.size()) {
+      throw std::runtime_error("D-Bus message truncated");
+    }
+    std::uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+      value = (value << 8) | static_cast<std::uint8_t>(data[pos + static_cast<std::size_t>(i)]);
+    }
+    return value;
+  }
+
+  struct Message {
+    std::uint8_t type = 0;
+    std::uint32_t serial = 0;
+    std::uint32_t replySerial = 0;
+    std::string member;
+    std::string sender;
+    std::string body;
+  };
+
+  // org.freedesktop.login1 on its own connection to the bus, served from a thread of its own
+  class StubLogin1 {
+    struct Lock {
+      std::string what;
+      // the write end of the pipe whose read end went to the backend; POLLERR once that is closed
+      int fd;
+    };
+
+    int mSocket = -1;
+    int mStopFd = -1;
+    std::uint32_t mSerial = 0;
+    std::string mReadBuffer;
+    std::mutex mMutex;
+    std::vector<Lock> mLocks;
+    std::atomic<std::uint64_t> mInhibitCalls = 0;
+    std::atomic<std::chrono::milliseconds::rep> mReplyDelayMs = 0;
+    std::thread mThread;
+
+    void SendAll(const std::string& data, int fd = -1) {
+      std::size_t sent = 0;
+      while (sent < data.size()) {
+        iovec iov{const_cast<char*>(data.data() + sent), data.size() - sent};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0 && sent == 0) {
+          msg.msg_control = control;
+          msg.msg_controllen = sizeof(control);
+          const auto cmsg = CMSG_FIRSTHDR(&msg);
+          cmsg->cmsg_level = SOL_SOCKET;
+          cmsg->cmsg_type = SCM_RIGHTS;
+          cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+          std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+        const auto written = sendmsg(mSocket, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw std::runtime_error("send to D-Bus failed");
+        }
+        sent += static_cast<std::size_t>(written);
+      }
+    }
+
+    // false once the bus is gone
+    bool ReceiveMore() {
+      char buffer[4096];
+      const auto received = recv(mSocket, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        return received < 0 && errno == EINTR;
+      }
+      mReadBuffer.append(buffer, static_cast<std::size_t>(received));
+      return true;
+    }
+
+    std::string ReadLine() {
+      while (true) {
+        if (const auto crlf = mReadBuffer.find("\r\n"); crlf != std::string::npos) {
+          auto line = mReadBuffer.substr(0, crlf);
+          mReadBuffer.erase(0, crlf + 2);
+          return line;
+        }
+        if (!ReceiveMore()) {
+          throw std::runtime_error("D-Bus connection closed");
+        }
+      }
+    }
+
+    // the next complete message, if the read buffer holds one
+    bool TakeMessage(Message& message) {
+      if (mReadBuffer.size() < 16) {
+        return false;
+      }
+      if (mReadBuffer[0] != 'l') {
+        throw std::runtime_error("D-Bus message in big-endian byte order");
+      }
+      const auto bodyLength = ReadU32(mReadBuffer, 4);
+      const auto fieldsLength = ReadU32(mReadBuffer, 12);
+      const std::size_t headerLength = (16 + static_cast<std::size_t>(fieldsLength) + 7) / 8 * 8;
+      if (mReadBuffer.size() < headerLength + bodyLength) {
+        return false;
+      }
+
+      message = Message{};
+      message.type = static_cast<std::uint8_t>(mReadBuffer[1]);
+      message.serial = ReadU32(mReadBuffer, 8);
+      std::size_t pos = 16;
+      while (pos < 16 + fieldsLength) {
+        pos = (pos + 7) / 8 * 8;
+        const auto code = static_cast<std::uint8_t>(mReadBuffer[pos]);
+        const auto type = mReadBuffer[pos + 2];
+        pos += 4;
+        if (type == 'u') {
+          const auto value = ReadU32(mReadBuffer, pos);
+          pos += 4;
+          if (code == HeaderFieldReplySerial) {
+            message.replySerial = value;
+          }
+        } else if (type == 'g') {
+          pos += static_cast<std::uint8_t>(mReadBuffer[pos]) + 2;
+        } else {
+          const auto length = ReadU32(mReadBuffer, pos);
+          const auto value = mReadBuffer.substr(pos + 4, length);
+          pos += 4 + length + 1;
+          if (code == HeaderFieldMember) {
+            message.member = value;
+          } else if (code == HeaderFieldSender) {
+            message.sender = value;
+          }
+        }
+      }
+      message.body = mReadBuffer.substr(headerLength, bodyLength);
+      mReadBuffer.erase(0, headerLength + bodyLength);
+      return true;
+    }
+
+    void Call(std::string_view destination, std::string_view path, std::string_view interfaceName, std::string_view member, std::string_view signature, const std::string& body) {
+      std::string message;
+      Writer writer(message);
+      writer.U8('l');
+      writer.U8(MessageTypeMethodCall);
+      writer.U8(0);
+      writer.U8(1);
+      writer.U32(static_cast<std::uint32_t>(body.size()));
+      const auto serial = ++mSerial;
+      writer.U32(serial);
+      const auto fieldsLengthPos = message.size();
+      writer.U32(0);
+      writer.Field(HeaderFieldPath, 'o', path);
+      writer.Field(HeaderFieldDestination, 's', destination);
+      writer.Field(HeaderFieldInterface, 's', interfaceName);
+      writer.Field(HeaderFieldMember, 's', member);
+      if (!signature.empty()) {
+        writer.Field(HeaderFieldSignature, 'g', signature);
+      }
+      const auto fieldsLength = static_cast<std::uint32_t>(message.size() - fieldsLengthPos - 4);
+      std::memcpy(message.data() + fieldsLengthPos, &fieldsLength, sizeof(fieldsLength));
+      writer.Align(8);
+      message += body;
+      SendAll(message);
+
+      Message reply;
+      while (true) {
+        while (!TakeMessage(reply)) {
+          if (!ReceiveMore()) {
+            throw std::runtime_error("D-Bus connection closed");
+          }
+        }
+        if (reply.replySerial == serial) {
+          if (reply.type != MessageTypeMethodReturn) {
+            throw std::runtime_error("D-Bus call "s + std::string(member) + " failed"s);
+          }
+          return;
+        }
+      }
+    }
+
+    // replies to an Inhibit with the read end of a new pipe
+    void Inhibit(const Message& call) {
+      mInhibitCalls++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(mReplyDelayMs.load()));
+      int fds[2];
+      if (pipe2(fds, O_CLOEXEC) != 0) {
+        throw std::runtime_error("pipe2 failed");
+      }
+      const auto whatLength = ReadU32(call.body, 0);
+      {
+        std::lock_guard lock(mMutex);
+        mLocks.push_back(Lock{call.body.substr(4, whatLength), fds[1]});
+      }
+
+      std::string body;
+      Writer(body).U32(0);
+      std::string message;
+      Writer writer(message);
+      writer.U8('l');
+      writer.U8(MessageTypeMethodReturn);
+      writer.U8(0);
+      writer.U8(1);
+      writer.U32(static_cast<std::uint32_t>(body.size()));
+      writer.U32(++mSerial);
+      const auto fieldsLengthPos = message.size();
+      writer.U32(0);
+      writer.Field(HeaderFieldReplySerial, call.serial);
+      writer.Field(HeaderFieldDestination, 's', call.sender);
+      writer.Field(HeaderFieldSignature, 'g', "h"sv);
+      writer.Field(HeaderFieldUnixFds, 1);
+      const auto fieldsLength = static_cast<std::uint32_t>(message.size() - fieldsLengthPos - 4);
+      std::memcpy(message.data() + fieldsLengthPos, &fieldsLength, sizeof(fieldsLength));
+      writer.Align(8);
+      message += body;
+      SendAll(message, fds[0]);
+      close(fds[0]);
+    }
+
+    void Serve() {
+      try {
+        while (true) {
+          pollfd pollFds[] = {
+            {mSocket, POLLIN, 0},
+            {mStopFd, POLLIN, 0},
+          };
+          if (poll(pollFds, 2, -1) < 0 && errno != EINTR) {
+            return;
+          }
+          if (pollFds[1].revents & POLLIN) {
+            return;
+          }
+          if ((pollFds[0].revents & (POLLIN | POLLHUP)) && !ReceiveMore()) {
+            return;
+          }
+          Message message;
+          while (TakeMessage(message)) {
+            if (message.type == MessageTypeMethodCall && message.member == "Inhibit"sv) {
+              Inhibit(message);
+            }
+          }
+        }
+      } catch (const std::exception& exception) {
+        std::printf("stub login1: %s\n", exception.what());
+      }
+    }
+
+  public:
+    // connects to the bus at socketPath and owns org.freedesktop.login1 once constructed; throws std::runtime_error
+    explicit StubLogin1(const std::string& socketPath) {
+      mSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      mStopFd = eventfd(0, EFD_CLOEXEC);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+      if (mSocket < 0 || mStopFd < 0 || connect(mSocket, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw std::runtime_error("cannot connect to the private bus");
+      }
+
+      std::string uid;
+      for (const char c : std::to_string(getuid())) {
+        constexpr char Digits[] = "0123456789abcdef";
+        uid.push_back(Digits[(c >> 4) & 0xF]);
+        uid.push_back(Digits[c & 0xF]);
+      }
+      SendAll("\0AUTH EXTERNAL "s + uid + "\r\n"s);
+      if (ReadLine().substr(0, 3) != "OK "sv) {
+        throw std::runtime_error("D-Bus authentication rejected");
+      }
+      SendAll("NEGOTIATE_UNIX_FD\r\n"s);
+      if (ReadLine() != "AGREE_UNIX_FD"sv) {
+        throw std::runtime_error("the private bus does not pass fds");
+      }
+      SendAll("BEGIN\r\n"s);
+
+      Call("org.freedesktop.DBus"sv, "/org/freedesktop/DBus"sv, "org.freedesktop.DBus"sv, "Hello"sv, ""sv, {});
+      std::string body;
+      Writer writer(body);
+      writer.String("org.freedesktop.login1"sv);
+      writer.U32(0);
+      Call("org.freedesktop.DBus"sv, "/org/freedesktop/DBus"sv, "org.freedesktop.DBus"sv, "RequestName"sv, "su"sv, body);
+
+      mThread = std::thread(&StubLogin1::Serve, this);
+    }
+
+    ~StubLogin1() {
+      const std::uint64_t one = 1;
+      [[maybe_unused]] const auto written = write(mStopFd, &one, sizeof(one));
+      if (mThread.joinable()) {
+        mThread.join();
+      }
+      for (const auto& lock : mLocks) {
+        close(lock.fd);
+      }
+      close(mStopFd);
+      close(mSocket);
+    }
+
+    StubLogin1(const StubLogin1&) = delete;
+    StubLogin1& operator=(const StubLogin1&) = delete;
+
+    // how long each Inhibit waits for its reply
+    void SetReplyDelay(std::chrono::milliseconds delay) {
+      mReplyDelayMs = delay.count();
+    }
+
+    std::uint64_t GetInhibitCalls() const {
+      return mInhibitCalls;
+    }
+
+    // locks of the given kind the backend still holds; forgets the released ones
+    int CountHeld(std::string_view what) {
+      std::lock_guard lock(mMutex);
+      int held = 0;
+      for (auto itr = mLocks.begin(); itr != mLocks.end();) {
+        pollfd pfd{itr->fd, 0, 0};
+        poll(&pfd, 1, 0);
+        if (pfd.revents & (POLLERR | POLLHUP)) {
+          close(itr->fd);
+          itr = mLocks.erase(itr);
+          continue;
+        }
+        if (itr->what == what) {
+          held++;
+        }
+        ++itr;
+      }
+      return held;
+    }
+  };
+
+  // waits until the stub sees exactly the expected locks; closing an fd reaches the pipe at once, but the bus may
+  // still be holding its copy of a lock it just passed on
+  bool WaitForLocks(StubLogin1& stub, bool system, bool display) {
+    const auto deadline = std::chrono::steady_clock::now() + LockTimeout;
+    while (stub.CountHeld("sleep"sv) != (system ? 1 : 0) || stub.CountHeld("idle"sv) != (display ? 1 : 0)) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+    return true;
+  }
+
+  // dispatches the backend's fd, as the daemon's reactor does, until no call is pending and the stub sees the expected
+  // locks
+  bool DispatchUntilLocks(Preventer::LogindBackend& backend, int fd, StubLogin1& stub, bool system, bool display) {
+    const auto deadline = std::chrono::steady_clock::now() + AsyncReplyDelay * 2 + LockTimeout;
+    while (true) {
+      pollfd pfd{fd, POLLIN, 0};
+      if (poll(&pfd, 1, 1) > 0 && !backend.Dispatch()) {
+        std::printf("an async Inhibit failed\n");
+        return false;
+      }
+      if (!backend.IsCallPending() && stub.CountHeld("sleep"sv) == (system ? 1 : 0) && stub.CountHeld("idle"sv) == (display ? 1 : 0)) {
+        return true;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        std::printf("the stub does not see the locks of system %d display %d from the async backend\n", system, display);
+        return false;
+      }
+    }
+  }
+
+  // returns how long the slowest Apply took, or nullopt on a failure
+  std::optional<std::chrono::nanoseconds> RunAsync(StubLogin1& stub, const std::string& busAddress) {
+    Preventer::LogindBackend backend(busAddress);
+    const int fd = backend.StartAsync();
+    stub.SetReplyDelay(AsyncReplyDelay);
+
+    std::chrono::nanoseconds slowest{0};
+    const auto apply = [&](bool system, bool display) {
+      const auto start = std::chrono::steady_clock::now();
+      const bool applied = backend.Apply(system, display);
+      slowest = std::max(slowest, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+      if (!applied) {
+        std::printf("async Apply of system %d display %d failed\n", system, display);
+      }
+      return applied;
+    };
+
+    const auto callsBefore = stub.GetInhibitCalls();
+    // both locks; then the sleep lock, released again before its reply can arrive
+    bool ok = apply(true, true) && DispatchUntilLocks(backend, fd, stub, true, true);
+    ok = ok && apply(false, false) && apply(true, false) && apply(false, false) && DispatchUntilLocks(backend, fd, stub, false, false);
+    const auto calls = stub.GetInhibitCalls() - callsBefore;
+    if (ok && calls != 3) {
+      std::printf("async Inhibit calls %llu, expected 3\n", static_cast<unsigned long long>(calls));
+      ok = false;
+    }
+
+    stub.SetReplyDelay(0ms);
+    if (!ok) {
+      return std::nullopt;
+    }
+    return slowest;
+  }
+
+  pid_t SpawnBus(const std::filesystem::path& configPath) {
+    const auto configArg = "--config-file="s + configPath.string();
+    std::vector<char*> argv{
+      const_cast<char*>("dbus-daemon"),
+      const_cast<char*>(configArg.c_str()),
+      const_cast<char*>("--nofork"),
+      const_cast<char*>("--nopidfile"),
+      nullptr,
+    };
+    // it warns when it cannot raise its fd limit, which does not matter here
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid = 0;
+    const int error = posix_spawnp(&pid, "dbus-daemon", &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+      std::printf("cannot run dbus-daemon: %s\n", std::strerror(error));
+      return 0;
+    }
+    return pid;
+  }
+}
+
+int main() {
+  const auto dir = std::filesystem::temp_directory_path() / ("SleepPreventer.LogindBenchmark."s + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+  const auto socketPath = (dir / "bus").string();
+  {
+    std::ofstream config(dir / "bus.conf");
+    config << "<busconfig>\n"
+      "  <type>session</type>\n"
+      "  <listen>unix:path=" << socketPath << "</listen>\n"
+      "  <auth>EXTERNAL</auth>\n"
+      "  <policy context=\"default\">\n"
+      "    <allow send_destination=\"*\"/>\n"
+      "    <allow receive_sender=\"*\"/>\n"
+      "    <allow own=\"*\"/>\n"
+      "  </policy>\n"
+      "</busconfig>\n";
+  }
+
+  const pid_t busPid = SpawnBus(dir / "bus.conf");
+  bool ready = busPid != 0;
+  for (const auto deadline = std::chrono::steady_clock::now() + ReadyTimeout; ready && !std::filesystem::exists(socketPath);) {
+    ready = std::chrono::steady_clock::now() < deadline;
+    std::this_thread::sleep_for(10ms);
+  }
+
+  int result = 2;
+  if (ready) {
+    try {
+      StubLogin1 stub(socketPath);
+      Preventer::LogindBackend backend("unix:path="s + socketPath);
+
+      bool ok = true;
+      bool system = false;
+      bool display = false;
+      std::vector<std::chrono::nanoseconds> lockTimes;
+      for (int round = 0; round < Rounds && ok; round++) {
+        for (const auto& state : States) {
+          const auto expectedCalls = static_cast<std::uint64_t>((state[0] && !system) + (state[1] && !display));
+          const auto stubBefore = stub.GetInhibitCalls();
+          const auto backendBefore = backend.GetBusCallCount();
+          const auto start = std::chrono::steady_clock::now();
+          const bool applied = backend.Apply(state[0], state[1]);
+          const auto elapsed = std::chrono::steady_clock::now() - start;
+          if (expectedCalls > 0) {
+            lockTimes.push_back(elapsed / expectedCalls);
+          }
+
+          const auto stubCalls = stub.GetInhibitCalls() - stubBefore;
+          const auto backendCalls = backend.GetBusCallCount() - backendBefore;
+          if (!applied || stubCalls != expectedCalls || backendCalls != expectedCalls) {
+            std::printf("from system %d display %d to system %d display %d: applied %d, Inhibit calls %llu seen by the stub and %llu by the backend, expected %llu\n",
+              system,
+              display,
+              state[0],
+              state[1],
+              applied,
+              static_cast<unsigned long long>(stubCalls),
+              static_cast<unsigned long long>(backendCalls),
+              static_cast<unsigned long long>(expectedCalls));
+            ok = false;
+          }
+          system = state[0];
+          display = state[1];
+          if (!WaitForLocks(stub, system, display)) {
+            std::printf("the stub does not see the locks of system %d display %d\n", system, display);
+            ok = false;
+          }
+        }
+      }
+      backend.Release();
+      ok = ok && WaitForLocks(stub, false, false);
+
+      const auto asyncApply = ok ? RunAsync(stub, "unix:path="s + socketPath) : std::nullopt;
+      if (asyncApply && asyncApply.value() > AsyncApplyBudget) {
+        std::printf("async Apply took %lld us with replies delayed by %lld ms\n",
+          static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(asyncApply.value()).count()),
+          static_cast<long long>(AsyncReplyDelay.count()));
+      }
+      ok = ok && asyncApply && asyncApply.value() <= AsyncApplyBudget;
+
+      std::sort(lockTimes.begin(), lockTimes.end());
+      std::printf("rounds %d, changes %zu, Inhibit calls %llu, lock taken in p50 %lld us, max %lld us, async Apply max %lld us\n",
+        Rounds,
+        static_cast<std::size_t>(Rounds) * std::size(States),
+        static_cast<unsigned long long>(stub.GetInhibitCalls()),
+        static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(lockTimes[lockTimes.size() / 2]).count()),
+        static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(lockTimes.back()).count()),
+        static_cast<long long>(asyncApply ? std::chrono::duration_cast<std::chrono::microseconds>(asyncApply.value()).count() : -1));
+      result = ok ? 0 : 1;
+    } catch (const std::exception& exception) {
+      std::printf("stub login1 failed: %s\n", exception.what());
+    }
+  }
+
+  if (busPid != 0) {
+    kill(busPid, SIGTERM);
+    waitpid(busPid, nullptr, 0);
+  }
+  std::filesystem::remove_all(dir);
+  return result;
+}
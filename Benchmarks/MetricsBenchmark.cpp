@@ -0,0 +1,114 @@
+// measures the hot path cost of recording metrics: a counter add, a histogram record of a known latency,
+// and a histogram record timed from a start point, which includes reading the clock
+// also checks that histogram quantiles of a uniform distribution land within one bucket width of the truth
+// exits with 1 on a wrong quantile or when recording goes over its budget
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "Metrics.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto RecordBudget = 50ns;
+  // reading the clock dominates, and costs more under some virtual machines
+  constexpr auto TimedRecordBudget = 250ns;
+  constexpr int DefaultIterations = 10000000;
+  // values of the quantile check are uniform in [1, QuantileRange] ns
+  constexpr std::uint64_t QuantileRange = 1000000;
+
+  std::uint64_t gRandomState = 0x9E3779B97F4A7C15;
+
+  std::uint64_t NextRandom() {
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return gRandomState;
+  }
+
+  double NanosecondsPerOperation(std::chrono::nanoseconds elapsed, std::size_t operations) {
+    return operations == 0 ? 0.0 : static_cast<double>(elapsed.count()) / static_cast<double>(operations);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+
+  // latencies are drawn up front, so that the loops time the recording alone
+  std::vector<std::chrono::nanoseconds> values(4096);
+  for (auto& value : values) {
+    value = std::chrono::nanoseconds(NextRandom() % QuantileRange + 1);
+  }
+  const auto mask = values.size() - 1;
+
+  Metrics::Counter counter;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    counter.Add();
+  }
+  const auto counterElapsed = std::chrono::steady_clock::now() - start;
+
+  Metrics::Histogram histogram;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    histogram.Record(values[static_cast<std::size_t>(i) & mask]);
+  }
+  const auto recordElapsed = std::chrono::steady_clock::now() - start;
+
+  Metrics::Histogram timedHistogram;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    timedHistogram.RecordSince(start);
+  }
+  const auto timedElapsed = std::chrono::steady_clock::now() - start;
+
+  std::size_t errors = 0;
+  if (counter.Get() != static_cast<std::uint64_t>(iterations)) {
+    errors++;
+  }
+
+  // the quantile check uses its own histogram with fresh values
+  Metrics::Histogram uniform;
+  constexpr int UniformCount = 1000000;
+  for (int i = 0; i < UniformCount; i++) {
+    uniform.Record(std::chrono::nanoseconds(NextRandom() % QuantileRange + 1));
+  }
+  const auto snapshot = uniform.GetSnapshot();
+  for (const auto q : {0.5, 0.9, 0.99, 0.999}) {
+    const auto expected = q * static_cast<double>(QuantileRange);
+    const auto actual = static_cast<double>(snapshot.GetQuantile(q));
+    // one bucket is at most 1/16 of its values wide, plus sampling noise
+    if (actual < expected * 0.99 || actual > expected * (1.0 + 1.0 / Metrics::Histogram::SubBucketCount) * 1.01) {
+      std::printf("quantile %.3f: expected about %.0f ns, got %.0f ns\n", q, expected, actual);
+      errors++;
+    }
+  }
+  if (snapshot.count != UniformCount || snapshot.max > QuantileRange) {
+    errors++;
+  }
+
+  const double counterAverage = NanosecondsPerOperation(counterElapsed, static_cast<std::size_t>(iterations));
+  const double recordAverage = NanosecondsPerOperation(recordElapsed, static_cast<std::size_t>(iterations));
+  const double timedAverage = NanosecondsPerOperation(timedElapsed, static_cast<std::size_t>(iterations));
+  std::printf("iterations %d: counter %.1f ns/op, record %.1f ns/op, timed record %.1f ns/op\n", iterations, counterAverage, recordAverage, timedAverage);
+  std::printf("uniform p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+    static_cast<unsigned long long>(snapshot.GetQuantile(0.5)),
+    static_cast<unsigned long long>(snapshot.GetQuantile(0.99)),
+    static_cast<unsigned long long>(snapshot.GetQuantile(0.999)),
+    static_cast<unsigned long long>(snapshot.max));
+  std::printf("errors %zu, budget %lld ns/op (record), %lld ns/op (timed record)\n",
+    errors,
+    static_cast<long long>(RecordBudget.count()),
+    static_cast<long long>(TimedRecordBudget.count()));
+
+  const bool withinBudget =
+    counterAverage <= static_cast<double>(RecordBudget.count()) &&
+    recordAverage <= static_cast<double>(RecordBudget.count()) &&
+    timedAverage <= static_cast<double>(TimedRecordBudget.count());
+  return errors == 0 && withinBudget ? 0 : 1;
+}
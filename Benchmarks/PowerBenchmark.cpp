@@ -0,0 +1,205 @@
+// builds a fake sysfs tree of a laptop (AC adapter, two batteries, a USB-C port and a wireless mouse), then replays
+// uevents through the power supply watcher: the adapter going away and both batteries draining to empty while the
+// mouse battery is nearly flat, interleaved with uevents of other subsystems
+// the policy state is checked after every uevent, and handling one is timed against rereading the tree, which is
+// what polling would do
+// exits with 1 on a wrong state, when handling a uevent allocates, or when its 99th percentile goes over EventBudget
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "PowerSupplyWatcher.hpp"
+
+using namespace std::literals;
+
+namespace {
+  std::atomic<std::uint64_t> gAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+  gAllocations++;
+  if (const auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+  constexpr auto EventBudget = 2us;
+  constexpr int MinBatteryPercent = 15;
+  constexpr int Rescans = 200;
+  // uevents of other subsystems per power supply uevent
+  constexpr int ForeignEventsPerEvent = 4;
+
+  constexpr const char* AdapterPath = "/devices/LNXSYSTM:00/LNXSYBUS:00/ACPI0003:00/power_supply/AC";
+  constexpr const char* BatteryPaths[] = {
+    "/devices/LNXSYSTM:00/LNXSYBUS:00/PNP0C0A:00/power_supply/BAT0",
+    "/devices/LNXSYSTM:00/LNXSYBUS:00/PNP0C0A:01/power_supply/BAT1",
+  };
+  constexpr char ForeignEvent[] =
+    "change@/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0\0"
+    "ACTION=change\0DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0\0SUBSYSTEM=usb\0"
+    "DEVTYPE=usb_interface\0PRODUCT=46d/c52b/1211\0TYPE=0/0/0\0INTERFACE=3/1/1\0MODALIAS=usb:v046DpC52Bd1211\0SEQNUM=4242";
+
+  void WriteFile(const std::filesystem::path& path, const std::string& contents) {
+    std::ofstream(path) << contents;
+  }
+
+  void AddSupply(const std::filesystem::path& directory, const char* name, const char* type, const std::string& properties) {
+    const auto supply = directory / name;
+    std::filesystem::create_directories(supply);
+    WriteFile(supply / "type", std::string(type) + "\n");
+    WriteFile(supply / "uevent", "POWER_SUPPLY_NAME="s + name + "\nPOWER_SUPPLY_TYPE=" + type + "\n" + properties);
+  }
+
+  // "change@path", the kernel's properties, all NUL separated as on the socket
+  std::string MakeEvent(const char* path, const std::string& properties) {
+    std::string event = "change@"s + path + '\0' + "ACTION=change" + '\0' + "DEVPATH=" + path + '\0' + "SUBSYSTEM=power_supply" + '\0';
+    for (const auto c : properties) {
+      event += c == '\n' ? '\0' : c;
+    }
+    event += "SEQNUM=4242"s;
+    return event;
+  }
+
+  std::string GetBatteryProperties(const char* name, const char* status, int capacity) {
+    return "POWER_SUPPLY_NAME="s + name + "\nPOWER_SUPPLY_TYPE=Battery\nPOWER_SUPPLY_STATUS=" + status + "\nPOWER_SUPPLY_PRESENT=1\n"
+      "POWER_SUPPLY_TECHNOLOGY=Li-ion\nPOWER_SUPPLY_CYCLE_COUNT=112\nPOWER_SUPPLY_VOLTAGE_NOW=11874000\n"
+      "POWER_SUPPLY_ENERGY_FULL=45140000\nPOWER_SUPPLY_CAPACITY=" + std::to_string(capacity) + "\nPOWER_SUPPLY_CAPACITY_LEVEL=Normal\n"
+      "POWER_SUPPLY_SCOPE=System\nPOWER_SUPPLY_MODEL_NAME=5B10W13975\nPOWER_SUPPLY_MANUFACTURER=SMP\n";
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  void Report(const char* name, std::vector<std::chrono::nanoseconds>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s: iterations %zu, p50 %lld ns, p99 %lld ns, max %lld ns\n", name, samples.size(), Percentile(samples, 0.5), Percentile(samples, 0.99), Percentile(samples, 1.0));
+  }
+}
+
+int main() {
+  const auto root = std::filesystem::temp_directory_path() / ("SleepPreventer.PowerBenchmark."s + std::to_string(getpid()));
+  const auto directory = root / "class" / "power_supply";
+  AddSupply(directory, "AC", "Mains", "POWER_SUPPLY_ONLINE=1\n");
+  AddSupply(directory, "BAT0", "Battery", GetBatteryProperties("BAT0", "Charging", 100));
+  AddSupply(directory, "BAT1", "Battery", GetBatteryProperties("BAT1", "Full", 100));
+  AddSupply(directory, "ucsi-source-psy-USBC000:001", "USB", "POWER_SUPPLY_ONLINE=0\nPOWER_SUPPLY_USB_TYPE=C [PD] PD_PPS\n");
+  AddSupply(directory, "hidpp_battery_0", "Battery", "POWER_SUPPLY_STATUS=Discharging\nPOWER_SUPPLY_SCOPE=Device\nPOWER_SUPPLY_CAPACITY=5\nPOWER_SUPPLY_ONLINE=1\n");
+
+  PowerSupplyWatcher::Policy policy;
+  policy.minBatteryPercent = MinBatteryPercent;
+  std::optional<PowerSupplyWatcher> watcher;
+  try {
+    watcher.emplace(policy, root);
+  } catch (const std::system_error& error) {
+    std::printf("uevents unavailable: %s\n", error.what());
+    std::filesystem::remove_all(root);
+    return 2;
+  }
+
+  std::size_t errors = 0;
+  const auto check = [&](const char* when, bool blocked) {
+    if (watcher.value().IsBlocked() != blocked) {
+      const auto& status = watcher.value().GetStatus();
+      std::printf("%s: blocked %d, expected %d (on AC %d, battery %d%%)\n", when, watcher.value().IsBlocked(), blocked, status.onAc, status.batteryPercent.value_or(-1));
+      errors++;
+    }
+  };
+  if (watcher.value().GetSupplyCount() != 5 || !watcher.value().GetStatus().onAc || watcher.value().GetStatus().batteryPercent != 100) {
+    std::puts("the tree was not read as written");
+    errors++;
+  }
+  check("initially", false);
+
+  // the whole discharge, built up front so that only the watcher allocates while timed
+  std::vector<std::string> events;
+  std::vector<bool> expected;
+  events.push_back(MakeEvent(AdapterPath, "POWER_SUPPLY_NAME=AC\nPOWER_SUPPLY_TYPE=Mains\nPOWER_SUPPLY_ONLINE=0\n"));
+  expected.push_back(false);
+  int capacities[2] = {100, 100};
+  for (int step = 0; capacities[1] > 0; step++) {
+    const int battery = step % 2;
+    capacities[battery] = std::max(capacities[battery] - 1, 0);
+    events.push_back(MakeEvent(BatteryPaths[battery], GetBatteryProperties(battery == 0 ? "BAT0" : "BAT1", "Discharging", capacities[battery])));
+    expected.push_back((capacities[0] + capacities[1]) / 2 < MinBatteryPercent);
+  }
+  events.push_back(MakeEvent(AdapterPath, "POWER_SUPPLY_NAME=AC\nPOWER_SUPPLY_TYPE=Mains\nPOWER_SUPPLY_ONLINE=1\n"));
+  expected.push_back(false);
+  const std::string foreignEvent(ForeignEvent, sizeof(ForeignEvent) - 1);
+
+  std::vector<std::chrono::nanoseconds> eventSamples;
+  std::vector<std::chrono::nanoseconds> foreignSamples;
+  eventSamples.reserve(events.size());
+  foreignSamples.reserve(events.size() * ForeignEventsPerEvent);
+  std::uint64_t allocations = 0;
+  std::size_t changes = 0;
+  for (std::size_t i = 0; i < events.size(); i++) {
+    for (int j = 0; j < ForeignEventsPerEvent; j++) {
+      const auto allocationsBefore = gAllocations.load();
+      const auto start = std::chrono::steady_clock::now();
+      const bool changed = watcher.value().HandleUevent(foreignEvent);
+      foreignSamples.push_back(std::chrono::steady_clock::now() - start);
+      allocations += gAllocations.load() - allocationsBefore;
+      if (changed) {
+        std::puts("a foreign uevent changed the state");
+        errors++;
+      }
+    }
+
+    const auto allocationsBefore = gAllocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    changes += watcher.value().HandleUevent(events[i]) ? 1 : 0;
+    eventSamples.push_back(std::chrono::steady_clock::now() - start);
+    allocations += gAllocations.load() - allocationsBefore;
+    check(("uevent "s + std::to_string(i)).c_str(), expected[i]);
+  }
+  if (changes != 2) {
+    std::printf("%zu changes, expected 2\n", changes);
+    errors++;
+  }
+
+  // what a poll would cost, with sysfs at its cheapest: these files are not backed by a battery driver
+  std::vector<std::chrono::nanoseconds> rescanSamples;
+  for (int i = 0; i < Rescans; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    PowerSupplyWatcher fresh(policy, root);
+    rescanSamples.push_back(std::chrono::steady_clock::now() - start);
+  }
+  std::filesystem::remove_all(root);
+
+  Report("power supply uevent", eventSamples);
+  Report("foreign uevent", foreignSamples);
+  Report("sysfs read (a poll)", rescanSamples);
+  std::printf("uevents %zu, state changes %zu, allocations %llu, errors %zu, budget (p99) %lld ns\n",
+    events.size(),
+    changes,
+    static_cast<unsigned long long>(allocations),
+    errors,
+    static_cast<long long>(std::chrono::nanoseconds(EventBudget).count()));
+
+  return errors == 0 && allocations == 0 && Percentile(eventSamples, 0.99) <= std::chrono::nanoseconds(EventBudget).count() ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// measures the CPU time the process watcher spends while another thread starts short-lived processes at a fixed rate
+// both the proc connector (when permitted) and the /proc scan fallback are measured
+// exits with 1 when either uses more than CpuBudget of one core
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "ProcessWatcher.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  // share of one core at DefaultChurnRate
+  constexpr double CpuBudget = 0.01;
+  constexpr int DefaultChurnRate = 200;
+  constexpr int DefaultSeconds = 5;
+  constexpr auto ScanInterval = 1s;
+
+  std::chrono::nanoseconds GetThreadCpuTime() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+  }
+
+  // starts /bin/true churnRate times a second until deadline; returns the number of processes started
+  int Churn(int churnRate, std::chrono::steady_clock::time_point deadline) {
+    char* const argv[] = {const_cast<char*>("true"), nullptr};
+    const auto period = std::chrono::nanoseconds(1s) / churnRate;
+    auto next = std::chrono::steady_clock::now();
+    int count = 0;
+    while (next < deadline) {
+      pid_t pid;
+      if (posix_spawn(&pid, "/bin/true", nullptr, nullptr, argv, environ) == 0) {
+        waitpid(pid, nullptr, 0);
+        count++;
+      }
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+    return count;
+  }
+
+  // returns the share of one core used by the watcher, or a negative value if it could not be set up as requested
+  double Measure(const char* name, ProcessWatcher::Source source, int churnRate, int seconds) {
+    const auto setupStart = GetThreadCpuTime();
+    std::optional<ProcessWatcher> watcher;
+    try {
+      watcher.emplace(std::vector<std::string>{"SleepPreventerProcessWatchBenchmark*"}, ScanInterval, source);
+    } catch (const std::system_error& error) {
+      std::printf("%s: unavailable (%s)\n", name, error.what());
+      return -1.0;
+    }
+    if (source == ProcessWatcher::Source::Auto && !watcher.value().IsUsingConnector()) {
+      std::printf("%s: unavailable (needs CAP_NET_ADMIN)\n", name);
+      return -1.0;
+    }
+    const auto setupCpu = GetThreadCpuTime() - setupStart;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    int started = 0;
+    std::thread churnThread([&] {
+      started = Churn(churnRate, deadline);
+    });
+
+    const auto start = GetThreadCpuTime();
+    const auto wallStart = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() < deadline) {
+      pollfd pfd{watcher.value().GetFd(), POLLIN, 0};
+      if (poll(&pfd, 1, 50) > 0) {
+        watcher.value().ReadEvents();
+      }
+    }
+    const auto cpu = GetThreadCpuTime() - start;
+    const auto wall = std::chrono::steady_clock::now() - wallStart;
+    churnThread.join();
+
+    const double share = std::chrono::duration<double>(cpu).count() / std::chrono::duration<double>(wall).count();
+    std::printf("%s: processes %d, setup %lld us, cpu %lld us over %lld ms, %.3f%% of a core, %.2f us per process\n",
+      name,
+      started,
+      static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(setupCpu).count()),
+      static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(cpu).count()),
+      static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(wall).count()),
+      share * 100.0,
+      started > 0 ? std::chrono::duration<double, std::micro>(cpu).count() / started : 0.0);
+    return share;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int churnRate = argc > 1 ? std::atoi(argv[1]) : DefaultChurnRate;
+  const int seconds = argc > 2 ? std::atoi(argv[2]) : DefaultSeconds;
+  if (churnRate <= 0 || seconds <= 0) {
+    std::fputs("usage: ProcessWatchBenchmark [processes per second] [seconds]\n", stderr);
+    return 2;
+  }
+
+  const double connector = Measure("proc connector", ProcessWatcher::Source::Auto, churnRate, seconds);
+  const double scan = Measure("proc scan (1s)", ProcessWatcher::Source::Scan, churnRate, seconds);
+  std::printf("budget: %.3f%% of a core\n", CpuBudget * 100.0);
+
+  return connector <= CpuBudget && scan <= CpuBudget ? 0 : 1;
+}
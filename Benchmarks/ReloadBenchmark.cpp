@@ -0,0 +1,98 @@
+// measures config hot reload latency: from an external rename-over replace to the new state reaching the backend
+// exits with 1 when the 99th percentile goes over ReloadBudget
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "ConfigFile.hpp"
+#include "ConfigWatcher.hpp"
+#include "Preventer.hpp"
+#include "PreventerConfig.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto ReloadBudget = 5ms;
+  constexpr int DefaultIterations = 1000;
+
+  class CountingBackend : public Preventer::Backend {
+  public:
+    int applies = 0;
+
+    bool Apply(bool, bool) override {
+      applies++;
+      return true;
+    }
+
+    void Release() override {}
+  };
+
+  // what config management tooling typically does: write a sibling file and rename it over the config
+  void ReplaceFile(const std::filesystem::path& path, const std::string& content) {
+    const auto tempPath = path.string() + ".new"s;
+    {
+      std::ofstream ofs(tempPath, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      ofs << content;
+    }
+    std::filesystem::rename(tempPath, path);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+
+  const auto dir = std::filesystem::temp_directory_path() / ("SleepPreventer.ReloadBenchmark."s + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+  const auto path = dir / "SleepPreventer.cfg";
+  ReplaceFile(path, "display = 0\nenable = 0\nsystem = 1\n"s);
+
+  auto backend = std::make_unique<CountingBackend>();
+  const auto& counter = *backend;
+  Preventer::SetBackend(std::move(backend));
+
+  ConfigFile configFile(path);
+  ConfigWatcher watcher(path);
+  Preventer::LoadStateFromConfig(configFile);
+
+  std::vector<std::chrono::nanoseconds> samples;
+  for (int i = 0; i < iterations; i++) {
+    const int appliesBefore = counter.applies;
+    const auto start = std::chrono::steady_clock::now();
+    ReplaceFile(path, "display = 0\nenable = "s + std::to_string((i + 1) % 2) + "\nsystem = 1\n"s);
+
+    while (counter.applies == appliesBefore) {
+      pollfd pfd{watcher.GetFd(), POLLIN, 0};
+      if (poll(&pfd, 1, 1000) != 1) {
+        std::fputs("reload did not happen\n", stderr);
+        return 2;
+      }
+      if (watcher.ReadEvents()) {
+        Preventer::ApplyConfigChanges(configFile, configFile.Reload());
+      }
+    }
+    samples.push_back(std::chrono::steady_clock::now() - start);
+  }
+
+  std::filesystem::remove_all(dir);
+
+  std::sort(samples.begin(), samples.end());
+  const auto percentile = [&](double p) {
+    return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(samples[static_cast<std::size_t>(p * (samples.size() - 1))]).count());
+  };
+  const auto budget = static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(ReloadBudget).count());
+
+  std::printf("reload: iterations %d, p50 %lld us, p99 %lld us, max %lld us, budget (p99) %lld us\n", iterations, percentile(0.5), percentile(0.99), percentile(1.0), budget);
+
+  return percentile(0.99) <= budget ? 0 : 1;
+}
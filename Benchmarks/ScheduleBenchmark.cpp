@@ -0,0 +1,182 @@
+// compiles several hundred random weekly rules and walks a year of transitions with GetNextTransition, in time zones
+// with DST (including a 30 minute one); every transition is checked against a minute by minute walk of a reference
+// bitmap of the week built straight from the parsed rules, so DST gaps and repeated hours are covered
+// exits with 1 on a mismatch, or when the 99th percentile of GetNextTransition goes over LookupBudget
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "Schedule.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto LookupBudget = 5us;
+  constexpr int DefaultRules = 400;
+  constexpr const char* Days[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+  // POSIX TZ strings, so that no tzdata is needed
+  constexpr const char* TimeZones[] = {
+    "CET-1CEST,M3.5.0,M10.5.0/3",
+    "EST5EDT,M3.2.0,M11.1.0",
+    "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0",
+  };
+
+  std::uint64_t gRandomState = 0x9E3779B97F4A7C15;
+
+  std::uint64_t NextRandom() {
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return gRandomState;
+  }
+
+  // short windows, so that the rules do not merge into a few long ones; the early hours are favoured, as DST
+  // changes there
+  std::string MakeRule() {
+    std::string rule;
+    switch (NextRandom() % 8) {
+      case 0:
+        rule = "daily";
+        break;
+      case 1:
+        rule = std::string(Days[NextRandom() % 7]) + "-" + Days[NextRandom() % 7];
+        break;
+      case 2:
+        rule = std::string(Days[NextRandom() % 7]) + " " + Days[NextRandom() % 7];
+        break;
+      default:
+        rule = Days[NextRandom() % 7];
+        break;
+    }
+    const int begin = NextRandom() % 3 == 0 ? static_cast<int>(60 + NextRandom() % 180) : static_cast<int>(NextRandom() % Schedule::MinutesPerDay);
+    const int end = (begin + 1 + static_cast<int>(NextRandom() % 15)) % Schedule::MinutesPerDay;
+    char range[32];
+    std::snprintf(range, sizeof(range), " %02d:%02d-%02d:%02d", begin / 60, begin % 60, end / 60, end % 60);
+    return rule + range;
+  }
+
+  Schedule::Clock::time_point GetLocalMidnight(int year, int month, int day) {
+    std::tm local{};
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = day;
+    local.tm_isdst = -1;
+    return Schedule::Clock::from_time_t(std::mktime(&local));
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int ruleCount = argc > 1 ? std::atoi(argv[1]) : DefaultRules;
+
+  std::vector<std::string> rules;
+  for (int i = 0; i < ruleCount; i++) {
+    rules.push_back(MakeRule());
+  }
+
+  // the reference marks every minute of the week covered by a parsed interval
+  Schedule schedule;
+  std::vector<bool> reference(Schedule::MinutesPerWeek, false);
+  std::size_t errors = 0;
+  const auto compileStart = std::chrono::steady_clock::now();
+  for (const auto& rule : rules) {
+    const auto intervals = Schedule::ParseRule(rule);
+    if (!intervals) {
+      std::printf("rule \"%s\" does not parse\n", rule.c_str());
+      errors++;
+      continue;
+    }
+    schedule.Add(intervals.value());
+  }
+  schedule.Compile();
+  const auto compileTime = std::chrono::steady_clock::now() - compileStart;
+  for (const auto& rule : rules) {
+    if (const auto intervals = Schedule::ParseRule(rule)) {
+      for (const auto& interval : intervals.value()) {
+        std::fill(reference.begin() + interval.begin, reference.begin() + interval.end, true);
+      }
+    }
+  }
+
+  std::vector<std::chrono::nanoseconds> samples;
+  std::size_t transitions = 0;
+  for (const auto timeZone : TimeZones) {
+    setenv("TZ", timeZone, 1);
+    tzset();
+    const auto start = GetLocalMidnight(2026, 1, 1);
+    const auto end = GetLocalMidnight(2027, 1, 1);
+
+    // the transitions of the engine
+    std::vector<Schedule::Clock::time_point> found;
+    for (auto time = start; ; ) {
+      const auto lookupStart = std::chrono::steady_clock::now();
+      const auto next = schedule.GetNextTransition(time);
+      samples.push_back(std::chrono::steady_clock::now() - lookupStart);
+      if (!next || next.value() >= end) {
+        break;
+      }
+      if (next.value() <= time) {
+        std::printf("%s: transition does not advance\n", timeZone);
+        errors++;
+        break;
+      }
+      found.push_back(next.value());
+      time = next.value();
+    }
+    transitions += found.size();
+
+    // the transitions of the reference, every DST change of these zones being on a whole minute
+    std::vector<Schedule::Clock::time_point> expected;
+    bool state = reference[Schedule::GetMinuteOfWeek(start)];
+    std::size_t stateErrors = 0;
+    for (auto time = start + 1min; time < end; time += 1min) {
+      const bool next = reference[Schedule::GetMinuteOfWeek(time)];
+      if (next != state) {
+        expected.push_back(time);
+        state = next;
+      }
+      if (schedule.IsActive(time) != next) {
+        stateErrors++;
+      }
+    }
+
+    if (found != expected || stateErrors != 0) {
+      std::printf("%s: %zu transitions, %zu expected, %zu wrong states\n", timeZone, found.size(), expected.size(), stateErrors);
+      for (std::size_t i = 0; i < std::min(found.size(), expected.size()); i++) {
+        if (found[i] != expected[i]) {
+          const auto foundTime = Schedule::Clock::to_time_t(found[i]);
+          const auto expectedTime = Schedule::Clock::to_time_t(expected[i]);
+          std::printf("  first difference at %zu: %s", i, std::ctime(&foundTime));
+          std::printf("  expected %s", std::ctime(&expectedTime));
+          break;
+        }
+      }
+      errors++;
+    }
+  }
+
+  std::sort(samples.begin(), samples.end());
+  std::printf("rules %d, transitions per week %zu, compile %lld us\n",
+    ruleCount,
+    schedule.GetTransitionCount(),
+    static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(compileTime).count()));
+  std::printf("a year in %zu time zones: %zu transitions, lookup p50 %lld ns, p99 %lld ns, max %lld ns\n",
+    std::size(TimeZones),
+    transitions,
+    Percentile(samples, 0.5),
+    Percentile(samples, 0.99),
+    Percentile(samples, 1.0));
+  std::printf("errors %zu, budget (p99) %lld ns\n", errors, static_cast<long long>(std::chrono::nanoseconds(LookupBudget).count()));
+
+  return errors == 0 && Percentile(samples, 0.99) <= std::chrono::nanoseconds(LookupBudget).count() ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+// measures cold start of the headless daemon, from spawn to the sd_notify "READY=1" datagram
+// exits with 1 when the 95th percentile goes over StartupBudget
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  // cold start budget for "ready to accept commands", 95th percentile
+  constexpr auto StartupBudget = 10ms;
+  constexpr int DefaultIterations = 50;
+  constexpr int ReadyTimeoutMs = 5000;
+}
+
+int main(int argc, char* argv[]) {
+  const std::string daemonPath = argc > 1 ? argv[1] : SLEEPPREVENTER_DAEMON_PATH;
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : DefaultIterations;
+
+  // readiness socket in the abstract namespace
+  const std::string notifyName = "SleepPreventer.StartupBenchmark."s + std::to_string(getpid());
+  const int notifyFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path + 1, notifyName.data(), notifyName.size());
+  if (notifyFd < 0 || bind(notifyFd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + notifyName.size())) != 0) {
+    std::perror("bind");
+    return 2;
+  }
+
+  const std::string configPath = "/tmp/SleepPreventer.StartupBenchmark."s + std::to_string(getpid()) + ".cfg"s;
+  const std::string journalPath = "/tmp/SleepPreventer.StartupBenchmark."s + std::to_string(getpid()) + ".journal"s;
+
+  std::vector<std::string> envStrings;
+  for (auto env = environ; *env != nullptr; env++) {
+    if (std::strncmp(*env, "NOTIFY_SOCKET=", 14) != 0 && std::strncmp(*env, "SLEEPPREVENTER_CONFIG=", 22) != 0 && std::strncmp(*env, "SLEEPPREVENTER_JOURNAL=", 23) != 0 && std::strncmp(*env, "SLEEPPREVENTER_STATUS=", 22) != 0) {
+      envStrings.emplace_back(*env);
+    }
+  }
+  envStrings.push_back("NOTIFY_SOCKET=@"s + notifyName);
+  envStrings.push_back("SLEEPPREVENTER_CONFIG="s + configPath);
+  envStrings.push_back("SLEEPPREVENTER_JOURNAL="s + journalPath);
+  envStrings.push_back("SLEEPPREVENTER_STATUS="s + journalPath + ".status"s);
+  std::vector<char*> envp;
+  for (auto& env : envStrings) {
+    envp.push_back(env.data());
+  }
+  envp.push_back(nullptr);
+
+  std::vector<char*> childArgv{const_cast<char*>(daemonPath.c_str()), nullptr};
+
+  std::vector<std::chrono::nanoseconds> samples;
+  for (int i = 0; i < iterations; i++) {
+    const auto start = std::chrono::steady_clock::now();
+
+    pid_t pid;
+    if (const int error = posix_spawn(&pid, daemonPath.c_str(), nullptr, nullptr, childArgv.data(), envp.data()); error != 0) {
+      std::fprintf(stderr, "posix_spawn failed with code %d\n", error);
+      return 2;
+    }
+
+    pollfd pfd{notifyFd, POLLIN, 0};
+    if (poll(&pfd, 1, ReadyTimeoutMs) != 1) {
+      std::fputs("daemon did not become ready\n", stderr);
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return 2;
+    }
+    char buffer[64];
+    recv(notifyFd, buffer, sizeof(buffer), 0);
+
+    samples.push_back(std::chrono::steady_clock::now() - start);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+  }
+  unlink(configPath.c_str());
+  unlink(journalPath.c_str());
+
+  std::sort(samples.begin(), samples.end());
+  const auto percentile = [&](double p) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(samples[static_cast<std::size_t>(p * (samples.size() - 1))]).count();
+  };
+  const auto budget = std::chrono::duration_cast<std::chrono::microseconds>(StartupBudget).count();
+
+  std::printf("startup: iterations %d, p50 %lld us, p95 %lld us, max %lld us, budget (p95) %lld us\n",
+    iterations,
+    static_cast<long long>(percentile(0.5)),
+    static_cast<long long>(percentile(0.95)),
+    static_cast<long long>(percentile(1.0)),
+    static_cast<long long>(budget));
+
+  return percentile(0.95) <= budget ? 0 : 1;
+}
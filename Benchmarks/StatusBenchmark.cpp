@@ -0,0 +1,176 @@
+// compares reading the shared-memory status page with a GetState query over the IPC socket, then reads the page while
+// another thread updates it as fast as it can and checks every snapshot for a torn read
+// the writer alternates SetState(x) and SetLeaseCount(x), so a consistent snapshot has state == lease_count after an
+// even number of updates and state == lease_count + 1 (mod StateCycle) after an odd one
+// exits with 1 on a torn or failed read, or when an uncontended read goes over ReadBudget on average
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "IPCCommands.hpp"
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+#include "NullBackend.hpp"
+#include "Preventer.hpp"
+#include "SleepPreventerStatus.h"
+#include "StatusPage.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto ReadBudget = 50ns;
+  constexpr int DefaultIterations = 20000;
+  constexpr int PageReadsPerQuery = 1000;
+  constexpr std::uint32_t StateCycle = 32;
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  void Report(const char* name, std::vector<std::chrono::nanoseconds>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s: iterations %zu, p50 %lld ns, p99 %lld ns, max %lld ns\n", name, samples.size(), Percentile(samples, 0.5), Percentile(samples, 0.99), Percentile(samples, 1.0));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::atoi(argv[1]) : DefaultIterations;
+
+  Preventer::SetBackend(std::make_unique<Preventer::NullBackend>());
+
+  const auto path = std::filesystem::temp_directory_path() / ("SleepPreventer.StatusBenchmark."s + std::to_string(getpid()) + ".status"s);
+  auto writer = StatusPage::Writer::Open(path);
+  const auto page = sleeppreventer_status_open(path.c_str());
+  if (page == nullptr) {
+    std::perror("sleeppreventer_status_open");
+    return 2;
+  }
+
+  const std::string socketName = "SleepPreventer.StatusBenchmark."s + std::to_string(getpid());
+  IPCServer server(socketName, IPC::ExecuteCommand);
+  std::atomic<bool> stop = false;
+  std::thread serverThread([&] {
+    pollfd pfd{server.GetFd(), POLLIN, 0};
+    while (!stop) {
+      if (poll(&pfd, 1, 100) > 0) {
+        server.Dispatch();
+      }
+    }
+  });
+
+  std::string request;
+  IPC::FrameWriter frameWriter(request, IPC::FrameType::Request);
+  frameWriter.Add(IPC::Opcode::GetState, IPC::Status::Ok);
+  frameWriter.Finish();
+
+  // uncontended; a page read is too short to time alone, so batches are timed
+  std::size_t errors = 0;
+  std::vector<std::chrono::nanoseconds> querySamples;
+  std::vector<std::chrono::nanoseconds> readSamples;
+  querySamples.reserve(iterations);
+  readSamples.reserve(iterations);
+  {
+    IPCClient client(socketName);
+    for (int i = 0; i < iterations; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      const auto& response = client.Call(request);
+      querySamples.push_back(std::chrono::steady_clock::now() - start);
+      if (response.entries.size() != 1 || response.entries[0].status != IPC::Status::Ok) {
+        errors++;
+      }
+    }
+  }
+  stop = true;
+  serverThread.join();
+
+  sleeppreventer_status status{};
+  for (int i = 0; i < iterations; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int j = 0; j < PageReadsPerQuery; j++) {
+      if (sleeppreventer_status_read(page, &status) != 0) {
+        errors++;
+      }
+    }
+    readSamples.push_back((std::chrono::steady_clock::now() - start) / PageReadsPerQuery);
+  }
+  if (status.running != 1 || status.pid != static_cast<std::uint32_t>(getpid())) {
+    std::puts("the page does not show this process running");
+    errors++;
+  }
+
+  // contended
+  std::atomic<bool> stopWriter = false;
+  std::uint64_t updates = 0;
+  std::thread writerThread([&] {
+    for (std::uint32_t x = 0; !stopWriter; x = (x + 1) % StateCycle) {
+      writer->SetState(static_cast<std::uint8_t>(x));
+      writer->SetLeaseCount(x);
+      updates += 2;
+    }
+  });
+  std::uint64_t contendedReads = 0;
+  std::uint64_t tornReads = 0;
+  std::uint64_t changesSeen = 0;
+  std::uint64_t lastGeneration = 0;
+  const auto contendedStart = std::chrono::steady_clock::now();
+  const auto contendedEnd = contendedStart + 1s;
+  while (std::chrono::steady_clock::now() < contendedEnd) {
+    for (int j = 0; j < PageReadsPerQuery; j++) {
+      if (sleeppreventer_status_read(page, &status) != 0) {
+        errors++;
+        continue;
+      }
+      contendedReads++;
+      // Open made one update, so the writer's updates begin at an odd generation
+      const bool afterState = (status.generation - 1) % 2 == 1;
+      const auto expected = afterState ? (status.lease_count + 1) % StateCycle : status.lease_count;
+      if (status.generation > 1 && status.state != expected) {
+        tornReads++;
+      }
+      if (status.generation != lastGeneration) {
+        changesSeen++;
+        lastGeneration = status.generation;
+      }
+    }
+  }
+  const auto contendedElapsed = std::chrono::steady_clock::now() - contendedStart;
+  stopWriter = true;
+  writerThread.join();
+
+  sleeppreventer_status_close(page);
+  writer.reset();
+  if (std::filesystem::exists(path)) {
+    std::puts("the writer did not remove the page");
+    errors++;
+  }
+
+  Report("socket GetState round trip", querySamples);
+  Report("status page read", readSamples);
+  const auto seconds = std::chrono::duration<double>(contendedElapsed).count();
+  std::printf("contended: %.0f reads/s, %.0f updates/s, %llu changes seen, %llu torn reads\n",
+    static_cast<double>(contendedReads) / seconds,
+    static_cast<double>(updates) / seconds,
+    static_cast<unsigned long long>(changesSeen),
+    static_cast<unsigned long long>(tornReads));
+  std::printf("errors %zu, budget (mean page read) %lld ns\n", errors, static_cast<long long>(ReadBudget.count()));
+
+  long long readTotal = 0;
+  for (const auto sample : readSamples) {
+    readTotal += sample.count();
+  }
+  const auto readMean = readSamples.empty() ? 0 : readTotal / static_cast<long long>(readSamples.size());
+  return errors == 0 && tornReads == 0 && readMean <= ReadBudget.count() ? 0 : 1;
+}
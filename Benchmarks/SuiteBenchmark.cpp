@@ -0,0 +1,460 @@
+// runs every hot path once with fake backends and writes the results as JSON, so that releases can be compared
+//   apply_state                 Preventer::ApplyState and ApplyStateFromIPCFlags from 1 and 4 threads,
+//                               against a null backend and one which holds each call for a D-Bus round trip
+//   config_load, config_save    ConfigFile load, and set plus flush, of a small and a large file
+//   parse_command_line_options  ParseCommandLineOptions of a typical second-instance command line
+//   second_instance             "sleeppreventer /E" against a running daemon, from spawn to exit
+//   cold_start                  the daemon, from spawn to its sd_notify "READY=1" datagram
+// the daemons run on the null backend; every time is in nanoseconds
+// usage: SuiteBenchmark [daemon path] [output file]; without an output file the JSON goes to stdout
+// exits with 2 when a case cannot be set up; there are no budgets, the other benchmarks enforce those
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "CommandLineOptions.hpp"
+#include "ConfigFile.hpp"
+#include "NullBackend.hpp"
+#include "Preventer.hpp"
+
+extern char** environ;
+
+using namespace std::literals;
+
+namespace {
+  constexpr int SchemaVersion = 1;
+  constexpr int ReadyTimeoutMs = 5000;
+  // stands in for an Inhibit call to logind
+  constexpr auto BackendDelay = 20us;
+  // patterns in the process_watch list of the large config file, and comment lines above it
+  constexpr int LargeConfigPatterns = 2000;
+  constexpr int LargeConfigComments = 1000;
+
+  using Samples = std::vector<std::chrono::nanoseconds>;
+
+  struct Result {
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+    Samples samples;
+    // wall time of the whole case, for throughput
+    std::chrono::nanoseconds elapsed{};
+  };
+
+  std::vector<Result> gResults;
+
+  // busy waits for BackendDelay in every Apply, holding Preventer's backend mutex as a real call would
+  class DelayBackend : public Preventer::Backend {
+  public:
+    bool Apply(bool, bool) override {
+      const auto end = std::chrono::steady_clock::now() + BackendDelay;
+      while (std::chrono::steady_clock::now() < end) {
+      }
+      return true;
+    }
+
+    void Release() override {}
+  };
+
+  void AddResult(std::string name, std::vector<std::pair<std::string, std::string>> params, Samples samples, std::chrono::nanoseconds elapsed) {
+    std::fprintf(stderr, "%s", name.c_str());
+    for (const auto& [key, value] : params) {
+      std::fprintf(stderr, " %s=%s", key.c_str(), value.c_str());
+    }
+    std::fprintf(stderr, ": %zu samples\n", samples.size());
+    std::sort(samples.begin(), samples.end());
+    gResults.push_back({std::move(name), std::move(params), std::move(samples), elapsed});
+  }
+
+  template<typename Function>
+  void Measure(std::string name, std::vector<std::pair<std::string, std::string>> params, int iterations, Function&& function) {
+    Samples samples;
+    samples.reserve(static_cast<std::size_t>(iterations));
+    const auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      function(i);
+      samples.push_back(std::chrono::steady_clock::now() - start);
+    }
+    AddResult(std::move(name), std::move(params), std::move(samples), std::chrono::steady_clock::now() - begin);
+  }
+
+  // apply_state
+
+  void MeasureApplyState(std::string_view backendName, int threadCount, int iterationsPerThread, bool fromIPCFlags) {
+    std::vector<Samples> threadSamples(static_cast<std::size_t>(threadCount));
+    std::vector<std::thread> threads;
+    const auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threadCount; t++) {
+      threads.emplace_back([&, t] {
+        auto& samples = threadSamples[static_cast<std::size_t>(t)];
+        samples.reserve(static_cast<std::size_t>(iterationsPerThread));
+        for (int i = 0; i < iterationsPerThread; i++) {
+          const auto start = std::chrono::steady_clock::now();
+          if (fromIPCFlags) {
+            Preventer::ApplyStateFromIPCFlags(i % 2 == 0 ? Preventer::IPCFlags::Enable : Preventer::IPCFlags::Disable);
+          } else {
+            Preventer::ApplyState();
+          }
+          samples.push_back(std::chrono::steady_clock::now() - start);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    Samples samples;
+    for (auto& part : threadSamples) {
+      samples.insert(samples.end(), part.begin(), part.end());
+    }
+    AddResult(fromIPCFlags ? "apply_state_from_ipc_flags" : "apply_state", {{"backend", std::string(backendName)}, {"threads", std::to_string(threadCount)}}, std::move(samples), elapsed);
+  }
+
+  void RunApplyState() {
+    Preventer::gSystemFlag = true;
+    for (const bool delayed : {false, true}) {
+      if (delayed) {
+        Preventer::SetBackend(std::make_unique<DelayBackend>());
+      } else {
+        Preventer::SetBackend(std::make_unique<Preventer::NullBackend>());
+      }
+      const auto backendName = delayed ? "delay"sv : "null"sv;
+      const int iterations = delayed ? 2000 : 200000;
+      for (const int threadCount : {1, 4}) {
+        Preventer::gEnable = true;
+        MeasureApplyState(backendName, threadCount, iterations, false);
+        MeasureApplyState(backendName, threadCount, iterations, true);
+      }
+    }
+    Preventer::SetBackend(std::make_unique<Preventer::NullBackend>());
+  }
+
+  // config_load, config_save
+
+  std::string BuildConfig(bool large) {
+    std::string text;
+    if (large) {
+      for (int i = 0; i < LargeConfigComments; i++) {
+        text += "# comment line "s + std::to_string(i) + " of a hand-edited config file\n"s;
+      }
+    }
+    text += "enable = 1\nsystem = 1\ndisplay = 0\nload_cpu = 50\nload_interval = 2s\n";
+    if (large) {
+      text += "process_watch = ";
+      for (int i = 0; i < LargeConfigPatterns; i++) {
+        text += (i == 0 ? ""s : ", "s) + "build-tool-"s + std::to_string(i) + "*"s;
+      }
+      text += "\n";
+    }
+    return text;
+  }
+
+  void RunConfig(const std::filesystem::path& directory) {
+    for (const bool large : {false, true}) {
+      const auto path = directory / (large ? "large.cfg" : "small.cfg");
+      const auto text = BuildConfig(large);
+      std::ofstream(path, std::ios_base::binary) << text;
+      const std::vector<std::pair<std::string, std::string>> params{{"size", large ? "large" : "small"}, {"bytes", std::to_string(text.size())}};
+
+      Measure("config_load", params, large ? 500 : 5000, [&](int) {
+        ConfigFile config(path);
+      });
+
+      ConfigFile config(path);
+      Measure("config_save", params, 200, [&](int i) {
+        config.SetBool(Config::Key::Display, i % 2 == 0);
+        config.Flush();
+      });
+    }
+  }
+
+  // parse_command_line_options
+
+  void RunParseCommandLineOptions() {
+    const std::vector<std::wstring> args{L"sleeppreventer", L"/E", L"/S", L"/-D", L"/T:1h30m", L"/L:build"};
+    std::size_t checksum = 0;
+    Measure("parse_command_line_options", {{"args", std::to_string(args.size() - 1)}}, 200000, [&](int) {
+      checksum += ParseCommandLineOptions(args).GetIPCFlags();
+    });
+    if (checksum == 0) {
+      std::fputs("unexpected parse result\n", stderr);
+    }
+  }
+
+  // second_instance, cold_start
+
+  class Environment {
+    std::vector<std::string> mStrings;
+    std::vector<char*> mPointers;
+
+  public:
+    Environment(const std::string& notifyName, const std::string& socketName, const std::string& configPath, const std::string& journalPath) {
+      for (auto env = environ; *env != nullptr; env++) {
+        if (std::strncmp(*env, "NOTIFY_SOCKET=", 14) != 0 && std::strncmp(*env, "SLEEPPREVENTER_", 15) != 0) {
+          mStrings.emplace_back(*env);
+        }
+      }
+      if (!notifyName.empty()) {
+        mStrings.push_back("NOTIFY_SOCKET=@"s + notifyName);
+      }
+      mStrings.push_back("SLEEPPREVENTER_CONFIG="s + configPath);
+      mStrings.push_back("SLEEPPREVENTER_JOURNAL="s + journalPath);
+      mStrings.push_back("SLEEPPREVENTER_STATUS="s + journalPath + ".status"s);
+      mStrings.push_back("SLEEPPREVENTER_SOCKET="s + socketName);
+      mStrings.push_back("SLEEPPREVENTER_BACKEND=null"s);
+      for (auto& env : mStrings) {
+        mPointers.push_back(env.data());
+      }
+      mPointers.push_back(nullptr);
+    }
+
+    char** Get() {
+      return mPointers.data();
+    }
+  };
+
+  int BindNotifySocket(const std::string& name) {
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0) {
+      std::perror("bind");
+      if (fd >= 0) {
+        close(fd);
+      }
+      return -1;
+    }
+    return fd;
+  }
+
+  pid_t Spawn(const std::string& path, std::vector<const char*> args, Environment& environment) {
+    std::vector<char*> argv{const_cast<char*>(path.c_str())};
+    for (const auto arg : args) {
+      argv.push_back(const_cast<char*>(arg));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = 0;
+    if (const int error = posix_spawn(&pid, path.c_str(), nullptr, nullptr, argv.data(), environment.Get()); error != 0) {
+      std::fprintf(stderr, "posix_spawn failed with code %d\n", error);
+      return 0;
+    }
+    return pid;
+  }
+
+  // spawns the daemon and waits for its readiness datagram; returns 0 on failure
+  pid_t StartDaemon(const std::string& daemonPath, int notifyFd, Environment& environment) {
+    const pid_t pid = Spawn(daemonPath, {}, environment);
+    if (pid == 0) {
+      return 0;
+    }
+    pollfd pfd{notifyFd, POLLIN, 0};
+    if (poll(&pfd, 1, ReadyTimeoutMs) != 1) {
+      std::fputs("daemon did not become ready\n", stderr);
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return 0;
+    }
+    char buffer[64];
+    recv(notifyFd, buffer, sizeof(buffer), 0);
+    return pid;
+  }
+
+  void StopDaemon(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+  }
+
+  bool RunColdStart(const std::string& daemonPath, const std::string& name, const std::filesystem::path& directory) {
+    const int notifyFd = BindNotifySocket(name + ".cold"s);
+    if (notifyFd < 0) {
+      return false;
+    }
+    Environment environment(name + ".cold"s, name + ".cold.daemon"s, (directory / "cold.cfg").string(), (directory / "cold.journal").string());
+
+    bool ok = true;
+    Measure("cold_start", {}, 50, [&](int) {
+      if (!ok) {
+        return;
+      }
+      const pid_t pid = StartDaemon(daemonPath, notifyFd, environment);
+      if (pid == 0) {
+        ok = false;
+        return;
+      }
+      StopDaemon(pid);
+    });
+    close(notifyFd);
+    return ok;
+  }
+
+  bool RunSecondInstance(const std::string& daemonPath, const std::string& name, const std::filesystem::path& directory) {
+    const int notifyFd = BindNotifySocket(name + ".second"s);
+    if (notifyFd < 0) {
+      return false;
+    }
+    const auto configPath = (directory / "second.cfg").string();
+    const auto journalPath = (directory / "second.journal").string();
+    const auto socketName = name + ".second.daemon"s;
+    Environment daemonEnvironment(name + ".second"s, socketName, configPath, journalPath);
+    Environment clientEnvironment({}, socketName, configPath, journalPath);
+
+    const pid_t daemonPid = StartDaemon(daemonPath, notifyFd, daemonEnvironment);
+    close(notifyFd);
+    if (daemonPid == 0) {
+      return false;
+    }
+
+    bool ok = true;
+    Measure("second_instance", {{"command", "/E"}}, 200, [&](int i) {
+      if (!ok) {
+        return;
+      }
+      const pid_t pid = Spawn(daemonPath, {i % 2 == 0 ? "/E" : "/-E"}, clientEnvironment);
+      int status = 0;
+      if (pid == 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::fputs("second instance failed\n", stderr);
+        ok = false;
+      }
+    });
+    StopDaemon(daemonPid);
+    return ok;
+  }
+
+  // output
+
+  std::string EscapeJSON(std::string_view text) {
+    std::string escaped;
+    for (const char c : text) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buffer[8];
+        std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned>(c));
+        escaped += buffer;
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped;
+  }
+
+  long long Percentile(const Samples& samples, double p) {
+    return samples.empty() ? 0 : static_cast<long long>(samples[static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1))].count());
+  }
+
+  std::string FormatJSON() {
+    std::string json;
+    char buffer[512];
+
+    const auto now = std::time(nullptr);
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    utsname system{};
+    uname(&system);
+#if defined(__clang__)
+    const std::string compiler = "clang "s + __clang_version__;
+#elif defined(__GNUC__)
+    const std::string compiler = "gcc "s + __VERSION__;
+#else
+    const std::string compiler = "unknown"s;
+#endif
+
+    std::snprintf(buffer, sizeof(buffer), "{\n  \"schema\": %d,\n  \"timestamp\": \"%s\",\n", SchemaVersion, timestamp);
+    json += buffer;
+    json += "  \"environment\": {\n";
+    json += "    \"kernel\": \""s + EscapeJSON(system.sysname) + " "s + EscapeJSON(system.release) + "\",\n"s;
+    json += "    \"machine\": \""s + EscapeJSON(system.machine) + "\",\n"s;
+    json += "    \"cpus\": "s + std::to_string(std::thread::hardware_concurrency()) + ",\n"s;
+    json += "    \"compiler\": \""s + EscapeJSON(compiler) + "\",\n"s;
+    json += "    \"build_type\": \""s + EscapeJSON(SLEEPPREVENTER_BUILD_TYPE) + "\"\n"s;
+    json += "  },\n  \"unit\": \"ns\",\n  \"results\": [\n";
+
+    for (std::size_t i = 0; i < gResults.size(); i++) {
+      const auto& result = gResults[i];
+      long double total = 0;
+      for (const auto sample : result.samples) {
+        total += static_cast<long double>(sample.count());
+      }
+      const auto count = result.samples.size();
+      const double mean = count == 0 ? 0.0 : static_cast<double>(total / static_cast<long double>(count));
+      const double throughput = result.elapsed.count() <= 0 ? 0.0 : static_cast<double>(count) * 1e9 / static_cast<double>(result.elapsed.count());
+
+      json += "    {\"name\": \""s + EscapeJSON(result.name) + "\", \"params\": {"s;
+      for (std::size_t p = 0; p < result.params.size(); p++) {
+        json += (p == 0 ? "\""s : ", \""s) + EscapeJSON(result.params[p].first) + "\": \""s + EscapeJSON(result.params[p].second) + "\""s;
+      }
+      std::snprintf(buffer, sizeof(buffer),
+        "}, \"iterations\": %zu, \"mean\": %.1f, \"min\": %lld, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld, \"ops_per_second\": %.1f}%s\n",
+        count,
+        mean,
+        Percentile(result.samples, 0.0),
+        Percentile(result.samples, 0.5),
+        Percentile(result.samples, 0.9),
+        Percentile(result.samples, 0.99),
+        Percentile(result.samples, 1.0),
+        throughput,
+        i + 1 < gResults.size() ? "," : "");
+      json += buffer;
+    }
+    json += "  ]\n}\n";
+    return json;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const std::string daemonPath = argc > 1 ? argv[1] : SLEEPPREVENTER_DAEMON_PATH;
+  const std::string outputPath = argc > 2 ? argv[2] : "";
+
+  const auto name = "SleepPreventer.SuiteBenchmark."s + std::to_string(getpid());
+  const auto directory = std::filesystem::temp_directory_path() / name;
+  std::filesystem::create_directories(directory);
+
+  RunApplyState();
+  RunConfig(directory);
+  RunParseCommandLineOptions();
+  const bool ok = RunSecondInstance(daemonPath, name, directory) && RunColdStart(daemonPath, name, directory);
+
+  std::error_code error;
+  std::filesystem::remove_all(directory, error);
+  if (!ok) {
+    return 2;
+  }
+
+  const auto json = FormatJSON();
+  if (outputPath.empty()) {
+    std::fputs(json.c_str(), stdout);
+  } else if (!(std::ofstream(outputPath, std::ios_base::binary) << json)) {
+    std::fprintf(stderr, "failed to write %s\n", outputPath.c_str());
+    return 2;
+  }
+  return 0;
+}
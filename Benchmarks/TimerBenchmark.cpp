@@ -0,0 +1,131 @@
+// schedules 100k timers with random deadlines on a virtual clock, cancels a tenth of them and expires the rest
+// in one-second steps, checking that every timer fires once, in deadline order and not before it is due
+// exits with 1 on a wrong expiration or when the average cost per operation goes over OperationBudget
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "TimerQueue.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto OperationBudget = 1us;
+  constexpr int DefaultTimerCount = 100000;
+  constexpr auto Horizon = 1h;
+  constexpr auto Step = 1s;
+  constexpr int CancelEvery = 10;
+  // these reschedule themselves once from their callback
+  constexpr int RescheduleEvery = 97;
+
+  std::uint64_t gRandomState = 0x9E3779B97F4A7C15;
+
+  std::uint64_t NextRandom() {
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return gRandomState;
+  }
+
+  double NanosecondsPerOperation(std::chrono::nanoseconds elapsed, std::size_t operations) {
+    return operations == 0 ? 0.0 : static_cast<double>(elapsed.count()) / static_cast<double>(operations);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int timerCount = argc > 1 ? std::atoi(argv[1]) : DefaultTimerCount;
+
+  TimerQueue queue;
+  const auto origin = TimerQueue::Clock::now() + 24h;
+  auto now = origin;
+
+  std::vector<TimerQueue::TimerId> ids;
+  ids.reserve(timerCount);
+  std::size_t expectedFires = 0;
+  std::size_t fired = 0;
+  std::size_t errors = 0;
+  TimerQueue::Clock::time_point lastDeadline = origin;
+  std::vector<TimerQueue::Clock::time_point> deadlines;
+  deadlines.reserve(timerCount + timerCount / RescheduleEvery + 1);
+
+  // the callback checks the deadline it was scheduled with against the virtual clock
+  const auto makeCallback = [&](std::size_t deadlineIndex, bool reschedule) {
+    return [&, deadlineIndex, reschedule](TimerQueue::TimerId) {
+      const auto deadline = deadlines[deadlineIndex];
+      if (deadline > now || deadline < lastDeadline || deadline <= now - Step) {
+        errors++;
+      }
+      lastDeadline = deadline;
+      fired++;
+      if (reschedule) {
+        deadlines.push_back(deadline + 30s);
+        queue.Schedule(deadlines.back(), [&, index = deadlines.size() - 1](TimerQueue::TimerId) {
+          if (deadlines[index] > now || deadlines[index] <= now - Step) {
+            errors++;
+          }
+          fired++;
+        });
+      }
+    };
+  };
+
+  const auto scheduleStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < timerCount; i++) {
+    const auto offset = std::chrono::milliseconds(NextRandom() % static_cast<std::uint64_t>(std::chrono::milliseconds(Horizon).count())) + 1ms;
+    deadlines.push_back(origin + offset);
+    const bool reschedule = i % RescheduleEvery == 0;
+    ids.push_back(queue.Schedule(deadlines.back(), makeCallback(deadlines.size() - 1, reschedule)));
+  }
+  const auto scheduleElapsed = std::chrono::steady_clock::now() - scheduleStart;
+
+  const auto cancelStart = std::chrono::steady_clock::now();
+  std::size_t cancelled = 0;
+  for (int i = 0; i < timerCount; i += CancelEvery) {
+    if (queue.Cancel(ids[i])) {
+      cancelled++;
+    }
+  }
+  const auto cancelElapsed = std::chrono::steady_clock::now() - cancelStart;
+  for (int i = 0; i < timerCount; i++) {
+    if (i % CancelEvery != 0) {
+      expectedFires += i % RescheduleEvery == 0 ? 2 : 1;
+    }
+  }
+
+  // cancelling twice must fail
+  if (queue.Cancel(ids[0])) {
+    errors++;
+  }
+
+  const auto expireStart = std::chrono::steady_clock::now();
+  while (queue.GetCount() > 0) {
+    now += Step;
+    queue.Expire(now);
+  }
+  const auto expireElapsed = std::chrono::steady_clock::now() - expireStart;
+
+  if (fired != expectedFires) {
+    errors++;
+  }
+
+  const auto operations = static_cast<std::size_t>(timerCount) + cancelled + fired;
+  const auto total = scheduleElapsed + cancelElapsed + expireElapsed;
+  const double average = NanosecondsPerOperation(total, operations);
+
+  std::printf("timers %d: schedule %.0f ns/op, cancel %.0f ns/op (%zu), expire %.0f ns/op (%zu of %zu expected), timerfd arms %llu\n",
+    timerCount,
+    NanosecondsPerOperation(scheduleElapsed, static_cast<std::size_t>(timerCount)),
+    NanosecondsPerOperation(cancelElapsed, cancelled),
+    cancelled,
+    NanosecondsPerOperation(expireElapsed, fired),
+    fired,
+    expectedFires,
+    static_cast<unsigned long long>(queue.GetArmCount()));
+  std::printf("errors %zu, average %.0f ns/op, budget %lld ns/op\n", errors, average, static_cast<long long>(std::chrono::nanoseconds(OperationBudget).count()));
+
+  return errors == 0 && average <= static_cast<double>(std::chrono::nanoseconds(OperationBudget).count()) ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+// measures the fan-out of state events from an in-process IPCServer to Subscribers watching connections, and the user
+// space memory each subscriber costs; kernel socket buffers are not included, but the send buffer of a subscriber is
+// shrunk to a few KiB
+// one more subscriber never reads while the others do; it must stay within MaxSubscriberBacklog plus one pending event
+// and, once it reads, receive every event either queued or folded into the final one, which carries the latest state
+// a publish is timed from Publish through the Dispatch which sends the queued events, as the daemon's reactor runs it
+// exits with 1 when the median publish goes over PublishBudget per subscriber, or the slow subscriber check fails
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <malloc.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+
+using namespace std::literals;
+
+namespace {
+  // Publish only queues; the Dispatch after it sends to every subscriber, one syscall each, which is most of the cost
+  // the median, since the tail follows whatever else the machine is doing; it measures about 1 us per subscriber
+  constexpr auto PublishBudget = 3us;
+  constexpr int DefaultSubscribers = 1000;
+  constexpr int DefaultRounds = 2000;
+
+  struct Subscriber {
+    int fd;
+    std::string input;
+    // size of the frame last read, which the entries point into until the next read
+    std::size_t frameSize;
+  };
+
+  int Connect(const std::string& name) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())) != 0) {
+      std::perror("connect");
+      std::exit(2);
+    }
+    return fd;
+  }
+
+  // reads until a whole frame is buffered; false if the connection went away, or nothing came and wait is false
+  bool ReadFrame(Subscriber& subscriber, IPC::Frame& frame, bool wait) {
+    subscriber.input.erase(0, subscriber.frameSize);
+    subscriber.frameSize = 0;
+    while (true) {
+      if (IPC::ParseFrame(subscriber.input, frame, subscriber.frameSize) == IPC::ParseResult::Complete) {
+        return true;
+      }
+      subscriber.frameSize = 0;
+      char buffer[4096];
+      const auto received = recv(subscriber.fd, buffer, sizeof(buffer), wait ? 0 : MSG_DONTWAIT);
+      if (received <= 0) {
+        return false;
+      }
+      subscriber.input.append(buffer, static_cast<std::size_t>(received));
+    }
+  }
+
+  long long Percentile(const std::vector<std::chrono::nanoseconds>& samples, double p) {
+    return static_cast<long long>(samples[static_cast<std::size_t>(p * (samples.size() - 1))].count());
+  }
+
+  void Report(const char* name, std::vector<std::chrono::nanoseconds>& samples) {
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s: rounds %zu, p50 %lld ns, p99 %lld ns, max %lld ns\n", name, samples.size(), Percentile(samples, 0.5), Percentile(samples, 0.99), Percentile(samples, 1.0));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const int subscriberCount = argc > 1 ? std::atoi(argv[1]) : DefaultSubscribers;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : DefaultRounds;
+
+  // two fds per subscriber live in this process
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < static_cast<rlim_t>(subscriberCount) * 2 + 64) {
+    std::printf("RLIMIT_NOFILE of %llu is too low for %d subscribers\n", static_cast<unsigned long long>(limit.rlim_cur), subscriberCount);
+    return 2;
+  }
+
+  const std::string socketName = "SleepPreventer.WatchBenchmark."s + std::to_string(getpid());
+  std::optional<IPCServer> server;
+  server.emplace(socketName, [&](const IPC::Entry& command, std::string& result) {
+    if (command.opcode != IPC::Opcode::Watch) {
+      return IPC::Status::UnknownCommand;
+    }
+    server.value().Subscribe();
+    result.push_back(0);
+    return IPC::Status::Ok;
+  });
+
+  std::string request;
+  IPC::FrameWriter writer(request, IPC::FrameType::Request);
+  writer.Add(IPC::Opcode::Watch, IPC::Status::Ok);
+  writer.Finish();
+
+  // the last subscriber is the slow one
+  const auto memoryBefore = mallinfo2().uordblks;
+  std::vector<Subscriber> subscribers;
+  subscribers.reserve(subscriberCount + 1);
+  for (int i = 0; i <= subscriberCount; i++) {
+    subscribers.push_back(Subscriber{Connect(socketName), {}, 0});
+    send(subscribers.back().fd, request.data(), request.size(), MSG_NOSIGNAL);
+    server.value().Dispatch();
+  }
+  while (server.value().GetSubscriberCount() != subscribers.size()) {
+    server.value().Dispatch();
+  }
+  IPC::Frame frame;
+  for (auto& subscriber : subscribers) {
+    if (!ReadFrame(subscriber, frame, true) || frame.type != IPC::FrameType::Response) {
+      std::puts("a subscriber got no response");
+      return 2;
+    }
+  }
+  const auto memoryPerSubscriber = static_cast<double>(mallinfo2().uordblks - memoryBefore) / static_cast<double>(subscribers.size());
+
+  // every round publishes one event and reads it on every subscriber but the slow one
+  std::vector<std::chrono::nanoseconds> queueSamples;
+  std::vector<std::chrono::nanoseconds> publishSamples;
+  std::vector<std::chrono::nanoseconds> deliverySamples;
+  queueSamples.reserve(rounds);
+  publishSamples.reserve(rounds);
+  deliverySamples.reserve(rounds);
+  std::size_t errors = 0;
+  std::uint8_t state = 0;
+  const auto memoryBeforeRounds = mallinfo2().uordblks;
+  for (int round = 0; round < rounds; round++) {
+    state = static_cast<std::uint8_t>(1 + round % 31);
+    const char payload = static_cast<char>(state);
+    const auto start = std::chrono::steady_clock::now();
+    server.value().Publish(IPC::Opcode::Watch, std::string_view(&payload, 1));
+    const auto queued = std::chrono::steady_clock::now();
+    server.value().Dispatch();
+    const auto published = std::chrono::steady_clock::now();
+    for (int i = 0; i < subscriberCount; i++) {
+      auto& subscriber = subscribers[i];
+      if (!ReadFrame(subscriber, frame, true) || frame.type != IPC::FrameType::Event || frame.entries.size() != 1 ||
+          frame.entries[0].payload.size() != 5 || static_cast<std::uint8_t>(frame.entries[0].payload[0]) != state) {
+        errors++;
+      }
+    }
+    const auto delivered = std::chrono::steady_clock::now();
+    queueSamples.push_back(queued - start);
+    publishSamples.push_back(published - start);
+    deliverySamples.push_back(delivered - start);
+  }
+  const auto memoryGrowth = static_cast<long long>(mallinfo2().uordblks) - static_cast<long long>(memoryBeforeRounds);
+
+  // the slow subscriber catches up; events queued in the kernel were never coalesced
+  auto& slow = subscribers.back();
+  int kernelQueued = 0;
+  ioctl(slow.fd, FIONREAD, &kernelQueued);
+  std::uint64_t receivedEvents = 0;
+  std::uint64_t foldedEvents = 0;
+  std::uint8_t lastState = 0;
+  std::uint32_t lastCoalesced = 0;
+  for (int idle = 0; idle < 100; ) {
+    server.value().Dispatch();
+    if (!ReadFrame(slow, frame, false)) {
+      idle++;
+      usleep(1000);
+      continue;
+    }
+    idle = 0;
+    if (frame.type == IPC::FrameType::Event && frame.entries.size() == 1 && frame.entries[0].payload.size() == 5) {
+      lastState = static_cast<std::uint8_t>(frame.entries[0].payload[0]);
+      lastCoalesced = IPC::ReadU32(frame.entries[0].payload, 1);
+      receivedEvents++;
+      foldedEvents += lastCoalesced;
+    }
+  }
+  const bool slowValid = lastState == state && lastCoalesced > 0 && receivedEvents + foldedEvents == static_cast<std::uint64_t>(rounds);
+  if (!slowValid) {
+    std::printf("slow subscriber: last state %u of %u, last coalesced %u, received %llu + folded %llu of %d events\n",
+      lastState,
+      state,
+      lastCoalesced,
+      static_cast<unsigned long long>(receivedEvents),
+      static_cast<unsigned long long>(foldedEvents),
+      rounds);
+  }
+
+  for (const auto& subscriber : subscribers) {
+    close(subscriber.fd);
+  }
+
+  std::printf("subscribers: %d + 1 slow, %.0f bytes of user space memory each\n", subscriberCount, memoryPerSubscriber);
+  Report("queue (Publish alone)", queueSamples);
+  Report("publish", publishSamples);
+  Report("delivered to all", deliverySamples);
+  std::printf("slow subscriber: %d bytes queued in the kernel, %llu events received, %llu coalesced, memory growth %lld bytes\n",
+    kernelQueued,
+    static_cast<unsigned long long>(receivedEvents),
+    static_cast<unsigned long long>(foldedEvents),
+    memoryGrowth);
+  const auto budget = std::chrono::nanoseconds(PublishBudget).count() * subscriberCount;
+  std::printf("errors %zu, budget %lld ns\n", errors, static_cast<long long>(budget));
+
+  return errors == 0 && slowValid && Percentile(publishSamples, 0.5) <= budget ? 0 : 1;
+}
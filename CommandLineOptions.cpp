@@ -0,0 +1,134 @@
+#include "CommandLineOptions.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ConfigSchema.hpp"
+#include "Preventer.hpp"
+
+using namespace std::literals;
+
+namespace {
+  // options are plain ASCII
+  std::string Narrow(std::wstring_view text) {
+    std::string narrow;
+    for (const auto c : text) {
+      narrow.push_back(c < 0x80 ? static_cast<char>(c) : '?');
+    }
+    return narrow;
+  }
+
+  std::optional<int> ParseTimeOfDay(std::string_view text) {
+    const auto colon = text.find(':');
+    if (colon == std::string_view::npos) {
+      return std::nullopt;
+    }
+    const auto hours = Config::ParseInt(text.substr(0, colon));
+    const auto minutes = Config::ParseInt(text.substr(colon + 1));
+    if (!hours || !minutes || hours.value() < 0 || hours.value() > 23 || minutes.value() < 0 || minutes.value() > 59) {
+      return std::nullopt;
+    }
+    return static_cast<int>(hours.value() * 60 + minutes.value());
+  }
+}
+
+std::uint32_t CommandLineOptions::GetIPCFlags() const {
+  using namespace Preventer::IPCFlags;
+
+  std::uint32_t ipcFlags = 0;
+  if (enable.has_value()) {
+    ipcFlags |= enable.value() ? Enable : Disable;
+  }
+  if (systemFlag.has_value()) {
+    ipcFlags |= systemFlag.value() ? SetSystemFlag : UnsetSystemFlag;
+  }
+  if (displayFlag.has_value()) {
+    ipcFlags |= displayFlag.value() ? SetDisplayFlag : UnsetDisplayFlag;
+  }
+  return ipcFlags;
+}
+
+CommandLineOptions ParseCommandLineOptions(const std::vector<std::wstring>& args) {
+  CommandLineOptions options;
+
+  for (const auto& arg : args) {
+    if (arg.size() >= 2 && (arg[1] == L'?' || arg[1] == L'H' || arg[1] == L'h')) {
+      options.help = true;
+      continue;
+    }
+
+    //
+
+    if (arg == L"/E"sv || arg == L"/e"sv) {
+      options.enable = true;
+      continue;
+    }
+
+    if (arg == L"/-E"sv || arg == L"/-e"sv) {
+      options.enable = false;
+      continue;
+    }
+
+    //
+
+    if (arg == L"/S"sv || arg == L"/s"sv) {
+      options.systemFlag = true;
+      continue;
+    }
+
+    if (arg == L"/-S"sv || arg == L"/-s"sv) {
+      options.systemFlag = false;
+      continue;
+    }
+
+    //
+
+    if (arg == L"/D"sv || arg == L"/d"sv) {
+      options.displayFlag = true;
+      continue;
+    }
+
+    if (arg == L"/-D"sv || arg == L"/-d"sv) {
+      options.displayFlag = false;
+      continue;
+    }
+
+    //
+
+    if (arg.size() > 3 && (arg.compare(0, 3, L"/T:") == 0 || arg.compare(0, 3, L"/t:") == 0)) {
+      if (const auto duration = Config::ParseDuration(Narrow(std::wstring_view(arg).substr(3))); duration && duration.value().count() > 0) {
+        options.holdFor = duration;
+      }
+      continue;
+    }
+
+    if (arg.size() > 3 && (arg.compare(0, 3, L"/U:") == 0 || arg.compare(0, 3, L"/u:") == 0)) {
+      if (const auto timeOfDay = ParseTimeOfDay(Narrow(std::wstring_view(arg).substr(3)))) {
+        options.holdUntil = timeOfDay;
+      }
+      continue;
+    }
+
+    if (arg == L"/-T"sv || arg == L"/-t"sv) {
+      options.cancelHolds = true;
+      continue;
+    }
+
+    //
+
+    if (arg.size() > 3 && (arg.compare(0, 3, L"/L:") == 0 || arg.compare(0, 3, L"/l:") == 0)) {
+      options.lease = Narrow(std::wstring_view(arg).substr(3));
+      continue;
+    }
+
+    if (arg.size() > 4 && (arg.compare(0, 4, L"/-L:") == 0 || arg.compare(0, 4, L"/-l:") == 0)) {
+      options.releaseLease = Narrow(std::wstring_view(arg).substr(4));
+      continue;
+    }
+  }
+
+  return options;
+}
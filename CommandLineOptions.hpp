@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+constexpr wchar_t HelpMessage[] =
+  L"\n"
+  L"SleepPreventer [/E | /-E] [/S | /-S] [/D | /-D]\n"
+  L"\n"
+  L"  /E    Enable prevention\n"
+  L"  /-E   Disable prevention\n"
+  L"  /S    Enable sleep prevention\n"
+  L"  /-S   Disable sleep prevention\n"
+  L"  /D    Enable display-off prevention\n"
+  L"  /-D   Disable display-off prevention\n"
+  L"\n";
+
+struct CommandLineOptions {
+  bool help = false;
+  std::optional<bool> enable;
+  std::optional<bool> systemFlag;
+  std::optional<bool> displayFlag;
+  // /T:<duration>, e.g. /T:90m
+  std::optional<std::chrono::milliseconds> holdFor;
+  // /U:<HH:MM>, in minutes after midnight
+  std::optional<int> holdUntil;
+  // /-T
+  bool cancelHolds = false;
+  // /L:<name>
+  std::optional<std::string> lease;
+  // /-L:<name>
+  std::optional<std::string> releaseLease;
+
+  // Preventer::IPCFlags equivalent of the options
+  std::uint32_t GetIPCFlags() const;
+};
+
+// unknown arguments are ignored
+CommandLineOptions ParseCommandLineOptions(const std::vector<std::wstring>& args);
@@ -1,91 +1,208 @@
 #include "ConfigFile.hpp"
 
+#include <chrono>
+#include <cstddef>
 #include <filesystem>
-#include <fstream>
-#include <map>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AtomicFile.hpp"
+#include "ConfigSchema.hpp"
+#include "Metrics.hpp"
 
 using namespace std::literals;
 
-ConfigFile::ConfigFile(const std::wstring& filepath) :
-  mFilepath(filepath)
+ConfigFile::ConfigFile(const std::filesystem::path& filepath, std::chrono::milliseconds flushDelay) :
+  mFilepath(filepath),
+  mFlushDelay(flushDelay)
 {
   Load();
 }
 
 ConfigFile::~ConfigFile() {
-  Save();
+  {
+    std::lock_guard lock(mFlushMutex);
+    mStopFlushThread = true;
+  }
+  mFlushCondition.notify_one();
+  if (mFlushThread.joinable()) {
+    mFlushThread.join();
+  }
+
+  Flush();
 }
 
 void ConfigFile::Load() {
   std::lock_guard lock(mMutex);
 
-  mConfigMap.clear();
+  mValues.Reset();
+  mDiagnostics.clear();
+  mChangedKeys.reset();
 
-  std::wfstream wfs;
-  wfs.open(mFilepath, std::ios_base::in);
-  if (wfs.fail()) {
+  auto data = ReadWholeFile(mFilepath);
+  if (!data) {
     return;
   }
 
-  for (std::wstring line; std::getline(wfs, line); ) {
-    if (line.empty()) {
-      continue;
-    }
+  Config::Parse(data.value(), mValues, mDiagnostics);
+  mFileContent = std::move(data.value());
+}
 
-    const auto eqPos = line.find_first_of(L'=');
-    if (eqPos == std::wstring::npos) {
-      continue;
+Config::KeySet ConfigFile::Reload() {
+  std::lock_guard writeLock(mWriteMutex);
+
+  auto data = ReadWholeFile(mFilepath);
+  std::lock_guard lock(mMutex);
+  // a missing file keeps the current state; our own writes come back unchanged
+  if (!data || data.value() == mFileContent) {
+    return {};
+  }
+
+  mDiagnostics.clear();
+  Config::Parse(data.value(), mReloadValues, mDiagnostics);
+  const auto changedKeys = mValues.Diff(mReloadValues);
+
+  // the file wins over changes which have not been flushed yet
+  std::swap(mValues, mReloadValues);
+  mFileContent = std::move(data.value());
+  mChangedKeys.reset();
+
+  return changedKeys;
+}
+
+void ConfigFile::Save() {
+  {
+    std::shared_lock lock(mMutex);
+    if (mChangedKeys.none()) {
+      return;
     }
+  }
 
-    std::size_t keyEnd = eqPos;
-    while (keyEnd > 0 && line[keyEnd - 1] == L' ') {
-      keyEnd--;
+  {
+    std::lock_guard lock(mFlushMutex);
+    if (mFlushDeadline) {
+      // already scheduled; this change rides along
+      return;
     }
+    mFlushDeadline = std::chrono::steady_clock::now() + mFlushDelay;
+    if (!mFlushThread.joinable()) {
+      mFlushThread = std::thread(&ConfigFile::FlushThreadProc, this);
+    }
+  }
+  mFlushCondition.notify_one();
+}
 
-    std::size_t valueBegin = eqPos + 1;
-    while (valueBegin < line.size() && line[valueBegin] == L' ') {
-      valueBegin++;
+bool ConfigFile::Flush() {
+  std::lock_guard writeLock(mWriteMutex);
+
+  std::string data;
+  Config::KeySet keys;
+  {
+    std::lock_guard lock(mMutex);
+    if (mChangedKeys.none()) {
+      return true;
     }
 
-    try {
-      mConfigMap.insert_or_assign(line.substr(0, keyEnd), std::stoi(line.substr(valueBegin)));
-    } catch (...) {}
+    // comments, unknown keys and untouched lines survive the write
+    keys = std::exchange(mChangedKeys, {});
+    mValues.Serialize(mFileContent, keys, data);
   }
-}
 
-void ConfigFile::Save() {
-  std::lock_guard lock(mMutex);
+  const auto start = Metrics::Clock::now();
+  const bool written = AtomicWriteFile(mFilepath, data);
+  Metrics::gConfigSaveLatency.RecordSince(start);
+  Metrics::gConfigSaves.Add();
+  if (!written) {
+    Metrics::gConfigSaveFailures.Add();
+    std::lock_guard lock(mMutex);
+    mChangedKeys |= keys;
+    return false;
+  }
 
-  std::wfstream wfs;
-  wfs.open(mFilepath, std::ios_base::out | std::ios_base::trunc);
-  if (wfs.fail()) {
-    return;
+  {
+    std::lock_guard lock(mMutex);
+    mFileContent = data;
   }
 
-  for (const auto& [key, value] : mConfigMap) {
-    wfs << key << L" = "sv << value << std::endl;
+  mWriteStats.flushes++;
+  mWriteStats.bytes += data.size();
+  return true;
+}
+
+void ConfigFile::FlushThreadProc() {
+  std::unique_lock lock(mFlushMutex);
+  while (!mStopFlushThread) {
+    if (!mFlushDeadline) {
+      mFlushCondition.wait(lock);
+      continue;
+    }
+
+    if (std::chrono::steady_clock::now() < mFlushDeadline.value()) {
+      mFlushCondition.wait_until(lock, mFlushDeadline.value());
+      continue;
+    }
+
+    mFlushDeadline.reset();
+    lock.unlock();
+    Flush();
+    lock.lock();
   }
-  wfs << std::flush;
 }
 
-std::optional<int> ConfigFile::Get(const std::wstring& key) const {
+bool ConfigFile::GetBool(Config::Key key) const {
+  std::shared_lock lock(mMutex);
+  return mValues.GetNumber(key) != 0;
+}
+
+std::int64_t ConfigFile::GetInt(Config::Key key) const {
+  std::shared_lock lock(mMutex);
+  return mValues.GetNumber(key);
+}
+
+std::chrono::milliseconds ConfigFile::GetDuration(Config::Key key) const {
+  std::shared_lock lock(mMutex);
+  return std::chrono::milliseconds(mValues.GetNumber(key));
+}
+
+std::string ConfigFile::GetString(Config::Key key) const {
   std::shared_lock lock(mMutex);
-  const auto itr = mConfigMap.find(key);
-  if (itr == mConfigMap.cend()) {
-    return std::nullopt;
+  return mValues.GetText(key);
+}
+
+void ConfigFile::SetBool(Config::Key key, bool value) {
+  SetInt(key, value ? 1 : 0);
+}
+
+void ConfigFile::SetInt(Config::Key key, std::int64_t value) {
+  std::lock_guard lock(mMutex);
+  if (mValues.SetNumber(key, value)) {
+    mChangedKeys.set(static_cast<std::size_t>(key));
   }
-  return std::make_optional(itr->second);
 }
 
-void ConfigFile::Set(const std::wstring& key, int value, bool skipIfExists) {
+void ConfigFile::SetDuration(Config::Key key, std::chrono::milliseconds value) {
+  SetInt(key, value.count());
+}
+
+void ConfigFile::SetString(Config::Key key, std::string_view value) {
   std::lock_guard lock(mMutex);
-  if (skipIfExists) {
-    mConfigMap.try_emplace(key, value);
-  } else {
-    mConfigMap.insert_or_assign(key, value);
+  if (mValues.SetText(key, value)) {
+    mChangedKeys.set(static_cast<std::size_t>(key));
   }
 }
+
+std::vector<Config::Diagnostic> ConfigFile::GetDiagnostics() const {
+  std::shared_lock lock(mMutex);
+  return mDiagnostics;
+}
+
+ConfigFile::WriteStats ConfigFile::GetWriteStats() {
+  std::lock_guard writeLock(mWriteMutex);
+  return mWriteStats;
+}
@@ -1,24 +1,78 @@
 #pragma once
 
-#include <fstream>
-#include <map>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ConfigSchema.hpp"
 
 class ConfigFile {
+public:
+  struct WriteStats {
+    std::uint64_t flushes = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  static constexpr std::chrono::milliseconds DefaultFlushDelay{500};
+
+private:
   mutable std::shared_mutex mMutex;
-  std::map<std::wstring, int> mConfigMap;
-  std::wstring mFilepath;
-  
+  Config::Values mValues;
+  // parse target of Reload, swapped with mValues so its buffers are reused
+  Config::Values mReloadValues;
+  std::vector<Config::Diagnostic> mDiagnostics;
+  std::filesystem::path mFilepath;
+  // keys set since the last write; only their lines are rewritten
+  Config::KeySet mChangedKeys;
+  // what the file on disk holds as far as we know, to tell our own writes from external edits
+  std::string mFileContent;
+
+  // serializes writers so that an older snapshot never lands after a newer one
+  std::mutex mWriteMutex;
+  WriteStats mWriteStats;
+
+  // write-behind state, guarded by mFlushMutex
+  std::chrono::milliseconds mFlushDelay;
+  std::mutex mFlushMutex;
+  std::condition_variable mFlushCondition;
+  std::optional<std::chrono::steady_clock::time_point> mFlushDeadline;
+  bool mStopFlushThread = false;
+  std::thread mFlushThread;
+
   void Load();
+  void FlushThreadProc();
 
 public:
-  ConfigFile(const std::wstring& filepath);
+  ConfigFile(const std::filesystem::path& filepath, std::chrono::milliseconds flushDelay = DefaultFlushDelay);
   ~ConfigFile();
 
+  // schedules a deferred write if anything changed; changes within flushDelay are coalesced into one write
   void Save();
+  // writes immediately if anything changed; returns false if the write failed
+  bool Flush();
+  // rereads the file after an external change and returns the keys whose value changed
+  Config::KeySet Reload();
+
+  bool GetBool(Config::Key key) const;
+  std::int64_t GetInt(Config::Key key) const;
+  std::chrono::milliseconds GetDuration(Config::Key key) const;
+  std::string GetString(Config::Key key) const;
+
+  void SetBool(Config::Key key, bool value);
+  void SetInt(Config::Key key, std::int64_t value);
+  void SetDuration(Config::Key key, std::chrono::milliseconds value);
+  void SetString(Config::Key key, std::string_view value);
+
+  // problems found by the last Load or Reload
+  std::vector<Config::Diagnostic> GetDiagnostics() const;
 
-  std::optional<int> Get(const std::wstring& key) const;
-  void Set(const std::wstring& key, int value, bool skipIfExists = false);
+  WriteStats GetWriteStats();
 };
@@ -0,0 +1,335 @@
+#include "ConfigSchema.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std::literals;
+
+namespace Config {
+  namespace {
+    std::string_view Trim(std::string_view text) {
+      while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+      }
+      while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+      }
+      return text;
+    }
+
+    bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+      if (a.size() != b.size()) {
+        return false;
+      }
+      for (std::size_t i = 0; i < a.size(); i++) {
+        const char ca = a[i] >= 'A' && a[i] <= 'Z' ? static_cast<char>(a[i] - 'A' + 'a') : a[i];
+        if (ca != b[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void AppendDuration(std::string& out, std::int64_t milliseconds) {
+      if (milliseconds != 0 && milliseconds % 3600000 == 0) {
+        out += std::to_string(milliseconds / 3600000);
+        out.push_back('h');
+      } else if (milliseconds != 0 && milliseconds % 60000 == 0) {
+        out += std::to_string(milliseconds / 60000);
+        out.push_back('m');
+      } else if (milliseconds % 1000 == 0) {
+        out += std::to_string(milliseconds / 1000);
+        out.push_back('s');
+      } else {
+        out += std::to_string(milliseconds);
+        out += "ms"sv;
+      }
+    }
+  }
+
+  std::string FormatDiagnostic(const Diagnostic& diagnostic) {
+    std::string message = "line "s + std::to_string(diagnostic.line) + ": "s;
+    if (diagnostic.key) {
+      message += GetKeyInfo(diagnostic.key.value()).name;
+      message += ": "sv;
+    }
+    switch (diagnostic.code) {
+      case DiagnosticCode::MissingEquals:
+        message += "expected \"key = value\""sv;
+        break;
+
+      case DiagnosticCode::UnknownKey:
+        message += "unknown key"sv;
+        break;
+
+      case DiagnosticCode::InvalidBool:
+        message += "expected a boolean (0, 1, true, false, yes, no, on, off)"sv;
+        break;
+
+      case DiagnosticCode::InvalidInt:
+        message += "expected an integer"sv;
+        break;
+
+      case DiagnosticCode::InvalidDuration:
+        message += "expected a duration such as 500ms, 45s, 90m or 1h30m"sv;
+        break;
+    }
+    return message;
+  }
+
+  Values::Values() {
+    Reset();
+  }
+
+  std::int64_t Values::GetNumber(Key key) const {
+    return mNumbers[static_cast<std::size_t>(key)];
+  }
+
+  const std::string& Values::GetText(Key key) const {
+    return mTexts[static_cast<std::size_t>(key)];
+  }
+
+  bool Values::SetNumber(Key key, std::int64_t value) {
+    const auto index = static_cast<std::size_t>(key);
+    mPresent.set(index);
+    if (mNumbers[index] == value) {
+      return false;
+    }
+    mNumbers[index] = value;
+    return true;
+  }
+
+  bool Values::SetText(Key key, std::string_view value) {
+    const auto index = static_cast<std::size_t>(key);
+    mPresent.set(index);
+    if (mTexts[index] == value) {
+      return false;
+    }
+    mTexts[index].assign(value);
+    return true;
+  }
+
+  const KeySet& Values::GetPresentKeys() const {
+    return mPresent;
+  }
+
+  KeySet Values::Diff(const Values& other) const {
+    KeySet changed;
+    for (std::size_t i = 0; i < KeyCount; i++) {
+      if (mNumbers[i] != other.mNumbers[i] || mTexts[i] != other.mTexts[i]) {
+        changed.set(i);
+      }
+    }
+    return changed;
+  }
+
+  void Values::Reset() {
+    for (std::size_t i = 0; i < KeyCount; i++) {
+      mNumbers[i] = Keys[i].defaultNumber;
+      mTexts[i].assign(Keys[i].defaultText);
+    }
+    mPresent.reset();
+  }
+
+  void Values::AppendValue(std::string& out, Key key) const {
+    const auto index = static_cast<std::size_t>(key);
+    switch (GetKeyInfo(key).type) {
+      case ValueType::Bool:
+        out.push_back(mNumbers[index] != 0 ? '1' : '0');
+        break;
+
+      case ValueType::Int:
+        out += std::to_string(mNumbers[index]);
+        break;
+
+      case ValueType::Duration:
+        AppendDuration(out, mNumbers[index]);
+        break;
+
+      case ValueType::String:
+      case ValueType::List:
+        out += mTexts[index];
+        break;
+    }
+  }
+
+  void Values::Serialize(std::string_view original, const KeySet& keys, std::string& out) const {
+    KeySet pending = keys;
+    while (!original.empty()) {
+      const auto lineEnd = original.find('\n');
+      const auto raw = original.substr(0, lineEnd == std::string_view::npos ? original.size() : lineEnd + 1);
+      original.remove_prefix(raw.size());
+
+      const auto line = Trim(raw.substr(0, raw.find('\n')));
+      const auto eqPos = line.find('=');
+      const auto key = line.empty() || line.front() == '#' || line.front() == ';' || eqPos == std::string_view::npos
+        ? std::nullopt
+        : FindKey(Trim(line.substr(0, eqPos)));
+      if (!key || !keys.test(static_cast<std::size_t>(key.value()))) {
+        out += raw;
+        continue;
+      }
+
+      // keep everything around the value: indentation, spacing, the line ending
+      const auto lineBegin = static_cast<std::size_t>(line.data() - raw.data());
+      auto valueBegin = lineBegin + eqPos + 1;
+      const auto valueEnd = lineBegin + line.size();
+      while (valueBegin < valueEnd && (raw[valueBegin] == ' ' || raw[valueBegin] == '\t')) {
+        valueBegin++;
+      }
+      out += raw.substr(0, valueBegin);
+      AppendValue(out, key.value());
+      out += raw.substr(valueEnd);
+      pending.reset(static_cast<std::size_t>(key.value()));
+    }
+
+    if (pending.none()) {
+      return;
+    }
+    if (!out.empty() && out.back() != '\n') {
+      out.push_back('\n');
+    }
+    for (const auto& info : Keys) {
+      if (!pending.test(static_cast<std::size_t>(info.key))) {
+        continue;
+      }
+      out += info.name;
+      out += " = "sv;
+      AppendValue(out, info.key);
+      out.push_back('\n');
+    }
+  }
+
+  std::optional<bool> ParseBool(std::string_view text) {
+    if (text == "1"sv || EqualsIgnoreCase(text, "true"sv) || EqualsIgnoreCase(text, "yes"sv) || EqualsIgnoreCase(text, "on"sv)) {
+      return true;
+    }
+    if (text == "0"sv || EqualsIgnoreCase(text, "false"sv) || EqualsIgnoreCase(text, "no"sv) || EqualsIgnoreCase(text, "off"sv)) {
+      return false;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<std::int64_t> ParseInt(std::string_view text) {
+    std::int64_t value = 0;
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{} || ptr != text.data() + text.size() || text.empty()) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+  std::optional<std::chrono::milliseconds> ParseDuration(std::string_view text) {
+    if (text.empty()) {
+      return std::nullopt;
+    }
+
+    std::int64_t total = 0;
+    while (!text.empty()) {
+      std::int64_t value = 0;
+      const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+      if (ec != std::errc{} || ptr == text.data() || value < 0) {
+        return std::nullopt;
+      }
+      text.remove_prefix(static_cast<std::size_t>(ptr - text.data()));
+
+      std::size_t unitLength = 0;
+      while (unitLength < text.size() && text[unitLength] >= 'a' && text[unitLength] <= 'z') {
+        unitLength++;
+      }
+      const auto unit = text.substr(0, unitLength);
+      text.remove_prefix(unitLength);
+
+      std::int64_t scale;
+      if (unit == "ms"sv) {
+        scale = 1;
+      } else if (unit.empty() || unit == "s"sv) {
+        scale = 1000;
+      } else if (unit == "m"sv) {
+        scale = 60 * 1000;
+      } else if (unit == "h"sv) {
+        scale = 60 * 60 * 1000;
+      } else if (unit == "d"sv) {
+        scale = 24 * 60 * 60 * 1000;
+      } else {
+        return std::nullopt;
+      }
+      // anything past what milliseconds can hold is rejected rather than wrapped
+      if (value > (std::numeric_limits<std::int64_t>::max() - total) / scale) {
+        return std::nullopt;
+      }
+      total += value * scale;
+    }
+
+    return std::chrono::milliseconds(total);
+  }
+
+  void Parse(std::string_view data, Values& values, std::vector<Diagnostic>& diagnostics) {
+    values.Reset();
+
+    std::uint32_t lineNumber = 0;
+    while (!data.empty()) {
+      const auto lineEnd = data.find('\n');
+      const auto line = Trim(data.substr(0, lineEnd));
+      data = lineEnd == std::string_view::npos ? std::string_view{} : data.substr(lineEnd + 1);
+      lineNumber++;
+
+      if (line.empty() || line.front() == '#' || line.front() == ';') {
+        continue;
+      }
+
+      const auto eqPos = line.find('=');
+      if (eqPos == std::string_view::npos) {
+        diagnostics.push_back({lineNumber, DiagnosticCode::MissingEquals, std::nullopt});
+        continue;
+      }
+
+      const auto name = Trim(line.substr(0, eqPos));
+      const auto text = Trim(line.substr(eqPos + 1));
+
+      const auto key = FindKey(name);
+      if (!key) {
+        diagnostics.push_back({lineNumber, DiagnosticCode::UnknownKey, std::nullopt});
+        continue;
+      }
+
+      switch (GetKeyInfo(key.value()).type) {
+        case ValueType::Bool:
+          if (const auto value = ParseBool(text); value) {
+            values.SetNumber(key.value(), value.value() ? 1 : 0);
+          } else {
+            diagnostics.push_back({lineNumber, DiagnosticCode::InvalidBool, key});
+          }
+          break;
+
+        case ValueType::Int:
+          if (const auto value = ParseInt(text); value) {
+            values.SetNumber(key.value(), value.value());
+          } else {
+            diagnostics.push_back({lineNumber, DiagnosticCode::InvalidInt, key});
+          }
+          break;
+
+        case ValueType::Duration:
+          if (const auto value = ParseDuration(text); value) {
+            values.SetNumber(key.value(), value.value().count());
+          } else {
+            diagnostics.push_back({lineNumber, DiagnosticCode::InvalidDuration, key});
+          }
+          break;
+
+        case ValueType::String:
+        case ValueType::List:
+          values.SetText(key.value(), text);
+          break;
+      }
+    }
+  }
+}
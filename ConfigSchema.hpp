@@ -0,0 +1,225 @@
+#pragma once
+
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// typed schema of SleepPreventer.cfg
+//
+// the file is a list of "key = value" lines; blank lines and lines starting with '#' or ';' are ignored
+//   bool      0, 1, true, false, yes, no, on, off
+//   int       decimal integer
+//   duration  integer with unit, e.g. 500ms, 45s, 90m, 1h30m, 2d; a bare integer is seconds
+//   string    the rest of the line with surrounding spaces removed
+//   list      comma separated strings
+namespace Config {
+  enum class ValueType : std::uint8_t {
+    Bool,
+    Int,
+    Duration,
+    String,
+    List,
+  };
+
+  enum class Key : std::uint16_t {
+    Enable,
+    System,
+    Display,
+    ProcessWatch,
+    ProcessWatchInterval,
+    LoadCpu,
+    LoadDisk,
+    LoadNet,
+    LoadInterval,
+    LoadWindow,
+    Schedule,
+    ConnectionPorts,
+    ConnectionInterval,
+    PowerRequireAc,
+    PowerMinBattery,
+    UserMaxLeases,
+    UserMaxDuration,
+    FleetListen,
+    FleetKeyFile,
+    HookOn,
+    HookOff,
+    HookTimeout,
+    HookWorkers,
+    BackendCoalesce,
+    MetricsFile,
+    MetricsInterval,
+    JournalRecords,
+    StatusPage,
+  };
+
+  struct KeyInfo {
+    Key key;
+    std::string_view name;
+    ValueType type;
+    // bool, int and duration (in milliseconds) keys
+    std::int64_t defaultNumber;
+    // string and list keys
+    std::string_view defaultText;
+  };
+
+  inline constexpr KeyInfo Keys[] = {
+    {Key::Enable, "enable", ValueType::Bool, 0, {}},
+    {Key::System, "system", ValueType::Bool, 0, {}},
+    {Key::Display, "display", ValueType::Bool, 0, {}},
+    // shell wildcards matched against the name and command line of running processes
+    {Key::ProcessWatch, "process_watch", ValueType::List, 0, {}},
+    // /proc scan period, used only when the proc connector is unavailable
+    {Key::ProcessWatchInterval, "process_watch_interval", ValueType::Duration, 5000, {}},
+    // activity thresholds of the load rule, in percent of all CPUs and KiB/s; 0 disables a metric
+    {Key::LoadCpu, "load_cpu", ValueType::Int, 0, {}},
+    {Key::LoadDisk, "load_disk", ValueType::Int, 0, {}},
+    {Key::LoadNet, "load_net", ValueType::Int, 0, {}},
+    {Key::LoadInterval, "load_interval", ValueType::Duration, 1000, {}},
+    // time constant of the moving average
+    {Key::LoadWindow, "load_window", ValueType::Duration, 30000, {}},
+    // weekly local times during which sleep is prevented, e.g. "Mon-Fri 08:00-19:00, Sun 02:00-04:00"; see Schedule.hpp
+    {Key::Schedule, "schedule", ValueType::List, 0, {}},
+    // local TCP ports or ranges of them, e.g. "22, 8000-8099"; an established connection on any of them prevents sleep
+    {Key::ConnectionPorts, "connection_ports", ValueType::List, 0, {}},
+    {Key::ConnectionInterval, "connection_interval", ValueType::Duration, 5000, {}},
+    // power policy, which overrides the manual state and every lease: nothing is held while on battery, or while on
+    // battery below power_min_battery percent; 0 disables it
+    {Key::PowerRequireAc, "power_require_ac", ValueType::Bool, 0, {}},
+    {Key::PowerMinBattery, "power_min_battery", ValueType::Int, 0, {}},
+    // limits on each user other than the daemon's own and root, which matter to a system-wide daemon: the leases and
+    // holds a user may have at once, and how long any of them may last, longer ones being cut short; 0 for no limit
+    {Key::UserMaxLeases, "user_max_leases", ValueType::Int, 0, {}},
+    {Key::UserMaxDuration, "user_max_duration", ValueType::Duration, 0, {}},
+    // TCP address fleet controllers connect to, e.g. "10.0.0.5:7455" or ":7455" for every interface; empty disables it
+    // the controllers must know the key in fleet_key_file, which must not be readable by group or others
+    {Key::FleetListen, "fleet_listen", ValueType::String, 0, {}},
+    {Key::FleetKeyFile, "fleet_key_file", ValueType::String, 0, {}},
+    // shell commands run when prevention turns on and off, with SLEEPPREVENTER_EVENT and SLEEPPREVENTER_STATE set;
+    // up to hook_workers run at once, off the daemon's thread, and each is killed after hook_timeout
+    {Key::HookOn, "hook_on", ValueType::String, 0, {}},
+    {Key::HookOff, "hook_off", ValueType::String, 0, {}},
+    {Key::HookTimeout, "hook_timeout", ValueType::Duration, 30000, {}},
+    {Key::HookWorkers, "hook_workers", ValueType::Int, 2, {}},
+    // a state change within backend_coalesce of the last backend call waits for the rest of it, together with any
+    // other change made meanwhile, so a burst of changes costs two backend calls; 0 applies every change at once
+    {Key::BackendCoalesce, "backend_coalesce", ValueType::Duration, 0, {}},
+    // Prometheus text file rewritten every metrics_interval, e.g. for the node_exporter textfile collector; empty disables it
+    {Key::MetricsFile, "metrics_file", ValueType::String, 0, {}},
+    {Key::MetricsInterval, "metrics_interval", ValueType::Duration, 15000, {}},
+    // size of the transition journal in 128 byte records, read at startup; 0 disables it
+    {Key::JournalRecords, "journal_records", ValueType::Int, 16384, {}},
+    // shared-memory status page for readers of SleepPreventerStatus.h, read at startup
+    {Key::StatusPage, "status_page", ValueType::Bool, 1, {}},
+  };
+
+  inline constexpr std::size_t KeyCount = std::size(Keys);
+
+  constexpr bool IsKeyTableOrdered() {
+    for (std::size_t i = 0; i < KeyCount; i++) {
+      if (static_cast<std::size_t>(Keys[i].key) != i) {
+        return false;
+      }
+    }
+    return true;
+  }
+  static_assert(IsKeyTableOrdered(), "Config::Keys must be in the order of Config::Key");
+
+  constexpr const KeyInfo& GetKeyInfo(Key key) {
+    return Keys[static_cast<std::size_t>(key)];
+  }
+
+  constexpr std::optional<Key> FindKey(std::string_view name) {
+    for (const auto& info : Keys) {
+      if (info.name == name) {
+        return info.key;
+      }
+    }
+    return std::nullopt;
+  }
+
+  using KeySet = std::bitset<KeyCount>;
+
+  enum class DiagnosticCode : std::uint8_t {
+    MissingEquals,
+    UnknownKey,
+    InvalidBool,
+    InvalidInt,
+    InvalidDuration,
+  };
+
+  struct Diagnostic {
+    std::uint32_t line;
+    DiagnosticCode code;
+    // set unless the key itself is unknown
+    std::optional<Key> key;
+  };
+
+  std::string FormatDiagnostic(const Diagnostic& diagnostic);
+
+  // typed storage for every key; numbers and strings are kept in fixed slots indexed by Key
+  class Values {
+    std::int64_t mNumbers[KeyCount];
+    std::string mTexts[KeyCount];
+    KeySet mPresent;
+
+  public:
+    // every key starts at its default
+    Values();
+
+    std::int64_t GetNumber(Key key) const;
+    const std::string& GetText(Key key) const;
+
+    // return true if the value changed
+    bool SetNumber(Key key, std::int64_t value);
+    bool SetText(Key key, std::string_view value);
+
+    // keys which were given explicitly, by Parse or a setter
+    const KeySet& GetPresentKeys() const;
+
+    // keys whose value differs from other
+    KeySet Diff(const Values& other) const;
+
+    // resets every key to its default, keeping the string buffers
+    void Reset();
+
+    // appends original with the values of keys rewritten in place; comments, unknown keys and the other lines
+    // are copied verbatim, and keys which original does not mention are appended as "key = value" lines
+    void Serialize(std::string_view original, const KeySet& keys, std::string& out) const;
+
+  private:
+    void AppendValue(std::string& out, Key key) const;
+  };
+
+  // single pass over data; does not allocate except for string values that grow and for diagnostics
+  // values is reset first, so keys not mentioned end up at their defaults
+  void Parse(std::string_view data, Values& values, std::vector<Diagnostic>& diagnostics);
+
+  std::optional<bool> ParseBool(std::string_view text);
+  std::optional<std::int64_t> ParseInt(std::string_view text);
+  std::optional<std::chrono::milliseconds> ParseDuration(std::string_view text);
+
+  // calls callback for every non-empty item of a list value, trimmed
+  template <typename Callback>
+  void ForEachListItem(std::string_view list, Callback&& callback) {
+    while (!list.empty()) {
+      const auto comma = list.find(',');
+      auto item = list.substr(0, comma);
+      list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+      while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+        item.remove_prefix(1);
+      }
+      while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+        item.remove_suffix(1);
+      }
+      if (!item.empty()) {
+        callback(item);
+      }
+    }
+  }
+} // namespace Config
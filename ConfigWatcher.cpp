@@ -0,0 +1,65 @@
+#include "ConfigWatcher.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+ConfigWatcher::ConfigWatcher(const std::filesystem::path& filepath) :
+  mFilename(filepath.filename().native())
+{
+  mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "inotify_init1 failed");
+  }
+
+  auto dirPath = filepath.parent_path();
+  if (dirPath.empty()) {
+    dirPath = ".";
+  }
+
+  // IN_CLOSE_WRITE catches in-place edits, IN_MOVED_TO catches rename-over replaces (including our own atomic writes)
+  if (inotify_add_watch(mFd, dirPath.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    const int error = errno;
+    close(mFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "inotify_add_watch failed");
+  }
+}
+
+ConfigWatcher::~ConfigWatcher() {
+  close(mFd);
+}
+
+int ConfigWatcher::GetFd() const {
+  return mFd;
+}
+
+bool ConfigWatcher::ReadEvents() {
+  bool changed = false;
+
+  alignas(inotify_event) char buffer[4096];
+  while (true) {
+    const auto length = read(mFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      if (length < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    for (std::size_t pos = 0; pos < static_cast<std::size_t>(length); ) {
+      const auto event = reinterpret_cast<const inotify_event*>(buffer + pos);
+      if (event->len != 0 && std::strcmp(event->name, mFilename.c_str()) == 0) {
+        changed = true;
+      }
+      pos += sizeof(inotify_event) + event->len;
+    }
+  }
+
+  return changed;
+}
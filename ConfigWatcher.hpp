@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// watches a config file through inotify on its directory, so that replacing the file by rename is seen as well
+class ConfigWatcher {
+  int mFd = -1;
+  std::string mFilename;
+
+public:
+  // throws std::system_error
+  explicit ConfigWatcher(const std::filesystem::path& filepath);
+  ~ConfigWatcher();
+
+  ConfigWatcher(const ConfigWatcher&) = delete;
+  ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+  // readable when events are pending
+  int GetFd() const;
+  // drains pending events without blocking; returns true if any of them touched the config file
+  bool ReadEvents();
+};
@@ -0,0 +1,231 @@
+#include "ConnectionWatcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  // a dump normally arrives at once; this only keeps a broken kernel from hanging the caller
+  constexpr auto ReceiveTimeout = 1s;
+
+  void AppendOp(std::vector<char>& bytecode, std::uint8_t code, std::uint8_t yes, std::uint16_t no) {
+    const inet_diag_bc_op op{code, yes, no};
+    const auto bytes = reinterpret_cast<const char*>(&op);
+    bytecode.insert(bytecode.end(), bytes, bytes + sizeof(op));
+  }
+
+  // "first <= sport && sport <= last" for every range, joined as in ss: a failed comparison jumps past the JMP to the
+  // next range (or 4 bytes past the end, which rejects), and a match falls through to a JMP to the end, which accepts
+  // the kernel checks that the "yes" offsets alone walk the whole program, so every range stays reachable that way
+  std::vector<char> BuildPortFilter(const std::vector<ConnectionWatcher::PortRange>& ranges) {
+    constexpr std::uint8_t OpSize = sizeof(inet_diag_bc_op);
+    constexpr std::uint16_t RangeSize = 4 * OpSize;
+    std::vector<char> bytecode;
+    for (std::size_t i = 0; i < ranges.size(); i++) {
+      if (i != 0) {
+        const auto rest = static_cast<std::uint16_t>((ranges.size() - i) * RangeSize + (ranges.size() - i - 1) * OpSize);
+        AppendOp(bytecode, INET_DIAG_BC_JMP, OpSize, static_cast<std::uint16_t>(rest + OpSize));
+      }
+      AppendOp(bytecode, INET_DIAG_BC_S_GE, 2 * OpSize, RangeSize + OpSize);
+      AppendOp(bytecode, INET_DIAG_BC_NOP, 0, ranges[i].first);
+      AppendOp(bytecode, INET_DIAG_BC_S_LE, 2 * OpSize, 2 * OpSize + OpSize);
+      AppendOp(bytecode, INET_DIAG_BC_NOP, 0, ranges[i].last);
+    }
+    return bytecode;
+  }
+
+  // sorted, with overlapping and adjacent ranges merged, so the filter is as short as it can be
+  std::vector<ConnectionWatcher::PortRange> MergeRanges(std::vector<ConnectionWatcher::PortRange> ranges) {
+    std::sort(ranges.begin(), ranges.end(), [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    });
+    std::vector<ConnectionWatcher::PortRange> merged;
+    for (const auto& range : ranges) {
+      if (!merged.empty() && range.first <= merged.back().last + 1) {
+        merged.back().last = std::max(merged.back().last, range.last);
+      } else {
+        merged.push_back(range);
+      }
+    }
+    return merged;
+  }
+
+  std::optional<std::uint16_t> ParsePort(std::string_view text) {
+    unsigned value = 0;
+    const auto end = text.data() + text.size();
+    const auto [ptr, ec] = std::from_chars(text.data(), end, value);
+    if (ec != std::errc() || ptr != end || value == 0 || value > 65535) {
+      return std::nullopt;
+    }
+    return static_cast<std::uint16_t>(value);
+  }
+}
+
+std::optional<ConnectionWatcher::PortRange> ConnectionWatcher::ParsePortRange(std::string_view text) {
+  const auto dash = text.find('-');
+  const auto first = ParsePort(text.substr(0, dash));
+  const auto last = dash == std::string_view::npos ? first : ParsePort(text.substr(dash + 1));
+  if (!first || !last || last.value() < first.value()) {
+    return std::nullopt;
+  }
+  return PortRange{first.value(), last.value()};
+}
+
+ConnectionWatcher::ConnectionWatcher(std::vector<PortRange> ports, std::chrono::milliseconds interval) {
+  const auto filter = BuildPortFilter(MergeRanges(std::move(ports)));
+  const auto attributeLength = NLA_HDRLEN + filter.size();
+  mRequest.resize(NLMSG_SPACE(sizeof(inet_diag_req_v2)) + (filter.empty() ? 0 : NLA_ALIGN(attributeLength)));
+  const auto header = reinterpret_cast<nlmsghdr*>(mRequest.data());
+  header->nlmsg_len = static_cast<std::uint32_t>(mRequest.size());
+  header->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  header->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  const auto request = static_cast<inet_diag_req_v2*>(NLMSG_DATA(header));
+  request->sdiag_protocol = IPPROTO_TCP;
+  request->idiag_states = 1u << TCP_ESTABLISHED;
+  if (!filter.empty()) {
+    const auto attribute = reinterpret_cast<nlattr*>(mRequest.data() + NLMSG_SPACE(sizeof(inet_diag_req_v2)));
+    attribute->nla_len = static_cast<std::uint16_t>(attributeLength);
+    attribute->nla_type = INET_DIAG_REQ_BYTECODE;
+    std::memcpy(reinterpret_cast<char*>(attribute) + NLA_HDRLEN, filter.data(), filter.size());
+  }
+
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "timerfd_create failed");
+  }
+  mSocketFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+  if (mSocketFd < 0) {
+    const int error = errno;
+    close(mTimerFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "sock_diag socket failed");
+  }
+  timeval timeout{};
+  timeout.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(ReceiveTimeout).count());
+  setsockopt(mSocketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // the first query tells which families the kernel supports, and sets the initial state
+  const auto ipv4 = Query(AF_INET);
+  if (ipv4 < 0) {
+    close(mSocketFd);
+    close(mTimerFd);
+    throw std::system_error(std::error_code(static_cast<int>(-ipv4), std::system_category()), "TCP sock_diag query failed");
+  }
+  mFamilies.push_back(AF_INET);
+  const auto ipv6 = Query(AF_INET6);
+  if (ipv6 >= 0) {
+    mFamilies.push_back(AF_INET6);
+  }
+  mConnectionCount = static_cast<std::size_t>(ipv4 + std::max<std::int64_t>(ipv6, 0));
+  mActive = mConnectionCount > 0;
+
+  const auto period = std::max(interval, 1ms);
+  itimerspec spec{};
+  spec.it_interval.tv_sec = static_cast<time_t>(period.count() / 1000);
+  spec.it_interval.tv_nsec = static_cast<long>(period.count() % 1000 * 1000000);
+  spec.it_value = spec.it_interval;
+  timerfd_settime(mTimerFd, 0, &spec, nullptr);
+}
+
+ConnectionWatcher::~ConnectionWatcher() {
+  close(mSocketFd);
+  close(mTimerFd);
+}
+
+std::int64_t ConnectionWatcher::Query(std::uint8_t family) {
+  const auto header = reinterpret_cast<nlmsghdr*>(mRequest.data());
+  header->nlmsg_seq = ++mSequence;
+  static_cast<inet_diag_req_v2*>(NLMSG_DATA(header))->sdiag_family = family;
+
+  sockaddr_nl kernel{};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(mSocketFd, mRequest.data(), mRequest.size(), 0, reinterpret_cast<const sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    return -errno;
+  }
+
+  std::int64_t count = 0;
+  while (true) {
+    const auto length = recv(mSocketFd, mBuffer, sizeof(mBuffer), 0);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+
+    int remaining = static_cast<int>(length);
+    for (auto message = reinterpret_cast<const nlmsghdr*>(mBuffer); NLMSG_OK(message, remaining); message = NLMSG_NEXT(message, remaining)) {
+      // the rest of a dump whose query failed halfway
+      if (message->nlmsg_seq != mSequence) {
+        continue;
+      }
+      if (message->nlmsg_type == SOCK_DIAG_BY_FAMILY) {
+        count++;
+        continue;
+      }
+      if (message->nlmsg_type == NLMSG_DONE || message->nlmsg_type == NLMSG_ERROR) {
+        // the end of the dump carries an error code too
+        int error = 0;
+        if (message->nlmsg_len >= NLMSG_LENGTH(sizeof(int))) {
+          std::memcpy(&error, NLMSG_DATA(message), sizeof(error));
+        }
+        return error < 0 ? error : count;
+      }
+    }
+  }
+}
+
+int ConnectionWatcher::GetFd() const {
+  return mTimerFd;
+}
+
+bool ConnectionWatcher::ReadEvents() {
+  std::uint64_t expirations;
+  if (read(mTimerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    return false;
+  }
+  return Update();
+}
+
+bool ConnectionWatcher::Update() {
+  std::size_t count = 0;
+  for (const auto family : mFamilies) {
+    const auto result = Query(family);
+    if (result < 0) {
+      return false;
+    }
+    count += static_cast<std::size_t>(result);
+  }
+
+  const bool wasActive = mActive;
+  mConnectionCount = count;
+  mActive = count > 0;
+  return mActive != wasActive;
+}
+
+bool ConnectionWatcher::IsActive() const {
+  return mActive;
+}
+
+std::size_t ConnectionWatcher::GetConnectionCount() const {
+  return mConnectionCount;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// keeps track of whether any established TCP connection, IPv4 or IPv6, has its local port in one of the ranges,
+// e.g. ssh sessions on port 22
+//
+// the kernel is asked every interval over NETLINK_SOCK_DIAG, with the state and a bytecode filter on the local port
+// attached to the request, so only matching sockets are sent back and nothing is parsed as text; a query still walks
+// every TCP socket of the network namespace in the kernel, but without formatting them as /proc/net/tcp does
+//
+// the request is built once and replies are received into a fixed buffer, so a query does not allocate
+class ConnectionWatcher {
+public:
+  // [first, last]
+  struct PortRange {
+    std::uint16_t first;
+    std::uint16_t last;
+  };
+
+private:
+  static constexpr std::size_t BufferSize = 32 * 1024;
+
+  // nlmsghdr, inet_diag_req_v2 and the filter as an INET_DIAG_REQ_BYTECODE attribute
+  std::vector<char> mRequest;
+  std::vector<std::uint8_t> mFamilies;
+  int mTimerFd = -1;
+  int mSocketFd = -1;
+  std::uint32_t mSequence = 0;
+  std::size_t mConnectionCount = 0;
+  bool mActive = false;
+  alignas(8) char mBuffer[BufferSize];
+
+  // number of matching connections of one address family; -errno if the kernel refused the query
+  std::int64_t Query(std::uint8_t family);
+
+public:
+  // "22" or "8000-8099"; nullopt if it does not parse or the range is empty
+  static std::optional<PortRange> ParsePortRange(std::string_view text);
+
+  // throws std::system_error if the timer or the netlink socket cannot be created, or if the kernel has no TCP
+  // sock_diag support; IPv6 is left out if the kernel has none
+  // every established connection counts if ports is empty
+  ConnectionWatcher(std::vector<PortRange> ports, std::chrono::milliseconds interval);
+  ~ConnectionWatcher();
+
+  ConnectionWatcher(const ConnectionWatcher&) = delete;
+  ConnectionWatcher& operator=(const ConnectionWatcher&) = delete;
+
+  // readable when a query is due
+  int GetFd() const;
+  // queries if one is due; returns true if IsActive() changed
+  bool ReadEvents();
+
+  // queries as of now regardless of the timer; returns true if IsActive() changed
+  // a failed query keeps the previous state
+  bool Update();
+
+  bool IsActive() const;
+  // as of the last successful query
+  std::size_t GetConnectionCount() const;
+};
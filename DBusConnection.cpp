@@ -0,0 +1,527 @@
+#include "DBusConnection.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  constexpr std::uint8_t MessageTypeMethodCall = 1;
+  constexpr std::uint8_t MessageTypeMethodReturn = 2;
+  constexpr std::uint8_t MessageTypeError = 3;
+
+  constexpr std::uint8_t HeaderFieldPath = 1;
+  constexpr std::uint8_t HeaderFieldInterface = 2;
+  constexpr std::uint8_t HeaderFieldMember = 3;
+  constexpr std::uint8_t HeaderFieldReplySerial = 5;
+  constexpr std::uint8_t HeaderFieldDestination = 6;
+  constexpr std::uint8_t HeaderFieldSignature = 8;
+  constexpr std::uint8_t HeaderFieldUnixFds = 9;
+
+  constexpr std::size_t MaxFdsPerMessage = 16;
+
+  const char NativeEndian = [] {
+    const std::uint16_t value = 1;
+    return *reinterpret_cast<const std::uint8_t*>(&value) == 1 ? 'l' : 'B';
+  }();
+
+  [[noreturn]] void ThrowLastError(const char* what) {
+    throw std::system_error(std::error_code(errno, std::system_category()), what);
+  }
+
+  class Writer {
+    std::vector<std::uint8_t>& mBuffer;
+
+  public:
+    Writer(std::vector<std::uint8_t>& buffer) :
+      mBuffer(buffer)
+    {}
+
+    void Align(std::size_t alignment) {
+      while (mBuffer.size() % alignment != 0) {
+        mBuffer.push_back(0);
+      }
+    }
+
+    void U8(std::uint8_t value) {
+      mBuffer.push_back(value);
+    }
+
+    void U32(std::uint32_t value) {
+      Align(4);
+      const auto ptr = reinterpret_cast<const std::uint8_t*>(&value);
+      mBuffer.insert(mBuffer.end(), ptr, ptr + sizeof(value));
+    }
+
+    void String(std::string_view value) {
+      U32(static_cast<std::uint32_t>(value.size()));
+      mBuffer.insert(mBuffer.end(), value.begin(), value.end());
+      mBuffer.push_back(0);
+    }
+
+    void Signature(std::string_view value) {
+      U8(static_cast<std::uint8_t>(value.size()));
+      mBuffer.insert(mBuffer.end(), value.begin(), value.end());
+      mBuffer.push_back(0);
+    }
+
+    void Field(std::uint8_t code, char type, std::string_view value) {
+      Align(8);
+      U8(code);
+      Signature(std::string_view(&type, 1));
+      if (type == 'g') {
+        Signature(value);
+      } else {
+        String(value);
+      }
+    }
+  };
+
+  class Reader {
+    const std::uint8_t* mData;
+    std::size_t mSize;
+    std::size_t mPos;
+
+  public:
+    Reader(const std::uint8_t* data, std::size_t size, std::size_t pos = 0) :
+      mData(data),
+      mSize(size),
+      mPos(pos)
+    {}
+
+    std::size_t Pos() const {
+      return mPos;
+    }
+
+    void Align(std::size_t alignment) {
+      mPos = (mPos + alignment - 1) / alignment * alignment;
+    }
+
+    std::uint8_t U8() {
+      if (mPos + 1 > mSize) {
+        throw std::runtime_error("D-Bus message truncated");
+      }
+      return mData[mPos++];
+    }
+
+    std::uint32_t U32() {
+      Align(4);
+      if (mPos + 4 > mSize) {
+        throw std::runtime_error("D-Bus message truncated");
+      }
+      std::uint32_t value;
+      std::memcpy(&value, mData + mPos, sizeof(value));
+      mPos += 4;
+      return value;
+    }
+
+    std::string_view Bytes(std::size_t length) {
+      // includes the trailing nul
+      if (mPos + length + 1 > mSize) {
+        throw std::runtime_error("D-Bus message truncated");
+      }
+      const std::string_view value(reinterpret_cast<const char*>(mData + mPos), length);
+      mPos += length + 1;
+      return value;
+    }
+
+    std::string_view String() {
+      return Bytes(U32());
+    }
+
+    std::string_view Signature() {
+      return Bytes(U8());
+    }
+  };
+
+  std::string DecodeAddressValue(std::string_view value) {
+    std::string decoded;
+    for (std::size_t i = 0; i < value.size(); i++) {
+      if (value[i] == '%' && i + 2 < value.size()) {
+        decoded.push_back(static_cast<char>(std::strtol(std::string(value.substr(i + 1, 2)).c_str(), nullptr, 16)));
+        i += 2;
+        continue;
+      }
+      decoded.push_back(value[i]);
+    }
+    return decoded;
+  }
+
+  // returns sockaddr_un for the first "unix:" entry of a D-Bus address
+  std::pair<sockaddr_un, socklen_t> ParseAddress(std::string_view address) {
+    while (!address.empty()) {
+      const auto semicolon = address.find(';');
+      const auto entry = address.substr(0, semicolon);
+      address = semicolon == std::string_view::npos ? ""sv : address.substr(semicolon + 1);
+
+      if (entry.substr(0, 5) != "unix:"sv) {
+        continue;
+      }
+
+      auto params = entry.substr(5);
+      while (!params.empty()) {
+        const auto comma = params.find(',');
+        const auto param = params.substr(0, comma);
+        params = comma == std::string_view::npos ? ""sv : params.substr(comma + 1);
+
+        const auto eqPos = param.find('=');
+        if (eqPos == std::string_view::npos) {
+          continue;
+        }
+
+        const auto key = param.substr(0, eqPos);
+        const bool abstract = key == "abstract"sv;
+        if (!abstract && key != "path"sv) {
+          continue;
+        }
+
+        const auto path = DecodeAddressValue(param.substr(eqPos + 1));
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        const std::size_t offset = abstract ? 1 : 0;
+        if (path.size() + offset >= sizeof(addr.sun_path)) {
+          throw std::runtime_error("D-Bus address too long");
+        }
+        std::memcpy(addr.sun_path + offset, path.data(), path.size());
+        const auto length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + offset + path.size() + (abstract ? 0 : 1));
+        return {addr, length};
+      }
+    }
+    throw std::runtime_error("no usable unix address in D-Bus address");
+  }
+}
+
+DBusConnection::DBusConnection(const std::string& address) {
+  const auto [addr, addrLength] = ParseAddress(address);
+
+  mSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (mSocket < 0) {
+    ThrowLastError("socket failed");
+  }
+
+  // a unix socket connects at once or not at all; EAGAIN means the bus is not accepting, which counts as a failure
+  if (connect(mSocket, reinterpret_cast<const sockaddr*>(&addr), addrLength) != 0) {
+    const int error = errno;
+    close(mSocket);
+    throw std::system_error(std::error_code(error, std::system_category()), "connect to D-Bus failed");
+  }
+
+  // the credentials byte, then the SASL conversation, which ProcessLines carries on
+  const std::string uid = std::to_string(getuid());
+  std::string auth = "\0AUTH EXTERNAL "s;
+  for (const char c : uid) {
+    constexpr char Digits[] = "0123456789abcdef";
+    auth.push_back(Digits[(c >> 4) & 0xF]);
+    auth.push_back(Digits[c & 0xF]);
+  }
+  auth += "\r\n"sv;
+
+  try {
+    Write(auth.data(), auth.size());
+    CallMethod("org.freedesktop.DBus"sv, "/org/freedesktop/DBus"sv, "org.freedesktop.DBus"sv, "Hello"sv, {}, [](std::optional<Reply> reply) {
+      if (reply) {
+        for (const auto fd : reply.value().fds) {
+          close(fd);
+        }
+      }
+    });
+  } catch (...) {
+    close(mSocket);
+    throw;
+  }
+}
+
+DBusConnection::~DBusConnection() {
+  close(mSocket);
+  for (const auto fd : mPendingFds) {
+    close(fd);
+  }
+}
+
+int DBusConnection::GetFd() const {
+  return mSocket;
+}
+
+std::uint32_t DBusConnection::GetEvents() const {
+  return mWriteBuffer.empty() ? static_cast<std::uint32_t>(EPOLLIN) : static_cast<std::uint32_t>(EPOLLIN | EPOLLOUT);
+}
+
+std::size_t DBusConnection::GetPendingCallCount() const {
+  return mCalls.size();
+}
+
+void DBusConnection::Write(const void* data, std::size_t size) {
+  const auto ptr = static_cast<const std::uint8_t*>(data);
+  mWriteBuffer.insert(mWriteBuffer.end(), ptr, ptr + size);
+  Send();
+}
+
+void DBusConnection::Send() {
+  std::size_t sent = 0;
+  while (sent < mWriteBuffer.size()) {
+    const auto written = send(mSocket, mWriteBuffer.data() + sent, mWriteBuffer.size() - sent, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      ThrowLastError("send to D-Bus failed");
+    }
+    sent += static_cast<std::size_t>(written);
+  }
+  mWriteBuffer.erase(mWriteBuffer.begin(), mWriteBuffer.begin() + static_cast<std::ptrdiff_t>(sent));
+}
+
+void DBusConnection::Receive() {
+  while (true) {
+    std::uint8_t buffer[4096];
+    iovec iov{buffer, sizeof(buffer)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MaxFdsPerMessage)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const auto received = recvmsg(mSocket, &msg, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      ThrowLastError("recvmsg from D-Bus failed");
+    }
+    if (received == 0) {
+      throw std::runtime_error("D-Bus connection closed");
+    }
+
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (std::size_t i = 0; i < count; i++) {
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        mPendingFds.push_back(fd);
+      }
+    }
+
+    mReadBuffer.insert(mReadBuffer.end(), buffer, buffer + received);
+  }
+}
+
+void DBusConnection::Dispatch() {
+  Send();
+  Receive();
+  ProcessLines();
+  if (mState == State::Open) {
+    ProcessMessages();
+  }
+}
+
+void DBusConnection::ProcessLines() {
+  while (mState != State::Open) {
+    const auto crlf = std::string_view(reinterpret_cast<const char*>(mReadBuffer.data()), mReadBuffer.size()).find("\r\n"sv);
+    if (crlf == std::string_view::npos) {
+      return;
+    }
+    const std::string line(mReadBuffer.begin(), mReadBuffer.begin() + static_cast<std::ptrdiff_t>(crlf));
+    mReadBuffer.erase(mReadBuffer.begin(), mReadBuffer.begin() + static_cast<std::ptrdiff_t>(crlf + 2));
+
+    if (mState == State::Authenticating) {
+      if (line.substr(0, 3) != "OK "sv) {
+        throw std::runtime_error("D-Bus authentication rejected");
+      }
+      constexpr auto Negotiate = "NEGOTIATE_UNIX_FD\r\n"sv;
+      Write(Negotiate.data(), Negotiate.size());
+      mState = State::Negotiating;
+      continue;
+    }
+
+    if (line != "AGREE_UNIX_FD"sv) {
+      throw std::runtime_error("D-Bus server does not support unix fd passing");
+    }
+    // BEGIN, then Hello and the calls made in the meantime
+    constexpr auto Begin = "BEGIN\r\n"sv;
+    mWriteBuffer.insert(mWriteBuffer.end(), Begin.begin(), Begin.end());
+    mWriteBuffer.insert(mWriteBuffer.end(), mQueued.begin(), mQueued.end());
+    mQueued.clear();
+    mQueued.shrink_to_fit();
+    mState = State::Open;
+    Send();
+  }
+}
+
+void DBusConnection::ProcessMessages() {
+  while (true) {
+    // fixed header: endian, type, flags, version, body length, serial, header field array length
+    if (mReadBuffer.size() < 16) {
+      return;
+    }
+    if (mReadBuffer[0] != static_cast<std::uint8_t>(NativeEndian)) {
+      throw std::runtime_error("D-Bus message in foreign byte order");
+    }
+
+    Reader fixedReader(mReadBuffer.data(), mReadBuffer.size(), 4);
+    const auto bodyLength = fixedReader.U32();
+    fixedReader.U32();
+    const auto fieldsLength = fixedReader.U32();
+    const std::size_t headerLength = (16 + static_cast<std::size_t>(fieldsLength) + 7) / 8 * 8;
+    const std::size_t messageLength = headerLength + bodyLength;
+    if (mReadBuffer.size() < messageLength) {
+      return;
+    }
+
+    const std::uint8_t type = mReadBuffer[1];
+    std::uint32_t replySerial = 0;
+    std::uint32_t numFds = 0;
+    std::string signature;
+
+    Reader reader(mReadBuffer.data(), 16 + fieldsLength, 16);
+    while (reader.Pos() < 16 + fieldsLength) {
+      reader.Align(8);
+      const auto code = reader.U8();
+      const auto fieldSignature = reader.Signature();
+      if (fieldSignature.size() != 1) {
+        throw std::runtime_error("unexpected D-Bus header field type");
+      }
+      switch (fieldSignature[0]) {
+        case 's':
+        case 'o':
+          reader.String();
+          break;
+
+        case 'g':
+        {
+          const auto value = reader.Signature();
+          if (code == HeaderFieldSignature) {
+            signature = value;
+          }
+          break;
+        }
+
+        case 'u':
+        {
+          const auto value = reader.U32();
+          if (code == HeaderFieldReplySerial) {
+            replySerial = value;
+          } else if (code == HeaderFieldUnixFds) {
+            numFds = value;
+          }
+          break;
+        }
+
+        default:
+          throw std::runtime_error("unexpected D-Bus header field type");
+      }
+    }
+
+    if (numFds > mPendingFds.size()) {
+      // fds may arrive slightly after the first byte of the message
+      return;
+    }
+
+    std::vector<int> fds(mPendingFds.begin(), mPendingFds.begin() + numFds);
+    mPendingFds.erase(mPendingFds.begin(), mPendingFds.begin() + numFds);
+    std::vector<std::uint8_t> body(mReadBuffer.begin() + static_cast<std::ptrdiff_t>(headerLength), mReadBuffer.begin() + static_cast<std::ptrdiff_t>(messageLength));
+    mReadBuffer.erase(mReadBuffer.begin(), mReadBuffer.begin() + static_cast<std::ptrdiff_t>(messageLength));
+
+    const auto call = std::find_if(mCalls.begin(), mCalls.end(), [&](const auto& pending) {
+      return pending.first == replySerial;
+    });
+    if ((type != MessageTypeMethodReturn && type != MessageTypeError) || call == mCalls.end()) {
+      // signals such as NameAcquired
+      for (const auto fd : fds) {
+        close(fd);
+      }
+      continue;
+    }
+
+    // taken out first, so the handler may make further calls
+    const auto handler = std::move(call->second);
+    mCalls.erase(call);
+    if (type == MessageTypeError) {
+      for (const auto fd : fds) {
+        close(fd);
+      }
+      handler(std::nullopt);
+      continue;
+    }
+    handler(Reply{
+      std::move(signature),
+      std::move(body),
+      std::move(fds),
+    });
+  }
+}
+
+void DBusConnection::CallMethod(std::string_view destination, std::string_view path, std::string_view interfaceName, std::string_view member, const std::vector<std::string_view>& args, ReplyHandler handler) {
+  std::vector<std::uint8_t> body;
+  Writer bodyWriter(body);
+  for (const auto arg : args) {
+    bodyWriter.String(arg);
+  }
+
+  const auto serial = ++mSerial;
+
+  std::vector<std::uint8_t> message;
+  Writer writer(message);
+  writer.U8(static_cast<std::uint8_t>(NativeEndian));
+  writer.U8(MessageTypeMethodCall);
+  writer.U8(0);
+  writer.U8(1);
+  writer.U32(static_cast<std::uint32_t>(body.size()));
+  writer.U32(serial);
+
+  const auto fieldsLengthPos = message.size();
+  writer.U32(0);
+  writer.Align(8);
+  const auto fieldsBegin = message.size();
+  writer.Field(HeaderFieldPath, 'o', path);
+  writer.Field(HeaderFieldDestination, 's', destination);
+  writer.Field(HeaderFieldInterface, 's', interfaceName);
+  writer.Field(HeaderFieldMember, 's', member);
+  if (!args.empty()) {
+    writer.Field(HeaderFieldSignature, 'g', std::string(args.size(), 's'));
+  }
+  const auto fieldsLength = static_cast<std::uint32_t>(message.size() - fieldsBegin);
+  std::memcpy(message.data() + fieldsLengthPos, &fieldsLength, sizeof(fieldsLength));
+  writer.Align(8);
+
+  message.insert(message.end(), body.begin(), body.end());
+
+  mCalls.emplace_back(serial, std::move(handler));
+  if (mState != State::Open) {
+    mQueued.insert(mQueued.end(), message.begin(), message.end());
+    return;
+  }
+  Write(message.data(), message.size());
+}
+
+std::string GetSystemBusAddress() {
+  if (const auto address = std::getenv("DBUS_SYSTEM_BUS_ADDRESS"); address != nullptr && address[0] != '\0') {
+    return address;
+  }
+  return "unix:path=/run/dbus/system_bus_socket"s;
+}
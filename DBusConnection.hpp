@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// minimal non-blocking D-Bus client speaking the wire protocol directly over a unix socket
+// only what the logind backend needs: EXTERNAL auth, unix fd passing and method calls with string arguments
+// nothing waits: the handshake and every call are queued and go out as the socket allows, and replies reach their
+// handlers from Dispatch, so the owner watches GetFd() for GetEvents() and calls Dispatch whenever it is ready
+class DBusConnection {
+public:
+  struct Reply {
+    std::string signature;
+    std::vector<std::uint8_t> body;
+    std::vector<int> fds;
+  };
+
+  // called from Dispatch with the reply, or with nullopt if the call returned an error; fds of the reply are owned by
+  // the handler
+  using ReplyHandler = std::function<void(std::optional<Reply> reply)>;
+
+private:
+  enum class State {
+    // waiting for OK to AUTH EXTERNAL
+    Authenticating,
+    // waiting for AGREE_UNIX_FD
+    Negotiating,
+    Open,
+  };
+
+  int mSocket = -1;
+  State mState = State::Authenticating;
+  std::uint32_t mSerial = 0;
+  std::vector<std::uint8_t> mReadBuffer;
+  std::vector<std::uint8_t> mWriteBuffer;
+  // messages made before BEGIN, starting with Hello, which may only follow it
+  std::vector<std::uint8_t> mQueued;
+  std::vector<int> mPendingFds;
+  // serials of calls without a reply yet
+  std::vector<std::pair<std::uint32_t, ReplyHandler>> mCalls;
+
+  void Write(const void* data, std::size_t size);
+  void Send();
+  void Receive();
+  void ProcessLines();
+  void ProcessMessages();
+
+public:
+  // address is a D-Bus server address such as "unix:path=/run/dbus/system_bus_socket"
+  // connects and queues the handshake; throws std::system_error or std::runtime_error on failure
+  explicit DBusConnection(const std::string& address);
+  ~DBusConnection();
+
+  DBusConnection(const DBusConnection&) = delete;
+  DBusConnection& operator=(const DBusConnection&) = delete;
+
+  int GetFd() const;
+  // EPOLLIN, with EPOLLOUT while something is waiting for the socket
+  std::uint32_t GetEvents() const;
+  // reads and writes whatever the socket allows and runs the handlers of the replies which arrived
+  // throws std::system_error or std::runtime_error once the connection is lost; the handlers of the calls still
+  // pending are dropped without being called
+  void Dispatch();
+
+  // every argument is marshalled as a string (signature "s" repeated); the call is sent before this returns if the
+  // socket allows it, and throws like Dispatch
+  void CallMethod(std::string_view destination, std::string_view path, std::string_view interfaceName, std::string_view member, const std::vector<std::string_view>& args, ReplyHandler handler);
+  // calls without a reply yet
+  std::size_t GetPendingCallCount() const;
+};
+
+// address of the system bus, honoring DBUS_SYSTEM_BUS_ADDRESS
+std::string GetSystemBusAddress();
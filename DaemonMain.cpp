@@ -0,0 +1,1430 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <bitset>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "AtomicFile.hpp"
+#include "CommandLineOptions.hpp"
+#include "ConfigFile.hpp"
+#include "ConfigSchema.hpp"
+#include "ConfigWatcher.hpp"
+#include "ConnectionWatcher.hpp"
+#include "ExecMode.hpp"
+#include "FleetSocket.hpp"
+#include "HookPool.hpp"
+#include "IPCCommands.hpp"
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+#include "Journal.hpp"
+#include "JournalReader.hpp"
+#include "LeaseTable.hpp"
+#include "LoadMonitor.hpp"
+#include "Metrics.hpp"
+#include "Preventer.hpp"
+#include "PowerSupplyWatcher.hpp"
+#include "PreventerConfig.hpp"
+#include "ProcessWatcher.hpp"
+#include "Reactor.hpp"
+#include "Schedule.hpp"
+#include "ScheduleWatcher.hpp"
+#include "StatusPage.hpp"
+#include "TimerQueue.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto ConfigFilename = "SleepPreventer.cfg";
+  constexpr auto JournalFilename = "SleepPreventer.journal";
+  // where a system-wide daemon keeps its config and journal
+  constexpr auto SystemConfigDirectory = "/etc";
+  constexpr auto SystemStateDirectory = "/var/lib/sleeppreventer";
+
+  constexpr char ExecHelpMessage[] =
+    "SleepPreventer [/S] [/D] exec [--] <command> [args...]\n"
+    "\n"
+    "  Runs the command and prevents sleep (/S, the default) and/or display-off (/D)\n"
+    "  until it exits. The exit code of the command is returned.\n"
+    "\n";
+
+  constexpr char StatsHelpMessage[] =
+    "SleepPreventer stats\n"
+    "\n"
+    "  Prints the metrics of the running instance in the Prometheus text format.\n"
+    "\n";
+
+  constexpr char WatchHelpMessage[] =
+    "SleepPreventer watch\n"
+    "\n"
+    "  Prints the state of the running instance, then a line on every change until\n"
+    "  interrupted. States read as in the journal; a line printed after falling behind\n"
+    "  tells how many changes it folds in.\n"
+    "\n";
+
+  constexpr char UsersHelpMessage[] =
+    "SleepPreventer users\n"
+    "\n"
+    "  Prints how many leases and holds each user has at the running instance, and\n"
+    "  what they prevent. Users other than its owner and root see only their own.\n"
+    "\n";
+
+  constexpr char SystemHelpMessage[] =
+    "SleepPreventer system [options]\n"
+    "\n"
+    "  Runs one daemon for every user of the machine, with its config in /etc and its\n"
+    "  journal in /var/lib/sleeppreventer. Commands of other users go to it while it\n"
+    "  runs as root. Their leases and holds are kept apart by uid and limited by\n"
+    "  user_max_leases and user_max_duration, and they cannot change the manual state.\n"
+    "\n";
+
+  constexpr char FleetHelpMessage[] =
+    "SleepPreventer fleet <hosts-file> [options]\n"
+    "\n"
+    "  Sends the options to the daemon of every host in the file at once, over the\n"
+    "  TCP listener set by fleet_listen, and prints each result with its latency.\n"
+    "  The file lists one host[:port] per line; '#' starts a comment. Without options\n"
+    "  the state is queried. The key is read from fleet_key_file of the local config.\n"
+    "  Returns 1 if any host failed.\n"
+    "\n";
+
+  constexpr char HoldHelpMessage[] =
+    "SleepPreventer [/S] [/D] /T:<duration> | /U:<HH:MM> | /-T\n"
+    "\n"
+    "  /T    Prevent sleep (/S, the default) and/or display-off (/D) for a duration,\n"
+    "        e.g. /T:90m or /T:1h30m\n"
+    "  /U    Same, until the next time the clock shows HH:MM\n"
+    "  /-T   Cancel every pending /T and /U\n"
+    "\n";
+
+  constexpr char LeaseHelpMessage[] =
+    "SleepPreventer [/S] [/D] /L:<name> [/T:<duration> | /U:<HH:MM>] | /-L:<name>\n"
+    "\n"
+    "  /L    Take a reference on the named lease, which prevents sleep (/S, the default)\n"
+    "        and/or display-off (/D) until every reference is dropped or /T or /U passes\n"
+    "  /-L   Drop a reference on the named lease\n"
+    "\n";
+
+  std::optional<ConfigFile> gConfigFile;
+  std::optional<ConfigWatcher> gConfigWatcher;
+  std::optional<IPCServer> gIPCServer;
+  std::optional<FleetServer> gFleetServer;
+  std::optional<HookPool> gHookPool;
+  std::optional<ProcessWatcher> gProcessWatcher;
+  std::optional<LoadMonitor> gLoadMonitor;
+  std::optional<ScheduleWatcher> gScheduleWatcher;
+  std::optional<ConnectionWatcher> gConnectionWatcher;
+  std::optional<PowerSupplyWatcher> gPowerSupplyWatcher;
+  std::optional<Reactor> gReactor;
+  std::optional<TimerQueue> gTimerQueue;
+  std::unique_ptr<Journal::Writer> gJournal;
+  std::unique_ptr<StatusPage::Writer> gStatusPage;
+  // the one timer for the earliest lease expiry; 0 while none is scheduled
+  TimerQueue::TimerId gLeaseTimer = 0;
+  std::optional<LeaseTable::Clock::time_point> gLeaseTimerDeadline;
+  bool gLeaseExpiryUpdateDeferred = false;
+  // state changes are published to watchers, and run hooks, once per reactor batch
+  std::uint8_t gPublishedState = 0;
+  std::uint8_t gLatestState = 0;
+  bool gPublishDeferred = false;
+  // periodic rewrite of metrics_file; 0 while it is off
+  TimerQueue::TimerId gMetricsTimer = 0;
+  constexpr auto MinMetricsInterval = 1s;
+  // whether the last hook queued was hook_on; nothing is held before the daemon starts
+  bool gHookActive = false;
+
+  // /T and /U holds are leases named HoldLeasePrefix followed by the hold id
+  constexpr auto HoldLeasePrefix = "hold:"sv;
+  // far enough out to mean forever, near enough not to overflow the clock; as IPC's MaxLeaseTTL
+  constexpr auto MaxHoldDuration = std::chrono::hours(24 * 366 * 100);
+  // leases of IPC clients, see IPC::GetClientLeaseName
+  constexpr auto ClientLeasePrefix = "client:"sv;
+  std::uint64_t gNextHoldId = 1;
+
+  // rules which prevent sleep on their own, each through a lease of its own
+  enum class Rule {
+    ProcessWatch,
+    Load,
+    Schedule,
+    Connection,
+  };
+  constexpr std::size_t RuleCount = 4;
+  constexpr std::string_view RuleLeaseNames[RuleCount] = {
+    "rule:process_watch"sv,
+    "rule:load"sv,
+    "rule:schedule"sv,
+    "rule:connection"sv,
+  };
+
+  std::bitset<RuleCount> gActiveRules;
+
+  // serving every user, see SystemHelpMessage
+  bool gSystemMode = false;
+
+  // how long a fleet controller waits for each host
+  constexpr auto FleetTimeout = 5s;
+  // descriptors a fleet controller keeps for everything but its connections
+  constexpr std::size_t FleetReservedFds = 16;
+
+  // options are plain ASCII, so widening byte by byte is enough
+  std::vector<std::wstring> WidenArgs(int argc, char* argv[]) {
+    std::vector<std::wstring> args(argc);
+    for (int i = 0; i < argc; i++) {
+      const std::string_view arg(argv[i]);
+      args[i].assign(arg.begin(), arg.end());
+    }
+    return args;
+  }
+
+  // $SLEEPPREVENTER_CONFIG, otherwise $XDG_CONFIG_HOME/SleepPreventer.cfg or ~/.config/SleepPreventer.cfg
+  // /etc/SleepPreventer.cfg in system mode
+  std::filesystem::path GetConfigFilepath() {
+    if (const auto path = std::getenv("SLEEPPREVENTER_CONFIG"); path != nullptr && path[0] != '\0') {
+      return path;
+    }
+    if (gSystemMode) {
+      return std::filesystem::path(SystemConfigDirectory) / ConfigFilename;
+    }
+    if (const auto dir = std::getenv("XDG_CONFIG_HOME"); dir != nullptr && dir[0] != '\0') {
+      return std::filesystem::path(dir) / ConfigFilename;
+    }
+    if (const auto home = std::getenv("HOME"); home != nullptr && home[0] != '\0') {
+      return std::filesystem::path(home) / ".config" / ConfigFilename;
+    }
+    return ConfigFilename;
+  }
+
+  // $SLEEPPREVENTER_JOURNAL, otherwise $XDG_STATE_HOME/SleepPreventer.journal or ~/.local/state/SleepPreventer.journal
+  // /var/lib/sleeppreventer/SleepPreventer.journal in system mode
+  std::filesystem::path GetJournalFilepath() {
+    if (const auto path = std::getenv("SLEEPPREVENTER_JOURNAL"); path != nullptr && path[0] != '\0') {
+      return path;
+    }
+    if (gSystemMode) {
+      return std::filesystem::path(SystemStateDirectory) / JournalFilename;
+    }
+    if (const auto dir = std::getenv("XDG_STATE_HOME"); dir != nullptr && dir[0] != '\0') {
+      return std::filesystem::path(dir) / JournalFilename;
+    }
+    if (const auto home = std::getenv("HOME"); home != nullptr && home[0] != '\0') {
+      return std::filesystem::path(home) / ".local" / "state" / JournalFilename;
+    }
+    return JournalFilename;
+  }
+
+  // $SLEEPPREVENTER_SYSFS, otherwise /sys; a fake tree for testing the power policy
+  std::filesystem::path GetSysfsRoot() {
+    if (const auto path = std::getenv("SLEEPPREVENTER_SYSFS"); path != nullptr && path[0] != '\0') {
+      return path;
+    }
+    return "/sys";
+  }
+
+  void ReportConfigDiagnostics(const ConfigFile& configFile) {
+    for (const auto& diagnostic : configFile.GetDiagnostics()) {
+      std::fprintf(stderr, "Config warning: %s\n", Config::FormatDiagnostic(diagnostic).c_str());
+    }
+  }
+
+  // sd_notify compatible readiness notification; does nothing unless NOTIFY_SOCKET is set
+  void NotifyReady() {
+    const auto notifySocket = std::getenv("NOTIFY_SOCKET");
+    if (notifySocket == nullptr || (notifySocket[0] != '/' && notifySocket[0] != '@')) {
+      return;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const auto length = std::strlen(notifySocket);
+    if (length >= sizeof(addr.sun_path)) {
+      return;
+    }
+    std::memcpy(addr.sun_path, notifySocket, length);
+    if (addr.sun_path[0] == '@') {
+      addr.sun_path[0] = '\0';
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return;
+    }
+    constexpr auto Message = "READY=1"sv;
+    sendto(fd, Message.data(), Message.size(), MSG_NOSIGNAL, reinterpret_cast<const sockaddr*>(&addr), static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + length));
+    close(fd);
+  }
+
+  bool IsAnyKeyChanged(const Config::KeySet& changedKeys, std::initializer_list<Config::Key> keys) {
+    for (const auto key : keys) {
+      if (changedKeys.test(static_cast<std::size_t>(key))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // keeps gLeaseTimer at the earliest lease expiry; called after anything that may have acquired or released leases
+  void ScheduleLeaseExpiry() {
+    const auto next = Preventer::GetNextLeaseExpiry();
+    if (next == gLeaseTimerDeadline) {
+      return;
+    }
+
+    if (gLeaseTimer != 0) {
+      gTimerQueue.value().Cancel(gLeaseTimer);
+      gLeaseTimer = 0;
+    }
+    gLeaseTimerDeadline = next;
+    if (next) {
+      gLeaseTimer = gTimerQueue.value().Schedule(next.value(), [](TimerQueue::TimerId) {
+        Journal::OriginScope origin(Journal::Source::Timer);
+        gLeaseTimer = 0;
+        gLeaseTimerDeadline.reset();
+        Preventer::ExpireLeases(LeaseTable::Clock::now());
+        ScheduleLeaseExpiry();
+      });
+    }
+  }
+
+  // runs ScheduleLeaseExpiry once after the current batch of events, however many commands it carried
+  void DeferLeaseExpiryUpdate() {
+    if (gLeaseExpiryUpdateDeferred) {
+      return;
+    }
+    gLeaseExpiryUpdateDeferred = true;
+    gReactor.value().Defer([] {
+      gLeaseExpiryUpdateDeferred = false;
+      ScheduleLeaseExpiry();
+    });
+  }
+
+  // queues hook_on or hook_off when what the backend holds turns on or off
+  void RunTransitionHooks(std::uint8_t state) {
+    const bool active = (state & (IPC::StateBits::ActiveSystem | IPC::StateBits::ActiveDisplay)) != 0;
+    if (active == gHookActive) {
+      return;
+    }
+    gHookActive = active;
+    if (!gHookPool) {
+      return;
+    }
+    const auto& configFile = gConfigFile.value();
+    auto command = configFile.GetString(active ? Config::Key::HookOn : Config::Key::HookOff);
+    if (command.empty()) {
+      return;
+    }
+    const auto event = active ? "on"s : "off"s;
+    gHookPool.value().Submit(event, std::move(command), {"SLEEPPREVENTER_EVENT="s + event, "SLEEPPREVENTER_STATE="s + IPC::FormatStateBits(state)}, configFile.GetDuration(Config::Key::HookTimeout));
+  }
+
+  // backend_coalesce; the flush runs on the timer queue, tagged with the origin of the change which started the window
+  void StartBackendCoalescing(const ConfigFile& configFile) {
+    Preventer::SetCoalescing(configFile.GetDuration(Config::Key::BackendCoalesce), [](std::chrono::milliseconds delay) {
+      const auto origin = Journal::GetOrigin();
+      gTimerQueue.value().Schedule(TimerQueue::Clock::now() + delay, [origin](TimerQueue::TimerId) {
+        Journal::OriginScope scope(origin.source, origin.pid, origin.uid);
+        Preventer::FlushState();
+      });
+    });
+  }
+
+  // the backend replies are read by the reactor, so that ApplyState, which runs on the reactor thread, never waits
+  // for the bus; throws std::system_error
+  void StartBackendDispatch() {
+    const int fd = Preventer::StartBackendAsync();
+    if (fd >= 0) {
+      gReactor.value().Add(fd, EPOLLIN, [](std::uint32_t) {
+        Preventer::DispatchBackend();
+      });
+    }
+  }
+
+  // Preventer::SetStateListener; runs under the backend lock, so publishing is left to the reactor
+  void OnStateChanged(std::uint8_t state) {
+    if (gStatusPage) {
+      gStatusPage->SetState(state);
+    }
+    gLatestState = state;
+    if (gPublishDeferred) {
+      return;
+    }
+    gPublishDeferred = true;
+    gReactor.value().Defer([] {
+      gPublishDeferred = false;
+      // changes that cancelled out within the batch are not worth an event
+      if (gLatestState == gPublishedState) {
+        return;
+      }
+      gPublishedState = gLatestState;
+      const char payload = static_cast<char>(gPublishedState);
+      gIPCServer.value().Publish(IPC::Opcode::Watch, std::string_view(&payload, 1));
+      RunTransitionHooks(gPublishedState);
+    });
+  }
+
+  // rules prevent sleep only; the display follows the manual state
+  void SetRuleActive(Rule rule, bool active) {
+    const auto index = static_cast<std::size_t>(rule);
+    if (gActiveRules.test(index) == active) {
+      return;
+    }
+    gActiveRules.set(index, active);
+    Journal::OriginScope origin(Journal::Source::Rule);
+    if (active) {
+      Preventer::AcquireLease(RuleLeaseNames[index], LeaseModes::System);
+    } else {
+      Preventer::ReleaseLease(RuleLeaseNames[index]);
+    }
+  }
+
+  // (re)creates the process watcher from the config; there is none while process_watch is empty
+  void StartProcessWatcher(const ConfigFile& configFile) {
+    if (gProcessWatcher) {
+      gReactor.value().Remove(gProcessWatcher.value().GetFd());
+      gProcessWatcher.reset();
+    }
+
+    std::vector<std::string> patterns;
+    const auto list = configFile.GetString(Config::Key::ProcessWatch);
+    Config::ForEachListItem(list, [&](std::string_view pattern) {
+      patterns.emplace_back(pattern);
+    });
+    if (!patterns.empty()) {
+      try {
+        gProcessWatcher.emplace(std::move(patterns), configFile.GetDuration(Config::Key::ProcessWatchInterval));
+        gReactor.value().Add(gProcessWatcher.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+          if (gProcessWatcher.value().ReadEvents()) {
+            SetRuleActive(Rule::ProcessWatch, gProcessWatcher.value().IsMatched());
+          }
+        });
+      } catch (const std::system_error& error) {
+        gProcessWatcher.reset();
+        std::fprintf(stderr, "Warning: process watch disabled: %s (code %d)\n", error.what(), error.code().value());
+      }
+    }
+
+    SetRuleActive(Rule::ProcessWatch, gProcessWatcher && gProcessWatcher.value().IsMatched());
+  }
+
+  // (re)creates the load monitor from the config; there is none while every threshold is 0
+  void StartLoadMonitor(const ConfigFile& configFile) {
+    if (gLoadMonitor) {
+      gReactor.value().Remove(gLoadMonitor.value().GetFd());
+      gLoadMonitor.reset();
+    }
+
+    LoadMonitor::Thresholds thresholds;
+    thresholds.cpuPercent = configFile.GetInt(Config::Key::LoadCpu);
+    thresholds.diskBytesPerSecond = configFile.GetInt(Config::Key::LoadDisk) * 1024;
+    thresholds.netBytesPerSecond = configFile.GetInt(Config::Key::LoadNet) * 1024;
+    if (thresholds.cpuPercent > 0 || thresholds.diskBytesPerSecond > 0 || thresholds.netBytesPerSecond > 0) {
+      try {
+        gLoadMonitor.emplace(thresholds, configFile.GetDuration(Config::Key::LoadInterval), configFile.GetDuration(Config::Key::LoadWindow));
+        gReactor.value().Add(gLoadMonitor.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+          if (gLoadMonitor.value().ReadEvents()) {
+            SetRuleActive(Rule::Load, gLoadMonitor.value().IsActive());
+          }
+        });
+      } catch (const std::system_error& error) {
+        gLoadMonitor.reset();
+        std::fprintf(stderr, "Warning: load rule disabled: %s (code %d)\n", error.what(), error.code().value());
+      }
+    }
+
+    SetRuleActive(Rule::Load, false);
+  }
+
+  // (re)creates the schedule watcher from the config; there is none while schedule is empty or never changes
+  void StartScheduleWatcher(const ConfigFile& configFile) {
+    if (gScheduleWatcher) {
+      gReactor.value().Remove(gScheduleWatcher.value().GetFd());
+      gScheduleWatcher.reset();
+    }
+
+    Schedule schedule;
+    Config::ForEachListItem(configFile.GetString(Config::Key::Schedule), [&](std::string_view rule) {
+      if (const auto intervals = Schedule::ParseRule(rule)) {
+        schedule.Add(intervals.value());
+      } else {
+        std::fprintf(stderr, "Config warning: schedule rule \"%.*s\" ignored, expected e.g. \"Mon-Fri 08:00-19:00\"\n", static_cast<int>(rule.size()), rule.data());
+      }
+    });
+    schedule.Compile();
+    if (!schedule.IsEmpty()) {
+      try {
+        gScheduleWatcher.emplace(std::move(schedule));
+        gReactor.value().Add(gScheduleWatcher.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+          if (gScheduleWatcher.value().ReadEvents()) {
+            SetRuleActive(Rule::Schedule, gScheduleWatcher.value().IsActive());
+          }
+        });
+      } catch (const std::system_error& error) {
+        gScheduleWatcher.reset();
+        std::fprintf(stderr, "Warning: schedule rule disabled: %s (code %d)\n", error.what(), error.code().value());
+      }
+    }
+
+    SetRuleActive(Rule::Schedule, gScheduleWatcher && gScheduleWatcher.value().IsActive());
+  }
+
+  // (re)creates the connection watcher from the config; there is none while connection_ports is empty
+  void StartConnectionWatcher(const ConfigFile& configFile) {
+    if (gConnectionWatcher) {
+      gReactor.value().Remove(gConnectionWatcher.value().GetFd());
+      gConnectionWatcher.reset();
+    }
+
+    std::vector<ConnectionWatcher::PortRange> ports;
+    Config::ForEachListItem(configFile.GetString(Config::Key::ConnectionPorts), [&](std::string_view item) {
+      if (const auto range = ConnectionWatcher::ParsePortRange(item)) {
+        ports.push_back(range.value());
+      } else {
+        std::fprintf(stderr, "Config warning: connection port \"%.*s\" ignored, expected e.g. \"22\" or \"8000-8099\"\n", static_cast<int>(item.size()), item.data());
+      }
+    });
+    if (!ports.empty()) {
+      try {
+        gConnectionWatcher.emplace(std::move(ports), configFile.GetDuration(Config::Key::ConnectionInterval));
+        gReactor.value().Add(gConnectionWatcher.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+          if (gConnectionWatcher.value().ReadEvents()) {
+            SetRuleActive(Rule::Connection, gConnectionWatcher.value().IsActive());
+          }
+        });
+      } catch (const std::system_error& error) {
+        gConnectionWatcher.reset();
+        std::fprintf(stderr, "Warning: connection rule disabled: %s (code %d)\n", error.what(), error.code().value());
+      }
+    }
+
+    SetRuleActive(Rule::Connection, gConnectionWatcher && gConnectionWatcher.value().IsActive());
+  }
+
+  void SetPowerBlocked(bool blocked) {
+    Journal::OriginScope origin(Journal::Source::Rule);
+    Preventer::SetPowerBlocked(blocked);
+  }
+
+  // (re)creates the power supply watcher from the config; there is none while the power policy is off
+  void StartPowerSupplyWatcher(const ConfigFile& configFile) {
+    if (gPowerSupplyWatcher) {
+      gReactor.value().Remove(gPowerSupplyWatcher.value().GetFd());
+      gPowerSupplyWatcher.reset();
+    }
+
+    PowerSupplyWatcher::Policy policy;
+    policy.requireAc = configFile.GetBool(Config::Key::PowerRequireAc);
+    policy.minBatteryPercent = static_cast<int>(std::clamp<std::int64_t>(configFile.GetInt(Config::Key::PowerMinBattery), 0, 100));
+    if (policy.requireAc || policy.minBatteryPercent > 0) {
+      try {
+        gPowerSupplyWatcher.emplace(policy, GetSysfsRoot());
+        gReactor.value().Add(gPowerSupplyWatcher.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+          if (gPowerSupplyWatcher.value().ReadEvents()) {
+            SetPowerBlocked(gPowerSupplyWatcher.value().IsBlocked());
+          }
+        });
+      } catch (const std::system_error& error) {
+        gPowerSupplyWatcher.reset();
+        std::fprintf(stderr, "Warning: power policy disabled: %s (code %d)\n", error.what(), error.code().value());
+      }
+    }
+
+    SetPowerBlocked(gPowerSupplyWatcher && gPowerSupplyWatcher.value().IsBlocked());
+  }
+
+  void WriteMetricsFile(const ConfigFile& configFile) {
+    const auto path = configFile.GetString(Config::Key::MetricsFile);
+    if (!path.empty() && !AtomicWriteFile(path, Metrics::FormatPrometheus())) {
+      std::fprintf(stderr, "Warning: failed to write %s\n", path.c_str());
+    }
+  }
+
+  std::chrono::milliseconds GetMetricsInterval(const ConfigFile& configFile) {
+    return std::max<std::chrono::milliseconds>(configFile.GetDuration(Config::Key::MetricsInterval), MinMetricsInterval);
+  }
+
+  void ScheduleMetricsWrite(TimerQueue::Clock::time_point deadline) {
+    gMetricsTimer = gTimerQueue.value().Schedule(deadline, [deadline](TimerQueue::TimerId) {
+      WriteMetricsFile(gConfigFile.value());
+      ScheduleMetricsWrite(deadline + GetMetricsInterval(gConfigFile.value()));
+    });
+  }
+
+  // (re)starts the periodic metrics_file rewrite; nothing is scheduled while metrics_file is empty
+  void StartMetricsFile(const ConfigFile& configFile) {
+    if (gMetricsTimer != 0) {
+      gTimerQueue.value().Cancel(gMetricsTimer);
+      gMetricsTimer = 0;
+    }
+    if (configFile.GetString(Config::Key::MetricsFile).empty()) {
+      return;
+    }
+
+    WriteMetricsFile(configFile);
+    ScheduleMetricsWrite(TimerQueue::Clock::now() + GetMetricsInterval(configFile));
+  }
+
+  void ApplyUserLimits(const ConfigFile& configFile) {
+    IPC::UserLimits limits;
+    limits.maxLeases = static_cast<std::size_t>(std::max<std::int64_t>(configFile.GetInt(Config::Key::UserMaxLeases), 0));
+    limits.maxDuration = configFile.GetDuration(Config::Key::UserMaxDuration);
+    IPC::SetUserLimits(limits);
+  }
+
+  // fleet_key_file; a relative path is taken from the directory of the config file
+  std::filesystem::path GetFleetKeyFilepath(const ConfigFile& configFile) {
+    return GetConfigFilepath().parent_path() / configFile.GetString(Config::Key::FleetKeyFile);
+  }
+
+  IPC::Status ExecuteFleetCommand(const IPC::Entry& command, std::string& result);
+
+  // (re)creates the fleet listener from the config; there is none while fleet_listen is empty
+  void StartFleetServer(const ConfigFile& configFile) {
+    if (gFleetServer) {
+      gReactor.value().Remove(gFleetServer.value().GetFd());
+      gFleetServer.reset();
+    }
+
+    const auto& listen = configFile.GetString(Config::Key::FleetListen);
+    if (listen.empty()) {
+      return;
+    }
+    const auto address = ResolveFleetAddress(listen, true);
+    if (!address) {
+      std::fprintf(stderr, "Config warning: fleet_listen \"%s\" ignored, expected e.g. \"10.0.0.5:%u\" or \":%u\"\n", listen.c_str(), DefaultFleetPort, DefaultFleetPort);
+      return;
+    }
+    try {
+      if (configFile.GetString(Config::Key::FleetKeyFile).empty()) {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), "fleet_key_file is not set");
+      }
+      gFleetServer.emplace(address.value(), ReadFleetKey(GetFleetKeyFilepath(configFile)), ExecuteFleetCommand);
+      gReactor.value().Add(gFleetServer.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+        gFleetServer.value().Dispatch();
+      });
+    } catch (const std::system_error& error) {
+      gFleetServer.reset();
+      std::fprintf(stderr, "Warning: fleet listener disabled: %s (code %d)\n", error.what(), error.code().value());
+    }
+  }
+
+  // (re)creates the hook pool from the config; there is none while hook_on and hook_off are empty
+  // hooks still queued are dropped and running ones killed, as they may be the ones the change replaced
+  void StartHookPool(const ConfigFile& configFile) {
+    gHookPool.reset();
+    if (configFile.GetString(Config::Key::HookOn).empty() && configFile.GetString(Config::Key::HookOff).empty()) {
+      return;
+    }
+    try {
+      gHookPool.emplace(static_cast<std::size_t>(std::max<std::int64_t>(configFile.GetInt(Config::Key::HookWorkers), 1)));
+    } catch (const std::system_error& error) {
+      std::fprintf(stderr, "Warning: hooks disabled: %s (code %d)\n", error.what(), error.code().value());
+    }
+  }
+
+  void ReloadConfig() {
+    Journal::OriginScope origin(Journal::Source::Config);
+    auto& configFile = gConfigFile.value();
+    const auto changedKeys = configFile.Reload();
+    ReportConfigDiagnostics(configFile);
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::BackendCoalesce})) {
+      StartBackendCoalescing(configFile);
+    }
+    Preventer::ApplyConfigChanges(configFile, changedKeys);
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::ProcessWatch, Config::Key::ProcessWatchInterval})) {
+      StartProcessWatcher(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::LoadCpu, Config::Key::LoadDisk, Config::Key::LoadNet, Config::Key::LoadInterval, Config::Key::LoadWindow})) {
+      StartLoadMonitor(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::Schedule})) {
+      StartScheduleWatcher(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::ConnectionPorts, Config::Key::ConnectionInterval})) {
+      StartConnectionWatcher(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::PowerRequireAc, Config::Key::PowerMinBattery})) {
+      StartPowerSupplyWatcher(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::MetricsFile, Config::Key::MetricsInterval})) {
+      StartMetricsFile(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::UserMaxLeases, Config::Key::UserMaxDuration})) {
+      ApplyUserLimits(configFile);
+    }
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::FleetListen, Config::Key::FleetKeyFile})) {
+      StartFleetServer(configFile);
+    }
+    // the commands are read as hooks are queued, so only the pool size or turning hooks on or off restarts the pool
+    const bool hooksConfigured = !configFile.GetString(Config::Key::HookOn).empty() || !configFile.GetString(Config::Key::HookOff).empty();
+    if (IsAnyKeyChanged(changedKeys, {Config::Key::HookWorkers}) || hooksConfigured != gHookPool.has_value()) {
+      StartHookPool(configFile);
+    }
+  }
+
+  // the owner's holds are "hold:<id>", other users' are the same under IPC::GetUserLeasePrefix
+  std::string GetHoldLeasePrefix(const IPC::Caller& caller) {
+    std::string prefix = caller.owner ? std::string() : IPC::GetUserLeasePrefix(caller.uid);
+    prefix.append(HoldLeasePrefix);
+    return prefix;
+  }
+
+  std::string GetHoldLeaseName(const IPC::Caller& caller, std::uint64_t id) {
+    auto name = GetHoldLeasePrefix(caller);
+    name.append(std::to_string(id));
+    return name;
+  }
+
+  // the daemon's own user and root are the owner
+  IPC::Caller GetCaller(std::uint32_t uid) {
+    return IPC::Caller{uid, uid == getuid() || uid == 0};
+  }
+
+  // holds the modes set in ipcFlags (sleep if none) until deadline, without touching the manual state
+  // returns the hold id, or nullopt if the caller is at its lease limit
+  std::optional<std::uint64_t> AddHold(const IPC::Caller& caller, std::uint32_t ipcFlags, LeaseTable::Clock::time_point deadline) {
+    auto modes = Preventer::GetLeaseModesFromIPCFlags(ipcFlags);
+    if (modes == 0) {
+      modes = LeaseModes::System;
+    }
+    const auto id = gNextHoldId;
+    const auto name = GetHoldLeaseName(caller, id);
+    if (IPC::CheckLeaseLimit(caller, name) != IPC::Status::Ok) {
+      return std::nullopt;
+    }
+    gNextHoldId++;
+    Preventer::AcquireLease(name, modes, IPC::LimitExpiry(caller, deadline));
+    ScheduleLeaseExpiry();
+    return id;
+  }
+
+  // every hold of the caller if id is 0
+  void CancelHolds(const IPC::Caller& caller, std::uint64_t id) {
+    if (id == 0) {
+      Preventer::ReleaseLeases(GetHoldLeasePrefix(caller));
+    } else {
+      Preventer::ReleaseLease(GetHoldLeaseName(caller, id));
+    }
+    ScheduleLeaseExpiry();
+  }
+
+  // wall clock deadlines are converted once, so a later clock change does not move them
+  TimerQueue::Clock::time_point ToSteadyTime(std::chrono::system_clock::time_point time) {
+    return TimerQueue::Clock::now() + std::chrono::duration_cast<TimerQueue::Clock::duration>(time - std::chrono::system_clock::now());
+  }
+
+  // the next time the local clock shows the given minutes after midnight
+  std::chrono::system_clock::time_point GetNextTimeOfDay(int minutes) {
+    const auto now = std::chrono::system_clock::now();
+    const auto nowTime = std::chrono::system_clock::to_time_t(now);
+    std::tm local{};
+    localtime_r(&nowTime, &local);
+    for (int days = 0; ; days++) {
+      std::tm target = local;
+      target.tm_mday += days;
+      target.tm_hour = minutes / 60;
+      target.tm_min = minutes % 60;
+      target.tm_sec = 0;
+      // let mktime work out DST for the target day
+      target.tm_isdst = -1;
+      const auto time = std::chrono::system_clock::from_time_t(std::mktime(&target));
+      if (time > now) {
+        return time;
+      }
+    }
+  }
+
+  // /T or /U as the TTL of /L; 0 for none
+  std::chrono::milliseconds GetLeaseTTL(const CommandLineOptions& options) {
+    if (options.holdFor) {
+      return options.holdFor.value();
+    }
+    if (options.holdUntil) {
+      return std::chrono::ceil<std::chrono::milliseconds>(GetNextTimeOfDay(options.holdUntil.value()) - std::chrono::system_clock::now());
+    }
+    return 0ms;
+  }
+
+  // publishes the state and lease count in shared memory from now on
+  void OpenStatusPage(const ConfigFile& configFile) {
+    if (!configFile.GetBool(Config::Key::StatusPage)) {
+      return;
+    }
+    try {
+      gStatusPage = StatusPage::Writer::Open(StatusPage::GetDefaultPath());
+    } catch (const std::system_error& error) {
+      std::fprintf(stderr, "Warning: status page disabled: %s (code %d)\n", error.what(), error.code().value());
+      return;
+    }
+    Preventer::SetLeaseCountListener([](std::size_t count) {
+      gStatusPage->SetLeaseCount(static_cast<std::uint32_t>(count));
+    });
+  }
+
+  // opens the journal, marks the start and restores the client leases and holds of the last run
+  // rule leases are not restored, as the rules are evaluated afresh
+  void OpenJournal(const ConfigFile& configFile) {
+    const auto capacity = configFile.GetInt(Config::Key::JournalRecords);
+    if (capacity <= 0) {
+      return;
+    }
+    const auto path = GetJournalFilepath();
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    try {
+      gJournal = Journal::Writer::Open(path, static_cast<std::size_t>(capacity));
+    } catch (const std::system_error& error) {
+      std::fprintf(stderr, "Warning: journal disabled: %s (code %d)\n", error.what(), error.code().value());
+      return;
+    }
+
+    const auto leases = Journal::RebuildLeases(gJournal->ReadRecords(), std::chrono::system_clock::now());
+    Journal::OriginScope origin(Journal::Source::Daemon);
+    gJournal->AppendMarker(Journal::Kind::Start, IPC::GetStateBits());
+    Preventer::SetJournal(gJournal.get());
+
+    for (const auto& [name, lease] : leases) {
+      // with the user prefix of a user other than the owner, if any
+      const auto unprefixed = IPC::SplitUserLeaseName(name).second;
+      const bool isHold = unprefixed.substr(0, HoldLeasePrefix.size()) == HoldLeasePrefix;
+      if (!isHold && unprefixed.substr(0, ClientLeasePrefix.size()) != ClientLeasePrefix) {
+        continue;
+      }
+      if (isHold) {
+        std::uint64_t id = 0;
+        std::from_chars(unprefixed.data() + HoldLeasePrefix.size(), unprefixed.data() + unprefixed.size(), id);
+        gNextHoldId = std::max<std::uint64_t>(gNextHoldId, id + 1);
+      }
+      for (std::uint32_t i = 0; i < lease.unbounded; i++) {
+        Preventer::AcquireLease(name, lease.modes);
+      }
+      for (const auto expiry : lease.expiries) {
+        Preventer::AcquireLease(name, lease.modes, ToSteadyTime(expiry));
+      }
+    }
+    ScheduleLeaseExpiry();
+  }
+
+  // the result of GetUsers: the owner's leases and holds count for the daemon's user, the others' for the uid they are
+  // kept under; a caller other than the owner gets only its own
+  void AppendUsers(const IPC::Caller& caller, std::string& result) {
+    struct Usage {
+      std::uint32_t count = 0;
+      std::uint8_t modes = 0;
+    };
+    std::map<std::uint32_t, Usage> users;
+    const auto add = [&](std::uint32_t uid) {
+      return [&users, uid](std::string_view, std::uint8_t modes) {
+        auto& usage = users[uid];
+        usage.count++;
+        usage.modes |= modes;
+      };
+    };
+    if (caller.owner) {
+      const auto ownerUid = static_cast<std::uint32_t>(getuid());
+      Preventer::ForEachLease(ClientLeasePrefix, add(ownerUid));
+      Preventer::ForEachLease(HoldLeasePrefix, add(ownerUid));
+      Preventer::ForEachLease(IPC::UserLeasePrefix, [&](std::string_view name, std::uint8_t modes) {
+        if (const auto uid = IPC::SplitUserLeaseName(name).first) {
+          add(uid.value())(name, modes);
+        }
+      });
+    } else {
+      Preventer::ForEachLease(IPC::GetUserLeasePrefix(caller.uid), add(caller.uid));
+    }
+    for (const auto& [uid, usage] : users) {
+      IPC::AppendU32(result, uid);
+      IPC::AppendU32(result, usage.count);
+      result.push_back(static_cast<char>(usage.modes));
+    }
+  }
+
+  // commands handled by the daemon itself, for the IPC socket and the fleet listener; everything else goes to
+  // IPC::ExecuteCommand
+  IPC::Status ExecuteCallerCommand(const IPC::Caller& caller, const IPC::Entry& command, std::string& result) {
+    switch (command.opcode) {
+      case IPC::Opcode::HoldFor:
+      case IPC::Opcode::HoldUntil: {
+        if (command.payload.size() != sizeof(std::uint32_t) + sizeof(std::uint64_t)) {
+          return IPC::Status::BadRequest;
+        }
+        const auto flags = IPC::ReadU32(command.payload);
+        const auto value = IPC::ReadU64(command.payload, sizeof(std::uint32_t));
+        // bounded before any clock arithmetic, which would overflow on a value from the peer
+        auto maxValue = static_cast<std::uint64_t>(std::chrono::milliseconds(MaxHoldDuration).count());
+        if (command.opcode == IPC::Opcode::HoldUntil) {
+          maxValue += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        }
+        if (value == 0 || value > maxValue) {
+          return IPC::Status::BadRequest;
+        }
+        const auto deadline = command.opcode == IPC::Opcode::HoldFor ?
+          TimerQueue::Clock::now() + std::chrono::milliseconds(value) :
+          ToSteadyTime(std::chrono::system_clock::time_point(std::chrono::milliseconds(value)));
+        if (deadline <= TimerQueue::Clock::now()) {
+          return IPC::Status::BadRequest;
+        }
+        const auto id = AddHold(caller, flags, deadline);
+        if (!id) {
+          return IPC::Status::Denied;
+        }
+        result.push_back(static_cast<char>(IPC::GetStateBits()));
+        IPC::AppendU64(result, id.value());
+        return IPC::Status::Ok;
+      }
+
+      case IPC::Opcode::CancelHolds:
+        if (!command.payload.empty() && command.payload.size() != sizeof(std::uint64_t)) {
+          return IPC::Status::BadRequest;
+        }
+        CancelHolds(caller, command.payload.empty() ? 0 : IPC::ReadU64(command.payload));
+        result.push_back(static_cast<char>(IPC::GetStateBits()));
+        return IPC::Status::Ok;
+
+      case IPC::Opcode::GetUsers:
+        if (!command.payload.empty()) {
+          return IPC::Status::BadRequest;
+        }
+        AppendUsers(caller, result);
+        return IPC::Status::Ok;
+
+      default: {
+        const auto status = IPC::ExecuteCommandFor(caller, command, result);
+        // AcquireLease may have brought the earliest expiry forward
+        DeferLeaseExpiryUpdate();
+        return status;
+      }
+    }
+  }
+
+  IPC::Status ExecuteDaemonCommand(const IPC::Entry& command, std::string& result) {
+    const auto& peer = gIPCServer.value().GetPeer();
+    Journal::OriginScope origin(Journal::Source::IPC, peer.pid, peer.uid);
+    if (command.opcode == IPC::Opcode::Watch) {
+      if (!command.payload.empty()) {
+        return IPC::Status::BadRequest;
+      }
+      gIPCServer.value().Subscribe();
+      result.push_back(static_cast<char>(IPC::GetStateBits()));
+      return IPC::Status::Ok;
+    }
+    return ExecuteCallerCommand(GetCaller(peer.uid), command, result);
+  }
+
+  // a controller which knows the fleet key acts as the owner; it cannot subscribe, since it only sends changes
+  IPC::Status ExecuteFleetCommand(const IPC::Entry& command, std::string& result) {
+    Journal::OriginScope origin(Journal::Source::Fleet);
+    if (command.opcode == IPC::Opcode::Watch) {
+      return IPC::Status::UnknownCommand;
+    }
+    return ExecuteCallerCommand(GetCaller(static_cast<std::uint32_t>(getuid())), command, result);
+  }
+
+  // the commands a second instance sends for its options
+  std::string BuildRequest(const CommandLineOptions& options) {
+    std::string request;
+    IPC::FrameWriter writer(request, IPC::FrameType::Request);
+    std::string payload;
+    if (options.cancelHolds) {
+      writer.Add(IPC::Opcode::CancelHolds, IPC::Status::Ok);
+    }
+    if (options.releaseLease) {
+      writer.Add(IPC::Opcode::ReleaseLease, IPC::Status::Ok, options.releaseLease.value());
+    }
+    if (options.lease) {
+      payload.push_back(static_cast<char>(Preventer::GetLeaseModesFromIPCFlags(options.GetIPCFlags())));
+      IPC::AppendU64(payload, static_cast<std::uint64_t>(GetLeaseTTL(options).count()));
+      payload.append(options.lease.value());
+      writer.Add(IPC::Opcode::AcquireLease, IPC::Status::Ok, payload);
+      writer.Finish();
+      return request;
+    }
+    IPC::AppendU32(payload, options.GetIPCFlags());
+    if (options.holdFor) {
+      IPC::AppendU64(payload, static_cast<std::uint64_t>(options.holdFor.value().count()));
+      writer.Add(IPC::Opcode::HoldFor, IPC::Status::Ok, payload);
+    } else if (options.holdUntil) {
+      const auto time = GetNextTimeOfDay(options.holdUntil.value());
+      IPC::AppendU64(payload, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count()));
+      writer.Add(IPC::Opcode::HoldUntil, IPC::Status::Ok, payload);
+    } else {
+      writer.Add(IPC::Opcode::ApplyFlags, IPC::Status::Ok, payload);
+    }
+    writer.Finish();
+    return request;
+  }
+
+  // asks the running instance for its metrics and prints them
+  int PrintStats(const std::string& socketName) {
+    try {
+      std::string request;
+      IPC::FrameWriter writer(request, IPC::FrameType::Request);
+      writer.Add(IPC::Opcode::GetStats, IPC::Status::Ok);
+      writer.Finish();
+
+      IPCClient client(socketName);
+      const auto& response = client.Call(request);
+      if (response.entries.size() != 1 || response.entries[0].status != IPC::Status::Ok) {
+        std::fputs("Error: the running instance rejected the request\n", stderr);
+        return 1;
+      }
+      std::fwrite(response.entries[0].payload.data(), 1, response.entries[0].payload.size(), stdout);
+    } catch (const std::exception& exception) {
+      std::fprintf(stderr, "Error: failed to query the running instance (%s)\n", exception.what());
+      return 1;
+    }
+    return 0;
+  }
+
+  // asks the running instance what each user holds and prints it
+  int PrintUsers(const std::string& socketName) {
+    try {
+      std::string request;
+      IPC::FrameWriter writer(request, IPC::FrameType::Request);
+      writer.Add(IPC::Opcode::GetUsers, IPC::Status::Ok);
+      writer.Finish();
+
+      IPCClient client(socketName);
+      const auto& response = client.Call(request);
+      constexpr std::size_t RecordSize = 2 * sizeof(std::uint32_t) + sizeof(std::uint8_t);
+      if (response.entries.size() != 1 || response.entries[0].status != IPC::Status::Ok || response.entries[0].payload.size() % RecordSize != 0) {
+        std::fputs("Error: the running instance rejected the request\n", stderr);
+        return 1;
+      }
+      const auto payload = response.entries[0].payload;
+      for (std::size_t offset = 0; offset < payload.size(); offset += RecordSize) {
+        const auto modes = static_cast<std::uint8_t>(payload[offset + 2 * sizeof(std::uint32_t)]);
+        std::printf("uid %u: %u held, %s%s\n",
+          static_cast<unsigned>(IPC::ReadU32(payload, offset)),
+          static_cast<unsigned>(IPC::ReadU32(payload, offset + sizeof(std::uint32_t))),
+          modes & LeaseModes::System ? "S" : "-",
+          modes & LeaseModes::Display ? "D" : "-");
+      }
+    } catch (const std::exception& exception) {
+      std::fprintf(stderr, "Error: failed to query the running instance (%s)\n", exception.what());
+      return 1;
+    }
+    return 0;
+  }
+
+  // where commands go: $SLEEPPREVENTER_SOCKET if set, otherwise the system-wide daemon if root runs one, otherwise the
+  // per-user daemon; a system socket bound by anyone but root is not trusted
+  std::string FindIPCSocketName() {
+    if (const auto name = std::getenv("SLEEPPREVENTER_SOCKET"); name != nullptr && name[0] != '\0') {
+      return name;
+    }
+    try {
+      if (IPCClient(GetSystemIPCSocketName()).GetServerUid() == 0) {
+        return GetSystemIPCSocketName();
+      }
+    } catch (const std::system_error&) {
+    }
+    return GetDefaultIPCSocketName();
+  }
+
+  // subscribes to the running instance and prints its state on every change, until interrupted or disconnected
+  int WatchState(const std::string& socketName) {
+    try {
+      std::string request;
+      IPC::FrameWriter writer(request, IPC::FrameType::Request);
+      writer.Add(IPC::Opcode::Watch, IPC::Status::Ok);
+      writer.Finish();
+
+      IPCClient client(socketName);
+      const auto& response = client.Call(request);
+      if (response.entries.size() != 1 || response.entries[0].status != IPC::Status::Ok || response.entries[0].payload.size() != 1) {
+        std::fputs("Error: the running instance rejected the request\n", stderr);
+        return 1;
+      }
+      std::printf("%s\n", IPC::FormatStateBits(static_cast<std::uint8_t>(response.entries[0].payload[0])).c_str());
+      std::fflush(stdout);
+
+      while (true) {
+        const auto& frame = client.Receive();
+        for (const auto& entry : frame.entries) {
+          if (frame.type != IPC::FrameType::Event || entry.opcode != IPC::Opcode::Watch || entry.payload.size() != 1 + sizeof(std::uint32_t)) {
+            continue;
+          }
+          const auto state = IPC::FormatStateBits(static_cast<std::uint8_t>(entry.payload[0]));
+          if (const auto coalesced = IPC::ReadU32(entry.payload, 1); coalesced != 0) {
+            std::printf("%s (%u earlier changes skipped)\n", state.c_str(), static_cast<unsigned>(coalesced));
+          } else {
+            std::printf("%s\n", state.c_str());
+          }
+        }
+        std::fflush(stdout);
+      }
+    } catch (const std::exception& exception) {
+      std::fprintf(stderr, "Error: lost the running instance (%s)\n", exception.what());
+      return 1;
+    }
+  }
+
+  // a lease or hold without /S or /D prevents sleep
+  void DefaultLeaseModes(CommandLineOptions& options) {
+    if ((options.holdFor || options.holdUntil || options.lease) && !options.systemFlag.has_value() && !options.displayFlag.has_value()) {
+      options.systemFlag = true;
+    }
+  }
+
+  // the hosts of a fleet file: one per line, '#' starts a comment; nullopt if it cannot be read
+  std::optional<std::vector<std::string>> ReadFleetHosts(const std::filesystem::path& path) {
+    const auto data = ReadWholeFile(path);
+    if (!data) {
+      return std::nullopt;
+    }
+    std::vector<std::string> hosts;
+    std::string_view rest(data.value());
+    while (!rest.empty()) {
+      const auto newline = rest.find('\n');
+      auto line = rest.substr(0, newline);
+      rest = newline == std::string_view::npos ? std::string_view{} : rest.substr(newline + 1);
+      line = line.substr(0, line.find('#'));
+      Config::ForEachListItem(line, [&](std::string_view host) {
+        hosts.emplace_back(host);
+      });
+    }
+    return hosts;
+  }
+
+  // sends the options to every host of the fleet file at once and prints the results, then a summary
+  int ControlFleet(const char* hostsPath, const CommandLineOptions& options) {
+    const auto hosts = ReadFleetHosts(hostsPath);
+    if (!hosts) {
+      std::fprintf(stderr, "Error: cannot read %s\n", hostsPath);
+      return 2;
+    }
+
+    const ConfigFile configFile(GetConfigFilepath());
+    if (configFile.GetString(Config::Key::FleetKeyFile).empty()) {
+      std::fputs("Error: fleet_key_file is not set in the config\n", stderr);
+      return 2;
+    }
+
+    // every host is connected at once as far as the descriptor limit allows
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    const auto maxConnections = limit.rlim_cur > FleetReservedFds * 2 ? static_cast<std::size_t>(limit.rlim_cur) - FleetReservedFds : FleetReservedFds;
+
+    std::vector<FleetResult> results;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      results = SendToFleet(hosts.value(), ReadFleetKey(GetFleetKeyFilepath(configFile)), BuildRequest(options), FleetTimeout, maxConnections);
+    } catch (const std::system_error& error) {
+      std::fprintf(stderr, "Error: %s (code %d)\n", error.what(), error.code().value());
+      return 2;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::size_t failed = 0;
+    std::vector<std::chrono::nanoseconds> latencies;
+    for (const auto& result : results) {
+      const double milliseconds = std::chrono::duration<double, std::milli>(result.latency).count();
+      if (!result.error.empty()) {
+        failed++;
+        std::printf("%s: error: %s (%.1f ms)\n", result.host.c_str(), result.error.c_str(), milliseconds);
+        continue;
+      }
+      latencies.push_back(result.latency);
+      std::printf("%s: ok %s (%.1f ms)\n", result.host.c_str(), result.state ? IPC::FormatStateBits(result.state.value()).c_str() : "", milliseconds);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&](double p) {
+      return latencies.empty() ? 0.0 : std::chrono::duration<double, std::milli>(latencies[static_cast<std::size_t>(p * (latencies.size() - 1))]).count();
+    };
+    std::printf("%zu hosts, %zu ok, %zu failed; latency p50 %.1f ms, p99 %.1f ms, max %.1f ms; total %.1f ms\n",
+      results.size(),
+      results.size() - failed,
+      failed,
+      percentile(0.5),
+      percentile(0.99),
+      percentile(1.0),
+      std::chrono::duration<double, std::milli>(elapsed).count());
+    return failed == 0 ? 0 : 1;
+  }
+
+  // forwards the options to the running instance, like WM_COPYDATA does in the tray application
+  int SendToFirstInstance(const std::string& socketName, const CommandLineOptions& options) {
+    try {
+      IPCClient client(socketName);
+      const auto& response = client.Call(BuildRequest(options));
+      for (const auto& entry : response.entries) {
+        if (entry.status != IPC::Status::Ok) {
+          std::fputs("Error: the running instance rejected the request\n", stderr);
+          return 1;
+        }
+      }
+    } catch (const std::system_error& error) {
+      if (error.code() == std::errc::permission_denied) {
+        std::fprintf(stderr, "Error: %s is held by another user (%s); nothing was sent to it and no daemon was started\n", socketName.c_str(), error.what());
+      } else {
+        std::fprintf(stderr, "Error: failed to send to the running instance (%s)\n", error.what());
+      }
+      return 1;
+    } catch (const std::exception& exception) {
+      std::fprintf(stderr, "Error: failed to send to the running instance (%s)\n", exception.what());
+      return 1;
+    }
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  // system mode takes the options of the daemon after "system"
+  if (argc >= 2 && argv[1] == "system"sv) {
+    gSystemMode = true;
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  // stats mode
+  if (argc == 2 && argv[1] == "stats"sv) {
+    return PrintStats(FindIPCSocketName());
+  }
+
+  // watch mode
+  if (argc == 2 && argv[1] == "watch"sv) {
+    return WatchState(FindIPCSocketName());
+  }
+
+  // users mode
+  if (argc == 2 && argv[1] == "users"sv) {
+    return PrintUsers(FindIPCSocketName());
+  }
+
+  // fleet mode; options after the hosts file select the change
+  if (argc >= 3 && argv[1] == "fleet"sv) {
+    auto fleetOptions = ParseCommandLineOptions(WidenArgs(argc - 3, argv + 3));
+    DefaultLeaseModes(fleetOptions);
+    return ControlFleet(argv[2], fleetOptions);
+  }
+
+  // journal mode
+  if (argc >= 2 && argv[1] == "journal"sv) {
+    return RunJournalReader(GetJournalFilepath(), argc - 2, argv + 2);
+  }
+
+  // exec mode; options before "exec" select what to hold
+  // only the first argument which is not an option counts, so that "exec" in the command it runs, or a name taken
+  // by another mode, never does
+  int execIndex = 1;
+  while (execIndex < argc && argv[execIndex][0] == '/') {
+    execIndex++;
+  }
+  if (execIndex < argc && argv[execIndex] == "exec"sv) {
+    int commandIndex = execIndex + 1;
+    if (commandIndex < argc && argv[commandIndex] == "--"sv) {
+      commandIndex++;
+    }
+    if (commandIndex >= argc) {
+      std::fputs(ExecHelpMessage, stderr);
+      return 2;
+    }
+
+    auto execOptions = ParseCommandLineOptions(WidenArgs(execIndex, argv));
+    if (!execOptions.systemFlag.has_value() && !execOptions.displayFlag.has_value()) {
+      execOptions.systemFlag = true;
+    }
+    execOptions.enable = true;
+    return RunExec(execOptions.GetIPCFlags(), argv + commandIndex);
+  }
+
+  // parse command line arguments
+  auto options = ParseCommandLineOptions(WidenArgs(argc, argv));
+  DefaultLeaseModes(options);
+  if (options.help) {
+    // the help text is plain ASCII
+    for (const auto c : std::wstring_view(HelpMessage)) {
+      std::fputc(static_cast<char>(c), stdout);
+    }
+    std::fputs(ExecHelpMessage, stdout);
+    std::fputs(StatsHelpMessage, stdout);
+    std::fputs(WatchHelpMessage, stdout);
+    std::fputs(UsersHelpMessage, stdout);
+    std::fputs(SystemHelpMessage, stdout);
+    std::fputs(FleetHelpMessage, stdout);
+    std::fputs(JournalHelpMessage, stdout);
+    std::fputs(HoldHelpMessage, stdout);
+    std::fputs(LeaseHelpMessage, stdout);
+    return 0;
+  }
+
+  // multiple instance check; a running system-wide daemon takes the commands of every user
+  if (!gSystemMode) {
+    if (const auto name = FindIPCSocketName(); name != GetDefaultIPCSocketName()) {
+      return SendToFirstInstance(name, options);
+    }
+  }
+  const auto socketName = gSystemMode ? GetSystemIPCSocketName() : GetDefaultIPCSocketName();
+  try {
+    gIPCServer.emplace(socketName, ExecuteDaemonCommand, gSystemMode ? IPCServer::Access::AnyUser : IPCServer::Access::Owner);
+  } catch (const std::system_error& error) {
+    if (error.code() == std::errc::address_in_use) {
+      return SendToFirstInstance(socketName, options);
+    }
+    std::fprintf(stderr, "Initialization error: %s (code %d)\n", error.what(), error.code().value());
+    return 1;
+  }
+
+  // signals are received through a signalfd in the main loop
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  if (const int error = pthread_sigmask(SIG_BLOCK, &signals, nullptr); error != 0) {
+    std::fprintf(stderr, "Initialization error: pthread_sigmask failed with code %d\n", error);
+    return 1;
+  }
+  const int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signalFd < 0) {
+    std::fprintf(stderr, "Initialization error: signalfd failed with code %d\n", errno);
+    return 1;
+  }
+
+  try {
+    gReactor.emplace();
+    gTimerQueue.emplace();
+  } catch (const std::system_error& error) {
+    std::fprintf(stderr, "Initialization error: %s (code %d)\n", error.what(), error.code().value());
+    return 1;
+  }
+
+  // instantiate ConfigFile
+  // unlike the tray application, defaults are not written back at startup
+  gConfigFile.emplace(GetConfigFilepath());
+
+  auto& configFile = gConfigFile.value();
+  ReportConfigDiagnostics(configFile);
+
+  // watch for external edits
+  try {
+    gConfigWatcher.emplace(GetConfigFilepath());
+  } catch (const std::system_error& error) {
+    std::fprintf(stderr, "Warning: config hot reload disabled: %s (code %d)\n", error.what(), error.code().value());
+  }
+
+  // start
+  ApplyUserLimits(configFile);
+  StartHookPool(configFile);
+  OpenStatusPage(configFile);
+  Preventer::SetStateListener(OnStateChanged);
+  StartBackendCoalescing(configFile);
+  try {
+    StartBackendDispatch();
+  } catch (const std::system_error& error) {
+    std::fprintf(stderr, "Initialization error: %s (code %d)\n", error.what(), error.code().value());
+    return 1;
+  }
+  // before anything is applied, so that nothing is held for a moment on battery
+  StartPowerSupplyWatcher(configFile);
+  Preventer::LoadStateFromConfig(configFile);
+  OpenJournal(configFile);
+  {
+    Journal::OriginScope origin(Journal::Source::CommandLine, static_cast<std::uint32_t>(getpid()), static_cast<std::uint32_t>(getuid()));
+    auto initialFlags = options.GetIPCFlags();
+    if (options.lease || options.holdFor || options.holdUntil) {
+      // /S and /D select the modes of the lease or hold, as they do when sent to a running instance
+      initialFlags &= Preventer::IPCFlags::Enable | Preventer::IPCFlags::Disable;
+    }
+    if (!Preventer::ApplyStateFromIPCFlags(initialFlags)) {
+      std::fputs("Warning: failed to apply initial state\n", stderr);
+    }
+    StartProcessWatcher(configFile);
+    StartLoadMonitor(configFile);
+    StartScheduleWatcher(configFile);
+    StartConnectionWatcher(configFile);
+    StartMetricsFile(configFile);
+    StartFleetServer(configFile);
+    if (options.lease) {
+      const auto ttl = GetLeaseTTL(options);
+      std::optional<LeaseTable::Clock::time_point> expiry;
+      if (ttl > 0ms) {
+        expiry = LeaseTable::Clock::now() + ttl;
+      }
+      Preventer::AcquireLease(IPC::GetClientLeaseName(options.lease.value()), Preventer::GetLeaseModesFromIPCFlags(options.GetIPCFlags()), expiry);
+      ScheduleLeaseExpiry();
+    } else if (options.holdFor) {
+      AddHold(GetCaller(static_cast<std::uint32_t>(getuid())), options.GetIPCFlags(), TimerQueue::Clock::now() + options.holdFor.value());
+    } else if (options.holdUntil) {
+      AddHold(GetCaller(static_cast<std::uint32_t>(getuid())), options.GetIPCFlags(), ToSteadyTime(GetNextTimeOfDay(options.holdUntil.value())));
+    }
+  }
+
+  NotifyReady();
+
+  // main loop; every handler drains its fd, as the reactor is edge-triggered
+  auto& reactor = gReactor.value();
+  try {
+    reactor.Add(signalFd, EPOLLIN, [&](std::uint32_t) {
+      signalfd_siginfo info;
+      while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        reactor.Stop();
+      }
+    });
+    reactor.Add(gIPCServer.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+      gIPCServer.value().Dispatch();
+    });
+    reactor.Add(gTimerQueue.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+      gTimerQueue.value().ReadEvents();
+    });
+    if (gConfigWatcher) {
+      reactor.Add(gConfigWatcher.value().GetFd(), EPOLLIN, [](std::uint32_t) {
+        if (gConfigWatcher.value().ReadEvents()) {
+          ReloadConfig();
+        }
+      });
+    }
+    reactor.Run();
+  } catch (const std::system_error& error) {
+    std::fprintf(stderr, "Error: %s (code %d)\n", error.what(), error.code().value());
+  }
+
+  // finish
+  Preventer::SetStateListener({});
+  Preventer::SetLeaseCountListener({});
+  Preventer::SetCoalescing(0ms, {});
+  if (gJournal) {
+    Journal::OriginScope origin(Journal::Source::Daemon);
+    gJournal->AppendMarker(Journal::Kind::Stop, IPC::GetStateBits());
+  }
+  Preventer::Finish();
+  WriteMetricsFile(configFile);
+
+  gFleetServer.reset();
+  gHookPool.reset();
+  gIPCServer.reset();
+  gStatusPage.reset();
+  close(signalFd);
+
+  return 0;
+}
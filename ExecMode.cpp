@@ -0,0 +1,147 @@
+#include "ExecMode.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Preventer.hpp"
+
+using namespace std::literals;
+
+extern char** environ;
+
+namespace {
+  // signals forwarded to the child; SIGCHLD is only used when pidfd is unavailable
+  constexpr int ForwardedSignals[] = {
+    SIGHUP,
+    SIGINT,
+    SIGQUIT,
+    SIGTERM,
+    SIGUSR1,
+    SIGUSR2,
+    SIGWINCH,
+  };
+
+  int OpenPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
+  // returns the exit code once the child is gone, -1 while it is still running
+  int ReapChild(pid_t pid) {
+    siginfo_t info{};
+    while (waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG) != 0) {
+      if (errno != EINTR) {
+        return 127;
+      }
+    }
+    if (info.si_pid != pid) {
+      return -1;
+    }
+    if (info.si_code == CLD_EXITED) {
+      return info.si_status;
+    }
+    return 128 + info.si_status;
+  }
+}
+
+int RunExec(std::uint32_t ipcFlags, char* const argv[]) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  for (const auto signal : ForwardedSignals) {
+    sigaddset(&signals, signal);
+  }
+  sigaddset(&signals, SIGCHLD);
+
+  sigset_t oldSignals;
+  pthread_sigmask(SIG_BLOCK, &signals, &oldSignals);
+  const int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signalFd < 0) {
+    std::fprintf(stderr, "Error: signalfd failed with code %d\n", errno);
+    return 126;
+  }
+
+  // the child starts with the signal mask we had before blocking
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &oldSignals);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  // take the inhibition before the child runs, so that it is covered from its first instruction
+  if (!Preventer::AcquireLease("exec"sv, Preventer::GetLeaseModesFromIPCFlags(ipcFlags))) {
+    std::fputs("Warning: failed to inhibit sleep; running the command anyway\n", stderr);
+  }
+
+  pid_t pid = 0;
+  const int spawnError = posix_spawnp(&pid, argv[0], nullptr, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  if (spawnError != 0) {
+    Preventer::Finish();
+    close(signalFd);
+    std::fprintf(stderr, "Error: cannot run %s: %s\n", argv[0], std::strerror(spawnError));
+    return spawnError == ENOENT ? 127 : 126;
+  }
+
+  const int pidFd = OpenPidfd(pid);
+
+  int exitCode = -1;
+  while (exitCode < 0) {
+    pollfd pollFds[] = {
+      {signalFd, POLLIN, 0},
+      {pidFd, POLLIN, 0},
+    };
+    if (poll(pollFds, pidFd >= 0 ? 2 : 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // we can no longer tell when the child exits; kill it rather than leave it running without the lease
+      std::fprintf(stderr, "Error: poll failed with code %d\n", errno);
+      kill(pid, SIGKILL);
+      while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+      break;
+    }
+
+    if (pollFds[0].revents & POLLIN) {
+      signalfd_siginfo info;
+      while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        const auto signal = static_cast<int>(info.ssi_signo);
+        if (signal == SIGCHLD) {
+          continue;
+        }
+        // keyboard generated signals already reach the child through the process group
+        if ((signal == SIGINT || signal == SIGQUIT) && info.ssi_code == SI_KERNEL) {
+          continue;
+        }
+        kill(pid, signal);
+      }
+    }
+
+    exitCode = ReapChild(pid);
+  }
+
+  // release as soon as the child is gone
+  Preventer::Finish();
+
+  if (pidFd >= 0) {
+    close(pidFd);
+  }
+  close(signalFd);
+  pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+
+  return exitCode < 0 ? 127 : exitCode;
+}
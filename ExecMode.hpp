@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// runs argv[0] with argv as a child process and holds the inhibition given by ipcFlags for exactly its lifetime
+// the inhibition is held through this process' own Preventer backend, so it is released even if we are killed
+// returns the child's exit code, 128 + signal number if it was killed, or 126/127 if it could not be started
+int RunExec(std::uint32_t ipcFlags, char* const argv[]);
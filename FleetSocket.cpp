@@ -0,0 +1,726 @@
+#include "FleetSocket.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "AtomicFile.hpp"
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+#include "Metrics.hpp"
+#include "Sha256.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int ListenBacklog = 64;
+  constexpr std::size_t ReceiveChunkSize = 16 * 1024;
+  constexpr int MaxEventsPerDispatch = 64;
+
+  [[noreturn]] void ThrowLastError(const char* what) {
+    throw std::system_error(std::error_code(errno, std::system_category()), what);
+  }
+
+  void SetNoDelay(int fd) {
+    // requests and responses are single small writes, which must not wait for an ACK
+    const int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  }
+
+  std::string_view AsString(const std::uint8_t* data, std::size_t size) {
+    return std::string_view(reinterpret_cast<const char*>(data), size);
+  }
+
+  // the commands of a response that end with StateBits
+  bool ReturnsState(IPC::Opcode opcode) {
+    return opcode != IPC::Opcode::GetStats && opcode != IPC::Opcode::GetUsers && opcode != IPC::Opcode::Auth;
+  }
+}
+
+std::optional<FleetAddress> ResolveFleetAddress(std::string_view text, bool numericOnly) {
+  std::string host;
+  std::string port = std::to_string(DefaultFleetPort);
+  if (!text.empty() && text.front() == '[') {
+    const auto close = text.find(']');
+    if (close == std::string_view::npos || (close + 1 < text.size() && text[close + 1] != ':')) {
+      return std::nullopt;
+    }
+    host = text.substr(1, close - 1);
+    if (close + 1 < text.size()) {
+      port = text.substr(close + 2);
+    }
+  } else if (const auto colon = text.rfind(':'); colon != std::string_view::npos && text.find(':') == colon) {
+    host = text.substr(0, colon);
+    port = text.substr(colon + 1);
+  } else {
+    host = text;
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | (numericOnly ? AI_NUMERICHOST : 0) | (host.empty() ? AI_PASSIVE : 0);
+  addrinfo* result = nullptr;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) {
+    return std::nullopt;
+  }
+  FleetAddress address{};
+  std::memcpy(&address.addr, result->ai_addr, result->ai_addrlen);
+  address.length = result->ai_addrlen;
+  freeaddrinfo(result);
+  return address;
+}
+
+std::string FormatFleetAddress(const FleetAddress& address) {
+  char host[NI_MAXHOST];
+  char port[NI_MAXSERV];
+  if (getnameinfo(reinterpret_cast<const sockaddr*>(&address.addr), address.length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+    return "?"s;
+  }
+  return address.addr.ss_family == AF_INET6 ? "["s + host + "]:"s + port : host + ":"s + port;
+}
+
+std::string ReadFleetKey(const std::filesystem::path& path) {
+  struct stat st{};
+  if (stat(path.c_str(), &st) != 0) {
+    ThrowLastError("cannot open the fleet key file");
+  }
+  if ((st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    throw std::system_error(std::make_error_code(std::errc::permission_denied), "the fleet key file must not be accessible to group or others");
+  }
+
+  auto key = ReadWholeFile(path);
+  if (!key) {
+    ThrowLastError("cannot read the fleet key file");
+  }
+  const auto begin = key.value().find_first_not_of(" \t\r\n");
+  const auto end = key.value().find_last_not_of(" \t\r\n");
+  auto trimmed = begin == std::string::npos ? std::string() : key.value().substr(begin, end - begin + 1);
+  if (trimmed.size() < MinFleetKeySize) {
+    throw std::system_error(std::make_error_code(std::errc::invalid_argument), "the fleet key is shorter than 16 bytes");
+  }
+  return trimmed;
+}
+
+FleetServer::FleetServer(const FleetAddress& address, std::string key, IPCServer::Handler handler) :
+  mKey(std::move(key)),
+  mHandler(std::move(handler))
+{
+  mListenFd = socket(address.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (mListenFd < 0) {
+    ThrowLastError("socket failed");
+  }
+
+  // a restarted daemon must not wait for the connections of the previous one to leave TIME_WAIT
+  const int reuse = 1;
+  setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(mListenFd, reinterpret_cast<const sockaddr*>(&address.addr), address.length) != 0 || listen(mListenFd, ListenBacklog) != 0) {
+    const int error = errno;
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "bind failed");
+  }
+
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    const int error = errno;
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "epoll_create1 failed");
+  }
+
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd < 0) {
+    const int error = errno;
+    close(mEpollFd);
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "timerfd_create failed");
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = mListenFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mListenFd, &event);
+  event.data.fd = mTimerFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &event);
+}
+
+FleetServer::~FleetServer() {
+  for (const auto& [fd, connection] : mConnections) {
+    close(fd);
+  }
+  close(mTimerFd);
+  close(mEpollFd);
+  close(mListenFd);
+}
+
+int FleetServer::GetFd() const {
+  return mEpollFd;
+}
+
+void FleetServer::Dispatch() {
+  epoll_event events[MaxEventsPerDispatch];
+  // a full batch may have left events behind, which would not signal an edge-triggered watcher of GetFd() again
+  int count = MaxEventsPerDispatch;
+  while (count == MaxEventsPerDispatch) {
+    count = epoll_wait(mEpollFd, events, MaxEventsPerDispatch, 0);
+    for (int i = 0; i < count; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == mListenFd) {
+        Accept();
+        continue;
+      }
+      if (fd == mTimerFd) {
+        ExpirePending();
+        continue;
+      }
+
+      const auto itr = mConnections.find(fd);
+      if (itr == mConnections.end()) {
+        continue;
+      }
+      auto& connection = itr->second;
+
+      bool alive = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0 || (events[i].events & EPOLLIN) != 0;
+      if (alive && (events[i].events & EPOLLIN)) {
+        alive = Receive(connection) && ProcessInput(connection);
+      }
+      if (alive) {
+        alive = Flush(connection);
+      }
+      if (!alive) {
+        CloseConnection(fd);
+      }
+    }
+  }
+}
+
+void FleetServer::Accept() {
+  while (true) {
+    const int fd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    if (mConnections.size() >= MaxConnections || mPendingCount >= MaxPendingConnections) {
+      close(fd);
+      continue;
+    }
+
+    Connection connection{fd, false, std::chrono::steady_clock::now() + AuthTimeout, {}, {}, {}, false};
+    if (getrandom(connection.nonce, NonceSize, 0) != static_cast<ssize_t>(NonceSize)) {
+      close(fd);
+      continue;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close(fd);
+      continue;
+    }
+    SetNoDelay(fd);
+
+    // the challenge goes out at once, so that the controller can answer it together with its commands
+    IPC::FrameWriter writer(connection.output, IPC::FrameType::Event);
+    writer.Add(IPC::Opcode::Auth, IPC::Status::Ok, AsString(connection.nonce, NonceSize));
+    writer.Finish();
+    auto& added = mConnections.emplace(fd, std::move(connection)).first->second;
+    mPendingCount++;
+    if (!mArmedDeadline) {
+      // deadlines grow with the accept order, so an armed timer is never later than this one
+      ArmTimer(added.authDeadline);
+    }
+    if (!Flush(added)) {
+      CloseConnection(fd);
+    }
+  }
+}
+
+void FleetServer::CloseConnection(int fd) {
+  if (const auto itr = mConnections.find(fd); itr != mConnections.end() && !itr->second.authenticated) {
+    mPendingCount--;
+  }
+  epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  mConnections.erase(fd);
+}
+
+void FleetServer::ExpirePending() {
+  std::uint64_t expirations;
+  while (read(mTimerFd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+
+  // a scan of at most MaxConnections, only while some are pending
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<int> expired;
+  std::optional<std::chrono::steady_clock::time_point> next;
+  for (const auto& [fd, connection] : mConnections) {
+    if (connection.authenticated) {
+      continue;
+    }
+    if (connection.authDeadline <= now) {
+      expired.push_back(fd);
+    } else if (!next || connection.authDeadline < next.value()) {
+      next = connection.authDeadline;
+    }
+  }
+  for (const int fd : expired) {
+    Metrics::gFleetAuthFailures.Add();
+    CloseConnection(fd);
+  }
+  ArmTimer(next);
+}
+
+void FleetServer::ArmTimer(std::optional<std::chrono::steady_clock::time_point> deadline) {
+  itimerspec spec{};
+  if (deadline) {
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.value().time_since_epoch()).count();
+    spec.it_value.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+  }
+  timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  mArmedDeadline = deadline;
+}
+
+bool FleetServer::Receive(Connection& connection) {
+  while (true) {
+    char buffer[ReceiveChunkSize];
+    const auto received = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      connection.input.append(buffer, static_cast<std::size_t>(received));
+      if (static_cast<std::size_t>(received) < ReceiveChunkSize) {
+        return true;
+      }
+      continue;
+    }
+    if (received == 0) {
+      return false;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+}
+
+bool FleetServer::ProcessInput(Connection& connection) {
+  std::size_t consumed = 0;
+  while (true) {
+    std::size_t frameSize = 0;
+    const auto result = IPC::ParseFrame(std::string_view(connection.input).substr(consumed), mFrame, frameSize);
+    if (result == IPC::ParseResult::Incomplete) {
+      break;
+    }
+    if (result == IPC::ParseResult::Malformed || mFrame.type != IPC::FrameType::Request) {
+      return false;
+    }
+
+    const auto start = Metrics::Clock::now();
+    bool refused = false;
+    IPC::FrameWriter writer(connection.output, IPC::FrameType::Response);
+    if (mFrame.version != IPC::ProtocolVersion) {
+      writer.Add(IPC::Opcode{}, IPC::Status::UnsupportedVersion);
+    } else {
+      for (const auto& command : mFrame.entries) {
+        if (refused) {
+          writer.Add(command.opcode, IPC::Status::Denied);
+          continue;
+        }
+        if (!connection.authenticated) {
+          if (command.opcode == IPC::Opcode::Auth && Sha256::Equal(Sha256::Hmac(mKey, AsString(connection.nonce, NonceSize)), command.payload)) {
+            connection.authenticated = true;
+            mPendingCount--;
+            writer.Add(command.opcode, IPC::Status::Ok);
+          } else {
+            // the rest of the frame is answered too, so the controller still gets one result per command
+            Metrics::gFleetAuthFailures.Add();
+            refused = true;
+            writer.Add(command.opcode, IPC::Status::Denied);
+          }
+          continue;
+        }
+        if (command.opcode == IPC::Opcode::Auth) {
+          writer.Add(command.opcode, IPC::Status::BadRequest);
+          continue;
+        }
+        mResult.clear();
+        const auto status = mHandler(command, mResult);
+        writer.Add(command.opcode, status, mResult);
+      }
+    }
+    writer.Finish();
+    Metrics::gIPCLatency.RecordSince(start);
+    Metrics::gIPCRequests.Add();
+
+    if (refused) {
+      // the refusal is sent on a best-effort basis before the connection is dropped
+      Flush(connection);
+      return false;
+    }
+    consumed += frameSize;
+  }
+  connection.input.erase(0, consumed);
+  return true;
+}
+
+bool FleetServer::Flush(Connection& connection) {
+  std::size_t sent = 0;
+  while (sent < connection.output.size()) {
+    const auto result = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+      break;
+    }
+    sent += static_cast<std::size_t>(result);
+  }
+  connection.output.erase(0, sent);
+
+  // wait for writability only while something is left over
+  if (const bool writing = !connection.output.empty(); writing != connection.writing) {
+    epoll_event event{};
+    event.events = EPOLLIN | (writing ? static_cast<std::uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = connection.fd;
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.writing = writing;
+  }
+  return true;
+}
+
+namespace {
+  using FleetClock = std::chrono::steady_clock;
+
+  enum class FleetPhase : std::uint8_t {
+    Idle,
+    Connecting,
+    AwaitChallenge,
+    AwaitResponse,
+    Done,
+  };
+
+  // one host of SendToFleet
+  struct FleetConnection {
+    int fd = -1;
+    FleetPhase phase = FleetPhase::Idle;
+    FleetClock::time_point start;
+    std::string input;
+    std::string output;
+    bool writing = false;
+  };
+
+  class FleetSender {
+    const std::vector<std::string>& mHosts;
+    std::string_view mKey;
+    const std::vector<IPC::Entry>& mCommands;
+    std::chrono::milliseconds mTimeout;
+    std::vector<FleetResult>& mResults;
+    std::vector<FleetConnection> mConnections;
+    int mEpollFd = -1;
+    std::size_t mOpen = 0;
+    std::size_t mDone = 0;
+    IPC::Frame mFrame;
+
+    void Finish(std::size_t index, std::string error) {
+      auto& connection = mConnections[index];
+      if (connection.fd >= 0) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        connection.fd = -1;
+        mOpen--;
+      }
+      connection.phase = FleetPhase::Done;
+      mDone++;
+      connection.input = {};
+      connection.output = {};
+      mResults[index].latency = FleetClock::now() - connection.start;
+      mResults[index].error = std::move(error);
+    }
+
+    void Watch(std::size_t index, std::uint32_t events) {
+      epoll_event event{};
+      event.events = events;
+      event.data.u64 = index;
+      epoll_ctl(mEpollFd, EPOLL_CTL_MOD, mConnections[index].fd, &event);
+    }
+
+    void Start(std::size_t index, const FleetAddress& address) {
+      auto& connection = mConnections[index];
+      connection.start = FleetClock::now();
+      connection.fd = socket(address.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (connection.fd < 0) {
+        Finish(index, std::error_code(errno, std::system_category()).message());
+        return;
+      }
+      mOpen++;
+      SetNoDelay(connection.fd);
+
+      epoll_event event{};
+      event.events = EPOLLOUT;
+      event.data.u64 = index;
+      if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, connection.fd, &event) != 0) {
+        Finish(index, std::error_code(errno, std::system_category()).message());
+        return;
+      }
+      if (connect(connection.fd, reinterpret_cast<const sockaddr*>(&address.addr), address.length) != 0 && errno != EINPROGRESS) {
+        Finish(index, std::error_code(errno, std::system_category()).message());
+        return;
+      }
+      connection.phase = FleetPhase::Connecting;
+    }
+
+    // false once the host is done
+    bool Send(std::size_t index) {
+      auto& connection = mConnections[index];
+      std::size_t sent = 0;
+      while (sent < connection.output.size()) {
+        const auto result = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Finish(index, std::error_code(errno, std::system_category()).message());
+            return false;
+          }
+          break;
+        }
+        sent += static_cast<std::size_t>(result);
+      }
+      connection.output.erase(0, sent);
+      if (const bool writing = !connection.output.empty(); writing != connection.writing) {
+        Watch(index, EPOLLIN | (writing ? static_cast<std::uint32_t>(EPOLLOUT) : 0u));
+        connection.writing = writing;
+      }
+      return true;
+    }
+
+    void OnChallenge(std::size_t index) {
+      auto& connection = mConnections[index];
+      if (mFrame.type != IPC::FrameType::Event || mFrame.entries.size() != 1 || mFrame.entries[0].opcode != IPC::Opcode::Auth || mFrame.entries[0].payload.size() != FleetServer::NonceSize) {
+        Finish(index, "no challenge from the host"s);
+        return;
+      }
+      const auto mac = Sha256::Hmac(mKey, mFrame.entries[0].payload);
+      IPC::FrameWriter writer(connection.output, IPC::FrameType::Request);
+      writer.Add(IPC::Opcode::Auth, IPC::Status::Ok, Sha256::AsString(mac));
+      for (const auto& command : mCommands) {
+        writer.Add(command.opcode, IPC::Status::Ok, command.payload);
+      }
+      writer.Finish();
+      connection.phase = FleetPhase::AwaitResponse;
+      Send(index);
+    }
+
+    void OnResponse(std::size_t index) {
+      if (mFrame.type != IPC::FrameType::Response || mFrame.entries.size() != mCommands.size() + 1) {
+        Finish(index, "unexpected response"s);
+        return;
+      }
+      if (mFrame.entries[0].status != IPC::Status::Ok) {
+        Finish(index, "authentication refused"s);
+        return;
+      }
+      for (std::size_t i = 1; i < mFrame.entries.size(); i++) {
+        if (const auto status = mFrame.entries[i].status; status != IPC::Status::Ok) {
+          Finish(index, "command "s + std::to_string(static_cast<unsigned>(mFrame.entries[i].opcode)) + " failed with status "s + std::to_string(static_cast<unsigned>(status)));
+          return;
+        }
+      }
+      const auto& last = mFrame.entries.back();
+      if (ReturnsState(last.opcode) && !last.payload.empty()) {
+        mResults[index].state = static_cast<std::uint8_t>(last.payload[0]);
+      }
+      Finish(index, {});
+    }
+
+    void OnReadable(std::size_t index) {
+      auto& connection = mConnections[index];
+      bool closed = false;
+      while (true) {
+        char buffer[ReceiveChunkSize];
+        const auto received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+          connection.input.append(buffer, static_cast<std::size_t>(received));
+          continue;
+        }
+        if (received == 0) {
+          closed = true;
+          break;
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          Finish(index, std::error_code(errno, std::system_category()).message());
+          return;
+        }
+        break;
+      }
+
+      // the challenge and the response may arrive in one read
+      while (connection.phase == FleetPhase::AwaitChallenge || connection.phase == FleetPhase::AwaitResponse) {
+        std::size_t frameSize = 0;
+        const auto result = IPC::ParseFrame(connection.input, mFrame, frameSize);
+        if (result == IPC::ParseResult::Malformed) {
+          Finish(index, "malformed frame"s);
+          return;
+        }
+        if (result == IPC::ParseResult::Incomplete) {
+          break;
+        }
+        if (connection.phase == FleetPhase::AwaitChallenge) {
+          OnChallenge(index);
+        } else {
+          OnResponse(index);
+        }
+        // OnResponse may have released the input, and the frame points into it
+        if (connection.phase != FleetPhase::Done) {
+          connection.input.erase(0, frameSize);
+        }
+      }
+      if (closed && connection.phase != FleetPhase::Done) {
+        Finish(index, "connection closed"s);
+      }
+    }
+
+    void OnEvent(std::size_t index, std::uint32_t events) {
+      auto& connection = mConnections[index];
+      if (connection.phase == FleetPhase::Connecting) {
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) != 0) {
+          error = errno;
+        }
+        if (error != 0) {
+          Finish(index, std::error_code(error, std::system_category()).message());
+          return;
+        }
+        connection.phase = FleetPhase::AwaitChallenge;
+        Watch(index, EPOLLIN);
+        return;
+      }
+      if (events & EPOLLIN) {
+        OnReadable(index);
+      }
+      if (connection.phase != FleetPhase::Done && (events & EPOLLOUT)) {
+        Send(index);
+      }
+      if (connection.phase != FleetPhase::Done && (events & (EPOLLERR | EPOLLHUP))) {
+        Finish(index, "connection closed"s);
+      }
+    }
+
+  public:
+    FleetSender(const std::vector<std::string>& hosts, std::string_view key, const std::vector<IPC::Entry>& commands, std::chrono::milliseconds timeout, std::vector<FleetResult>& results) :
+      mHosts(hosts),
+      mKey(key),
+      mCommands(commands),
+      mTimeout(timeout),
+      mResults(results),
+      mConnections(hosts.size())
+    {
+      mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+      if (mEpollFd < 0) {
+        ThrowLastError("epoll_create1 failed");
+      }
+    }
+
+    ~FleetSender() {
+      for (const auto& connection : mConnections) {
+        if (connection.fd >= 0) {
+          close(connection.fd);
+        }
+      }
+      close(mEpollFd);
+    }
+
+    FleetSender(const FleetSender&) = delete;
+    FleetSender& operator=(const FleetSender&) = delete;
+
+    void Run(std::size_t maxConnections) {
+      // names are resolved up front, so that the connections start back to back
+      std::vector<std::optional<FleetAddress>> addresses;
+      addresses.reserve(mHosts.size());
+      for (const auto& host : mHosts) {
+        addresses.push_back(ResolveFleetAddress(host, false));
+      }
+
+      std::size_t next = 0;
+      // hosts are started in order, so the oldest open one has the earliest deadline
+      std::size_t oldest = 0;
+      epoll_event events[MaxEventsPerDispatch];
+      while (mDone < mHosts.size()) {
+        for (; next < mHosts.size() && mOpen < std::max<std::size_t>(maxConnections, 1); next++) {
+          if (addresses[next]) {
+            Start(next, addresses[next].value());
+          } else {
+            mConnections[next].start = FleetClock::now();
+            Finish(next, "cannot resolve the host"s);
+          }
+        }
+
+        while (oldest < next && mConnections[oldest].phase == FleetPhase::Done) {
+          oldest++;
+        }
+        int wait = -1;
+        if (oldest < next) {
+          const auto remaining = mConnections[oldest].start + mTimeout - FleetClock::now();
+          wait = static_cast<int>(std::max<std::int64_t>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count(), 0));
+        }
+
+        const int count = epoll_wait(mEpollFd, events, MaxEventsPerDispatch, wait);
+        if (count < 0 && errno != EINTR) {
+          ThrowLastError("epoll_wait failed");
+        }
+        for (int i = 0; i < count; i++) {
+          const auto index = static_cast<std::size_t>(events[i].data.u64);
+          if (mConnections[index].phase != FleetPhase::Done) {
+            OnEvent(index, events[i].events);
+          }
+        }
+
+        const auto now = FleetClock::now();
+        for (std::size_t i = oldest; i < next && mConnections[i].start + mTimeout <= now; i++) {
+          if (mConnections[i].phase != FleetPhase::Done) {
+            Finish(i, "timed out"s);
+          }
+        }
+      }
+    }
+  };
+}
+
+std::vector<FleetResult> SendToFleet(const std::vector<std::string>& hosts, std::string_view key, const std::string& request, std::chrono::milliseconds timeout, std::size_t maxConnections) {
+  IPC::Frame frame;
+  std::size_t frameSize = 0;
+  if (IPC::ParseFrame(request, frame, frameSize) != IPC::ParseResult::Complete || frame.type != IPC::FrameType::Request) {
+    throw std::system_error(std::make_error_code(std::errc::invalid_argument), "malformed fleet request");
+  }
+
+  std::vector<FleetResult> results(hosts.size());
+  for (std::size_t i = 0; i < hosts.size(); i++) {
+    results[i].host = hosts[i];
+  }
+  FleetSender sender(hosts, key, frame.entries, timeout, results);
+  sender.Run(maxConnections);
+  return results;
+}
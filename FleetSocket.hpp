@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "IPCProtocol.hpp"
+#include "IPCSocket.hpp"
+
+// fleet control: the IPC protocol over TCP, so that one controller can change the state of many hosts at once
+//
+// on accept the listener sends an event frame with an Auth entry carrying a random nonce; the first entry the
+// controller sends must be Auth with HMAC-SHA256(key, nonce), and every command before it is Denied
+// the commands may follow the Auth entry in the same frame, so a change costs the controller one round trip after
+// the nonce; a wrong MAC closes the connection, and so does no Auth within FleetServer::AuthTimeout
+// the key authenticates the controller but nothing is encrypted, so the listener belongs on a management network
+
+// port used when an address gives none
+constexpr std::uint16_t DefaultFleetPort = 7455;
+// shortest key accepted
+constexpr std::size_t MinFleetKeySize = 16;
+
+struct FleetAddress {
+  sockaddr_storage addr;
+  socklen_t length;
+};
+
+// "host", "host:port", "[v6]" or "[v6]:port"; with numericOnly the host must be a numeric address, so that no DNS
+// lookup is made; nullopt if it does not resolve
+std::optional<FleetAddress> ResolveFleetAddress(std::string_view text, bool numericOnly);
+// "address:port", for messages
+std::string FormatFleetAddress(const FleetAddress& address);
+
+// the shared key of the fleet, the content of path without surrounding whitespace
+// throws std::system_error: std::errc::permission_denied if group or others may read it, std::errc::invalid_argument
+// if the key is shorter than MinFleetKeySize
+std::string ReadFleetKey(const std::filesystem::path& path);
+
+// non-blocking TCP listener for fleet controllers, run like IPCServer
+class FleetServer {
+public:
+  // at most this many connections are open at once; further ones are closed as they are accepted
+  static constexpr std::size_t MaxConnections = 256;
+  // of which at most this many may still be waiting to authenticate, each for at most AuthTimeout after the accept
+  static constexpr std::size_t MaxPendingConnections = 32;
+  static constexpr auto AuthTimeout = std::chrono::seconds(5);
+  static constexpr std::size_t NonceSize = 16;
+
+private:
+  struct Connection {
+    int fd;
+    bool authenticated;
+    // closed when reached before authenticating
+    std::chrono::steady_clock::time_point authDeadline;
+    std::uint8_t nonce[NonceSize];
+    std::string input;
+    std::string output;
+    bool writing;
+  };
+
+  int mListenFd = -1;
+  int mEpollFd = -1;
+  // fires at the earliest authDeadline of the connections which have not authenticated
+  int mTimerFd = -1;
+  std::optional<std::chrono::steady_clock::time_point> mArmedDeadline;
+  std::size_t mPendingCount = 0;
+  std::string mKey;
+  IPCServer::Handler mHandler;
+  std::unordered_map<int, Connection> mConnections;
+  IPC::Frame mFrame;
+  std::string mResult;
+
+  void Accept();
+  void CloseConnection(int fd);
+  void ExpirePending();
+  void ArmTimer(std::optional<std::chrono::steady_clock::time_point> deadline);
+  bool Receive(Connection& connection);
+  bool ProcessInput(Connection& connection);
+  bool Flush(Connection& connection);
+
+public:
+  // throws std::system_error
+  FleetServer(const FleetAddress& address, std::string key, IPCServer::Handler handler);
+  ~FleetServer();
+
+  FleetServer(const FleetServer&) = delete;
+  FleetServer& operator=(const FleetServer&) = delete;
+
+  // readable whenever Dispatch has work to do
+  int GetFd() const;
+  // handles every pending connection event without blocking, so GetFd() may be watched edge-triggered
+  void Dispatch();
+};
+
+// outcome of a fleet request at one host
+struct FleetResult {
+  // "host[:port]" as given
+  std::string host;
+  // empty once every command succeeded
+  std::string error;
+  // StateBits of the last command, if it returned any
+  std::optional<std::uint8_t> state;
+  // from the start of the connect to the response
+  std::chrono::nanoseconds latency{};
+};
+
+// sends the commands of request, a frame built with IPC::FrameWriter, to every host concurrently over non-blocking
+// sockets, each with the Auth entry in front, and waits for all responses or the timeout
+// at most maxConnections are open at once; the results are in the order of hosts
+std::vector<FleetResult> SendToFleet(const std::vector<std::string>& hosts, std::string_view key, const std::string& request, std::chrono::milliseconds timeout, std::size_t maxConnections);
@@ -0,0 +1,220 @@
+#include "HookPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Metrics.hpp"
+
+using namespace std::literals;
+
+extern char** environ;
+
+namespace {
+  // how often a hook is checked on when pidfd is unavailable
+  constexpr auto ReapInterval = 10ms;
+
+  int OpenPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
+  // the waitpid status once the hook is gone, -1 while it is still running
+  int TryReap(pid_t pid) {
+    int status = 0;
+    while (true) {
+      const auto result = waitpid(pid, &status, WNOHANG);
+      if (result == pid) {
+        return status;
+      }
+      if (result == 0) {
+        return -1;
+      }
+      if (errno != EINTR) {
+        return 0;
+      }
+    }
+  }
+
+  int Reap(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    return status;
+  }
+}
+
+HookPool::HookPool(std::size_t workerCount, std::size_t queueCapacity) :
+  mWorkerCount(std::max<std::size_t>(workerCount, 1)),
+  mQueueCapacity(std::max<std::size_t>(queueCapacity, 1))
+{
+  mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mStopFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "eventfd failed");
+  }
+}
+
+HookPool::~HookPool() {
+  {
+    std::lock_guard lock(mMutex);
+    mStopping = true;
+    mQueue.clear();
+  }
+  mCondition.notify_all();
+  const std::uint64_t one = 1;
+  [[maybe_unused]] const auto written = write(mStopFd, &one, sizeof(one));
+  for (auto& worker : mWorkers) {
+    worker.join();
+  }
+  close(mStopFd);
+}
+
+void HookPool::Submit(std::string name, std::string command, std::vector<std::string> environment, std::chrono::milliseconds timeout) {
+  {
+    std::lock_guard lock(mMutex);
+    if (const auto itr = std::find_if(mQueue.begin(), mQueue.end(), [&](const Hook& hook) { return hook.name == name; }); itr != mQueue.end()) {
+      mQueue.erase(itr);
+      Metrics::gHookCoalesced.Add();
+    } else if (mQueue.size() >= mQueueCapacity) {
+      mQueue.pop_front();
+      Metrics::gHookCoalesced.Add();
+    }
+    mQueue.push_back(Hook{std::move(name), std::move(command), std::move(environment), timeout});
+
+    if (mIdleWorkers == 0 && mWorkers.size() < mWorkerCount) {
+      mWorkers.emplace_back(&HookPool::WorkerProc, this);
+      return;
+    }
+  }
+  mCondition.notify_one();
+}
+
+void HookPool::WorkerProc() {
+  std::unique_lock lock(mMutex);
+  while (true) {
+    mIdleWorkers++;
+    mCondition.wait(lock, [this] { return mStopping || !mQueue.empty(); });
+    mIdleWorkers--;
+    if (mStopping) {
+      return;
+    }
+    const auto hook = std::move(mQueue.front());
+    mQueue.pop_front();
+
+    lock.unlock();
+    Run(hook);
+    lock.lock();
+  }
+}
+
+void HookPool::Run(const Hook& hook) {
+  std::vector<char*> envp;
+  for (auto env = environ; *env != nullptr; env++) {
+    envp.push_back(*env);
+  }
+  std::vector<std::string> environment = hook.environment;
+  for (auto& env : environment) {
+    envp.push_back(env.data());
+  }
+  envp.push_back(nullptr);
+  std::string command = hook.command;
+  char shell[] = "/bin/sh";
+  char option[] = "-c";
+  char* const argv[] = {shell, option, command.data(), nullptr};
+
+  // a group of its own, so that a timeout also ends whatever the shell started; the daemon's blocked signals are
+  // not passed on
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setpgroup(&attr, 0);
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attr, &signals);
+  sigaddset(&signals, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &signals);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+  const auto start = Metrics::Clock::now();
+  pid_t pid = 0;
+  const int spawnError = posix_spawn(&pid, shell, &actions, &attr, argv, envp.data());
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  Metrics::gHookRuns.Add();
+  if (spawnError != 0) {
+    Metrics::gHookFailures.Add();
+    std::fprintf(stderr, "Warning: hook %s failed to start: %s\n", hook.name.c_str(), std::strerror(spawnError));
+    return;
+  }
+
+  const int pidFd = OpenPidfd(pid);
+  const auto deadline = start + hook.timeout;
+  int status = -1;
+  bool timedOut = false;
+  bool stopped = false;
+  while (status < 0) {
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Metrics::Clock::now());
+    if (remaining <= 0ms) {
+      timedOut = true;
+      break;
+    }
+    pollfd pollFds[] = {
+      {mStopFd, POLLIN, 0},
+      {pidFd, POLLIN, 0},
+    };
+    const auto wait = pidFd >= 0 ? remaining : std::min<std::chrono::milliseconds>(remaining, ReapInterval);
+    if (poll(pollFds, pidFd >= 0 ? 2 : 1, static_cast<int>(wait.count())) < 0 && errno != EINTR) {
+      break;
+    }
+    if (pollFds[0].revents & POLLIN) {
+      stopped = true;
+      break;
+    }
+    status = TryReap(pid);
+  }
+  if (status < 0) {
+    kill(-pid, SIGKILL);
+    status = Reap(pid);
+  }
+  if (pidFd >= 0) {
+    close(pidFd);
+  }
+  Metrics::gHookLatency.RecordSince(start);
+
+  if (stopped) {
+    return;
+  }
+  if (timedOut) {
+    Metrics::gHookTimeouts.Add();
+    Metrics::gHookFailures.Add();
+    std::fprintf(stderr, "Warning: hook %s killed after %lld ms\n", hook.name.c_str(), static_cast<long long>(hook.timeout.count()));
+  } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    Metrics::gHookFailures.Add();
+    std::fprintf(stderr, "Warning: hook %s failed with status %d\n", hook.name.c_str(), WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// runs hook commands on a bounded pool of worker threads, so that a slow or hung hook delays nothing but other hooks
+// each hook is `/bin/sh -c command` in a process group of its own, with stdin from /dev/null and the given variables
+// added to the environment; the group is killed once the hook runs longer than its timeout
+//
+// a queued hook replaces any queued hook of the same name, moving behind everything queued since, so a burst of
+// transitions runs the latest of each; once the queue is full the oldest queued hook is dropped
+// runs, failures, timeouts, coalesced hooks and durations go to Metrics
+class HookPool {
+  struct Hook {
+    std::string name;
+    std::string command;
+    std::vector<std::string> environment;
+    std::chrono::milliseconds timeout;
+  };
+
+  std::size_t mWorkerCount;
+  std::size_t mQueueCapacity;
+  // readable once the pool is being destroyed, to wake workers waiting for a hook to exit
+  int mStopFd = -1;
+
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::deque<Hook> mQueue;
+  std::size_t mIdleWorkers = 0;
+  bool mStopping = false;
+  // started on demand, so a daemon without hooks has no threads
+  std::vector<std::thread> mWorkers;
+
+  void WorkerProc();
+  void Run(const Hook& hook);
+
+public:
+  static constexpr std::size_t DefaultQueueCapacity = 16;
+
+  // throws std::system_error
+  explicit HookPool(std::size_t workerCount, std::size_t queueCapacity = DefaultQueueCapacity);
+  // drops the queued hooks and kills the running ones
+  ~HookPool();
+
+  HookPool(const HookPool&) = delete;
+  HookPool& operator=(const HookPool&) = delete;
+
+  // queues a hook and returns at once; environment holds "NAME=value" entries
+  void Submit(std::string name, std::string command, std::vector<std::string> environment, std::chrono::milliseconds timeout);
+};
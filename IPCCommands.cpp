@@ -0,0 +1,187 @@
+#include "IPCCommands.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "IPCProtocol.hpp"
+#include "LeaseTable.hpp"
+#include "Metrics.hpp"
+#include "Preventer.hpp"
+
+using namespace std::literals;
+
+namespace IPC {
+  namespace {
+    // keeps client leases apart from the ones the daemon takes for its rules
+    constexpr auto ClientLeasePrefix = "client:"sv;
+    // far enough out to mean forever, near enough not to overflow the clock
+    constexpr auto MaxLeaseTTL = std::chrono::hours(24 * 366 * 100);
+
+    UserLimits gUserLimits;
+
+    bool IsValidLeaseName(std::string_view name) {
+      return !name.empty() && name.size() <= MaxLeaseNameSize;
+    }
+
+    // digits of the largest uid
+    constexpr std::size_t MaxUidSize = 10;
+
+    // appends GetUserLeasePrefix(uid) without a temporary, as it is part of every command a user sends
+    void AppendUserLeasePrefix(std::string& name, std::uint32_t uid) {
+      char digits[MaxUidSize];
+      const auto end = std::to_chars(digits, digits + MaxUidSize, uid).ptr;
+      name.append(UserLeasePrefix);
+      name.append(digits, static_cast<std::size_t>(end - digits));
+      name.push_back(':');
+    }
+  }
+
+  void SetUserLimits(const UserLimits& limits) {
+    gUserLimits = limits;
+  }
+
+  std::string GetUserLeasePrefix(std::uint32_t uid) {
+    std::string prefix;
+    AppendUserLeasePrefix(prefix, uid);
+    return prefix;
+  }
+
+  std::pair<std::optional<std::uint32_t>, std::string_view> SplitUserLeaseName(std::string_view name) {
+    if (name.substr(0, UserLeasePrefix.size()) != UserLeasePrefix) {
+      return {std::nullopt, name};
+    }
+    std::uint32_t uid = 0;
+    const auto end = name.data() + name.size();
+    const auto [uidEnd, error] = std::from_chars(name.data() + UserLeasePrefix.size(), end, uid);
+    if (error != std::errc() || uidEnd == end || *uidEnd != ':') {
+      return {std::nullopt, name};
+    }
+    return {uid, name.substr(static_cast<std::size_t>(uidEnd - name.data()) + 1)};
+  }
+
+  std::string GetClientLeaseName(std::string_view name) {
+    std::string leaseName(ClientLeasePrefix);
+    leaseName.append(name);
+    return leaseName;
+  }
+
+  std::string GetClientLeaseName(const Caller& caller, std::string_view name) {
+    if (caller.owner) {
+      return GetClientLeaseName(name);
+    }
+    std::string leaseName;
+    leaseName.reserve(UserLeasePrefix.size() + MaxUidSize + 1 + ClientLeasePrefix.size() + name.size());
+    AppendUserLeasePrefix(leaseName, caller.uid);
+    leaseName.append(ClientLeasePrefix);
+    leaseName.append(name);
+    return leaseName;
+  }
+
+  Status CheckLeaseLimit(const Caller& caller, std::string_view leaseName) {
+    if (caller.owner || gUserLimits.maxLeases == 0) {
+      return Status::Ok;
+    }
+    // the caller's prefix is the start of leaseName, so it need not be built again
+    const auto prefix = leaseName.substr(0, leaseName.size() - SplitUserLeaseName(leaseName).second.size());
+    if (Preventer::IsLeaseWithinLimit(leaseName, prefix, gUserLimits.maxLeases)) {
+      return Status::Ok;
+    }
+    Metrics::gIPCDenied.Add();
+    return Status::Denied;
+  }
+
+  std::optional<LeaseTable::Clock::time_point> LimitExpiry(const Caller& caller, std::optional<LeaseTable::Clock::time_point> expiry) {
+    if (caller.owner || gUserLimits.maxDuration <= std::chrono::milliseconds::zero()) {
+      return expiry;
+    }
+    const auto limit = LeaseTable::Clock::now() + gUserLimits.maxDuration;
+    return expiry && expiry.value() < limit ? expiry : limit;
+  }
+
+  std::uint8_t GetStateBits() {
+    // what was applied rather than what the flags and leases ask for, so that replies and events agree with the
+    // journal, the hooks and the status page while a coalesced flush is pending
+    return Preventer::GetAppliedState();
+  }
+
+  Status ExecuteCommand(const Entry& command, std::string& result) {
+    return ExecuteCommandFor(Caller{}, command, result);
+  }
+
+  Status ExecuteCommandFor(const Caller& caller, const Entry& command, std::string& result) {
+    Status status = Status::Ok;
+
+    switch (command.opcode) {
+      case Opcode::GetState:
+        break;
+
+      case Opcode::ApplyFlags:
+        if (command.payload.size() != sizeof(std::uint32_t)) {
+          return Status::BadRequest;
+        }
+        // the manual state is shared by every user, so only the owner may change it; others take leases or holds
+        if (!caller.owner && ReadU32(command.payload) != 0) {
+          Metrics::gIPCDenied.Add();
+          return Status::Denied;
+        }
+        if (!Preventer::ApplyStateFromIPCFlags(ReadU32(command.payload))) {
+          // the state is still updated; only the backend call failed
+          status = Status::Failed;
+        }
+        break;
+
+      case Opcode::AcquireLease: {
+        constexpr std::size_t HeaderSize = sizeof(std::uint8_t) + sizeof(std::uint64_t);
+        if (command.payload.size() < HeaderSize || !IsValidLeaseName(command.payload.substr(HeaderSize))) {
+          return Status::BadRequest;
+        }
+        const auto modes = static_cast<std::uint8_t>(command.payload[0]);
+        const auto ttl = ReadU64(command.payload, sizeof(std::uint8_t));
+        if ((modes & ~(LeaseModes::System | LeaseModes::Display)) != 0 || ttl > static_cast<std::uint64_t>(std::chrono::milliseconds(MaxLeaseTTL).count())) {
+          return Status::BadRequest;
+        }
+        std::optional<LeaseTable::Clock::time_point> expiry;
+        if (ttl != 0) {
+          expiry = LeaseTable::Clock::now() + std::chrono::milliseconds(ttl);
+        }
+        const auto leaseName = GetClientLeaseName(caller, command.payload.substr(HeaderSize));
+        if (const auto limitStatus = CheckLeaseLimit(caller, leaseName); limitStatus != Status::Ok) {
+          return limitStatus;
+        }
+        if (!Preventer::AcquireLease(leaseName, modes, LimitExpiry(caller, expiry))) {
+          status = Status::Failed;
+        }
+        break;
+      }
+
+      case Opcode::ReleaseLease:
+        if (!IsValidLeaseName(command.payload)) {
+          return Status::BadRequest;
+        }
+        if (!Preventer::ReleaseLease(GetClientLeaseName(caller, command.payload))) {
+          status = Status::Failed;
+        }
+        break;
+
+      case Opcode::GetStats:
+        if (!command.payload.empty()) {
+          return Status::BadRequest;
+        }
+        result = Metrics::FormatPrometheus();
+        return Status::Ok;
+
+      default:
+        return Status::UnknownCommand;
+    }
+
+    result.push_back(static_cast<char>(GetStateBits()));
+    return status;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "IPCProtocol.hpp"
+#include "LeaseTable.hpp"
+
+namespace IPC {
+  // the state Preventer last applied, as StateBits
+  std::uint8_t GetStateBits();
+
+  // who a command runs for, from the credentials of its connection
+  struct Caller {
+    std::uint32_t uid = 0;
+    // the daemon's own user or root; other users may not change the manual state, and their leases are kept apart
+    // under their uid and limited
+    bool owner = true;
+  };
+
+  // limits on each user other than the owner; 0 for none
+  struct UserLimits {
+    // leases and holds at once
+    std::size_t maxLeases = 0;
+    // longest time a lease or hold lasts; longer ones, and ones without an expiry, are cut to it
+    std::chrono::milliseconds maxDuration = std::chrono::milliseconds::zero();
+  };
+
+  // set on the thread that executes commands
+  void SetUserLimits(const UserLimits& limits);
+
+  // keeps the leases of each user other than the owner apart, so that one cannot release another's or count against
+  // its limits
+  inline constexpr std::string_view UserLeasePrefix = "uid:";
+
+  // "uid:<uid>:", which the names of the leases and holds of a user other than the owner start with
+  std::string GetUserLeasePrefix(std::uint32_t uid);
+
+  // the uid of the GetUserLeasePrefix a lease name starts with, nullopt if it has none, and the rest of the name
+  std::pair<std::optional<std::uint32_t>, std::string_view> SplitUserLeaseName(std::string_view name);
+
+  // the lease a client's AcquireLease and ReleaseLease commands act on
+  std::string GetClientLeaseName(std::string_view name);
+  std::string GetClientLeaseName(const Caller& caller, std::string_view name);
+
+  // Status::Denied if taking leaseName would give the caller more leases than UserLimits::maxLeases; another
+  // reference on a lease it holds is not one more
+  // counts only the caller's own leases, so the check stays cheap however many users there are
+  Status CheckLeaseLimit(const Caller& caller, std::string_view leaseName);
+  // expiry, cut to UserLimits::maxDuration from now for a caller other than the owner
+  std::optional<LeaseTable::Clock::time_point> LimitExpiry(const Caller& caller, std::optional<LeaseTable::Clock::time_point> expiry);
+
+  // executes one command against Preventer and writes its result payload; as the owner unless a caller is given
+  Status ExecuteCommand(const Entry& command, std::string& result);
+  Status ExecuteCommandFor(const Caller& caller, const Entry& command, std::string& result);
+} // namespace IPC
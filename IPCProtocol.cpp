@@ -0,0 +1,145 @@
+#include "IPCProtocol.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace IPC {
+  namespace {
+    std::uint16_t ReadU16(std::string_view data, std::size_t offset) {
+      return static_cast<std::uint16_t>(
+        static_cast<std::uint8_t>(data[offset]) |
+        static_cast<std::uint8_t>(data[offset + 1]) << 8);
+    }
+
+    void AppendU16(std::string& buffer, std::uint16_t value) {
+      buffer.push_back(static_cast<char>(value & 0xFF));
+      buffer.push_back(static_cast<char>(value >> 8));
+    }
+
+    void WriteU32(std::string& buffer, std::size_t offset, std::uint32_t value) {
+      for (int i = 0; i < 4; i++) {
+        buffer[offset + i] = static_cast<char>((value >> (i * 8)) & 0xFF);
+      }
+    }
+
+    void WriteU16(std::string& buffer, std::size_t offset, std::uint16_t value) {
+      buffer[offset] = static_cast<char>(value & 0xFF);
+      buffer[offset + 1] = static_cast<char>(value >> 8);
+    }
+  }
+
+  void AppendU32(std::string& buffer, std::uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      buffer.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+  }
+
+  void AppendU64(std::string& buffer, std::uint64_t value) {
+    AppendU32(buffer, static_cast<std::uint32_t>(value));
+    AppendU32(buffer, static_cast<std::uint32_t>(value >> 32));
+  }
+
+  std::uint32_t ReadU32(std::string_view data, std::size_t offset) {
+    return
+      static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[offset])) |
+      static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[offset + 1])) << 8 |
+      static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[offset + 2])) << 16 |
+      static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[offset + 3])) << 24;
+  }
+
+  std::uint64_t ReadU64(std::string_view data, std::size_t offset) {
+    return static_cast<std::uint64_t>(ReadU32(data, offset)) | static_cast<std::uint64_t>(ReadU32(data, offset + 4)) << 32;
+  }
+
+  ParseResult ParseFrame(std::string_view data, Frame& frame, std::size_t& frameSize) {
+    if (data.size() < FrameHeaderSize) {
+      return ParseResult::Incomplete;
+    }
+
+    const std::size_t size = ReadU32(data, 0);
+    if (size < FrameHeaderSize || size > MaxFrameSize) {
+      return ParseResult::Malformed;
+    }
+    if (data.size() < size) {
+      return ParseResult::Incomplete;
+    }
+
+    frame.version = static_cast<std::uint8_t>(data[4]);
+    frame.type = static_cast<FrameType>(data[5]);
+    frame.entries.clear();
+    frameSize = size;
+
+    // entries of other versions are not interpreted; the caller only needs the version to reject the frame
+    if (frame.version != ProtocolVersion) {
+      return ParseResult::Complete;
+    }
+
+    const std::size_t count = ReadU16(data, 6);
+    std::size_t pos = FrameHeaderSize;
+    for (std::size_t i = 0; i < count; i++) {
+      if (pos + EntryHeaderSize > size) {
+        return ParseResult::Malformed;
+      }
+      const std::size_t payloadSize = ReadU32(data, pos + 4);
+      if (payloadSize > size - pos - EntryHeaderSize) {
+        return ParseResult::Malformed;
+      }
+      frame.entries.push_back(Entry{
+        static_cast<Opcode>(ReadU16(data, pos)),
+        static_cast<Status>(ReadU16(data, pos + 2)),
+        data.substr(pos + EntryHeaderSize, payloadSize),
+      });
+      pos += EntryHeaderSize + payloadSize;
+    }
+    if (pos != size) {
+      return ParseResult::Malformed;
+    }
+
+    return ParseResult::Complete;
+  }
+
+  std::string FormatStateBits(std::uint8_t bits) {
+    std::string text = "---/--";
+    if (bits & StateBits::Enable) {
+      text[0] = 'E';
+    }
+    if (bits & StateBits::SystemFlag) {
+      text[1] = 'S';
+    }
+    if (bits & StateBits::DisplayFlag) {
+      text[2] = 'D';
+    }
+    if (bits & StateBits::ActiveSystem) {
+      text[4] = 's';
+    }
+    if (bits & StateBits::ActiveDisplay) {
+      text[5] = 'd';
+    }
+    return text;
+  }
+
+  FrameWriter::FrameWriter(std::string& buffer, FrameType type, std::uint8_t version) :
+    mBuffer(buffer),
+    mFrameBegin(buffer.size())
+  {
+    AppendU32(mBuffer, 0);
+    mBuffer.push_back(static_cast<char>(version));
+    mBuffer.push_back(static_cast<char>(type));
+    AppendU16(mBuffer, 0);
+  }
+
+  void FrameWriter::Add(Opcode opcode, Status status, std::string_view payload) {
+    AppendU16(mBuffer, static_cast<std::uint16_t>(opcode));
+    AppendU16(mBuffer, static_cast<std::uint16_t>(status));
+    AppendU32(mBuffer, static_cast<std::uint32_t>(payload.size()));
+    mBuffer.append(payload);
+    mCount++;
+  }
+
+  void FrameWriter::Finish() {
+    WriteU32(mBuffer, mFrameBegin, static_cast<std::uint32_t>(mBuffer.size() - mFrameBegin));
+    WriteU16(mBuffer, mFrameBegin + 6, mCount);
+  }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// versioned, length-prefixed binary protocol spoken over the IPC socket
+//
+// frame:  u32 frame size (including this header) | u8 version | u8 frame type | u16 entry count | entries...
+// entry:  u16 opcode | u16 status | u32 payload size | payload...
+//
+// a request frame carries any number of commands, and the response frame carries one result per command in the same order
+// a connection which sent Watch also receives event frames, pushed between responses whenever the state changes
+// all integers are little endian; requests have status 0
+namespace IPC {
+  constexpr std::uint8_t ProtocolVersion = 1;
+  constexpr std::size_t FrameHeaderSize = 8;
+  constexpr std::size_t EntryHeaderSize = 8;
+  constexpr std::size_t MaxFrameSize = 64 * 1024;
+
+  enum class FrameType : std::uint8_t {
+    Request = 1,
+    Response = 2,
+    Event = 3,
+  };
+
+  enum class Opcode : std::uint16_t {
+    // payload: none; result: u8 StateBits
+    GetState = 1,
+    // payload: u32 Preventer::IPCFlags; result: u8 StateBits after applying
+    ApplyFlags = 2,
+    // holds a lease until a deadline; the set bits of the flags select its modes (sleep if none), and the manual state is left alone
+    // payload: u32 Preventer::IPCFlags | u64 duration in milliseconds; result: u8 StateBits | u64 hold id
+    HoldFor = 3,
+    // payload: u32 Preventer::IPCFlags | u64 unix time in milliseconds; result: u8 StateBits | u64 hold id
+    HoldUntil = 4,
+    // payload: none to cancel every hold of the caller, or u64 hold id; result: u8 StateBits
+    CancelHolds = 5,
+    // takes a reference on a named lease, see LeaseTable; with a TTL of 0 it lasts until released
+    // payload: u8 LeaseModes | u64 TTL in milliseconds, 0 for none | name; result: u8 StateBits
+    AcquireLease = 6,
+    // drops one reference
+    // payload: name; result: u8 StateBits
+    ReleaseLease = 7,
+    // payload: none; result: every metric in the Prometheus text format
+    GetStats = 8,
+    // subscribes the connection to state changes until it is closed
+    // payload: none; result: u8 StateBits
+    // event: u8 StateBits | u32 number of earlier events folded into this one; a subscriber which falls behind
+    // gets only the latest state once it catches up
+    Watch = 9,
+    // what each user holds, for users with at least one lease or hold; a caller other than the daemon's owner and
+    // root sees only its own
+    // payload: none; result: per user, u32 uid | u32 number of leases and holds | u8 LeaseModes
+    GetUsers = 10,
+    // proves knowledge of the fleet key, see FleetSocket.hpp; only the fleet listener knows it
+    // event, sent once when a fleet connection is accepted: nonce
+    // payload: HMAC-SHA256 of the nonce under the fleet key; result: none
+    Auth = 11,
+  };
+
+  // lease names are 1 to MaxLeaseNameSize bytes; clients cannot reach the daemon's own leases
+  constexpr std::size_t MaxLeaseNameSize = 255;
+
+  enum class Status : std::uint16_t {
+    Ok = 0,
+    UnknownCommand = 1,
+    BadRequest = 2,
+    UnsupportedVersion = 3,
+    Failed = 4,
+    // refused by a per-user limit, or by the fleet listener before Auth; nothing was changed
+    Denied = 5,
+  };
+
+  namespace StateBits {
+    constexpr std::uint8_t Enable = 0x01;
+    constexpr std::uint8_t SystemFlag = 0x02;
+    constexpr std::uint8_t DisplayFlag = 0x04;
+    // what the backend holds: the manual state together with the leases
+    constexpr std::uint8_t ActiveSystem = 0x08;
+    constexpr std::uint8_t ActiveDisplay = 0x10;
+  } // namespace StateBits
+
+  struct Entry {
+    Opcode opcode;
+    Status status;
+    // points into the buffer the frame was parsed from
+    std::string_view payload;
+  };
+
+  struct Frame {
+    std::uint8_t version = 0;
+    FrameType type = FrameType::Request;
+    std::vector<Entry> entries;
+  };
+
+  enum class ParseResult {
+    Complete,
+    Incomplete,
+    Malformed,
+  };
+
+  // parses the frame at the front of data; frame.entries is reused to avoid allocation
+  // on Complete, frameSize receives the number of bytes the frame occupies
+  ParseResult ParseFrame(std::string_view data, Frame& frame, std::size_t& frameSize);
+
+  // appends a frame to buffer; call Add for each entry, then Finish
+  class FrameWriter {
+    std::string& mBuffer;
+    std::size_t mFrameBegin;
+    std::uint16_t mCount = 0;
+
+  public:
+    FrameWriter(std::string& buffer, FrameType type, std::uint8_t version = ProtocolVersion);
+
+    void Add(Opcode opcode, Status status, std::string_view payload = {});
+    void Finish();
+  };
+
+  // StateBits as "ESD/sd": the manual enable, system and display flags, then what is held from the system;
+  // '-' for each unset bit
+  std::string FormatStateBits(std::uint8_t bits);
+
+  void AppendU32(std::string& buffer, std::uint32_t value);
+  void AppendU64(std::string& buffer, std::uint64_t value);
+  std::uint32_t ReadU32(std::string_view data, std::size_t offset = 0);
+  std::uint64_t ReadU64(std::string_view data, std::size_t offset = 0);
+} // namespace IPC
@@ -0,0 +1,479 @@
+#include "IPCSocket.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "IPCProtocol.hpp"
+#include "Metrics.hpp"
+
+using namespace std::literals;
+
+namespace {
+  constexpr int ListenBacklog = 64;
+  constexpr std::size_t ReceiveChunkSize = 16 * 1024;
+  constexpr int MaxEventsPerDispatch = 64;
+  // kernel send buffer of a subscriber, so that one which does not read pins little kernel memory
+  constexpr int SubscriberSendBufferSize = 4 * 1024;
+
+  // the daemon's own user and root are trusted with any number of connections
+  bool IsLimitedUser(std::uint32_t uid) {
+    return uid != getuid() && uid != 0;
+  }
+
+  [[noreturn]] void ThrowLastError(const char* what) {
+    throw std::system_error(std::error_code(errno, std::system_category()), what);
+  }
+
+  std::pair<sockaddr_un, socklen_t> MakeAbstractAddress(const std::string& name) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (name.size() + 1 > sizeof(addr.sun_path)) {
+      throw std::system_error(std::make_error_code(std::errc::filename_too_long), "IPC socket name too long");
+    }
+    std::memcpy(addr.sun_path + 1, name.data(), name.size());
+    return {addr, static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size())};
+  }
+}
+
+std::string GetDefaultIPCSocketName() {
+  if (const auto name = std::getenv("SLEEPPREVENTER_SOCKET"); name != nullptr && name[0] != '\0') {
+    return name;
+  }
+  // abstract sockets are not scoped per user, so the uid keeps users apart
+  return "SleepPreventer."s + std::to_string(getuid());
+}
+
+std::string GetSystemIPCSocketName() {
+  if (const auto name = std::getenv("SLEEPPREVENTER_SOCKET"); name != nullptr && name[0] != '\0') {
+    return name;
+  }
+  return "SleepPreventer.system"s;
+}
+
+IPCServer::IPCServer(const std::string& name, Handler handler, Access access) :
+  mHandler(std::move(handler)),
+  mAccess(access)
+{
+  const auto [addr, addrLength] = MakeAbstractAddress(name);
+
+  mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (mListenFd < 0) {
+    ThrowLastError("socket failed");
+  }
+
+  // binding an abstract address doubles as the single instance check
+  if (bind(mListenFd, reinterpret_cast<const sockaddr*>(&addr), addrLength) != 0 || listen(mListenFd, ListenBacklog) != 0) {
+    const int error = errno;
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "bind failed");
+  }
+
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    const int error = errno;
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "epoll_create1 failed");
+  }
+
+  mFlushFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mFlushFd < 0) {
+    const int error = errno;
+    close(mEpollFd);
+    close(mListenFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "eventfd failed");
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = mListenFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mListenFd, &event);
+  event.data.fd = mFlushFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mFlushFd, &event);
+}
+
+IPCServer::~IPCServer() {
+  for (const auto& [fd, connection] : mConnections) {
+    close(fd);
+  }
+  close(mFlushFd);
+  close(mEpollFd);
+  close(mListenFd);
+}
+
+int IPCServer::GetFd() const {
+  return mEpollFd;
+}
+
+void IPCServer::Dispatch() {
+  epoll_event events[MaxEventsPerDispatch];
+  // a full batch may have left events behind, which would not signal an edge-triggered watcher of GetFd() again
+  int count = MaxEventsPerDispatch;
+  while (count == MaxEventsPerDispatch) {
+    count = epoll_wait(mEpollFd, events, MaxEventsPerDispatch, 0);
+    for (int i = 0; i < count; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == mListenFd) {
+        Accept();
+        continue;
+      }
+      if (fd == mFlushFd) {
+        FlushSubscribers();
+        continue;
+      }
+
+      const auto itr = mConnections.find(fd);
+      if (itr == mConnections.end()) {
+        continue;
+      }
+      auto& connection = itr->second;
+
+      bool alive = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0 || (events[i].events & EPOLLIN) != 0;
+      if (alive && (events[i].events & EPOLLIN)) {
+        alive = Receive(connection);
+      }
+      // requests held back by MaxOutputBacklog are picked up as the output drains
+      while (alive) {
+        alive = ProcessInput(connection);
+        const bool capped = connection.output.size() >= MaxOutputBacklog;
+        alive = alive && Flush(connection);
+        if (!capped || !connection.output.empty()) {
+          break;
+        }
+      }
+      if (!alive) {
+        CloseConnection(fd);
+      }
+    }
+  }
+}
+
+void IPCServer::Accept() {
+  while (true) {
+    const int fd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    // unless it serves every user, only the owner of the daemon (or root) may control it
+    ucred cred{};
+    socklen_t credLength = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLength) != 0 || (mAccess == Access::Owner && IsLimitedUser(cred.uid))) {
+      close(fd);
+      continue;
+    }
+    const auto uid = static_cast<std::uint32_t>(cred.uid);
+    const bool limited = IsLimitedUser(uid);
+    if (const auto itr = mUserConnections.find(uid); limited && itr != mUserConnections.end() && itr->second >= MaxConnectionsPerUser) {
+      close(fd);
+      continue;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close(fd);
+      continue;
+    }
+    mConnections.emplace(fd, Connection{fd, Peer{static_cast<std::uint32_t>(cred.pid), uid}, {}, {}, EPOLLIN, false, std::nullopt, {}, 0});
+    if (limited) {
+      mUserConnections[uid]++;
+    }
+  }
+}
+
+void IPCServer::CloseConnection(int fd) {
+  if (const auto itr = mConnections.find(fd); itr != mConnections.end()) {
+    if (itr->second.subscribed) {
+      mSubscriberCount--;
+    }
+    if (const auto uid = itr->second.peer.uid; IsLimitedUser(uid) && --mUserConnections[uid] == 0) {
+      mUserConnections.erase(uid);
+    }
+  }
+  epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  mConnections.erase(fd);
+}
+
+bool IPCServer::Receive(Connection& connection) {
+  while (true) {
+    char buffer[ReceiveChunkSize];
+    const auto received = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      connection.input.append(buffer, static_cast<std::size_t>(received));
+      if (static_cast<std::size_t>(received) < ReceiveChunkSize) {
+        return true;
+      }
+      continue;
+    }
+    if (received == 0) {
+      return false;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+}
+
+bool IPCServer::ProcessInput(Connection& connection) {
+  std::size_t consumed = 0;
+  while (connection.output.size() < MaxOutputBacklog) {
+    std::size_t frameSize = 0;
+    const auto result = IPC::ParseFrame(std::string_view(connection.input).substr(consumed), mFrame, frameSize);
+    if (result == IPC::ParseResult::Incomplete) {
+      break;
+    }
+    if (result == IPC::ParseResult::Malformed || mFrame.type != IPC::FrameType::Request) {
+      return false;
+    }
+
+    const auto start = Metrics::Clock::now();
+    mCurrent = &connection;
+    IPC::FrameWriter writer(connection.output, IPC::FrameType::Response);
+    if (mFrame.version != IPC::ProtocolVersion) {
+      writer.Add(IPC::Opcode{}, IPC::Status::UnsupportedVersion);
+    } else {
+      for (const auto& command : mFrame.entries) {
+        mResult.clear();
+        const auto status = mHandler(command, mResult);
+        writer.Add(command.opcode, status, mResult);
+      }
+    }
+    writer.Finish();
+    mCurrent = nullptr;
+    Metrics::gIPCLatency.RecordSince(start);
+    Metrics::gIPCRequests.Add();
+
+    consumed += frameSize;
+  }
+  connection.input.erase(0, consumed);
+  return true;
+}
+
+const IPCServer::Peer& IPCServer::GetPeer() const {
+  return mCurrent->peer;
+}
+
+void IPCServer::Subscribe() {
+  if (mCurrent->subscribed) {
+    return;
+  }
+  mCurrent->subscribed = true;
+  mSubscriberCount++;
+  setsockopt(mCurrent->fd, SOL_SOCKET, SO_SNDBUF, &SubscriberSendBufferSize, sizeof(SubscriberSendBufferSize));
+}
+
+void IPCServer::Publish(IPC::Opcode opcode, std::string_view payload) {
+  if (mSubscriberCount == 0) {
+    return;
+  }
+
+  // the frame is built once; every subscriber which is keeping up gets a copy with a count of 0
+  mEvent.clear();
+  IPC::FrameWriter writer(mEvent, IPC::FrameType::Event);
+  std::string eventPayload(payload);
+  IPC::AppendU32(eventPayload, 0);
+  writer.Add(opcode, IPC::Status::Ok, eventPayload);
+  writer.Finish();
+
+  const bool signalled = !mFlushFds.empty();
+  for (auto& [fd, connection] : mConnections) {
+    if (!connection.subscribed) {
+      continue;
+    }
+    if (connection.output.size() >= MaxSubscriberBacklog) {
+      if (connection.pendingOpcode) {
+        connection.coalescedEvents++;
+      }
+      connection.pendingOpcode = opcode;
+      connection.pendingPayload.assign(payload);
+      continue;
+    }
+    // output left over from before is already waiting for EPOLLOUT or in mFlushFds
+    if (connection.output.empty()) {
+      mFlushFds.push_back(fd);
+    }
+    connection.output += mEvent;
+  }
+
+  if (!signalled && !mFlushFds.empty()) {
+    const std::uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(mFlushFd, &one, sizeof(one));
+  }
+}
+
+void IPCServer::FlushSubscribers() {
+  std::uint64_t count;
+  [[maybe_unused]] const auto readBytes = read(mFlushFd, &count, sizeof(count));
+
+  // a subscriber may have gone away, and its fd been reused, since Publish; flushing a connection with nothing queued
+  // costs nothing
+  for (const int fd : mFlushFds) {
+    if (const auto itr = mConnections.find(fd); itr != mConnections.end() && !Flush(itr->second)) {
+      mDeadFds.push_back(fd);
+    }
+  }
+  mFlushFds.clear();
+
+  for (const int fd : mDeadFds) {
+    CloseConnection(fd);
+  }
+  mDeadFds.clear();
+}
+
+std::size_t IPCServer::GetSubscriberCount() const {
+  return mSubscriberCount;
+}
+
+bool IPCServer::Send(Connection& connection) {
+  std::size_t sent = 0;
+  while (sent < connection.output.size()) {
+    const auto result = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+      break;
+    }
+    sent += static_cast<std::size_t>(result);
+  }
+  connection.output.erase(0, sent);
+  return true;
+}
+
+bool IPCServer::Flush(Connection& connection) {
+  if (!Send(connection)) {
+    return false;
+  }
+
+  // a coalesced event goes out once the backlog has drained
+  if (connection.pendingOpcode && connection.output.size() < MaxSubscriberBacklog) {
+    IPC::AppendU32(connection.pendingPayload, connection.coalescedEvents);
+    IPC::FrameWriter writer(connection.output, IPC::FrameType::Event);
+    writer.Add(connection.pendingOpcode.value(), IPC::Status::Ok, connection.pendingPayload);
+    writer.Finish();
+    connection.pendingOpcode.reset();
+    connection.pendingPayload.clear();
+    connection.coalescedEvents = 0;
+    if (!Send(connection)) {
+      return false;
+    }
+  }
+
+  // wait for writability only while something is left over, and stop reading while too much is
+  const std::uint32_t events = (connection.output.size() < MaxOutputBacklog ? static_cast<std::uint32_t>(EPOLLIN) : 0u) |
+    (connection.output.empty() ? 0u : static_cast<std::uint32_t>(EPOLLOUT));
+  if (events != connection.events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = connection.fd;
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+  }
+  return true;
+}
+
+IPCClient::IPCClient(const std::string& name) {
+  const auto [addr, addrLength] = MakeAbstractAddress(name);
+
+  mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (mFd < 0) {
+    ThrowLastError("socket failed");
+  }
+
+  if (connect(mFd, reinterpret_cast<const sockaddr*>(&addr), addrLength) != 0) {
+    const int error = errno;
+    close(mFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "connect failed");
+  }
+
+  ucred cred{};
+  socklen_t credLength = sizeof(cred);
+  if (getsockopt(mFd, SOL_SOCKET, SO_PEERCRED, &cred, &credLength) != 0) {
+    const int error = errno;
+    close(mFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "SO_PEERCRED failed");
+  }
+  if (cred.uid != getuid() && cred.uid != 0) {
+    close(mFd);
+    throw std::system_error(std::make_error_code(std::errc::permission_denied), "the socket is held by uid "s + std::to_string(cred.uid));
+  }
+  mServerUid = static_cast<std::uint32_t>(cred.uid);
+}
+
+std::uint32_t IPCClient::GetServerUid() const {
+  return mServerUid;
+}
+
+IPCClient::~IPCClient() {
+  close(mFd);
+}
+
+const IPC::Frame& IPCClient::Call(const std::string& request) {
+  // drop the previous frame, which the caller no longer references
+  mInput.erase(0, mFrameSize);
+  mFrameSize = 0;
+
+  std::size_t sent = 0;
+  while (sent < request.size()) {
+    const auto result = send(mFd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowLastError("send failed");
+    }
+    sent += static_cast<std::size_t>(result);
+  }
+
+  return Receive();
+}
+
+const IPC::Frame& IPCClient::Receive() {
+  mInput.erase(0, mFrameSize);
+  mFrameSize = 0;
+
+  while (true) {
+    switch (IPC::ParseFrame(mInput, mFrame, mFrameSize)) {
+      case IPC::ParseResult::Complete:
+        return mFrame;
+
+      case IPC::ParseResult::Malformed:
+        throw std::runtime_error("malformed IPC frame");
+
+      case IPC::ParseResult::Incomplete:
+        mFrameSize = 0;
+        break;
+    }
+
+    char buffer[ReceiveChunkSize];
+    const auto received = recv(mFd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      mInput.append(buffer, static_cast<std::size_t>(received));
+      continue;
+    }
+    if (received == 0) {
+      throw std::runtime_error("IPC connection closed");
+    }
+    if (received < 0 && errno != EINTR) {
+      ThrowLastError("recv failed");
+    }
+  }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "IPCProtocol.hpp"
+
+// name of the abstract unix socket the daemon listens on; $SLEEPPREVENTER_SOCKET overrides the per-user default
+std::string GetDefaultIPCSocketName();
+// name of the abstract unix socket a system-wide daemon listens on for every user; $SLEEPPREVENTER_SOCKET overrides it
+std::string GetSystemIPCSocketName();
+
+// non-blocking server side of the IPC socket
+// all sockets live in an internal epoll set, so the owner only has to watch GetFd()
+// connections which subscribed also receive the event frames passed to Publish; a subscriber that does not read keeps at
+// most MaxSubscriberBacklog bytes queued plus one pending event, which later events replace
+// a client which sends requests without reading the responses is no longer read from once MaxOutputBacklog bytes are
+// queued for it, and users other than the daemon's own and root may hold at most MaxConnectionsPerUser connections
+class IPCServer {
+public:
+  // called once per command of a request frame; writes the result payload into result
+  using Handler = std::function<IPC::Status(const IPC::Entry& command, std::string& result)>;
+
+  // credentials of a client, taken once when it connected, so commands cost no lookup
+  struct Peer {
+    std::uint32_t pid;
+    std::uint32_t uid;
+  };
+
+  // who may connect
+  enum class Access {
+    // the daemon's own user and root
+    Owner,
+    // every local user, for a system-wide daemon; the handler tells them apart by GetPeer()
+    AnyUser,
+  };
+
+private:
+  struct Connection {
+    int fd;
+    Peer peer;
+    std::string input;
+    std::string output;
+    // what the connection is watched for in the epoll set
+    std::uint32_t events;
+    bool subscribed;
+    // the latest event which did not fit in output, and how many earlier events it replaced
+    std::optional<IPC::Opcode> pendingOpcode;
+    std::string pendingPayload;
+    std::uint32_t coalescedEvents;
+  };
+
+  int mListenFd = -1;
+  int mEpollFd = -1;
+  // eventfd in the epoll set which Publish signals once it queued events for Dispatch to send
+  int mFlushFd = -1;
+  Handler mHandler;
+  Access mAccess;
+  std::unordered_map<int, Connection> mConnections;
+  IPC::Frame mFrame;
+  std::string mResult;
+  std::string mEvent;
+  std::vector<int> mDeadFds;
+  // subscribers with events queued by Publish and not yet sent
+  std::vector<int> mFlushFds;
+  // the connection whose commands the handler is running for
+  Connection* mCurrent = nullptr;
+  std::size_t mSubscriberCount = 0;
+  // open connections of each user subject to MaxConnectionsPerUser
+  std::unordered_map<std::uint32_t, std::uint32_t> mUserConnections;
+
+  void Accept();
+  void CloseConnection(int fd);
+  bool Receive(Connection& connection);
+  bool ProcessInput(Connection& connection);
+  bool Send(Connection& connection);
+  bool Flush(Connection& connection);
+  void FlushSubscribers();
+
+public:
+  // output a subscriber may have queued before further events are coalesced
+  static constexpr std::size_t MaxSubscriberBacklog = 4 * 1024;
+  // output queued for any connection beyond which its requests wait until the client reads
+  static constexpr std::size_t MaxOutputBacklog = 64 * 1024;
+  static constexpr std::uint32_t MaxConnectionsPerUser = 32;
+
+  // throws std::system_error; the error is std::errc::address_in_use if another instance is listening
+  IPCServer(const std::string& name, Handler handler, Access access = Access::Owner);
+  ~IPCServer();
+
+  IPCServer(const IPCServer&) = delete;
+  IPCServer& operator=(const IPCServer&) = delete;
+
+  // readable whenever Dispatch has work to do
+  int GetFd() const;
+  // handles every pending connection event without blocking, so GetFd() may be watched edge-triggered
+  void Dispatch();
+  // the client whose commands the handler is running for; only meaningful inside the handler
+  const Peer& GetPeer() const;
+  // subscribes that client to Publish until it disconnects; only meaningful inside the handler
+  void Subscribe();
+  // queues an event frame with a single entry for every subscriber; the server appends a u32 count of the events
+  // coalesced into it to payload
+  // nothing is sent here: GetFd() becomes readable and the next Dispatch sends to every subscriber at once, so a
+  // publish costs one syscall however many subscribers there are, and back-to-back events share each send
+  // must not be called from inside the handler, whose response may be under construction in a subscriber's output
+  void Publish(IPC::Opcode opcode, std::string_view payload);
+  std::size_t GetSubscriberCount() const;
+};
+
+// blocking client side of the IPC socket
+class IPCClient {
+  int mFd = -1;
+  std::uint32_t mServerUid = 0;
+  std::string mInput;
+  IPC::Frame mFrame;
+  // size of mFrame in mInput, which is dropped by the next call
+  std::size_t mFrameSize = 0;
+
+public:
+  // throws std::system_error; with std::errc::permission_denied when the server runs as neither the calling user nor
+  // root, since anyone may bind an abstract name and a squatter must not get the caller's commands
+  explicit IPCClient(const std::string& name);
+  ~IPCClient();
+
+  IPCClient(const IPCClient&) = delete;
+  IPCClient& operator=(const IPCClient&) = delete;
+
+  // user the server runs as, taken when connecting
+  std::uint32_t GetServerUid() const;
+
+  // sends a request frame built with IPC::FrameWriter and waits for the response frame
+  // the returned frame stays valid until the next call; throws std::system_error or std::runtime_error
+  const IPC::Frame& Call(const std::string& request);
+  // waits for the next frame, such as an event after a Watch command; valid until the next call
+  // a subscribed client should not Call, since events may arrive ahead of the response
+  const IPC::Frame& Receive();
+};
@@ -0,0 +1,279 @@
+#include "Journal.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "AtomicFile.hpp"
+
+using namespace std::literals;
+
+namespace Journal {
+  namespace {
+    thread_local Origin tOrigin;
+
+    std::int64_t ToUnixNanoseconds(std::chrono::system_clock::time_point time) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    bool IsHeaderValid(const Header& header, std::size_t capacity) {
+      return
+        std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 &&
+        header.version == FormatVersion &&
+        header.recordSize == sizeof(Record) &&
+        header.capacity == capacity &&
+        header.nextSequence != 0;
+    }
+
+    // records [nextSequence - capacity, nextSequence) which still sit in their slot
+    std::vector<Record> CollectRecords(const Header& header, const Record* records) {
+      const auto next = header.nextSequence;
+      const auto first = next > header.capacity ? next - header.capacity : 1;
+      std::vector<Record> result;
+      result.reserve(static_cast<std::size_t>(next - first));
+      for (auto sequence = first; sequence < next; sequence++) {
+        const auto& record = records[(sequence - 1) % header.capacity];
+        if (record.sequence == sequence) {
+          result.push_back(record);
+        }
+      }
+      return result;
+    }
+  }
+
+  OriginScope::OriginScope(Source source, std::uint32_t pid, std::uint32_t uid) :
+    mPrevious(tOrigin)
+  {
+    tOrigin = Origin{source, pid, uid};
+  }
+
+  OriginScope::~OriginScope() {
+    tOrigin = mPrevious;
+  }
+
+  Origin GetOrigin() {
+    return tOrigin;
+  }
+
+  void Writer::Attach(void* mapping, std::size_t mappingSize, std::size_t capacity) {
+    mMapping = mapping;
+    mMappingSize = mappingSize;
+    mHeader = static_cast<Header*>(mapping);
+    mRecords = reinterpret_cast<Record*>(static_cast<char*>(mapping) + sizeof(Header));
+    if (IsHeaderValid(*mHeader, capacity)) {
+      return;
+    }
+
+    // slots left over from before cannot pass for records of the new journal: the reader only looks at sequence
+    // numbers below nextSequence, and each of those has been written to its slot since
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = FormatVersion;
+    header.recordSize = sizeof(Record);
+    header.capacity = capacity;
+    header.nextSequence = 1;
+    *mHeader = header;
+  }
+
+  void Writer::Append(Record& record) {
+    const auto origin = tOrigin;
+    record.time = ToUnixNanoseconds(std::chrono::system_clock::now());
+    record.source = origin.source;
+    record.pid = origin.pid;
+    record.uid = origin.uid;
+
+    std::lock_guard lock(mMutex);
+    const auto sequence = mHeader->nextSequence;
+    record.sequence = sequence;
+    mRecords[(sequence - 1) % mHeader->capacity] = record;
+    // the record must be in place before it is published
+    std::atomic_thread_fence(std::memory_order_release);
+    mHeader->nextSequence = sequence + 1;
+  }
+
+  void Writer::AppendMarker(Kind kind, std::uint8_t state) {
+    Record record{};
+    record.kind = kind;
+    record.oldState = state;
+    record.newState = state;
+    Append(record);
+  }
+
+  void Writer::AppendState(std::uint8_t oldState, std::uint8_t newState) {
+    Record record{};
+    record.kind = Kind::State;
+    record.oldState = oldState;
+    record.newState = newState;
+    Append(record);
+  }
+
+  void Writer::AppendLease(Kind kind, std::string_view name, std::uint8_t modes, std::optional<std::chrono::system_clock::time_point> expiry) {
+    Record record{};
+    record.kind = kind;
+    record.modes = modes;
+    record.expiry = expiry ? ToUnixNanoseconds(expiry.value()) : 0;
+    const auto size = std::min(name.size(), NameCapacity);
+    std::memcpy(record.name, name.data(), size);
+    record.nameSize = static_cast<std::uint8_t>(size);
+    if (size < name.size()) {
+      record.flags |= RecordFlags::NameTruncated;
+    }
+    Append(record);
+  }
+
+  std::vector<Record> Writer::ReadRecords() {
+    std::lock_guard lock(mMutex);
+    return CollectRecords(*mHeader, mRecords);
+  }
+
+  std::vector<Record> ReadFile(const std::filesystem::path& path) {
+    const auto contents = ReadWholeFile(path);
+    if (!contents) {
+      throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), "cannot open "s + path.string());
+    }
+    const auto& data = contents.value();
+
+    Header header{};
+    if (data.size() < sizeof(Header)) {
+      throw std::runtime_error(path.string() + " is not a journal"s);
+    }
+    std::memcpy(&header, data.data(), sizeof(Header));
+    const auto capacity = static_cast<std::size_t>(header.capacity);
+    if (!IsHeaderValid(header, capacity) || capacity == 0 || (data.size() - sizeof(Header)) / sizeof(Record) < capacity) {
+      throw std::runtime_error(path.string() + " is not a journal of this version"s);
+    }
+
+    std::vector<Record> records(capacity);
+    std::memcpy(records.data(), data.data() + sizeof(Header), capacity * sizeof(Record));
+    return CollectRecords(header, records.data());
+  }
+
+  std::map<std::string, Lease> RebuildLeases(const std::vector<Record>& records, std::chrono::system_clock::time_point now) {
+    auto begin = records.begin();
+    for (auto itr = records.begin(); itr != records.end(); itr++) {
+      if (itr->kind == Kind::Start) {
+        begin = itr + 1;
+      }
+    }
+
+    std::map<std::string, Lease> leases;
+    for (auto itr = begin; itr != records.end(); itr++) {
+      const auto& record = *itr;
+      if (record.flags & RecordFlags::NameTruncated) {
+        continue;
+      }
+      switch (record.kind) {
+        case Kind::LeaseAcquire: {
+          // as LeaseTable::Acquire: one more reference with its own expiry, wider modes
+          auto& lease = leases[std::string(record.GetName())];
+          lease.modes |= record.modes;
+          if (record.expiry == 0) {
+            lease.unbounded++;
+          } else {
+            const auto expiry = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record.expiry)));
+            lease.expiries.insert(std::upper_bound(lease.expiries.begin(), lease.expiries.end(), expiry), expiry);
+          }
+          break;
+        }
+
+        case Kind::LeaseRelease: {
+          // as LeaseTable::Release: a reference without an expiry if there is any, otherwise the one expiring first
+          const auto lease = leases.find(std::string(record.GetName()));
+          if (lease == leases.end()) {
+            break;
+          }
+          if (lease->second.unbounded != 0) {
+            lease->second.unbounded--;
+          } else if (!lease->second.expiries.empty()) {
+            lease->second.expiries.erase(lease->second.expiries.begin());
+          }
+          if (lease->second.unbounded == 0 && lease->second.expiries.empty()) {
+            leases.erase(lease);
+          }
+          break;
+        }
+
+        case Kind::LeaseExpire:
+          // LeaseTable::Expire drops the earliest first; the recorded expiry was converted from the steady clock anew
+          // and need not match the acquired one to the nanosecond
+          if (const auto lease = leases.find(std::string(record.GetName())); lease != leases.end() && !lease->second.expiries.empty()) {
+            lease->second.expiries.erase(lease->second.expiries.begin());
+          }
+          break;
+
+        case Kind::LeaseEnd:
+          leases.erase(std::string(record.GetName()));
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    // references which expired while nobody was expiring them, e.g. while the daemon was down
+    for (auto itr = leases.begin(); itr != leases.end();) {
+      auto& expiries = itr->second.expiries;
+      expiries.erase(expiries.begin(), std::upper_bound(expiries.begin(), expiries.end(), now));
+      if (itr->second.unbounded == 0 && expiries.empty()) {
+        itr = leases.erase(itr);
+      } else {
+        itr++;
+      }
+    }
+    return leases;
+  }
+
+  std::string_view GetKindName(Kind kind) {
+    switch (kind) {
+      case Kind::Start:
+        return "start"sv;
+      case Kind::Stop:
+        return "stop"sv;
+      case Kind::State:
+        return "state"sv;
+      case Kind::LeaseAcquire:
+        return "acquire"sv;
+      case Kind::LeaseRelease:
+        return "release"sv;
+      case Kind::LeaseEnd:
+        return "end"sv;
+      case Kind::LeaseExpire:
+        return "expire"sv;
+    }
+    return "unknown"sv;
+  }
+
+  std::string_view GetSourceName(Source source) {
+    switch (source) {
+      case Source::Unknown:
+        return "unknown"sv;
+      case Source::CommandLine:
+        return "cli"sv;
+      case Source::IPC:
+        return "ipc"sv;
+      case Source::Rule:
+        return "rule"sv;
+      case Source::Timer:
+        return "timer"sv;
+      case Source::Config:
+        return "config"sv;
+      case Source::Daemon:
+        return "daemon"sv;
+      case Source::Fleet:
+        return "fleet"sv;
+    }
+    return "unknown"sv;
+  }
+}
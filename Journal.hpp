@@ -0,0 +1,169 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// fixed-size ring of state transitions and lease changes in a memory-mapped file, for post-mortems
+//
+// file: Header | Record[capacity], integers in host byte order
+// record n (sequence numbers start at 1) lives in slot (n - 1) % capacity; it is written in place and then published
+// by bumping Header::nextSequence, so appending never calls write() or allocates, and a record cut short by a crash
+// is never published
+namespace Journal {
+  constexpr char Magic[8] = {'S', 'P', 'J', 'O', 'U', 'R', 'N', 'L'};
+  constexpr std::uint32_t FormatVersion = 1;
+  // longer names are cut, and their records are left out when rebuilding leases
+  constexpr std::size_t NameCapacity = 88;
+
+  enum class Kind : std::uint8_t {
+    // the daemon started or stopped; newState is its state at that point
+    Start = 1,
+    Stop = 2,
+    // oldState changed to newState
+    State = 3,
+    // a reference was taken on the named lease; modes and expiry are those of the call
+    LeaseAcquire = 4,
+    // a reference was dropped
+    LeaseRelease = 5,
+    // the lease ended, as its last reference expired or a prefix release ended it regardless of its references
+    LeaseEnd = 6,
+    // a reference expired while others keep the lease; expiry is the reference's
+    LeaseExpire = 7,
+  };
+
+  // who caused a record
+  enum class Source : std::uint8_t {
+    Unknown = 0,
+    // options the daemon was started with
+    CommandLine = 1,
+    // a command of an IPC client; pid and uid are the client's
+    IPC = 2,
+    Rule = 3,
+    Timer = 4,
+    // a config file reload
+    Config = 5,
+    // the daemon itself, e.g. leases restored at startup
+    Daemon = 6,
+    // a command of a fleet controller, over the fleet listener
+    Fleet = 7,
+  };
+
+  namespace RecordFlags {
+    constexpr std::uint8_t NameTruncated = 0x01;
+  } // namespace RecordFlags
+
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordSize;
+    std::uint64_t capacity;
+    // sequence number of the next record; every record below it is published
+    std::uint64_t nextSequence;
+    std::uint8_t reserved[32];
+  };
+  static_assert(sizeof(Header) == 64, "Journal::Header is part of the file format");
+
+  struct Record {
+    std::uint64_t sequence;
+    // unix time in nanoseconds
+    std::int64_t time;
+    // unix time in nanoseconds of a lease expiry, 0 for none
+    std::int64_t expiry;
+    std::uint32_t pid;
+    std::uint32_t uid;
+    Kind kind;
+    Source source;
+    // IPC::StateBits
+    std::uint8_t oldState;
+    std::uint8_t newState;
+    // LeaseModes
+    std::uint8_t modes;
+    std::uint8_t nameSize;
+    std::uint8_t flags;
+    std::uint8_t reserved;
+    char name[NameCapacity];
+
+    std::string_view GetName() const {
+      return std::string_view(name, nameSize);
+    }
+  };
+  static_assert(sizeof(Record) == 128, "Journal::Record is part of the file format");
+
+  struct Origin {
+    Source source = Source::Unknown;
+    std::uint32_t pid = 0;
+    std::uint32_t uid = 0;
+  };
+
+  // the origin of the records appended by the current thread until destroyed; scopes nest
+  class OriginScope {
+    Origin mPrevious;
+
+  public:
+    explicit OriginScope(Source source, std::uint32_t pid = 0, std::uint32_t uid = 0);
+    ~OriginScope();
+
+    OriginScope(const OriginScope&) = delete;
+    OriginScope& operator=(const OriginScope&) = delete;
+  };
+
+  Origin GetOrigin();
+
+  // a lease as rebuilt from the records
+  struct Lease {
+    // references without an expiry
+    std::uint32_t unbounded = 0;
+    std::uint8_t modes = 0;
+    // expiries of the other references, earliest first
+    std::vector<std::chrono::system_clock::time_point> expiries;
+  };
+
+  // appends to a journal file; safe to call from any thread
+  class Writer {
+    std::mutex mMutex;
+    void* mMapping = nullptr;
+    std::size_t mMappingSize = 0;
+    Header* mHeader = nullptr;
+    Record* mRecords = nullptr;
+
+    Writer() = default;
+    // called by Open once the file is mapped; starts the journal over unless the header matches capacity
+    void Attach(void* mapping, std::size_t mappingSize, std::size_t capacity);
+    void Append(Record& record);
+
+  public:
+    // maps the file, creating it or starting it over if it does not hold a journal of this capacity
+    // throws std::system_error
+    static std::unique_ptr<Writer> Open(const std::filesystem::path& path, std::size_t capacity);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void AppendMarker(Kind kind, std::uint8_t state);
+    void AppendState(std::uint8_t oldState, std::uint8_t newState);
+    void AppendLease(Kind kind, std::string_view name, std::uint8_t modes = 0, std::optional<std::chrono::system_clock::time_point> expiry = std::nullopt);
+
+    // the published records, oldest first
+    std::vector<Record> ReadRecords();
+  };
+
+  // the published records of a journal file, oldest first; throws std::system_error or std::runtime_error
+  std::vector<Record> ReadFile(const std::filesystem::path& path);
+
+  // replays the lease records since the last Start (or all of them, if it was overwritten) and returns the leases
+  // which are still live at now
+  std::map<std::string, Lease> RebuildLeases(const std::vector<Record>& records, std::chrono::system_clock::time_point now);
+
+  std::string_view GetKindName(Kind kind);
+  std::string_view GetSourceName(Source source);
+} // namespace Journal
@@ -0,0 +1,58 @@
+#include "Journal.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Journal {
+  std::unique_ptr<Writer> Writer::Open(const std::filesystem::path& path, std::size_t capacity) {
+    const auto size = sizeof(Header) + capacity * sizeof(Record);
+
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      throw std::system_error(std::error_code(errno, std::system_category()), "open failed");
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+      const int error = errno;
+      close(fd);
+      throw std::system_error(std::error_code(error, std::system_category()), "fstat failed");
+    }
+    if (static_cast<std::size_t>(st.st_size) != size) {
+      // a journal of another capacity is started over
+      if (ftruncate(fd, 0) != 0 || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        const int error = errno;
+        close(fd);
+        throw std::system_error(std::error_code(error, std::system_category()), "ftruncate failed");
+      }
+      // reserve the blocks now, so that a full disk cannot turn a later store into SIGBUS
+      // file systems without fallocate support keep the file sparse
+      posix_fallocate(fd, 0, static_cast<off_t>(size));
+    }
+
+    const auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      throw std::system_error(std::error_code(error, std::system_category()), "mmap failed");
+    }
+
+    std::unique_ptr<Writer> writer(new Writer());
+    writer->Attach(mapping, size, capacity);
+    return writer;
+  }
+
+  Writer::~Writer() {
+    if (mMapping != nullptr) {
+      munmap(mMapping, mMappingSize);
+    }
+  }
+}
@@ -0,0 +1,201 @@
+#include "JournalReader.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fnmatch.h>
+
+#include "ConfigSchema.hpp"
+#include "IPCProtocol.hpp"
+#include "Journal.hpp"
+#include "LeaseTable.hpp"
+
+using namespace std::literals;
+
+namespace {
+  struct Filter {
+    std::optional<std::chrono::system_clock::time_point> since;
+    // bit per Journal::Source and Journal::Kind value; empty means all
+    std::uint32_t sources = 0;
+    std::uint32_t kinds = 0;
+    std::optional<std::string> namePattern;
+
+    bool Matches(const Journal::Record& record) const {
+      if (since && std::chrono::nanoseconds(record.time) < since.value().time_since_epoch()) {
+        return false;
+      }
+      if (sources != 0 && (sources & (1u << static_cast<unsigned>(record.source))) == 0) {
+        return false;
+      }
+      if (kinds != 0 && (kinds & (1u << static_cast<unsigned>(record.kind))) == 0) {
+        return false;
+      }
+      if (namePattern) {
+        const std::string name(record.GetName());
+        if (record.nameSize == 0 || fnmatch(namePattern.value().c_str(), name.c_str(), 0) != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  // parses a comma separated list of names into bits of the values they name; false on an unknown name
+  template <typename Enum>
+  bool ParseNameList(std::string_view list, std::string_view (*getName)(Enum), std::uint32_t& bits) {
+    bool valid = true;
+    Config::ForEachListItem(list, [&](std::string_view item) {
+      for (unsigned value = 0; value < 32; value++) {
+        if (getName(static_cast<Enum>(value)) == item && item != "unknown"sv) {
+          bits |= 1u << value;
+          return;
+        }
+      }
+      valid = false;
+    });
+    return valid;
+  }
+
+  std::string FormatTime(std::int64_t unixNanoseconds) {
+    const auto seconds = static_cast<std::time_t>(unixNanoseconds / 1000000000);
+    std::tm local{};
+    localtime_r(&seconds, &local);
+    char buffer[64];
+    const auto length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    std::snprintf(buffer + length, sizeof(buffer) - length, ".%06lld", static_cast<long long>(unixNanoseconds % 1000000000 / 1000));
+    return buffer;
+  }
+
+  std::string FormatModes(std::uint8_t modes) {
+    std::string text;
+    if (modes & LeaseModes::System) {
+      text += 'S';
+    }
+    if (modes & LeaseModes::Display) {
+      text += 'D';
+    }
+    return text.empty() ? "-"s : text;
+  }
+
+  void PrintRecord(const Journal::Record& record) {
+    std::string line = FormatTime(record.time);
+    line += " #"s + std::to_string(record.sequence) + " "s;
+    line += Journal::GetSourceName(record.source);
+    if (record.source == Journal::Source::IPC || record.source == Journal::Source::CommandLine) {
+      line += " pid="s + std::to_string(record.pid) + " uid="s + std::to_string(record.uid);
+    }
+    line += " "s;
+    line += Journal::GetKindName(record.kind);
+
+    switch (record.kind) {
+      case Journal::Kind::Start:
+      case Journal::Kind::Stop:
+        line += " "s + IPC::FormatStateBits(record.newState);
+        break;
+
+      case Journal::Kind::State:
+        line += " "s + IPC::FormatStateBits(record.oldState) + " -> "s + IPC::FormatStateBits(record.newState);
+        break;
+
+      case Journal::Kind::LeaseAcquire:
+      case Journal::Kind::LeaseRelease:
+      case Journal::Kind::LeaseEnd:
+      case Journal::Kind::LeaseExpire:
+        line += " "s;
+        line += record.GetName();
+        if (record.flags & Journal::RecordFlags::NameTruncated) {
+          line += "...";
+        }
+        if (record.kind == Journal::Kind::LeaseAcquire) {
+          line += " modes="s + FormatModes(record.modes);
+        }
+        if (record.expiry != 0) {
+          line += " until "s + FormatTime(record.expiry);
+        }
+        break;
+    }
+
+    line += "\n";
+    std::fputs(line.c_str(), stdout);
+  }
+
+  void PrintLeases(const std::vector<Journal::Record>& records) {
+    for (const auto& [name, lease] : Journal::RebuildLeases(records, std::chrono::system_clock::now())) {
+      std::string line = name;
+      line += " references="s + std::to_string(lease.unbounded + lease.expiries.size()) + " modes="s + FormatModes(lease.modes);
+      // when the last reference expires, unless one has no expiry
+      if (lease.unbounded == 0) {
+        line += " until "s + FormatTime(std::chrono::duration_cast<std::chrono::nanoseconds>(lease.expiries.back().time_since_epoch()).count());
+      }
+      line += "\n";
+      std::fputs(line.c_str(), stdout);
+    }
+  }
+}
+
+int RunJournalReader(const std::filesystem::path& defaultPath, int argc, char* argv[]) {
+  std::filesystem::path path = defaultPath;
+  Filter filter;
+  bool leases = false;
+
+  for (int i = 0; i < argc; i++) {
+    const std::string_view arg(argv[i]);
+    const auto equals = arg.find('=');
+    const auto option = arg.substr(0, equals);
+    const auto value = equals == std::string_view::npos ? ""sv : arg.substr(equals + 1);
+
+    bool valid = true;
+    if (option == "--file"sv && !value.empty()) {
+      path = std::string(value);
+    } else if (option == "--since"sv) {
+      const auto duration = Config::ParseDuration(value);
+      valid = duration.has_value();
+      if (valid) {
+        filter.since = std::chrono::system_clock::now() - duration.value();
+      }
+    } else if (option == "--source"sv) {
+      valid = ParseNameList(value, Journal::GetSourceName, filter.sources);
+    } else if (option == "--kind"sv) {
+      valid = ParseNameList(value, Journal::GetKindName, filter.kinds);
+    } else if (option == "--name"sv && !value.empty()) {
+      filter.namePattern = std::string(value);
+    } else if (arg == "--leases"sv) {
+      leases = true;
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      std::fprintf(stderr, "Error: bad argument %s\n\n", argv[i]);
+      std::fputs(JournalHelpMessage, stderr);
+      return 2;
+    }
+  }
+
+  std::vector<Journal::Record> records;
+  try {
+    records = Journal::ReadFile(path);
+  } catch (const std::exception& exception) {
+    std::fprintf(stderr, "Error: failed to read the journal (%s)\n", exception.what());
+    return 1;
+  }
+
+  if (leases) {
+    PrintLeases(records);
+    return 0;
+  }
+  for (const auto& record : records) {
+    if (filter.Matches(record)) {
+      PrintRecord(record);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <filesystem>
+
+constexpr char JournalHelpMessage[] =
+  "SleepPreventer journal [--file=<path>] [--since=<duration>] [--source=<sources>]\n"
+  "                       [--kind=<kinds>] [--name=<pattern>] [--leases]\n"
+  "\n"
+  "  Prints the transition journal, oldest first. The daemon need not be running.\n"
+  "  --since    Only records of the last duration, e.g. 2h or 3d\n"
+  "  --source   Comma separated: cli, ipc, rule, timer, config, daemon, fleet\n"
+  "  --kind     Comma separated: start, stop, state, acquire, release, end\n"
+  "  --name     Only lease records whose name matches the shell wildcard\n"
+  "  --leases   Print the leases the daemon would restore instead\n"
+  "  States read ESD/sd: E, S and D are the manual enable, sleep and display-off\n"
+  "  flags, s and d what was held from the system; '-' is unset.\n"
+  "\n";
+
+// the "journal" mode; args are the arguments after "journal"
+// returns 0, 1 if the journal cannot be read, or 2 on a bad argument
+int RunJournalReader(const std::filesystem::path& defaultPath, int argc, char* argv[]);
@@ -0,0 +1,62 @@
+#include "Journal.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+
+#include <Windows.h>
+
+namespace Journal {
+  std::unique_ptr<Writer> Writer::Open(const std::filesystem::path& path, std::size_t capacity) {
+    const auto size = sizeof(Header) + capacity * sizeof(Record);
+
+    const HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+      throw std::system_error(std::error_code(GetLastError(), std::system_category()), "CreateFileW failed");
+    }
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(hFile, &fileSize)) {
+      const auto error = GetLastError();
+      CloseHandle(hFile);
+      throw std::system_error(std::error_code(error, std::system_category()), "GetFileSizeEx failed");
+    }
+    if (static_cast<std::size_t>(fileSize.QuadPart) != size) {
+      // a journal of another capacity is started over
+      LARGE_INTEGER zero{};
+      LARGE_INTEGER newSize{};
+      newSize.QuadPart = static_cast<LONGLONG>(size);
+      if (!SetFilePointerEx(hFile, zero, NULL, FILE_BEGIN) || !SetEndOfFile(hFile) || !SetFilePointerEx(hFile, newSize, NULL, FILE_BEGIN) || !SetEndOfFile(hFile)) {
+        const auto error = GetLastError();
+        CloseHandle(hFile);
+        throw std::system_error(std::error_code(error, std::system_category()), "SetEndOfFile failed");
+      }
+    }
+
+    const HANDLE hMapping = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+    const auto mappingError = GetLastError();
+    CloseHandle(hFile);
+    if (hMapping == NULL) {
+      throw std::system_error(std::error_code(mappingError, std::system_category()), "CreateFileMappingW failed");
+    }
+
+    // the view keeps the mapping and the file open
+    const auto mapping = MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    const auto viewError = GetLastError();
+    CloseHandle(hMapping);
+    if (mapping == NULL) {
+      throw std::system_error(std::error_code(viewError, std::system_category()), "MapViewOfFile failed");
+    }
+
+    std::unique_ptr<Writer> writer(new Writer());
+    writer->Attach(mapping, size, capacity);
+    return writer;
+  }
+
+  Writer::~Writer() {
+    if (mMapping != nullptr) {
+      UnmapViewOfFile(mMapping);
+    }
+  }
+}
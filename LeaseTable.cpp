@@ -0,0 +1,172 @@
+#include "LeaseTable.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+void LeaseTable::CountModes(std::uint8_t modes, bool add) {
+  if (modes & LeaseModes::System) {
+    add ? mSystemCount++ : mSystemCount--;
+  }
+  if (modes & LeaseModes::Display) {
+    add ? mDisplayCount++ : mDisplayCount--;
+  }
+}
+
+void LeaseTable::Erase(LeaseMap::iterator itr) {
+  if (!itr->second.expiries.empty()) {
+    mExpiries.erase({itr->second.expiries.front(), itr->first});
+  }
+  CountModes(itr->second.modes, false);
+  mLeases.erase(itr);
+}
+
+void LeaseTable::PopExpiry(Lease& lease) {
+  std::pop_heap(lease.expiries.begin(), lease.expiries.end(), std::greater<>());
+  lease.expiries.pop_back();
+}
+
+void LeaseTable::UpdateExpiry(LeaseMap::iterator itr, std::optional<Clock::time_point> earliest) {
+  const auto& expiries = itr->second.expiries;
+  const auto current = expiries.empty() ? std::nullopt : std::optional(expiries.front());
+  if (current == earliest) {
+    return;
+  }
+  if (earliest) {
+    mExpiries.erase({earliest.value(), itr->first});
+  }
+  if (current) {
+    mExpiries.emplace(current.value(), itr->first);
+  }
+}
+
+bool LeaseTable::Acquire(std::string_view name, std::uint8_t modes, std::optional<Clock::time_point> expiry) {
+  const auto before = GetModes();
+
+  auto itr = mLeases.find(name);
+  if (itr == mLeases.end()) {
+    itr = mLeases.emplace(std::string(name), Lease{0, 0, {}}).first;
+  }
+  auto& lease = itr->second;
+
+  if (const auto added = static_cast<std::uint8_t>(modes & ~lease.modes); added != 0) {
+    CountModes(added, true);
+    lease.modes |= added;
+  }
+
+  if (!expiry) {
+    lease.unbounded++;
+  } else {
+    const auto earliest = lease.expiries.empty() ? std::nullopt : std::optional(lease.expiries.front());
+    lease.expiries.push_back(expiry.value());
+    std::push_heap(lease.expiries.begin(), lease.expiries.end(), std::greater<>());
+    UpdateExpiry(itr, earliest);
+  }
+
+  return GetModes() != before;
+}
+
+bool LeaseTable::Release(std::string_view name) {
+  const auto itr = mLeases.find(name);
+  if (itr == mLeases.end()) {
+    return false;
+  }
+  auto& lease = itr->second;
+  if (lease.unbounded != 0) {
+    lease.unbounded--;
+  } else {
+    const auto earliest = lease.expiries.front();
+    PopExpiry(lease);
+    UpdateExpiry(itr, earliest);
+  }
+  if (lease.unbounded != 0 || !lease.expiries.empty()) {
+    return false;
+  }
+
+  const auto before = GetModes();
+  Erase(itr);
+  return GetModes() != before;
+}
+
+bool LeaseTable::ReleasePrefix(std::string_view prefix, const EndedCallback& onEnded) {
+  const auto before = GetModes();
+  auto itr = mLeases.lower_bound(prefix);
+  while (itr != mLeases.end() && std::string_view(itr->first).substr(0, prefix.size()) == prefix) {
+    if (onEnded) {
+      onEnded(itr->first);
+    }
+    Erase(itr++);
+  }
+  return GetModes() != before;
+}
+
+bool LeaseTable::Expire(Clock::time_point now, const EndedCallback& onEnded, const ExpiredCallback& onExpired) {
+  const auto before = GetModes();
+  while (!mExpiries.empty() && mExpiries.begin()->first <= now) {
+    const auto itr = mLeases.find(mExpiries.begin()->second);
+    auto& lease = itr->second;
+    const auto earliest = lease.expiries.front();
+    while (!lease.expiries.empty() && lease.expiries.front() <= now) {
+      if (onExpired && lease.expiries.size() + lease.unbounded > 1) {
+        onExpired(itr->first, lease.expiries.front());
+      }
+      PopExpiry(lease);
+    }
+    if (lease.unbounded != 0 || !lease.expiries.empty()) {
+      UpdateExpiry(itr, earliest);
+      continue;
+    }
+
+    if (onEnded) {
+      onEnded(itr->first);
+    }
+    mExpiries.erase(mExpiries.begin());
+    Erase(itr);
+  }
+  return GetModes() != before;
+}
+
+std::uint8_t LeaseTable::GetModes() const {
+  std::uint8_t modes = 0;
+  if (mSystemCount != 0) {
+    modes |= LeaseModes::System;
+  }
+  if (mDisplayCount != 0) {
+    modes |= LeaseModes::Display;
+  }
+  return modes;
+}
+
+std::optional<LeaseTable::Clock::time_point> LeaseTable::GetNextExpiry() const {
+  if (mExpiries.empty()) {
+    return std::nullopt;
+  }
+  return mExpiries.begin()->first;
+}
+
+std::size_t LeaseTable::GetCount() const {
+  return mLeases.size();
+}
+
+bool LeaseTable::IsHeld(std::string_view name) const {
+  return mLeases.find(name) != mLeases.end();
+}
+
+std::size_t LeaseTable::CountPrefix(std::string_view prefix, std::size_t limit) const {
+  std::size_t count = 0;
+  for (auto itr = mLeases.lower_bound(prefix); count < limit && itr != mLeases.end() && std::string_view(itr->first).substr(0, prefix.size()) == prefix; itr++) {
+    count++;
+  }
+  return count;
+}
+
+void LeaseTable::ForEachPrefix(std::string_view prefix, const std::function<void(std::string_view name, std::uint8_t modes)>& callback) const {
+  for (auto itr = mLeases.lower_bound(prefix); itr != mLeases.end() && std::string_view(itr->first).substr(0, prefix.size()) == prefix; itr++) {
+    callback(itr->first, itr->second.modes);
+  }
+}
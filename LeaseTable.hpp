@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace LeaseModes {
+  constexpr std::uint8_t System = 0x01;
+  constexpr std::uint8_t Display = 0x02;
+} // namespace LeaseModes
+
+// named, reference-counted leases on the system and display modes, with optional expiry
+//
+// acquiring a held name adds a reference with an expiry of its own and widens the modes of the lease; releasing
+// drops one reference, one without an expiry if there is any and otherwise the one expiring first; each expiry drops
+// only its own reference, and the lease ends when the last one is gone
+//
+// the effective modes are the union over all live leases, kept as per-mode counts
+// Acquire, Release and the expiry of each reference are O(log n + log r) for r references of the lease
+class LeaseTable {
+public:
+  using Clock = std::chrono::steady_clock;
+  // called with the name of each lease ReleasePrefix or Expire ends, before it is erased
+  using EndedCallback = std::function<void(std::string_view name)>;
+  // called with the name and expiry of each reference Expire drops from a lease which lives on
+  using ExpiredCallback = std::function<void(std::string_view name, Clock::time_point expiry)>;
+
+private:
+  struct Lease {
+    // references without an expiry, which only Release drops
+    std::uint32_t unbounded;
+    std::uint8_t modes;
+    // expiries of the other references as a min-heap; the earliest is the lease's entry in mExpiries
+    std::vector<Clock::time_point> expiries;
+  };
+
+  using LeaseMap = std::map<std::string, Lease, std::less<>>;
+
+  LeaseMap mLeases;
+  // the views point at keys of mLeases, whose nodes never move
+  std::set<std::pair<Clock::time_point, std::string_view>> mExpiries;
+  std::size_t mSystemCount = 0;
+  std::size_t mDisplayCount = 0;
+
+  void CountModes(std::uint8_t modes, bool add);
+  void Erase(LeaseMap::iterator itr);
+  void PopExpiry(Lease& lease);
+  // moves the lease's entry in mExpiries from earliest, the first expiry before the change, to the current one
+  void UpdateExpiry(LeaseMap::iterator itr, std::optional<Clock::time_point> earliest);
+
+public:
+  // each returns true if the effective modes changed
+  bool Acquire(std::string_view name, std::uint8_t modes, std::optional<Clock::time_point> expiry = std::nullopt);
+  bool Release(std::string_view name);
+  // ends every lease whose name starts with prefix, regardless of its references
+  bool ReleasePrefix(std::string_view prefix, const EndedCallback& onEnded = {});
+  // drops every reference whose expiry is at or before now, ending the leases left without one
+  bool Expire(Clock::time_point now, const EndedCallback& onEnded = {}, const ExpiredCallback& onExpired = {});
+
+  // union of the live leases as LeaseModes bits
+  std::uint8_t GetModes() const;
+  std::optional<Clock::time_point> GetNextExpiry() const;
+  std::size_t GetCount() const;
+  bool IsHeld(std::string_view name) const;
+  // number of live leases whose name starts with prefix, counting no further than limit; O(log n) plus one step per
+  // match counted
+  std::size_t CountPrefix(std::string_view prefix, std::size_t limit = SIZE_MAX) const;
+  // calls callback(name, modes) for every live lease whose name starts with prefix, in name order
+  void ForEachPrefix(std::string_view prefix, const std::function<void(std::string_view name, std::uint8_t modes)>& callback) const;
+};
@@ -0,0 +1,292 @@
+#include "LoadMonitor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  constexpr std::uint64_t SectorSize = 512;
+
+  int OpenReadOnly(const std::filesystem::path& path) {
+    return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+
+  std::string_view NextToken(std::string_view& line) {
+    std::size_t begin = 0;
+    while (begin < line.size() && line[begin] == ' ') {
+      begin++;
+    }
+    std::size_t end = begin;
+    while (end < line.size() && line[end] != ' ') {
+      end++;
+    }
+    const auto token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return token;
+  }
+
+  std::uint64_t ParseCounter(std::string_view token) {
+    std::uint64_t value = 0;
+    std::from_chars(token.data(), token.data() + token.size(), value);
+    return value;
+  }
+
+  bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  // whole disks only, since partitions, device mapper and md devices would count the same I/O twice
+  bool IsWholeDisk(std::string_view name) {
+    if (name.empty() || name.substr(0, 4) == "loop"sv || name.substr(0, 3) == "ram"sv || name.substr(0, 3) == "dm-"sv || name.substr(0, 2) == "md"sv) {
+      return false;
+    }
+    // nvme0n1p2, mmcblk0p1
+    if (name.substr(0, 4) == "nvme"sv || name.substr(0, 6) == "mmcblk"sv) {
+      std::size_t end = name.size();
+      while (end > 0 && IsDigit(name[end - 1])) {
+        end--;
+      }
+      return !(end > 1 && end < name.size() && name[end - 1] == 'p' && IsDigit(name[end - 2]));
+    }
+    // sda1, vdb2, xvda1
+    return !IsDigit(name.back());
+  }
+
+  // reads the whole file from the start in buffer-sized chunks and calls callback for every line until it returns false
+  // lines longer than the buffer are skipped
+  template <typename Callback>
+  bool ForEachLine(int fd, char* buffer, std::size_t size, Callback&& callback) {
+    off_t offset = 0;
+    std::size_t kept = 0;
+    bool skipping = false;
+    while (true) {
+      const auto length = pread(fd, buffer + kept, size - kept, offset);
+      if (length < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      if (length == 0) {
+        if (kept != 0 && !skipping) {
+          callback(std::string_view(buffer, kept));
+        }
+        return true;
+      }
+      offset += length;
+
+      const std::size_t end = kept + static_cast<std::size_t>(length);
+      std::size_t begin = 0;
+      while (const auto newline = static_cast<const char*>(std::memchr(buffer + begin, '\n', end - begin))) {
+        const auto lineEnd = static_cast<std::size_t>(newline - buffer);
+        if (!skipping && !callback(std::string_view(buffer + begin, lineEnd - begin))) {
+          return true;
+        }
+        skipping = false;
+        begin = lineEnd + 1;
+      }
+
+      kept = end - begin;
+      if (kept == size) {
+        skipping = true;
+        kept = 0;
+      } else {
+        std::memmove(buffer, buffer + begin, kept);
+      }
+    }
+  }
+
+  double UpdateAverage(double average, double value, double alpha) {
+    return average + alpha * (value - average);
+  }
+}
+
+LoadMonitor::LoadMonitor(const Thresholds& thresholds, std::chrono::milliseconds interval, std::chrono::milliseconds window, const std::filesystem::path& procRoot) :
+  mThresholds(thresholds),
+  mWindow(window)
+{
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "timerfd_create failed");
+  }
+
+  const auto period = std::max(interval, 1ms);
+  itimerspec spec{};
+  spec.it_interval.tv_sec = static_cast<time_t>(period.count() / 1000);
+  spec.it_interval.tv_nsec = static_cast<long>(period.count() % 1000 * 1000000);
+  spec.it_value = spec.it_interval;
+  timerfd_settime(mTimerFd, 0, &spec, nullptr);
+
+  if (mThresholds.cpuPercent > 0) {
+    mStatFd = OpenReadOnly(procRoot / "stat");
+  }
+  if (mThresholds.diskBytesPerSecond > 0) {
+    mDiskStatsFd = OpenReadOnly(procRoot / "diskstats");
+  }
+  if (mThresholds.netBytesPerSecond > 0) {
+    mNetDevFd = OpenReadOnly(procRoot / "net" / "dev");
+  }
+}
+
+LoadMonitor::~LoadMonitor() {
+  for (const int fd : {mTimerFd, mStatFd, mDiskStatsFd, mNetDevFd}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+// "cpu  user nice system idle iowait irq softirq steal guest guest_nice"
+// guest time is already part of user and nice
+bool LoadMonitor::ReadCpu(Counters& counters) {
+  bool found = false;
+  ForEachLine(mStatFd, mBuffer, BufferSize, [&](std::string_view line) {
+    if (NextToken(line) != "cpu"sv) {
+      return true;
+    }
+    std::uint64_t fields[8]{};
+    for (auto& field : fields) {
+      field = ParseCounter(NextToken(line));
+    }
+    const auto idle = fields[3] + fields[4];
+    std::uint64_t total = 0;
+    for (const auto field : fields) {
+      total += field;
+    }
+    counters.cpuTotal = total;
+    counters.cpuBusy = total - idle;
+    found = true;
+    return false;
+  });
+  return found;
+}
+
+// "major minor name reads merged sectors_read ms writes merged sectors_written ..."
+bool LoadMonitor::ReadDisk(Counters& counters) {
+  std::uint64_t bytes = 0;
+  const bool ok = ForEachLine(mDiskStatsFd, mBuffer, BufferSize, [&](std::string_view line) {
+    NextToken(line);
+    NextToken(line);
+    if (!IsWholeDisk(NextToken(line))) {
+      return true;
+    }
+    std::uint64_t fields[7]{};
+    for (auto& field : fields) {
+      field = ParseCounter(NextToken(line));
+    }
+    bytes += (fields[2] + fields[6]) * SectorSize;
+    return true;
+  });
+  counters.diskBytes = bytes;
+  return ok;
+}
+
+// two header lines, then "name: rx_bytes packets errs drop fifo frame compressed multicast tx_bytes ..."
+bool LoadMonitor::ReadNet(Counters& counters) {
+  std::uint64_t bytes = 0;
+  const bool ok = ForEachLine(mNetDevFd, mBuffer, BufferSize, [&](std::string_view line) {
+    const auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return true;
+    }
+    auto name = line.substr(0, colon);
+    if (NextToken(name) == "lo"sv) {
+      return true;
+    }
+    line.remove_prefix(colon + 1);
+    std::uint64_t fields[9]{};
+    for (auto& field : fields) {
+      field = ParseCounter(NextToken(line));
+    }
+    bytes += fields[0] + fields[8];
+    return true;
+  });
+  counters.netBytes = bytes;
+  return ok;
+}
+
+int LoadMonitor::GetFd() const {
+  return mTimerFd;
+}
+
+bool LoadMonitor::ReadEvents() {
+  std::uint64_t expirations;
+  if (read(mTimerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    return false;
+  }
+  return Sample(std::chrono::steady_clock::now());
+}
+
+bool LoadMonitor::Sample(std::chrono::steady_clock::time_point now) {
+  Counters counters;
+  const bool hasCpu = mStatFd >= 0 && ReadCpu(counters);
+  const bool hasDisk = mDiskStatsFd >= 0 && ReadDisk(counters);
+  const bool hasNet = mNetDevFd >= 0 && ReadNet(counters);
+
+  const auto lastTime = mLastSampleTime;
+  const auto last = mLastCounters;
+  mLastSampleTime = now;
+  mLastCounters = counters;
+  if (!lastTime || now <= lastTime.value()) {
+    return false;
+  }
+
+  const double seconds = std::chrono::duration<double>(now - lastTime.value()).count();
+  // a sample covering a whole window or more replaces the average
+  const double alpha = std::min(1.0, seconds / std::max(std::chrono::duration<double>(mWindow).count(), 1e-3));
+
+  // counters going backwards (a device removed, a wrap) are treated as no activity
+  const auto delta = [](std::uint64_t current, std::uint64_t previous) {
+    return current >= previous ? static_cast<double>(current - previous) : 0.0;
+  };
+  if (hasCpu) {
+    const double total = delta(counters.cpuTotal, last.cpuTotal);
+    const double busy = total > 0.0 ? delta(counters.cpuBusy, last.cpuBusy) * 100.0 / total : 0.0;
+    mAverages.cpuPercent = UpdateAverage(mAverages.cpuPercent, busy, alpha);
+  }
+  if (hasDisk) {
+    mAverages.diskBytesPerSecond = UpdateAverage(mAverages.diskBytesPerSecond, delta(counters.diskBytes, last.diskBytes) / seconds, alpha);
+  }
+  if (hasNet) {
+    mAverages.netBytesPerSecond = UpdateAverage(mAverages.netBytesPerSecond, delta(counters.netBytes, last.netBytes) / seconds, alpha);
+  }
+
+  // fraction of its threshold reached by the busiest metric
+  double level = 0.0;
+  const auto consider = [&](bool has, double average, std::int64_t threshold) {
+    if (has && threshold > 0) {
+      level = std::max(level, average / static_cast<double>(threshold));
+    }
+  };
+  consider(hasCpu, mAverages.cpuPercent, mThresholds.cpuPercent);
+  consider(hasDisk, mAverages.diskBytesPerSecond, mThresholds.diskBytesPerSecond);
+  consider(hasNet, mAverages.netBytesPerSecond, mThresholds.netBytesPerSecond);
+
+  const bool active = mActive ? level >= ReleaseRatio : level >= 1.0;
+  if (active == mActive) {
+    return false;
+  }
+  mActive = active;
+  return true;
+}
+
+bool LoadMonitor::IsActive() const {
+  return mActive;
+}
+
+const LoadMonitor::Averages& LoadMonitor::GetAverages() const {
+  return mAverages;
+}
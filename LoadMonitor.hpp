@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+// samples CPU, disk and network activity from <procRoot>/stat, diskstats and net/dev and decides whether the system is busy
+//
+// every metric is smoothed by an exponential moving average with the time constant window
+// the monitor becomes active when any average reaches its threshold, and inactive again only when all of them
+// have dropped below ReleaseRatio of their thresholds
+//
+// files are kept open and reread with pread into a fixed buffer, so sampling does not allocate
+class LoadMonitor {
+public:
+  // 0 disables a metric
+  struct Thresholds {
+    std::int64_t cpuPercent = 0;
+    std::int64_t diskBytesPerSecond = 0;
+    std::int64_t netBytesPerSecond = 0;
+  };
+
+  struct Averages {
+    double cpuPercent = 0.0;
+    double diskBytesPerSecond = 0.0;
+    double netBytesPerSecond = 0.0;
+  };
+
+  static constexpr double ReleaseRatio = 0.5;
+
+private:
+  struct Counters {
+    std::uint64_t cpuBusy = 0;
+    std::uint64_t cpuTotal = 0;
+    std::uint64_t diskBytes = 0;
+    std::uint64_t netBytes = 0;
+  };
+
+  static constexpr std::size_t BufferSize = 16 * 1024;
+
+  Thresholds mThresholds;
+  std::chrono::milliseconds mWindow;
+  int mTimerFd = -1;
+  int mStatFd = -1;
+  int mDiskStatsFd = -1;
+  int mNetDevFd = -1;
+  char mBuffer[BufferSize];
+
+  std::optional<std::chrono::steady_clock::time_point> mLastSampleTime;
+  Counters mLastCounters;
+  Averages mAverages;
+  bool mActive = false;
+
+  bool ReadCpu(Counters& counters);
+  bool ReadDisk(Counters& counters);
+  bool ReadNet(Counters& counters);
+
+public:
+  // throws std::system_error if the timer cannot be created; metrics whose file cannot be opened are left out
+  LoadMonitor(const Thresholds& thresholds, std::chrono::milliseconds interval, std::chrono::milliseconds window, const std::filesystem::path& procRoot = "/proc");
+  ~LoadMonitor();
+
+  LoadMonitor(const LoadMonitor&) = delete;
+  LoadMonitor& operator=(const LoadMonitor&) = delete;
+
+  // readable when a sample is due
+  int GetFd() const;
+  // takes a sample if one is due; returns true if IsActive() changed
+  bool ReadEvents();
+
+  // takes a sample as of now regardless of the timer; returns true if IsActive() changed
+  // the first sample only records the counters
+  bool Sample(std::chrono::steady_clock::time_point now);
+
+  bool IsActive() const;
+  const Averages& GetAverages() const;
+};
@@ -0,0 +1,223 @@
+#include "LogindBackend.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "DBusConnection.hpp"
+#include "NullBackend.hpp"
+#include "PreventerBackend.hpp"
+
+using namespace std::literals;
+
+namespace Preventer {
+  LogindBackend::LogindBackend(std::string busAddress) :
+    mBusAddress(std::move(busAddress)),
+    mEpollFd(epoll_create1(EPOLL_CLOEXEC))
+  {
+    if (mEpollFd < 0) {
+      throw std::system_error(std::error_code(errno, std::system_category()), "epoll_create1 failed");
+    }
+  }
+
+  LogindBackend::~LogindBackend() {
+    Release();
+    mConnection.reset();
+    close(mEpollFd);
+  }
+
+  void LogindBackend::Inhibit(Lock& lock) {
+    if (!mConnection) {
+      // connect lazily so that a daemon which never enables prevention never touches the bus
+      mConnection.emplace(mBusAddress);
+    }
+
+    if (!IsCallPending()) {
+      mCallStart = std::chrono::steady_clock::now();
+    }
+    mBusCalls++;
+    lock.pending = true;
+    mConnection.value().CallMethod(
+      "org.freedesktop.login1"sv,
+      "/org/freedesktop/login1"sv,
+      "org.freedesktop.login1.Manager"sv,
+      "Inhibit"sv,
+      {lock.what, "SleepPreventer"sv, "Prevention enabled by SleepPreventer"sv, "block"sv},
+      [this, &lock](std::optional<DBusConnection::Reply> reply) {
+        lock.pending = false;
+
+        int fd = -1;
+        if (reply && reply.value().signature == "h"sv && reply.value().body.size() >= sizeof(std::uint32_t)) {
+          std::uint32_t index;
+          std::memcpy(&index, reply.value().body.data(), sizeof(index));
+          if (index < reply.value().fds.size()) {
+            fd = std::exchange(reply.value().fds[index], -1);
+          }
+        }
+        if (reply) {
+          for (const auto otherFd : reply.value().fds) {
+            if (otherFd >= 0) {
+              close(otherFd);
+            }
+          }
+        }
+
+        if (!lock.wanted) {
+          // released while the call was on its way
+          if (fd >= 0) {
+            close(fd);
+          }
+          return;
+        }
+        if (fd < 0) {
+          mFailed = true;
+          return;
+        }
+        lock.fd = fd;
+      });
+  }
+
+  void LogindBackend::Update(Lock& lock) {
+    if (!lock.wanted && lock.fd >= 0) {
+      close(lock.fd);
+      lock.fd = -1;
+    }
+    // a lock whose call is on its way is taken, or dropped, when the reply arrives
+    if (lock.wanted && lock.fd < 0 && !lock.pending) {
+      Inhibit(lock);
+    }
+  }
+
+  void LogindBackend::WatchConnection() {
+    if (!mConnection) {
+      return;
+    }
+    const auto events = mConnection.value().GetEvents();
+    if (events == mEvents) {
+      return;
+    }
+    epoll_event event{};
+    event.events = events;
+    if (epoll_ctl(mEpollFd, mEvents == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, mConnection.value().GetFd(), &event) != 0) {
+      throw std::system_error(std::error_code(errno, std::system_category()), "epoll_ctl failed");
+    }
+    mEvents = events;
+  }
+
+  void LogindBackend::DispatchConnection() {
+    if (!mConnection) {
+      return;
+    }
+    try {
+      mConnection.value().Dispatch();
+      WatchConnection();
+    } catch (const std::exception&) {
+      // reconnect on the next attempt
+      mFailed = mFailed || IsCallPending();
+      Disconnect();
+    }
+  }
+
+  void LogindBackend::Disconnect() {
+    // closing the socket also takes it out of mEpollFd; the locks already taken stay valid without the connection
+    mConnection.reset();
+    mEvents = 0;
+    mSleepLock.pending = false;
+    mIdleLock.pending = false;
+  }
+
+  bool LogindBackend::TakeResult() {
+    return !std::exchange(mFailed, false);
+  }
+
+  bool LogindBackend::IsCallPending() const {
+    return mSleepLock.pending || mIdleLock.pending;
+  }
+
+  bool LogindBackend::Apply(bool systemRequired, bool displayRequired) {
+    // only the locks whose state differs are touched; nothing changed means no bus traffic at all
+    mSleepLock.wanted = systemRequired;
+    mIdleLock.wanted = displayRequired;
+
+    // a call which never got its reply would hold its lock back for good; start over on a fresh connection
+    if (IsCallPending() && std::chrono::steady_clock::now() - mCallStart >= CallTimeout) {
+      Disconnect();
+    }
+
+    try {
+      Update(mSleepLock);
+      Update(mIdleLock);
+      WatchConnection();
+    } catch (const std::exception&) {
+      // reconnect on the next attempt
+      mFailed = true;
+      Disconnect();
+    }
+
+    if (mAsync) {
+      return TakeResult();
+    }
+
+    const auto deadline = mCallStart + CallTimeout;
+    while (IsCallPending()) {
+      const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      epoll_event event;
+      const int count = remaining.count() > 0 ? epoll_wait(mEpollFd, &event, 1, static_cast<int>(remaining.count())) : 0;
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        mFailed = true;
+        Disconnect();
+        break;
+      }
+      DispatchConnection();
+    }
+    return TakeResult();
+  }
+
+  void LogindBackend::Release() {
+    mSleepLock.wanted = false;
+    mIdleLock.wanted = false;
+    Update(mSleepLock);
+    Update(mIdleLock);
+  }
+
+  int LogindBackend::StartAsync() {
+    mAsync = true;
+    return mEpollFd;
+  }
+
+  bool LogindBackend::Dispatch() {
+    DispatchConnection();
+    return TakeResult();
+  }
+
+  unsigned long long LogindBackend::GetBusCallCount() const {
+    return mBusCalls;
+  }
+
+  std::unique_ptr<Backend> CreateDefaultBackend() {
+    if (const auto backend = std::getenv("SLEEPPREVENTER_BACKEND"); backend != nullptr && backend == "null"sv) {
+      return std::make_unique<NullBackend>();
+    }
+
+    // SLEEPPREVENTER_LOGIND_BUS points the backend at a private bus, e.g. a dbus-daemon running a stub login1 service
+    if (const auto address = std::getenv("SLEEPPREVENTER_LOGIND_BUS"); address != nullptr && address[0] != '\0') {
+      return std::make_unique<LogindBackend>(address);
+    }
+    return std::make_unique<LogindBackend>();
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "DBusConnection.hpp"
+#include "PreventerBackend.hpp"
+
+namespace Preventer {
+  // holds org.freedesktop.login1 inhibitor locks
+  // system maps to a "sleep" lock and display maps to an "idle" lock; each lock is released by closing its fd
+  // Apply waits for the Inhibit replies unless StartAsync handed the wait to the caller's event loop; then Apply only
+  // sends the calls and Dispatch takes each lock as its reply arrives
+  class LogindBackend : public Backend {
+    struct Lock {
+      const char* what;
+      int fd = -1;
+      // what the last Apply asked for
+      bool wanted = false;
+      // an Inhibit call for this lock awaits its reply
+      bool pending = false;
+    };
+
+    std::string mBusAddress;
+    std::optional<DBusConnection> mConnection;
+    // watches the connection socket, which changes on every reconnect, so that callers can watch one fd for good
+    int mEpollFd = -1;
+    std::uint32_t mEvents = 0;
+    Lock mSleepLock{"sleep"};
+    Lock mIdleLock{"idle"};
+    bool mAsync = false;
+    // an Inhibit call failed since the last Apply or Dispatch reported it
+    bool mFailed = false;
+    std::chrono::steady_clock::time_point mCallStart;
+    unsigned long long mBusCalls = 0;
+
+    void Inhibit(Lock& lock);
+    void Update(Lock& lock);
+    void WatchConnection();
+    void DispatchConnection();
+    void Disconnect();
+    bool TakeResult();
+
+  public:
+    // how long an Inhibit call may go without a reply before the connection is given up
+    static constexpr std::chrono::milliseconds CallTimeout{5000};
+
+    // busAddress defaults to the system bus; pass a private bus address to run against a stub login1 service
+    explicit LogindBackend(std::string busAddress = GetSystemBusAddress());
+    ~LogindBackend() override;
+
+    bool Apply(bool systemRequired, bool displayRequired) override;
+    void Release() override;
+    int StartAsync() override;
+    bool Dispatch() override;
+
+    // number of Inhibit calls issued so far, including failed ones
+    unsigned long long GetBusCallCount() const;
+    // true while an Inhibit call awaits its reply
+    bool IsCallPending() const;
+  };
+} // namespace Preventer
@@ -1,7 +1,5 @@
 #include <atomic>
 #include <cstddef>
-#include <iostream>
-#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -12,9 +10,12 @@
 #include <Shlwapi.h>
 
 #include "CommandLineArgs.hpp"
+#include "CommandLineOptions.hpp"
 #include "ConfigFile.hpp"
+#include "ConfigSchema.hpp"
 #include "NotifyIcon.hpp"
 #include "Preventer.hpp"
+#include "PreventerConfig.hpp"
 
 #include "resource.h"
 
@@ -25,7 +26,6 @@ namespace {
     SecondInstanceLaunched = 1,
   };
 
-  constexpr std::size_t PathBufferSize = 65600;
   constexpr std::size_t MenuPathLength = 32;
   constexpr auto ClassName = L"SleepPreventer.CLS";
   constexpr auto MutexName = L"SleepPreventer.MTX";
@@ -42,20 +42,36 @@ namespace {
   HICON gHIconDisabled = NULL;
 
   std::wstring GetModuleFilepath(HMODULE hModule) {
-    constexpr std::size_t BufferSize = 65600;
-
-    auto buffer = std::make_unique<wchar_t[]>(BufferSize);
-    GetModuleFileNameW(hModule, buffer.get(), BufferSize);
-    if (GetLastError() != ERROR_SUCCESS) {
-      throw std::system_error(std::error_code(GetLastError(), std::system_category()), "GetModukeFileNameW failed");
+    // MAX_PATH is enough for almost every path, so the long path limit is only tried when it was truncated
+    constexpr std::size_t MaxBufferSize = 32768;
+
+    std::wstring buffer(MAX_PATH, L'\0');
+    while (true) {
+      const DWORD length = GetModuleFileNameW(hModule, buffer.data(), static_cast<DWORD>(buffer.size()));
+      if (length == 0) {
+        throw std::system_error(std::error_code(GetLastError(), std::system_category()), "GetModuleFileNameW failed");
+      }
+      if (length < buffer.size() || buffer.size() >= MaxBufferSize) {
+        buffer.resize(length);
+        return buffer;
+      }
+      buffer.resize(MaxBufferSize);
     }
+  }
 
-    return std::wstring(buffer.get());
+  // loads the icon on first use at the size of the notification area, so the other icon and the larger images are
+  // never loaded if they are not shown
+  HICON GetIcon(bool enabled) {
+    auto& hIcon = enabled ? gHIcon : gHIconDisabled;
+    if (hIcon == NULL) {
+      hIcon = static_cast<HICON>(LoadImageW(gHInstance, MAKEINTRESOURCEW(enabled ? IDI_ICON : IDI_ICON_DISABLED), IMAGE_ICON, GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON), LR_DEFAULTCOLOR));
+    }
+    return hIcon;
   }
 
   void UpdateNotifyIcon() {
     if (gNotifyIcon) {
-      gNotifyIcon.value().SetIcon(Preventer::gEnable ? gHIcon : gHIconDisabled);
+      gNotifyIcon.value().SetIcon(GetIcon(Preventer::gEnable));
     }
   }
 }
@@ -109,7 +125,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         case IDM_CTX_TOGGLE_ENABLE:
           Preventer::gEnable = !Preventer::gEnable;
           Preventer::ApplyState();
-          configFile.Set(L"enable"s, Preventer::gEnable ? 1 : 0);
+          configFile.SetBool(Config::Key::Enable, Preventer::gEnable);
           configFile.Save();
           UpdateNotifyIcon();
           return 0;
@@ -117,14 +133,14 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         case IDM_CTX_TOGGLE_SYSTEM:
           Preventer::gSystemFlag = !Preventer::gSystemFlag;
           Preventer::ApplyState();
-          configFile.Set(L"system"s, Preventer::gSystemFlag ? 1 : 0);
+          configFile.SetBool(Config::Key::System, Preventer::gSystemFlag);
           configFile.Save();
           return 0;
 
         case IDM_CTX_TOGGLE_DISPLAY:
           Preventer::gDisplayFlag = !Preventer::gDisplayFlag;
           Preventer::ApplyState();
-          configFile.Set(L"display"s, Preventer::gDisplayFlag ? 1 : 0);
+          configFile.SetBool(Config::Key::Display, Preventer::gDisplayFlag);
           configFile.Save();
           return 0;
       }
@@ -246,101 +262,20 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
   // parse command line arguments
   const auto& args = GetCurrentCommandLineArgs();
 
-  std::optional<bool> enable;
-  std::optional<bool> systemFlag;
-  std::optional<bool> displayFlag;
-  for (const auto& arg : args) {
-    if (arg.size() >= 2 && (arg[1] == L'?' || arg[1] == L'H' || arg[1] == L'h')) {
-      const wchar_t message[] =
-        L"\n"
-        L"SleepPreventer [/E | /-E] [/S | /-S] [/D | /-D]\n"
-        L"\n"
-        L"  /E    Enable prevention\n"
-        L"  /-E   Disable prevention\n"
-        L"  /S    Enable sleep prevention\n"
-        L"  /-S   Disable sleep prevention\n"
-        L"  /D    Enable display-off prevention\n"
-        L"  /-D   Disable display-off prevention\n"
-        L"\n";
-
-      std::wcout << message;
-
-      AttachConsole(ATTACH_PARENT_PROCESS);
-      DWORD written = 0;
-      WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), message, sizeof(message) / sizeof(wchar_t), &written, NULL);
-      FreeConsole();
-
-      return 0;
-    }
-
-    //
-
-    if (arg == L"/E"sv || arg == L"/e"sv) {
-      enable = true;
-      continue;
-    }
-
-    if (arg == L"/-E"sv || arg == L"/-e"sv) {
-      enable = false;
-      continue;
-    }
+  const auto options = ParseCommandLineOptions(args);
+  if (options.help) {
+    AttachConsole(ATTACH_PARENT_PROCESS);
+    DWORD written = 0;
+    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), HelpMessage, sizeof(HelpMessage) / sizeof(wchar_t), &written, NULL);
+    FreeConsole();
 
-    //
-
-    if (arg == L"/S"sv || arg == L"/s"sv) {
-      systemFlag = true;
-      continue;
-    }
-
-    if (arg == L"/-S"sv || arg == L"/-s"sv) {
-      systemFlag = false;
-      continue;
-    }
-
-    //
-
-    if (arg == L"/D"sv || arg == L"/d"sv) {
-      displayFlag = true;
-      continue;
-    }
-
-    if (arg == L"/-D"sv || arg == L"/-d"sv) {
-      displayFlag = false;
-      continue;
-    }
-  }
-
-  DWORD ipcFlags = 0;
-  {
-    using namespace Preventer::IPCFlags;
-
-    if (enable.has_value()) {
-      ipcFlags |= enable.value() ? Enable : Disable;
-    }
-    if (systemFlag.has_value()) {
-      ipcFlags |= systemFlag.value() ? SetSystemFlag : UnsetSystemFlag;
-    }
-    if (displayFlag.has_value()) {
-      ipcFlags |= displayFlag.value() ? SetDisplayFlag : UnsetDisplayFlag;
-    }
-  }
-
-  // open icon
-  gHIcon = LoadIconW(hInstance, MAKEINTRESOURCEW(IDI_ICON));
-  if (gHIcon == NULL) {
-    const std::wstring message = L"Initialization error: LoadIconW failed with code "s + std::to_wstring(GetLastError());
-    MessageBoxW(NULL, message.c_str(), L"SleepPreventer", MB_OK | MB_ICONERROR | MB_SETFOREGROUND);
-    return 1;
+    return 0;
   }
 
-  gHIconDisabled = LoadIconW(hInstance, MAKEINTRESOURCEW(IDI_ICON_DISABLED));
-  if (gHIconDisabled == NULL) {
-    const std::wstring message = L"Initialization error: LoadIconW failed with code "s + std::to_wstring(GetLastError());
-    MessageBoxW(NULL, message.c_str(), L"SleepPreventer", MB_OK | MB_ICONERROR | MB_SETFOREGROUND);
-    return 1;
-  }
+  const DWORD ipcFlags = options.GetIPCFlags();
 
   // register window class
+  // the window is never shown, so it has no icon of its own; the notify icon is loaded once the state is known
   const WNDCLASSEXW wndClassExW{
     sizeof(wndClassExW),
     0,
@@ -348,12 +283,12 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
     0,
     0,
     hInstance,
-    gHIcon,
+    NULL,
     LoadCursorW(NULL, IDC_ARROW),
     reinterpret_cast<HBRUSH>(GetStockObject(WHITE_BRUSH)),
     NULL,
     ClassName,
-    gHIcon,
+    NULL,
   };
   if (!RegisterClassExW(&wndClassExW)) {
     const std::wstring message = L"Initialization error: RegisterClassExW failed with code "s + std::to_wstring(GetLastError());
@@ -424,14 +359,36 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
     return 1;
   }
 
+  // instantiate ConfigFile
+  const auto exeFilepath = GetModuleFilepath(NULL);
+  const auto bsPos = exeFilepath.find_last_of(L'\\');
+  const auto configFilepath = bsPos == std::wstring::npos ? exeFilepath + L".cfg"s : exeFilepath.substr(0, bsPos + 1) + L"SleepPreventer.cfg"s;
+  gConfigFile.emplace(configFilepath);
+
+  // defaults come from the schema; the file is written with every key on the first change
+  auto& configFile = gConfigFile.value();
+
+  // start
+  Preventer::LoadStateFromConfig(configFile);
+  Preventer::ApplyStateFromIPCFlags(ipcFlags);
+
   // register notify icon
+  const auto hIcon = GetIcon(Preventer::gEnable);
+  if (hIcon == NULL) {
+    ReleaseMutex(hMutex);
+    const std::wstring message = L"Initialization error: LoadImageW failed with code "s + std::to_wstring(GetLastError());
+    MessageBoxW(NULL, message.c_str(), L"SleepPreventer", MB_OK | MB_ICONERROR | MB_SETFOREGROUND);
+    DestroyWindow(hWnd);
+    return 1;
+  }
+
   gNotifyIcon.emplace(NOTIFYICONDATAW{
     sizeof(NOTIFYICONDATAW),
     hWnd,
     NotifyIconId,
     NIF_MESSAGE | NIF_ICON | NIF_TIP | NIF_SHOWTIP,
     NotifyIconCallbackMessageId,
-    gHIcon,
+    hIcon,
     L"SleepPreventer",
     0,
     0,
@@ -453,25 +410,6 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
     return 1;
   }
 
-  // instantiate ConfigFile
-  const auto exeFilepath = GetModuleFilepath(NULL);
-  const auto bsPos = exeFilepath.find_last_of(L'\\');
-  const auto configFilepath = bsPos == std::wstring::npos ? exeFilepath + L".cfg"s : exeFilepath.substr(0, bsPos + 1) + L"SleepPreventer.cfg"s;
-  gConfigFile.emplace(configFilepath);
-
-  auto& configFile = gConfigFile.value();
-  configFile.Set(L"enable"s, 0, true);
-  configFile.Set(L"system"s, 0, true);
-  configFile.Set(L"display"s, 0, true);
-  configFile.Save();
-
-  // start
-  Preventer::gEnable = configFile.Get(L"enable"s).value_or(0) != 0;
-  Preventer::gSystemFlag = configFile.Get(L"system"s).value_or(0) != 0;
-  Preventer::gDisplayFlag = configFile.Get(L"display"s).value_or(0) != 0;
-  Preventer::ApplyStateFromIPCFlags(ipcFlags);
-
-  UpdateNotifyIcon();
 
   // message loop
   MSG msg;
@@ -488,6 +426,13 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
   // finish
   Preventer::Finish();
 
+  if (gHIcon != NULL) {
+    DestroyIcon(gHIcon);
+  }
+  if (gHIconDisabled != NULL) {
+    DestroyIcon(gHIconDisabled);
+  }
+
   ReleaseMutex(hMutex);
 
   return msg.message == WM_QUIT ? static_cast<int>(msg.wParam) : 0;
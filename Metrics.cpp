@@ -0,0 +1,262 @@
+#include "Metrics.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Metrics {
+  Counter gStateTransitions;
+  Counter gBackendCalls;
+  Counter gBackendFailures;
+  Counter gBackendCallsElided;
+  Counter gIPCRequests;
+  Counter gIPCDenied;
+  Counter gFleetAuthFailures;
+  Counter gHookRuns;
+  Counter gHookFailures;
+  Counter gHookTimeouts;
+  Counter gHookCoalesced;
+  Counter gConfigSaves;
+  Counter gConfigSaveFailures;
+  Histogram gBackendLatency;
+  Histogram gIPCLatency;
+  Histogram gConfigSaveLatency;
+  Histogram gHookLatency;
+  StateClock gStateTime;
+
+  namespace {
+    // Prometheus bucket bounds in seconds, 1-2-5 steps from 1us to 10s
+    constexpr double ExportBounds[] = {
+      1e-6, 2e-6, 5e-6,
+      1e-5, 2e-5, 5e-5,
+      1e-4, 2e-4, 5e-4,
+      1e-3, 2e-3, 5e-3,
+      1e-2, 2e-2, 5e-2,
+      1e-1, 2e-1, 5e-1,
+      1.0, 2.0, 5.0,
+      10.0,
+    };
+
+    // index of the highest set bit; value must not be 0
+    unsigned GetHighestBit(std::uint64_t value) {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanReverse64(&index, value);
+      return static_cast<unsigned>(index);
+#else
+      return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    void AppendHeader(std::string& text, std::string_view name, std::string_view type, std::string_view help) {
+      text.append("# HELP ").append(name).append(" ").append(help).append("\n");
+      text.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    void AppendCounter(std::string& text, std::string_view name, std::string_view help, std::uint64_t value) {
+      AppendHeader(text, name, "counter", help);
+      text.append(name).append(" ").append(std::to_string(value)).append("\n");
+    }
+
+    std::string FormatSeconds(double seconds) {
+      char buffer[32];
+      std::snprintf(buffer, sizeof(buffer), "%.9g", seconds);
+      return buffer;
+    }
+
+    // buckets are cumulative counts of the values below each bound; a recorded value counts towards a bound
+    // once its whole histogram bucket lies below it, so counts err on the low side by at most one bucket width
+    void AppendHistogram(std::string& text, std::string_view name, std::string_view help, const Histogram& histogram) {
+      const auto snapshot = histogram.GetSnapshot();
+      AppendHeader(text, name, "histogram", help);
+
+      std::size_t index = 0;
+      std::uint64_t cumulative = 0;
+      for (const auto bound : ExportBounds) {
+        const auto boundNanoseconds = static_cast<std::uint64_t>(bound * 1e9 + 0.5);
+        while (index < Histogram::BucketCount - 1 && Histogram::GetBucketLowerBound(index + 1) <= boundNanoseconds + 1) {
+          cumulative += snapshot.counts[index++];
+        }
+        text.append(name).append("_bucket{le=\"").append(FormatSeconds(bound)).append("\"} ").append(std::to_string(cumulative)).append("\n");
+      }
+      text.append(name).append("_bucket{le=\"+Inf\"} ").append(std::to_string(snapshot.count)).append("\n");
+      text.append(name).append("_sum ").append(FormatSeconds(static_cast<double>(snapshot.sum) / 1e9)).append("\n");
+      text.append(name).append("_count ").append(std::to_string(snapshot.count)).append("\n");
+    }
+  }
+
+  std::size_t Histogram::GetBucketIndex(std::uint64_t value) {
+    if (value < SubBucketCount) {
+      return static_cast<std::size_t>(value);
+    }
+    const auto exponent = GetHighestBit(value);
+    if (exponent >= MaxExponent) {
+      return BucketCount - 1;
+    }
+    const auto shift = exponent - SubBucketBits;
+    const auto subBucket = static_cast<std::size_t>(value >> shift) & (SubBucketCount - 1);
+    return (shift + 1) * SubBucketCount + subBucket;
+  }
+
+  std::uint64_t Histogram::GetBucketLowerBound(std::size_t index) {
+    const auto block = index / SubBucketCount;
+    const auto subBucket = index % SubBucketCount;
+    if (block == 0) {
+      return subBucket;
+    }
+    return static_cast<std::uint64_t>(SubBucketCount + subBucket) << (block - 1);
+  }
+
+  void Histogram::Record(std::chrono::nanoseconds value) {
+    const auto nanoseconds = value.count() > 0 ? static_cast<std::uint64_t>(value.count()) : 0;
+    mCounts[GetBucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    // only a new maximum pays for the compare-exchange
+    auto max = mMax.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !mMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+    }
+  }
+
+  Histogram::Snapshot Histogram::GetSnapshot() const {
+    Snapshot snapshot;
+    snapshot.count = 0;
+    for (std::size_t i = 0; i < BucketCount; i++) {
+      snapshot.counts[i] = mCounts[i].load(std::memory_order_relaxed);
+      snapshot.count += snapshot.counts[i];
+    }
+    snapshot.sum = mSum.load(std::memory_order_relaxed);
+    snapshot.max = mMax.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  std::uint64_t Histogram::Snapshot::GetQuantile(double q) const {
+    if (count == 0) {
+      return 0;
+    }
+    // rank of the quantile, 1 based
+    auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count) + 0.5);
+    rank = rank < 1 ? 1 : rank > count ? count : rank;
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < BucketCount; i++) {
+      cumulative += counts[i];
+      if (cumulative >= rank) {
+        const auto upper = i + 1 < BucketCount ? GetBucketLowerBound(i + 1) - 1 : max;
+        return upper < max ? upper : max;
+      }
+    }
+    return max;
+  }
+
+  std::size_t GetStateIndex(std::uint8_t stateBits) {
+    std::size_t index = 0;
+    if (stateBits & IPC::StateBits::Enable) {
+      index |= 0x1;
+    }
+    if (stateBits & IPC::StateBits::ActiveSystem) {
+      index |= 0x2;
+    }
+    if (stateBits & IPC::StateBits::ActiveDisplay) {
+      index |= 0x4;
+    }
+    return index;
+  }
+
+  std::uint8_t GetIndexStateBits(std::size_t index) {
+    std::uint8_t stateBits = 0;
+    if (index & 0x1) {
+      stateBits |= IPC::StateBits::Enable;
+    }
+    if (index & 0x2) {
+      stateBits |= IPC::StateBits::ActiveSystem;
+    }
+    if (index & 0x4) {
+      stateBits |= IPC::StateBits::ActiveDisplay;
+    }
+    return stateBits;
+  }
+
+  StateClock::StateClock() :
+    mSince(Clock::now().time_since_epoch().count())
+  {}
+
+  bool StateClock::Set(std::uint8_t stateBits, Clock::time_point now) {
+    const auto state = static_cast<std::uint8_t>(GetStateIndex(stateBits));
+    const auto current = mState.load(std::memory_order_relaxed);
+    if (state == current) {
+      return false;
+    }
+    const auto nowTicks = now.time_since_epoch().count();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::duration(nowTicks - mSince.load(std::memory_order_relaxed)));
+    if (elapsed.count() > 0) {
+      mTotals[current].fetch_add(static_cast<std::uint64_t>(elapsed.count()), std::memory_order_relaxed);
+    }
+    mSince.store(nowTicks, std::memory_order_relaxed);
+    mState.store(state, std::memory_order_relaxed);
+    return true;
+  }
+
+  std::uint8_t StateClock::GetState() const {
+    return mState.load(std::memory_order_relaxed);
+  }
+
+  std::array<std::uint64_t, StateCount> StateClock::GetTotals(Clock::time_point now) const {
+    std::array<std::uint64_t, StateCount> totals;
+    for (std::size_t i = 0; i < StateCount; i++) {
+      totals[i] = mTotals[i].load(std::memory_order_relaxed);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - Clock::time_point(Clock::duration(mSince.load(std::memory_order_relaxed))));
+    if (elapsed.count() > 0) {
+      totals[mState.load(std::memory_order_relaxed)] += static_cast<std::uint64_t>(elapsed.count());
+    }
+    return totals;
+  }
+
+  std::string FormatPrometheus(Clock::time_point now) {
+    std::string text;
+    text.reserve(8 * 1024);
+
+    AppendCounter(text, "sleeppreventer_state_transitions_total", "Changes of the (enable, system, display) state", gStateTransitions.Get());
+
+    AppendHeader(text, "sleeppreventer_state_seconds_total", "counter", "Time spent in each (enable, system, display) state");
+    const auto totals = gStateTime.GetTotals(now);
+    for (std::size_t state = 0; state < StateCount; state++) {
+      const auto stateBits = GetIndexStateBits(state);
+      text.append("sleeppreventer_state_seconds_total{enable=\"").append((stateBits & IPC::StateBits::Enable) ? "1" : "0");
+      text.append("\",system=\"").append((stateBits & IPC::StateBits::ActiveSystem) ? "1" : "0");
+      text.append("\",display=\"").append((stateBits & IPC::StateBits::ActiveDisplay) ? "1" : "0");
+      text.append("\"} ").append(FormatSeconds(static_cast<double>(totals[state]) / 1e9)).append("\n");
+    }
+
+    AppendCounter(text, "sleeppreventer_backend_calls_total", "Calls into the power management backend", gBackendCalls.Get());
+    AppendCounter(text, "sleeppreventer_backend_failures_total", "Backend calls which failed", gBackendFailures.Get());
+    AppendCounter(text, "sleeppreventer_backend_calls_elided_total", "State changes which left the backend alone, as unchanged or coalesced", gBackendCallsElided.Get());
+    AppendHistogram(text, "sleeppreventer_backend_call_duration_seconds", "Duration of backend calls", gBackendLatency);
+
+    AppendCounter(text, "sleeppreventer_ipc_requests_total", "IPC request frames handled", gIPCRequests.Get());
+    AppendCounter(text, "sleeppreventer_ipc_denied_total", "IPC commands refused by a per-user limit", gIPCDenied.Get());
+    AppendCounter(text, "sleeppreventer_fleet_auth_failures_total", "Fleet connections refused for a wrong key", gFleetAuthFailures.Get());
+    AppendHistogram(text, "sleeppreventer_ipc_request_duration_seconds", "Time to handle an IPC request frame", gIPCLatency);
+
+    AppendCounter(text, "sleeppreventer_config_saves_total", "Config file writes", gConfigSaves.Get());
+    AppendCounter(text, "sleeppreventer_config_save_failures_total", "Config file writes which failed", gConfigSaveFailures.Get());
+    AppendHistogram(text, "sleeppreventer_config_save_duration_seconds", "Duration of config file writes", gConfigSaveLatency);
+
+    AppendCounter(text, "sleeppreventer_hook_runs_total", "Transition hooks started", gHookRuns.Get());
+    AppendCounter(text, "sleeppreventer_hook_failures_total", "Transition hooks which failed, timed out or could not start", gHookFailures.Get());
+    AppendCounter(text, "sleeppreventer_hook_timeouts_total", "Transition hooks killed at their timeout", gHookTimeouts.Get());
+    AppendCounter(text, "sleeppreventer_hook_coalesced_total", "Queued transition hooks replaced by a later one or dropped", gHookCoalesced.Get());
+    AppendHistogram(text, "sleeppreventer_hook_duration_seconds", "Run time of transition hooks", gHookLatency);
+
+    return text;
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "IPCProtocol.hpp"
+
+// process-wide counters, latency histograms and time in state
+// recording is a few relaxed atomic operations and never takes a lock; readers see each value on its own,
+// not a snapshot consistent across values
+namespace Metrics {
+  using Clock = std::chrono::steady_clock;
+
+  class Counter {
+    std::atomic<std::uint64_t> mValue{0};
+
+  public:
+    void Add(std::uint64_t amount = 1) {
+      mValue.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Get() const {
+      return mValue.load(std::memory_order_relaxed);
+    }
+  };
+
+  // nanosecond latencies in log-linear buckets, after HdrHistogram: each power of two is split into
+  // SubBucketCount linear buckets, so a bucket is at most 1/SubBucketCount of its values wide
+  // values from 2^MaxExponent ns (about 18 minutes) on share the last bucket
+  class Histogram {
+  public:
+    static constexpr unsigned SubBucketBits = 4;
+    static constexpr std::size_t SubBucketCount = std::size_t{1} << SubBucketBits;
+    static constexpr unsigned MaxExponent = 40;
+    static constexpr std::size_t BucketCount = (MaxExponent - SubBucketBits + 1) * SubBucketCount;
+
+    struct Snapshot {
+      std::array<std::uint64_t, BucketCount> counts;
+      std::uint64_t count;
+      std::uint64_t sum;
+      std::uint64_t max;
+
+      // upper bound of the bucket holding the q-quantile (0 to 1), in nanoseconds; 0 if nothing was recorded
+      std::uint64_t GetQuantile(double q) const;
+    };
+
+  private:
+    std::array<std::atomic<std::uint64_t>, BucketCount> mCounts{};
+    std::atomic<std::uint64_t> mSum{0};
+    std::atomic<std::uint64_t> mMax{0};
+
+  public:
+    static std::size_t GetBucketIndex(std::uint64_t value);
+    // smallest value of the bucket
+    static std::uint64_t GetBucketLowerBound(std::size_t index);
+
+    void Record(std::chrono::nanoseconds value);
+    void RecordSince(Clock::time_point start) {
+      Record(Clock::now() - start);
+    }
+
+    Snapshot GetSnapshot() const;
+  };
+
+  // time is kept per (enable, system, display) state, as taken from IPC::StateBits: enable is the manual switch, while
+  // system and display are the active bits, what the backend was asked to hold, leases included
+  constexpr std::size_t StateCount = 8;
+  // index of the state of the given IPC::StateBits; the flags alone do not make a state of their own
+  std::size_t GetStateIndex(std::uint8_t stateBits);
+  // IPC::StateBits of the state at index, without the flags
+  std::uint8_t GetIndexStateBits(std::size_t index);
+
+  // cumulative time spent in each state since the process started
+  // Set has a single writer at a time (Preventer calls it under its backend mutex); readers may be anywhere
+  class StateClock {
+    std::atomic<std::uint8_t> mState{0};
+    std::atomic<Clock::rep> mSince;
+    std::array<std::atomic<std::uint64_t>, StateCount> mTotals{};
+
+  public:
+    StateClock();
+
+    // stateBits are IPC::StateBits; returns true if the state changed
+    bool Set(std::uint8_t stateBits, Clock::time_point now);
+    // GetStateIndex of the current state
+    std::uint8_t GetState() const;
+    // totals in nanoseconds, including the time in the current state up to now
+    std::array<std::uint64_t, StateCount> GetTotals(Clock::time_point now) const;
+  };
+
+  extern Counter gStateTransitions;
+  extern Counter gBackendCalls;
+  extern Counter gBackendFailures;
+  extern Counter gBackendCallsElided;
+  extern Counter gIPCRequests;
+  extern Counter gIPCDenied;
+  extern Counter gFleetAuthFailures;
+  extern Counter gHookRuns;
+  extern Counter gHookFailures;
+  extern Counter gHookTimeouts;
+  extern Counter gHookCoalesced;
+  extern Counter gConfigSaves;
+  extern Counter gConfigSaveFailures;
+  extern Histogram gBackendLatency;
+  extern Histogram gIPCLatency;
+  extern Histogram gConfigSaveLatency;
+  extern Histogram gHookLatency;
+  extern StateClock gStateTime;
+
+  // every metric in the Prometheus text exposition format
+  std::string FormatPrometheus(Clock::time_point now = Clock::now());
+} // namespace Metrics
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "PreventerBackend.hpp"
+
+namespace Preventer {
+  // accepts every state without touching the OS; for benchmarks and for running without a session manager
+  class NullBackend : public Backend {
+  public:
+    bool Apply(bool, bool) override {
+      return true;
+    }
+
+    void Release() override {}
+  };
+} // namespace Preventer
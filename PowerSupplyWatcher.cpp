@@ -0,0 +1,253 @@
+#include "PowerSupplyWatcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  // the multicast group of uevents straight from the kernel; udev rebroadcasts them on group 2
+  constexpr unsigned KernelUeventGroup = 1;
+  // room for a burst of uevents, e.g. when a dock with many devices is plugged in
+  constexpr int ReceiveBufferSize = 256 * 1024;
+  // part of the device path of every power supply, so other uevents are skipped without parsing them
+  constexpr auto PowerSupplyPath = "/power_supply/"sv;
+
+  // calls callback(key, value) for every "KEY=VALUE" field
+  template <typename Callback>
+  void ForEachProperty(std::string_view properties, char separator, Callback&& callback) {
+    while (!properties.empty()) {
+      const auto end = std::min(properties.find(separator), properties.size());
+      const auto field = properties.substr(0, end);
+      properties.remove_prefix(std::min(end + 1, properties.size()));
+      const auto equals = field.find('=');
+      if (equals != std::string_view::npos) {
+        callback(field.substr(0, equals), field.substr(equals + 1));
+      }
+    }
+  }
+
+  // reads a small sysfs file into buffer; returns its contents without the trailing newline
+  std::optional<std::string_view> ReadFile(const std::filesystem::path& path, char* buffer, std::size_t size) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    ssize_t length;
+    do {
+      length = read(fd, buffer, size);
+    } while (length < 0 && errno == EINTR);
+    close(fd);
+    if (length < 0) {
+      return std::nullopt;
+    }
+    std::string_view contents(buffer, static_cast<std::size_t>(length));
+    while (!contents.empty() && contents.back() == '\n') {
+      contents.remove_suffix(1);
+    }
+    return contents;
+  }
+}
+
+PowerSupplyWatcher::PowerSupplyWatcher(const Policy& policy, const std::filesystem::path& sysfsRoot) :
+  mPolicy(policy),
+  mClassDirectory(sysfsRoot / "class" / "power_supply")
+{
+  mSocketFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (mSocketFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "uevent socket failed");
+  }
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = KernelUeventGroup;
+  if (bind(mSocketFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    const int error = errno;
+    close(mSocketFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "uevent bind failed");
+  }
+  const int receiveBufferSize = ReceiveBufferSize;
+  if (setsockopt(mSocketFd, SOL_SOCKET, SO_RCVBUFFORCE, &receiveBufferSize, sizeof(receiveBufferSize)) != 0) {
+    setsockopt(mSocketFd, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+  }
+
+  // subscribed first, so that a change during the scan is not missed
+  Rescan();
+}
+
+PowerSupplyWatcher::~PowerSupplyWatcher() {
+  close(mSocketFd);
+}
+
+void PowerSupplyWatcher::Rescan() {
+  mSupplies.clear();
+  std::error_code error;
+  for (std::filesystem::directory_iterator it(mClassDirectory, error), end; !error && it != end; it.increment(error)) {
+    const auto name = it->path().filename().string();
+    const auto properties = ReadFile(it->path() / "uevent", mBuffer, sizeof(mBuffer));
+    if (!properties) {
+      continue;
+    }
+    const auto supply = Apply(properties.value(), '\n', name);
+    // older kernels leave the type out of the uevent
+    if (const auto type = ReadFile(it->path() / "type", mBuffer, sizeof(mBuffer)); supply != nullptr && type) {
+      supply->battery = type.value() == "Battery"sv;
+    }
+  }
+  Evaluate();
+}
+
+PowerSupplyWatcher::Supply* PowerSupplyWatcher::Apply(std::string_view properties, char separator, std::string_view fallbackName) {
+  auto name = fallbackName;
+  std::string_view action;
+  std::string_view type;
+  std::string_view scope;
+  std::string_view online;
+  std::string_view status;
+  std::string_view capacity;
+  ForEachProperty(properties, separator, [&](std::string_view key, std::string_view value) {
+    if (key == "ACTION"sv) {
+      action = value;
+    } else if (key == "POWER_SUPPLY_NAME"sv) {
+      name = value;
+    } else if (key == "POWER_SUPPLY_TYPE"sv) {
+      type = value;
+    } else if (key == "POWER_SUPPLY_SCOPE"sv) {
+      scope = value;
+    } else if (key == "POWER_SUPPLY_ONLINE"sv) {
+      online = value;
+    } else if (key == "POWER_SUPPLY_STATUS"sv) {
+      status = value;
+    } else if (key == "POWER_SUPPLY_CAPACITY"sv) {
+      capacity = value;
+    }
+  });
+  if (name.empty()) {
+    return nullptr;
+  }
+
+  auto supply = std::find_if(mSupplies.begin(), mSupplies.end(), [name](const Supply& supply) {
+    return supply.name == name;
+  });
+  if (action == "remove"sv) {
+    if (supply != mSupplies.end()) {
+      mSupplies.erase(supply);
+    }
+    return nullptr;
+  }
+  if (supply == mSupplies.end()) {
+    supply = mSupplies.emplace(mSupplies.end());
+    supply->name = name;
+  }
+
+  // a change uevent carries every property, but an older kernel may leave some out
+  if (!type.empty()) {
+    supply->battery = type == "Battery"sv;
+  }
+  if (!scope.empty()) {
+    supply->peripheral = scope == "Device"sv;
+  }
+  if (!online.empty()) {
+    supply->online = online != "0"sv;
+  }
+  if (!status.empty()) {
+    supply->discharging = status == "Discharging"sv;
+  }
+  if (!capacity.empty()) {
+    int value = 0;
+    if (std::from_chars(capacity.data(), capacity.data() + capacity.size(), value).ec == std::errc()) {
+      supply->capacity = std::clamp(value, 0, 100);
+    }
+  }
+  return &*supply;
+}
+
+bool PowerSupplyWatcher::Evaluate() {
+  bool externalOnline = false;
+  bool discharging = false;
+  int capacityTotal = 0;
+  int capacityCount = 0;
+  for (const auto& supply : mSupplies) {
+    if (!supply.battery) {
+      externalOnline |= supply.online;
+    } else if (!supply.peripheral) {
+      discharging |= supply.discharging;
+      if (supply.capacity) {
+        capacityTotal += supply.capacity.value();
+        capacityCount++;
+      }
+    }
+  }
+
+  mStatus.onAc = externalOnline || !discharging;
+  mStatus.batteryPercent = capacityCount > 0 ? std::optional<int>(capacityTotal / capacityCount) : std::nullopt;
+
+  const bool wasBlocked = mBlocked;
+  const bool lowBattery = mPolicy.minBatteryPercent > 0 && mStatus.batteryPercent && mStatus.batteryPercent.value() < mPolicy.minBatteryPercent;
+  mBlocked = !mStatus.onAc && (mPolicy.requireAc || lowBattery);
+  return mBlocked != wasBlocked;
+}
+
+int PowerSupplyWatcher::GetFd() const {
+  return mSocketFd;
+}
+
+bool PowerSupplyWatcher::ReadEvents() {
+  const bool wasBlocked = mBlocked;
+  while (true) {
+    sockaddr_nl sender{};
+    socklen_t senderLength = sizeof(sender);
+    const auto length = recvfrom(mSocketFd, mBuffer, sizeof(mBuffer), 0, reinterpret_cast<sockaddr*>(&sender), &senderLength);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        Rescan();
+        continue;
+      }
+      break;
+    }
+    // only the kernel sends to this group, but a forged uevent would not come from port 0
+    if (sender.nl_pid != 0) {
+      continue;
+    }
+    HandleUevent(std::string_view(mBuffer, static_cast<std::size_t>(length)));
+  }
+  return mBlocked != wasBlocked;
+}
+
+bool PowerSupplyWatcher::HandleUevent(std::string_view message) {
+  const auto headerEnd = std::min(message.find('\0'), message.size());
+  const auto header = message.substr(0, headerEnd);
+  const auto at = header.find('@');
+  if (at == std::string_view::npos || header.find(PowerSupplyPath, at) == std::string_view::npos) {
+    return false;
+  }
+  const auto devicePath = header.substr(at + 1);
+  const auto slash = devicePath.rfind('/');
+  Apply(message.substr(std::min(headerEnd + 1, message.size())), '\0', devicePath.substr(slash + 1));
+  return Evaluate();
+}
+
+bool PowerSupplyWatcher::IsBlocked() const {
+  return mBlocked;
+}
+
+const PowerSupplyWatcher::Status& PowerSupplyWatcher::GetStatus() const {
+  return mStatus;
+}
+
+std::size_t PowerSupplyWatcher::GetSupplyCount() const {
+  return mSupplies.size();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// decides from the power supplies in <sysfsRoot>/class/power_supply whether the power policy lets sleep be prevented
+//
+// sysfs is read once; after that the kernel's uevents keep the supplies up to date, as their properties carry the
+// online flag, status and capacity, so nothing is polled and the batteries are not queried again; sysfs is only read
+// again if uevents were lost
+// a driver that changes the capacity without sending a uevent is caught up at its next one
+//
+// the system is on AC while any supply that is not a battery is online, or while no battery discharges; batteries of
+// peripherals (scope "Device", e.g. a wireless mouse) are left out, and the battery level is the mean of the others
+class PowerSupplyWatcher {
+public:
+  struct Policy {
+    // block while on battery
+    bool requireAc = false;
+    // block while on battery below this level in percent; 0 disables it
+    int minBatteryPercent = 0;
+  };
+
+  struct Status {
+    bool onAc = true;
+    // nullopt without a battery that reports a capacity
+    std::optional<int> batteryPercent;
+  };
+
+private:
+  struct Supply {
+    std::string name;
+    // anything else feeds the system from outside: Mains, USB, Wireless...
+    bool battery = false;
+    // scope "Device"
+    bool peripheral = false;
+    bool online = false;
+    bool discharging = false;
+    std::optional<int> capacity;
+  };
+
+  static constexpr std::size_t BufferSize = 8 * 1024;
+
+  Policy mPolicy;
+  std::filesystem::path mClassDirectory;
+  int mSocketFd = -1;
+  std::vector<Supply> mSupplies;
+  Status mStatus;
+  bool mBlocked = false;
+  alignas(8) char mBuffer[BufferSize];
+
+  void Rescan();
+  // applies "KEY=VALUE" properties separated by separator to the supply they name, fallbackName if they do not
+  // a "remove" action drops the supply; returns the supply, or nullptr if there is none
+  Supply* Apply(std::string_view properties, char separator, std::string_view fallbackName);
+  // returns true if IsBlocked() changed
+  bool Evaluate();
+
+public:
+  // throws std::system_error if the uevent socket cannot be opened
+  explicit PowerSupplyWatcher(const Policy& policy, const std::filesystem::path& sysfsRoot = "/sys");
+  ~PowerSupplyWatcher();
+
+  PowerSupplyWatcher(const PowerSupplyWatcher&) = delete;
+  PowerSupplyWatcher& operator=(const PowerSupplyWatcher&) = delete;
+
+  // readable when uevents are pending
+  int GetFd() const;
+  // handles pending uevents without blocking; returns true if IsBlocked() changed
+  bool ReadEvents();
+  // handles one uevent as the kernel sends it, "ACTION@DEVPATH" and the properties, all NUL terminated; uevents of
+  // other subsystems are skipped by their path; returns true if IsBlocked() changed
+  bool HandleUevent(std::string_view message);
+
+  // true while the policy forbids preventing sleep
+  bool IsBlocked() const;
+  const Status& GetStatus() const;
+  std::size_t GetSupplyCount() const;
+};
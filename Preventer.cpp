@@ -1,29 +1,210 @@
 #include "Preventer.hpp"
 
-#include <Windows.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "IPCProtocol.hpp"
+#include "Journal.hpp"
+#include "LeaseTable.hpp"
+#include "Metrics.hpp"
+#include "PreventerBackend.hpp"
 
 namespace Preventer {
-  extern std::atomic<bool> gEnable = false;
-  extern std::atomic<bool> gSystemFlag = false;
-  extern std::atomic<bool> gDisplayFlag = false;
+  std::atomic<bool> gEnable = false;
+  std::atomic<bool> gSystemFlag = false;
+  std::atomic<bool> gDisplayFlag = false;
+  std::atomic<bool> gPowerBlocked = false;
+
+  namespace {
+    std::mutex gBackendMutex;
+    std::unique_ptr<Backend> gBackend;
+    // taken after gBackendMutex when both are needed
+    std::mutex gLeaseMutex;
+    LeaseTable gLeases;
+    Journal::Writer* gJournal = nullptr;
+    // IPC::StateBits of the last ApplyState, guarded by gBackendMutex
+    std::uint8_t gAppliedState = 0;
+    // the systemRequired and displayRequired the backend last applied, guarded by gBackendMutex; none before the first
+    // call, after a failed one and after Release, so that the next call goes through
+    std::optional<std::pair<bool, bool>> gBackendState;
+    // guarded by gBackendMutex
+    std::chrono::milliseconds gCoalesceWindow{0};
+    std::function<void(std::chrono::milliseconds)> gScheduleFlush;
+    Metrics::Clock::time_point gLastBackendCall;
+    bool gFlushPending = false;
+    std::function<void(std::uint8_t)> gStateListener;
+    // guarded by gLeaseMutex
+    std::function<void(std::size_t)> gLeaseCountListener;
+
+    Backend& GetBackend() {
+      if (!gBackend) {
+        gBackend = CreateDefaultBackend();
+      }
+      return *gBackend;
+    }
+
+    std::chrono::system_clock::time_point ToSystemTime(LeaseTable::Clock::time_point time) {
+      return std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(time - LeaseTable::Clock::now());
+    }
+
+    void JournalLeaseEnded(std::string_view name) {
+      gJournal->AppendLease(Journal::Kind::LeaseEnd, name);
+    }
+
+    void JournalLeaseExpired(std::string_view name, LeaseTable::Clock::time_point expiry) {
+      gJournal->AppendLease(Journal::Kind::LeaseExpire, name, 0, ToSystemTime(expiry));
+    }
+
+    LeaseTable::EndedCallback GetLeaseEndedCallback() {
+      return gJournal != nullptr ? LeaseTable::EndedCallback(JournalLeaseEnded) : LeaseTable::EndedCallback();
+    }
+
+    // called under gLeaseMutex after the leases were changed
+    void NotifyLeaseCount(std::size_t previousCount) {
+      if (gLeaseCountListener && gLeases.GetCount() != previousCount) {
+        gLeaseCountListener(gLeases.GetCount());
+      }
+    }
+
+    // called under gBackendMutex
+    bool ApplyLockedState() {
+      // read under gBackendMutex, so that whichever call applies last applies the latest state and leases
+      const bool enable = gEnable;
+      const bool systemFlag = gSystemFlag;
+      const bool displayFlag = gDisplayFlag;
+      const auto leaseModes = GetLeaseModes();
+      const bool allowed = !gPowerBlocked;
+      const bool systemRequired = allowed && ((enable && systemFlag) || (leaseModes & LeaseModes::System));
+      const bool displayRequired = allowed && ((enable && displayFlag) || (leaseModes & LeaseModes::Display));
 
-  void ApplyState() {
-    DWORD flags = ES_CONTINUOUS;
+      bool result = true;
+      auto end = Metrics::Clock::now();
+      if (gBackendState == std::pair(systemRequired, displayRequired)) {
+        Metrics::gBackendCallsElided.Add();
+      } else {
+        const auto start = end;
+        result = GetBackend().Apply(systemRequired, displayRequired);
+        end = Metrics::Clock::now();
+        Metrics::gBackendLatency.Record(end - start);
+        Metrics::gBackendCalls.Add();
+        if (!result) {
+          Metrics::gBackendFailures.Add();
+        }
+        gLastBackendCall = end;
+        gBackendState = result ? std::optional(std::pair(systemRequired, displayRequired)) : std::nullopt;
+      }
 
-    if (gEnable) {
-      if (gSystemFlag) {
-        flags |= ES_SYSTEM_REQUIRED;
+      std::uint8_t state = 0;
+      if (enable) {
+        state |= IPC::StateBits::Enable;
+      }
+      if (systemFlag) {
+        state |= IPC::StateBits::SystemFlag;
+      }
+      if (displayFlag) {
+        state |= IPC::StateBits::DisplayFlag;
       }
+      if (systemRequired) {
+        state |= IPC::StateBits::ActiveSystem;
+      }
+      if (displayRequired) {
+        state |= IPC::StateBits::ActiveDisplay;
+      }
+      if (Metrics::gStateTime.Set(state, end)) {
+        Metrics::gStateTransitions.Add();
+      }
+      if (state != gAppliedState) {
+        if (gJournal != nullptr) {
+          gJournal->AppendState(gAppliedState, state);
+        }
+        gAppliedState = state;
+        if (gStateListener) {
+          gStateListener(state);
+        }
+      }
+
+      return result;
+    }
+  }
+
+  void SetBackend(std::unique_ptr<Backend> backend) {
+    std::lock_guard lock(gBackendMutex);
+    gBackend = std::move(backend);
+    gBackendState.reset();
+  }
+
+  int StartBackendAsync() {
+    std::lock_guard lock(gBackendMutex);
+    return GetBackend().StartAsync();
+  }
+
+  void DispatchBackend() {
+    std::lock_guard lock(gBackendMutex);
+    if (!GetBackend().Dispatch()) {
+      Metrics::gBackendFailures.Add();
+      gBackendState.reset();
+    }
+  }
+
+  void SetJournal(Journal::Writer* journal) {
+    gJournal = journal;
+  }
+
+  void SetStateListener(std::function<void(std::uint8_t state)> listener) {
+    std::lock_guard lock(gBackendMutex);
+    gStateListener = std::move(listener);
+  }
+
+  void SetLeaseCountListener(std::function<void(std::size_t count)> listener) {
+    std::lock_guard lock(gLeaseMutex);
+    gLeaseCountListener = std::move(listener);
+  }
 
-      if (gDisplayFlag) {
-        flags |= ES_DISPLAY_REQUIRED;
+  void SetCoalescing(std::chrono::milliseconds window, std::function<void(std::chrono::milliseconds delay)> scheduleFlush) {
+    std::lock_guard lock(gBackendMutex);
+    gCoalesceWindow = window;
+    gScheduleFlush = std::move(scheduleFlush);
+  }
+
+  bool ApplyState() {
+    std::lock_guard lock(gBackendMutex);
+    if (gFlushPending) {
+      Metrics::gBackendCallsElided.Add();
+      return true;
+    }
+    if (gCoalesceWindow > std::chrono::milliseconds::zero() && gScheduleFlush) {
+      const auto elapsed = Metrics::Clock::now() - gLastBackendCall;
+      if (elapsed < gCoalesceWindow) {
+        gFlushPending = true;
+        gScheduleFlush(std::chrono::ceil<std::chrono::milliseconds>(gCoalesceWindow - elapsed));
+        return true;
       }
     }
+    return ApplyLockedState();
+  }
+
+  bool FlushState() {
+    std::lock_guard lock(gBackendMutex);
+    if (!gFlushPending) {
+      return true;
+    }
+    gFlushPending = false;
+    return ApplyLockedState();
+  }
 
-    SetThreadExecutionState(flags);
-   }
+  std::uint8_t GetAppliedState() {
+    std::lock_guard lock(gBackendMutex);
+    return gAppliedState;
+  }
 
-  void ApplyStateFromIPCFlags(DWORD flags) {
+  bool ApplyStateFromIPCFlags(std::uint32_t flags) {
     if (flags & IPCFlags::Enable) {
       gEnable = true;
     }
@@ -54,10 +235,105 @@ namespace Preventer {
 
     //
 
-    ApplyState();
+    return ApplyState();
+  }
+
+  bool SetPowerBlocked(bool blocked) {
+    if (gPowerBlocked.exchange(blocked) == blocked) {
+      return true;
+    }
+    return ApplyState();
+  }
+
+  std::uint8_t GetLeaseModesFromIPCFlags(std::uint32_t flags) {
+    std::uint8_t modes = 0;
+    if (flags & IPCFlags::SetSystemFlag) {
+      modes |= LeaseModes::System;
+    }
+    if (flags & IPCFlags::SetDisplayFlag) {
+      modes |= LeaseModes::Display;
+    }
+    return modes;
+  }
+
+  bool AcquireLease(std::string_view name, std::uint8_t modes, std::optional<LeaseTable::Clock::time_point> expiry) {
+    std::unique_lock lock(gLeaseMutex);
+    const auto count = gLeases.GetCount();
+    const bool changed = gLeases.Acquire(name, modes, expiry);
+    if (gJournal != nullptr) {
+      gJournal->AppendLease(Journal::Kind::LeaseAcquire, name, modes, expiry ? std::optional(ToSystemTime(expiry.value())) : std::nullopt);
+    }
+    NotifyLeaseCount(count);
+    lock.unlock();
+    return !changed || ApplyState();
+  }
+
+  bool ReleaseLease(std::string_view name) {
+    std::unique_lock lock(gLeaseMutex);
+    if (gJournal != nullptr && gLeases.IsHeld(name)) {
+      gJournal->AppendLease(Journal::Kind::LeaseRelease, name);
+    }
+    const auto count = gLeases.GetCount();
+    const bool changed = gLeases.Release(name);
+    NotifyLeaseCount(count);
+    lock.unlock();
+    return !changed || ApplyState();
+  }
+
+  bool ReleaseLeases(std::string_view prefix) {
+    std::unique_lock lock(gLeaseMutex);
+    const auto count = gLeases.GetCount();
+    const bool changed = gLeases.ReleasePrefix(prefix, GetLeaseEndedCallback());
+    NotifyLeaseCount(count);
+    lock.unlock();
+    return !changed || ApplyState();
+  }
+
+  bool ExpireLeases(LeaseTable::Clock::time_point now) {
+    std::unique_lock lock(gLeaseMutex);
+    const auto count = gLeases.GetCount();
+    const bool changed = gLeases.Expire(now, GetLeaseEndedCallback(), gJournal != nullptr ? LeaseTable::ExpiredCallback(JournalLeaseExpired) : LeaseTable::ExpiredCallback());
+    NotifyLeaseCount(count);
+    lock.unlock();
+    return !changed || ApplyState();
+  }
+
+  std::uint8_t GetLeaseModes() {
+    std::lock_guard lock(gLeaseMutex);
+    return gLeases.GetModes();
+  }
+
+  std::optional<LeaseTable::Clock::time_point> GetNextLeaseExpiry() {
+    std::lock_guard lock(gLeaseMutex);
+    return gLeases.GetNextExpiry();
+  }
+
+  std::size_t GetLeaseCount() {
+    std::lock_guard lock(gLeaseMutex);
+    return gLeases.GetCount();
+  }
+
+  bool IsLeaseHeld(std::string_view name) {
+    std::lock_guard lock(gLeaseMutex);
+    return gLeases.IsHeld(name);
+  }
+
+  bool IsLeaseWithinLimit(std::string_view name, std::string_view prefix, std::size_t limit) {
+    std::lock_guard lock(gLeaseMutex);
+    return gLeases.IsHeld(name) || gLeases.CountPrefix(prefix, limit) < limit;
+  }
+
+  void ForEachLease(std::string_view prefix, const std::function<void(std::string_view name, std::uint8_t modes)>& callback) {
+    std::lock_guard lock(gLeaseMutex);
+    gLeases.ForEachPrefix(prefix, callback);
   }
 
   void Finish() {
-    SetThreadExecutionState(ES_CONTINUOUS);
+    std::lock_guard lock(gBackendMutex);
+    gFlushPending = false;
+    if (gBackend) {
+      gBackend->Release();
+    }
+    gBackendState.reset();
   }
 }
@@ -1,24 +1,90 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
 
-#include <Windows.h>
+#include "Journal.hpp"
+#include "LeaseTable.hpp"
+#include "PreventerBackend.hpp"
 
 namespace Preventer {
   namespace IPCFlags {
-    constexpr DWORD Enable = 0x00000001;
-    constexpr DWORD Disable = 0x00000002;
-    constexpr DWORD SetSystemFlag = 0x00000010;
-    constexpr DWORD UnsetSystemFlag = 0x00000020;
-    constexpr DWORD SetDisplayFlag = 0x00000100;
-    constexpr DWORD UnsetDisplayFlag = 0x00000200;
+    constexpr std::uint32_t Enable = 0x00000001;
+    constexpr std::uint32_t Disable = 0x00000002;
+    constexpr std::uint32_t SetSystemFlag = 0x00000010;
+    constexpr std::uint32_t UnsetSystemFlag = 0x00000020;
+    constexpr std::uint32_t SetDisplayFlag = 0x00000100;
+    constexpr std::uint32_t UnsetDisplayFlag = 0x00000200;
   } // namespace IPCFlags
 
+  // the manual state, as toggled from the tray, the config and the command line
+  // the backend state is the manual state together with the modes of every live lease
   extern std::atomic<bool> gEnable;
   extern std::atomic<bool> gSystemFlag;
   extern std::atomic<bool> gDisplayFlag;
+  // set while the power policy forbids preventing sleep, e.g. on battery; ApplyState then holds nothing, whatever
+  // the manual state and the leases ask for
+  extern std::atomic<bool> gPowerBlocked;
 
-  void ApplyState();
-  void ApplyStateFromIPCFlags(DWORD flags);
+  // replaces the backend used by ApplyState and Finish
+  // the platform default (CreateDefaultBackend) is used if this is never called
+  void SetBackend(std::unique_ptr<Backend> backend);
+  // see Backend::StartAsync; from then on ApplyState returns as soon as the backend call is sent, and a call which
+  // fails later shows up in DispatchBackend, which makes the next ApplyState call the backend again
+  int StartBackendAsync();
+  void DispatchBackend();
+  // journal of every state change and lease call, tagged with the calling thread's Journal::Origin; none if null
+  // must be set before anything is applied and outlive every later call
+  void SetJournal(Journal::Writer* journal);
+  // called with the new IPC::StateBits whenever an ApplyState changes them, on the applying thread and under the
+  // backend lock, so it must not call back into Preventer; none if empty
+  void SetStateListener(std::function<void(std::uint8_t state)> listener);
+  // called with the number of leases whenever it changes, under the lease lock; none if empty
+  void SetLeaseCountListener(std::function<void(std::size_t count)> listener);
+
+  // coalesces bursts of ApplyState: one within window of the last backend call only marks the state dirty and asks
+  // scheduleFlush to call FlushState after the given delay, once; the pending state is then applied in one call, so
+  // a burst costs two backend calls at most and a change waits no longer than window
+  // scheduleFlush runs on the applying thread under the backend lock, like the state listener; a zero window or an
+  // empty scheduleFlush applies every call at once, which is the default
+  void SetCoalescing(std::chrono::milliseconds window, std::function<void(std::chrono::milliseconds delay)> scheduleFlush);
+
+  // returns false if the backend call failed; a call coalesced into a later FlushState returns true
+  // the backend is called only if the state it should hold differs from the last one it applied
+  bool ApplyState();
+  bool ApplyStateFromIPCFlags(std::uint32_t flags);
+  // applies the state left dirty by coalesced ApplyState calls, if any
+  bool FlushState();
+  // IPC::StateBits of the state last applied, which trails the flags and leases while a flush is pending
+  std::uint8_t GetAppliedState();
+  // sets gPowerBlocked and applies the state if it changed
+  bool SetPowerBlocked(bool blocked);
   void Finish();
+
+  // LeaseModes for the set bits of IPCFlags; the enable and unset bits are ignored
+  std::uint8_t GetLeaseModesFromIPCFlags(std::uint32_t flags);
+
+  // see LeaseTable; the state is applied only if the effective modes changed
+  // each returns false if the backend call failed
+  bool AcquireLease(std::string_view name, std::uint8_t modes, std::optional<LeaseTable::Clock::time_point> expiry = std::nullopt);
+  bool ReleaseLease(std::string_view name);
+  bool ReleaseLeases(std::string_view prefix);
+  bool ExpireLeases(LeaseTable::Clock::time_point now);
+
+  // union of the live leases as LeaseModes bits
+  std::uint8_t GetLeaseModes();
+  std::optional<LeaseTable::Clock::time_point> GetNextLeaseExpiry();
+  std::size_t GetLeaseCount();
+  bool IsLeaseHeld(std::string_view name);
+  // true if name is held or fewer than limit leases start with prefix, both read under one lock; see
+  // LeaseTable::CountPrefix
+  bool IsLeaseWithinLimit(std::string_view name, std::string_view prefix, std::size_t limit);
+  // see LeaseTable::ForEachPrefix; the callback runs under the lease lock
+  void ForEachLease(std::string_view prefix, const std::function<void(std::string_view name, std::uint8_t modes)>& callback);
 } // namespace Preventer
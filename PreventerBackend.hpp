@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+
+namespace Preventer {
+  // the part of Preventer which actually talks to the OS
+  class Backend {
+  public:
+    virtual ~Backend() = default;
+
+    // requests the given state; returns false if the OS call failed
+    // backends may skip the OS call if the requested state is already held
+    virtual bool Apply(bool systemRequired, bool displayRequired) = 0;
+    // drops everything held by Apply
+    virtual void Release() = 0;
+
+    // hands the backend's waits to the caller's event loop: returns an fd to watch for EPOLLIN, on which Dispatch must
+    // be called, after which Apply only starts its OS calls; -1 if every call completes within Apply
+    virtual int StartAsync() {
+      return -1;
+    }
+    // completes the calls Apply started; returns false if one of them failed
+    virtual bool Dispatch() {
+      return true;
+    }
+  };
+
+  // defined by the platform backend linked into the executable
+  std::unique_ptr<Backend> CreateDefaultBackend();
+} // namespace Preventer
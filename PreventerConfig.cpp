@@ -0,0 +1,47 @@
+#include "PreventerConfig.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+#include "ConfigFile.hpp"
+#include "ConfigSchema.hpp"
+#include "Preventer.hpp"
+
+namespace Preventer {
+  namespace {
+    struct KeyBinding {
+      Config::Key key;
+      std::atomic<bool>& flag;
+    };
+
+    const KeyBinding gKeyBindings[] = {
+      {Config::Key::Enable, gEnable},
+      {Config::Key::System, gSystemFlag},
+      {Config::Key::Display, gDisplayFlag},
+    };
+  }
+
+  void LoadStateFromConfig(const ConfigFile& configFile) {
+    for (const auto& binding : gKeyBindings) {
+      binding.flag = configFile.GetBool(binding.key);
+    }
+  }
+
+  bool ApplyConfigChanges(const ConfigFile& configFile, const Config::KeySet& changedKeys) {
+    bool changed = false;
+    for (const auto& binding : gKeyBindings) {
+      if (!changedKeys.test(static_cast<std::size_t>(binding.key))) {
+        continue;
+      }
+      const bool value = configFile.GetBool(binding.key);
+      if (binding.flag.exchange(value) != value) {
+        changed = true;
+      }
+    }
+
+    if (!changed) {
+      return true;
+    }
+    return ApplyState();
+  }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ConfigFile.hpp"
+#include "ConfigSchema.hpp"
+
+namespace Preventer {
+  // sets gEnable, gSystemFlag and gDisplayFlag from the config without applying them
+  void LoadStateFromConfig(const ConfigFile& configFile);
+
+  // copies the changed keys into the state and applies it only if the state actually changed
+  // returns false if the backend call failed
+  bool ApplyConfigChanges(const ConfigFile& configFile, const Config::KeySet& changedKeys);
+} // namespace Preventer
@@ -0,0 +1,456 @@
+#include "ProcessWatcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  constexpr int AckTimeoutMs = 200;
+  constexpr auto EventBatchDelay = 100ms;
+  constexpr int ConnectorReceiveBufferSize = 1024 * 1024;
+  constexpr std::size_t CommandLineBufferSize = 4096;
+  // a proc connector datagram is 76 bytes
+  constexpr std::size_t ReceiveSlotSize = 128;
+  constexpr std::size_t ReceiveBatchSize = 64;
+
+  // reads a small /proc/<pid>/<name> file into buffer and NUL terminates it; returns the length or -1
+  ssize_t ReadProcFile(pid_t pid, const char* name, char* buffer, std::size_t size) {
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/%d/%s", static_cast<int>(pid), name);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return -1;
+    }
+    ssize_t length;
+    do {
+      length = read(fd, buffer, size - 1);
+    } while (length < 0 && errno == EINTR);
+    close(fd);
+    if (length < 0) {
+      return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+  }
+
+  // calls callback(event, ack) for every proc connector message in a received datagram
+  // the payload follows a 20 byte cn_msg, so events are copied out rather than accessed in place
+  template <typename Callback>
+  void ForEachProcEvent(const char* data, std::size_t length, Callback&& callback) {
+    while (length >= NLMSG_HDRLEN) {
+      const auto header = reinterpret_cast<const nlmsghdr*>(data);
+      if (header->nlmsg_len < NLMSG_HDRLEN || header->nlmsg_len > length) {
+        return;
+      }
+
+      if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(cn_msg))) {
+        const auto message = static_cast<const cn_msg*>(NLMSG_DATA(header));
+        if (message->id.idx == CN_IDX_PROC && message->id.val == CN_VAL_PROC) {
+          proc_event event{};
+          std::memcpy(&event, message->data, std::min<std::size_t>({message->len, sizeof(event), header->nlmsg_len - NLMSG_LENGTH(sizeof(cn_msg))}));
+          callback(event, message->ack);
+        }
+      }
+
+      const auto advance = std::min<std::size_t>(NLMSG_ALIGN(header->nlmsg_len), length);
+      data += advance;
+      length -= advance;
+    }
+  }
+}
+
+ProcessWatcher::ProcessWatcher(std::vector<std::string> patterns, std::chrono::milliseconds scanInterval, Source source) :
+  mPatterns(std::move(patterns))
+{
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "epoll_create1 failed");
+  }
+
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd < 0) {
+    const int error = errno;
+    close(mEpollFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "timerfd_create failed");
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = mTimerFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &event);
+
+  // subscribe before the initial scan, so that nothing started in between is missed
+  if (source == Source::Auto && OpenConnector()) {
+    event.data.fd = mConnectorFd;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mConnectorFd, &event);
+    Resync();
+    return;
+  }
+
+  const auto interval = std::max(scanInterval, 1ms);
+  itimerspec spec{};
+  spec.it_interval.tv_sec = static_cast<time_t>(interval.count() / 1000);
+  spec.it_interval.tv_nsec = static_cast<long>(interval.count() % 1000 * 1000000);
+  spec.it_value = spec.it_interval;
+  timerfd_settime(mTimerFd, 0, &spec, nullptr);
+
+  if (!Scan()) {
+    const int error = errno;
+    close(mTimerFd);
+    close(mEpollFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "failed to read /proc");
+  }
+}
+
+ProcessWatcher::~ProcessWatcher() {
+  if (mConnectorFd >= 0) {
+    close(mConnectorFd);
+  }
+  close(mTimerFd);
+  close(mEpollFd);
+}
+
+bool ProcessWatcher::OpenConnector() {
+  const int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (fd < 0) {
+    return false;
+  }
+
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // room for EventBatchDelay worth of events; anything beyond is recovered by a rescan
+  const int receiveBufferSize = ConnectorReceiveBufferSize;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &receiveBufferSize, sizeof(receiveBufferSize)) != 0) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+  }
+
+  // PROC_CN_MCAST_LISTEN; the kernel answers with a PROC_EVENT_NONE whose ack field is ours plus one
+  const auto ack = static_cast<std::uint32_t>(getpid());
+  alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))]{};
+  const auto header = reinterpret_cast<nlmsghdr*>(request);
+  header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+  header->nlmsg_type = NLMSG_DONE;
+  header->nlmsg_pid = 0;
+  const auto message = static_cast<cn_msg*>(NLMSG_DATA(header));
+  message->id.idx = CN_IDX_PROC;
+  message->id.val = CN_VAL_PROC;
+  message->ack = ack;
+  message->len = sizeof(proc_cn_mcast_op);
+  const auto op = PROC_CN_MCAST_LISTEN;
+  std::memcpy(message->data, &op, sizeof(op));
+  if (send(fd, request, header->nlmsg_len, 0) < 0) {
+    close(fd);
+    return false;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(AckTimeoutMs);
+  while (true) {
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    pollfd pfd{fd, POLLIN, 0};
+    if (remaining <= 0 || poll(&pfd, 1, static_cast<int>(remaining)) <= 0) {
+      close(fd);
+      return false;
+    }
+
+    alignas(nlmsghdr) char buffer[ReceiveSlotSize * ReceiveBatchSize];
+    const auto length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length <= 0) {
+      continue;
+    }
+    int result = -1;
+    ForEachProcEvent(buffer, static_cast<std::size_t>(length), [&](const proc_event& event, std::uint32_t eventAck) {
+      if (event.what == proc_event::PROC_EVENT_NONE && eventAck == ack + 1) {
+        result = static_cast<int>(event.event_data.ack.err);
+      }
+    });
+    if (result == 0) {
+      mConnectorFd = fd;
+      return true;
+    }
+    if (result > 0) {
+      close(fd);
+      return false;
+    }
+  }
+}
+
+bool ProcessWatcher::Matches(pid_t pid) const {
+  char comm[64];
+  const auto commLength = ReadProcFile(pid, "comm", comm, sizeof(comm));
+  if (commLength < 0) {
+    return false;
+  }
+  if (commLength > 0 && comm[commLength - 1] == '\n') {
+    comm[commLength - 1] = '\0';
+  }
+
+  // empty for kernel threads and zombies
+  char commandLine[CommandLineBufferSize];
+  auto commandLineLength = ReadProcFile(pid, "cmdline", commandLine, sizeof(commandLine));
+  if (commandLineLength < 0) {
+    commandLineLength = 0;
+    commandLine[0] = '\0';
+  }
+
+  // argv[0] is the first NUL terminated string
+  const std::string_view argv0(commandLine);
+  const auto slash = argv0.rfind('/');
+  const char* const argv0Name = commandLine + (slash == std::string_view::npos ? 0 : slash + 1);
+
+  for (const auto& pattern : mPatterns) {
+    if (fnmatch(pattern.c_str(), comm, 0) == 0 || (argv0Name[0] != '\0' && fnmatch(pattern.c_str(), argv0Name, 0) == 0)) {
+      return true;
+    }
+  }
+  if (commandLineLength == 0) {
+    return false;
+  }
+
+  // the full command line, with the separators turned into spaces and the trailing NUL dropped
+  for (ssize_t i = 0; i < commandLineLength; i++) {
+    if (commandLine[i] == '\0') {
+      commandLine[i] = ' ';
+    }
+  }
+  if (commandLine[commandLineLength - 1] == ' ') {
+    commandLine[commandLineLength - 1] = '\0';
+  }
+  for (const auto& pattern : mPatterns) {
+    if (fnmatch(pattern.c_str(), commandLine, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ProcessWatcher::Update(pid_t pid) {
+  if (Matches(pid)) {
+    mMatchedPids.insert(pid);
+  } else {
+    mMatchedPids.erase(pid);
+  }
+}
+
+bool ProcessWatcher::Scan() {
+  DIR* const dir = opendir("/proc");
+  if (dir == nullptr) {
+    return false;
+  }
+  mScanPids.clear();
+  while (const auto entry = readdir(dir)) {
+    const std::string_view name(entry->d_name);
+    pid_t pid = 0;
+    if (const auto [ptr, ec] = std::from_chars(name.data(), name.data() + name.size(), pid); ec == std::errc{} && ptr == name.data() + name.size()) {
+      mScanPids.push_back(pid);
+    }
+  }
+  closedir(dir);
+
+  // procfs lists PIDs in ascending order already, so this is a linear pass
+  std::sort(mScanPids.begin(), mScanPids.end());
+
+  // only PIDs that appeared since the last scan are read
+  auto known = mKnownPids.cbegin();
+  for (const auto pid : mScanPids) {
+    while (known != mKnownPids.cend() && *known < pid) {
+      mMatchedPids.erase(*known++);
+    }
+    if (known != mKnownPids.cend() && *known == pid) {
+      known++;
+      continue;
+    }
+    if (Matches(pid)) {
+      mMatchedPids.insert(pid);
+    }
+  }
+  while (known != mKnownPids.cend()) {
+    mMatchedPids.erase(*known++);
+  }
+
+  // a matched PID may have been reused between two scans; there are few of them, so check them all again
+  for (auto itr = mMatchedPids.begin(); itr != mMatchedPids.end(); ) {
+    itr = Matches(*itr) ? std::next(itr) : mMatchedPids.erase(itr);
+  }
+
+  std::swap(mKnownPids, mScanPids);
+  return true;
+}
+
+void ProcessWatcher::Resync() {
+  mKnownPids.clear();
+  mMatchedPids.clear();
+  Scan();
+
+  // events keep the state from here on
+  mKnownPids = {};
+  mScanPids = {};
+}
+
+void ProcessWatcher::ReadConnector() {
+  // one event per datagram, so they are received in batches
+  alignas(nlmsghdr) char buffers[ReceiveBatchSize][ReceiveSlotSize];
+  iovec iovecs[ReceiveBatchSize];
+  mmsghdr messages[ReceiveBatchSize];
+  for (std::size_t i = 0; i < ReceiveBatchSize; i++) {
+    iovecs[i] = {buffers[i], ReceiveSlotSize};
+    messages[i] = {};
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  mPendingExecs.clear();
+  while (true) {
+    const int count = recvmmsg(mConnectorFd, messages, ReceiveBatchSize, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // the socket buffer overflowed and events were lost
+      if (errno == ENOBUFS) {
+        mPendingExecs.clear();
+        Resync();
+        continue;
+      }
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      ForEachProcEvent(buffers[i], messages[i].msg_len, [this](const proc_event& event, std::uint32_t) {
+        switch (event.what) {
+          case proc_event::PROC_EVENT_FORK:
+            // a forked child runs the same program as its parent until it execs
+            if (event.event_data.fork.child_pid == event.event_data.fork.child_tgid && mMatchedPids.count(event.event_data.fork.parent_tgid) != 0) {
+              mMatchedPids.insert(event.event_data.fork.child_tgid);
+            }
+            break;
+
+          case proc_event::PROC_EVENT_EXEC:
+            mPendingExecs.push_back(event.event_data.exec.process_tgid);
+            break;
+
+          case proc_event::PROC_EVENT_COMM:
+            if (event.event_data.comm.process_pid == event.event_data.comm.process_tgid) {
+              mPendingExecs.push_back(event.event_data.comm.process_tgid);
+            }
+            break;
+
+          case proc_event::PROC_EVENT_EXIT:
+            if (event.event_data.exit.process_pid == event.event_data.exit.process_tgid) {
+              const auto pid = event.event_data.exit.process_tgid;
+              mMatchedPids.erase(pid);
+              mPendingExecs.erase(std::remove(mPendingExecs.begin(), mPendingExecs.end(), pid), mPendingExecs.end());
+            }
+            break;
+
+          default:
+            break;
+        }
+      });
+    }
+    if (static_cast<std::size_t>(count) < ReceiveBatchSize) {
+      break;
+    }
+  }
+
+  // /proc is read once per process that exec'd and is still alive at the end of the batch
+  std::sort(mPendingExecs.begin(), mPendingExecs.end());
+  mPendingExecs.erase(std::unique(mPendingExecs.begin(), mPendingExecs.end()), mPendingExecs.end());
+  for (const auto pid : mPendingExecs) {
+    Update(pid);
+  }
+}
+
+int ProcessWatcher::GetFd() const {
+  return mEpollFd;
+}
+
+bool ProcessWatcher::ReadEvents() {
+  const bool wasMatched = IsMatched();
+
+  epoll_event events[2];
+  const int count = epoll_wait(mEpollFd, events, 2, 0);
+  bool timerExpired = false;
+  bool connectorReadable = false;
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.fd == mTimerFd) {
+      std::uint64_t expirations;
+      timerExpired = read(mTimerFd, &expirations, sizeof(expirations)) == sizeof(expirations);
+    } else {
+      connectorReadable = true;
+    }
+  }
+
+  if (mConnectorFd < 0) {
+    if (timerExpired) {
+      Scan();
+    }
+    return IsMatched() != wasMatched;
+  }
+
+  // after handling events the connector is muted for EventBatchDelay, so that a steady stream of
+  // process churn costs a few wakeups per second instead of one per event
+  if (connectorReadable || timerExpired) {
+    ReadConnector();
+  }
+  if (connectorReadable) {
+    SetConnectorMuted(true);
+  } else if (timerExpired) {
+    SetConnectorMuted(false);
+  }
+
+  return IsMatched() != wasMatched;
+}
+
+void ProcessWatcher::SetConnectorMuted(bool muted) {
+  epoll_event event{};
+  event.events = muted ? 0u : static_cast<std::uint32_t>(EPOLLIN);
+  event.data.fd = mConnectorFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_MOD, mConnectorFd, &event);
+
+  if (muted) {
+    itimerspec spec{};
+    spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(EventBatchDelay).count();
+    timerfd_settime(mTimerFd, 0, &spec, nullptr);
+  }
+}
+
+bool ProcessWatcher::IsMatched() const {
+  return !mMatchedPids.empty();
+}
+
+std::size_t ProcessWatcher::GetMatchedCount() const {
+  return mMatchedPids.size();
+}
+
+bool ProcessWatcher::IsUsingConnector() const {
+  return mConnectorFd >= 0;
+}
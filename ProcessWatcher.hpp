@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/types.h>
+
+// keeps track of whether any process matching one of the patterns is alive
+//
+// patterns are shell wildcards (fnmatch) matched against /proc/<pid>/comm, the basename of argv[0]
+// and the whole command line joined by spaces, so "rsync" and "*build-agent*" both work
+//
+// fork/exec/exit events come from the netlink proc connector, which needs CAP_NET_ADMIN;
+// they are handled in batches at most every 100ms, and /proc is only read for processes still alive then
+// without it the watcher rescans /proc every scanInterval, reading only PIDs it has not seen before;
+// in that mode an exec in an already known process goes unnoticed
+class ProcessWatcher {
+public:
+  enum class Source {
+    // proc connector if available, otherwise scanning
+    Auto,
+    Scan,
+  };
+
+private:
+  std::vector<std::string> mPatterns;
+  // holds the connector socket and the timer, see GetFd()
+  int mEpollFd = -1;
+  int mConnectorFd = -1;
+  // scan period, or the end of an event batch while the connector is in use
+  int mTimerFd = -1;
+  // sorted; only kept while scanning
+  std::vector<pid_t> mKnownPids;
+  std::vector<pid_t> mScanPids;
+  std::unordered_set<pid_t> mMatchedPids;
+  std::vector<pid_t> mPendingExecs;
+
+  bool OpenConnector();
+  bool Matches(pid_t pid) const;
+  void Update(pid_t pid);
+  bool Scan();
+  void Resync();
+  void ReadConnector();
+  void SetConnectorMuted(bool muted);
+
+public:
+  // throws std::system_error if neither the proc connector nor scanning can be set up
+  ProcessWatcher(std::vector<std::string> patterns, std::chrono::milliseconds scanInterval, Source source = Source::Auto);
+  ~ProcessWatcher();
+
+  ProcessWatcher(const ProcessWatcher&) = delete;
+  ProcessWatcher& operator=(const ProcessWatcher&) = delete;
+
+  // readable when events are pending or a scan is due
+  int GetFd() const;
+  // handles pending events without blocking; returns true if IsMatched() changed
+  bool ReadEvents();
+
+  bool IsMatched() const;
+  std::size_t GetMatchedCount() const;
+  bool IsUsingConnector() const;
+};
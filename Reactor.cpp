@@ -0,0 +1,102 @@
+#include "Reactor.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace {
+  constexpr int MaxEventsPerWait = 64;
+}
+
+Reactor::Reactor() {
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "epoll_create1 failed");
+  }
+}
+
+Reactor::~Reactor() {
+  close(mEpollFd);
+}
+
+void Reactor::Add(int fd, std::uint32_t events, Handler handler) {
+  auto registration = std::make_unique<Registration>(Registration{false, std::move(handler)});
+
+  epoll_event event{};
+  event.events = events | EPOLLET;
+  event.data.ptr = registration.get();
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "epoll_ctl failed");
+  }
+  mRegistrations[fd] = std::move(registration);
+}
+
+void Reactor::Remove(int fd) {
+  const auto itr = mRegistrations.find(fd);
+  if (itr == mRegistrations.end()) {
+    return;
+  }
+  epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+  itr->second->removed = true;
+  mRemoved.push_back(std::move(itr->second));
+  mRegistrations.erase(itr);
+}
+
+bool Reactor::IsRegistered(int fd) const {
+  return mRegistrations.count(fd) != 0;
+}
+
+void Reactor::Defer(Callback callback) {
+  mDeferred.push_back(std::move(callback));
+}
+
+void Reactor::RunDeferred() {
+  mRunning.swap(mDeferred);
+  for (auto& callback : mRunning) {
+    callback();
+  }
+  mRunning.clear();
+}
+
+void Reactor::Run() {
+  mStopped = false;
+  epoll_event events[MaxEventsPerWait];
+  while (!mStopped) {
+    const int count = epoll_wait(mEpollFd, events, MaxEventsPerWait, mDeferred.empty() ? -1 : 0);
+    mWakeupCount++;
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(std::error_code(errno, std::system_category()), "epoll_wait failed");
+    }
+
+    for (int i = 0; i < count; i++) {
+      const auto registration = static_cast<Registration*>(events[i].data.ptr);
+      if (!registration->removed) {
+        registration->handler(events[i].events);
+      }
+    }
+    mRemoved.clear();
+
+    RunDeferred();
+  }
+}
+
+void Reactor::Stop() {
+  mStopped = true;
+}
+
+std::uint64_t Reactor::GetWakeupCount() const {
+  return mWakeupCount;
+}
+
+std::size_t Reactor::GetRegistrationCount() const {
+  return mRegistrations.size();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// single-threaded event loop over an edge-triggered epoll set
+// a handler is called once per readiness edge, so it has to drain its fd (read until EAGAIN) or it will not be called again
+// the loop blocks in epoll_wait without a timeout whenever nothing is deferred, so an idle reactor never wakes up
+class Reactor {
+public:
+  // receives the epoll event bits
+  using Handler = std::function<void(std::uint32_t events)>;
+  using Callback = std::function<void()>;
+
+private:
+  struct Registration {
+    bool removed;
+    Handler handler;
+  };
+
+  int mEpollFd = -1;
+  std::unordered_map<int, std::unique_ptr<Registration>> mRegistrations;
+  // removed registrations, kept until the current batch is done since its events and running handler may point at them
+  std::vector<std::unique_ptr<Registration>> mRemoved;
+  std::vector<Callback> mDeferred;
+  std::vector<Callback> mRunning;
+  std::uint64_t mWakeupCount = 0;
+  bool mStopped = false;
+
+  void RunDeferred();
+
+public:
+  // throws std::system_error
+  Reactor();
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  // watches fd for events (EPOLLIN, EPOLLOUT, ...); EPOLLET is implied
+  // the fd stays owned by the caller, who must Remove it before closing it; throws std::system_error
+  void Add(int fd, std::uint32_t events, Handler handler);
+  // does nothing for fds that are not registered; safe to call from any handler
+  void Remove(int fd);
+  bool IsRegistered(int fd) const;
+
+  // runs callback once the current batch of events has been handled, before blocking again
+  // callbacks deferred from a deferred callback run after the next batch, which is polled without blocking
+  void Defer(Callback callback);
+
+  // dispatches events until Stop is called
+  void Run();
+  // makes Run return after the current batch
+  void Stop();
+
+  // number of times epoll_wait returned so far
+  std::uint64_t GetWakeupCount() const;
+  std::size_t GetRegistrationCount() const;
+};
@@ -0,0 +1,260 @@
+#include "Schedule.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+  constexpr std::string_view DayNames[7] = {"mon"sv, "tue"sv, "wed"sv, "thu"sv, "fri"sv, "sat"sv, "sun"sv};
+
+  std::optional<int> ParseDay(std::string_view text) {
+    if (text.size() != 3) {
+      return std::nullopt;
+    }
+    char lower[3];
+    for (std::size_t i = 0; i < 3; i++) {
+      lower[i] = text[i] >= 'A' && text[i] <= 'Z' ? static_cast<char>(text[i] - 'A' + 'a') : text[i];
+    }
+    for (int day = 0; day < 7; day++) {
+      if (DayNames[day] == std::string_view(lower, 3)) {
+        return day;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // "Mon", "Fri-Mon" or "daily" as a bit per day
+  std::optional<unsigned> ParseDays(std::string_view text) {
+    if (text == "daily"sv || text == "*"sv) {
+      return 0x7Fu;
+    }
+    const auto dash = text.find('-');
+    const auto first = ParseDay(text.substr(0, dash));
+    const auto last = dash == std::string_view::npos ? first : ParseDay(text.substr(dash + 1));
+    if (!first || !last) {
+      return std::nullopt;
+    }
+    unsigned days = 0;
+    for (int day = first.value(); ; day = (day + 1) % 7) {
+      days |= 1u << day;
+      if (day == last.value()) {
+        return days;
+      }
+    }
+  }
+
+  // "H:MM" or "HH:MM" in minutes; 24:00 is allowed
+  std::optional<int> ParseTime(std::string_view text) {
+    const auto colon = text.find(':');
+    if (colon == std::string_view::npos || colon == 0 || colon > 2 || text.size() != colon + 3) {
+      return std::nullopt;
+    }
+    int values[2] = {0, 0};
+    const std::string_view parts[2] = {text.substr(0, colon), text.substr(colon + 1)};
+    for (int i = 0; i < 2; i++) {
+      for (const auto c : parts[i]) {
+        if (c < '0' || c > '9') {
+          return std::nullopt;
+        }
+        values[i] = values[i] * 10 + (c - '0');
+      }
+    }
+    const auto minutes = values[0] * 60 + values[1];
+    if (values[1] >= 60 || minutes > Schedule::MinutesPerDay) {
+      return std::nullopt;
+    }
+    return minutes;
+  }
+
+  std::tm ToLocalTime(Schedule::Clock::time_point time) {
+    const auto seconds = Schedule::Clock::to_time_t(time);
+    std::tm local{};
+    localtime_r(&seconds, &local);
+    return local;
+  }
+
+  int GetMinuteOfWeek(const std::tm& local) {
+    return (local.tm_wday + 6) % 7 * Schedule::MinutesPerDay + local.tm_hour * 60 + local.tm_min;
+  }
+}
+
+std::optional<std::vector<Schedule::Interval>> Schedule::ParseRule(std::string_view rule) {
+  std::vector<std::string_view> tokens;
+  while (!rule.empty()) {
+    const auto begin = rule.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) {
+      break;
+    }
+    rule.remove_prefix(begin);
+    const auto end = std::min(rule.find_first_of(" \t"), rule.size());
+    tokens.push_back(rule.substr(0, end));
+    rule.remove_prefix(end);
+  }
+  if (tokens.size() < 2) {
+    return std::nullopt;
+  }
+
+  unsigned days = 0;
+  for (std::size_t i = 0; i + 1 < tokens.size(); i++) {
+    const auto parsed = ParseDays(tokens[i]);
+    if (!parsed) {
+      return std::nullopt;
+    }
+    days |= parsed.value();
+  }
+
+  const auto range = tokens.back();
+  const auto dash = range.find('-');
+  if (dash == std::string_view::npos) {
+    return std::nullopt;
+  }
+  const auto begin = ParseTime(range.substr(0, dash));
+  auto end = ParseTime(range.substr(dash + 1));
+  if (!begin || !end || begin.value() == MinutesPerDay) {
+    return std::nullopt;
+  }
+  if (end.value() <= begin.value()) {
+    end = end.value() + MinutesPerDay;
+  }
+
+  std::vector<Interval> intervals;
+  for (int day = 0; day < 7; day++) {
+    if ((days & (1u << day)) == 0) {
+      continue;
+    }
+    const int intervalBegin = day * MinutesPerDay + begin.value();
+    const int intervalEnd = day * MinutesPerDay + end.value();
+    if (intervalEnd <= MinutesPerWeek) {
+      intervals.push_back({intervalBegin, intervalEnd});
+    } else {
+      intervals.push_back({intervalBegin, MinutesPerWeek});
+      intervals.push_back({0, intervalEnd - MinutesPerWeek});
+    }
+  }
+  return intervals;
+}
+
+void Schedule::Add(const std::vector<Interval>& intervals) {
+  mIntervals.insert(mIntervals.end(), intervals.begin(), intervals.end());
+}
+
+void Schedule::Compile() {
+  std::sort(mIntervals.begin(), mIntervals.end(), [](const Interval& a, const Interval& b) {
+    return a.begin < b.begin;
+  });
+
+  // merge overlapping and touching intervals
+  std::vector<Interval> merged;
+  for (const auto& interval : mIntervals) {
+    if (!merged.empty() && interval.begin <= merged.back().end) {
+      merged.back().end = std::max(merged.back().end, interval.end);
+    } else {
+      merged.push_back(interval);
+    }
+  }
+  mIntervals = merged;
+
+  mTransitions.clear();
+  mActiveAtWeekEnd = !merged.empty() && merged.back().end == MinutesPerWeek;
+  if (merged.empty()) {
+    return;
+  }
+  // an interval running into the next week and one starting at its beginning are a single stretch
+  const bool wraps = mActiveAtWeekEnd && merged.front().begin == 0;
+  if (mActiveAtWeekEnd && !wraps) {
+    mTransitions.push_back(0);
+  }
+  for (const auto& interval : merged) {
+    if (interval.begin != 0 || !wraps) {
+      mTransitions.push_back(interval.begin);
+    }
+    if (interval.end != MinutesPerWeek) {
+      mTransitions.push_back(interval.end);
+    }
+  }
+}
+
+bool Schedule::IsEmpty() const {
+  return mIntervals.empty();
+}
+
+std::size_t Schedule::GetTransitionCount() const {
+  return mTransitions.size();
+}
+
+bool Schedule::IsActive(int minuteOfWeek) const {
+  const auto flips = std::upper_bound(mTransitions.begin(), mTransitions.end(), minuteOfWeek) - mTransitions.begin();
+  return mActiveAtWeekEnd != (flips % 2 == 1);
+}
+
+std::optional<int> Schedule::GetMinutesToNextTransition(int minuteOfWeek) const {
+  if (mTransitions.empty()) {
+    return std::nullopt;
+  }
+  const auto next = std::upper_bound(mTransitions.begin(), mTransitions.end(), minuteOfWeek);
+  return next == mTransitions.end() ? mTransitions.front() + MinutesPerWeek - minuteOfWeek : *next - minuteOfWeek;
+}
+
+bool Schedule::IsActiveAt(Clock::time_point time) const {
+  return IsActive(GetMinuteOfWeek(time));
+}
+
+bool Schedule::IsActive(Clock::time_point now) const {
+  return IsActiveAt(now);
+}
+
+std::optional<Schedule::Clock::time_point> Schedule::GetNextTransition(Clock::time_point now) const {
+  if (mTransitions.empty()) {
+    return std::nullopt;
+  }
+
+  const bool current = IsActiveAt(now);
+  auto from = now;
+  // a round ends at a transition or an offset change; a transition is passed over only where DST makes wall-clock
+  // times cancel out
+  for (std::size_t round = 0; round < mTransitions.size() + 4; round++) {
+    const auto local = ToLocalTime(from);
+    const auto minutes = GetMinutesToNextTransition(::GetMinuteOfWeek(local)).value();
+    const auto minuteStart = Clock::from_time_t(Clock::to_time_t(from) - local.tm_sec);
+    const auto candidate = minuteStart + std::chrono::minutes(minutes);
+
+    // the usual case: no offset change in between, so the wall-clock time is reached exactly
+    const auto offset = ToLocalTime(candidate).tm_gmtoff;
+    if (offset == local.tm_gmtoff) {
+      if (IsActiveAt(candidate) != current) {
+        return candidate;
+      }
+      from = candidate;
+      continue;
+    }
+
+    // the offset changes in between; until then the wall-clock time runs without crossing a transition, and at the
+    // change it jumps, which may flip the state on its own
+    auto low = from;
+    auto high = candidate;
+    while (high - low > 1s) {
+      const auto middle = low + (high - low) / 2;
+      if (ToLocalTime(middle).tm_gmtoff == local.tm_gmtoff) {
+        low = middle;
+      } else {
+        high = middle;
+      }
+    }
+    const auto change = Clock::time_point(std::chrono::time_point_cast<std::chrono::seconds>(high));
+    if (IsActiveAt(change) != current) {
+      return change;
+    }
+    from = change;
+  }
+  return std::nullopt;
+}
+
+int Schedule::GetMinuteOfWeek(Clock::time_point time) {
+  return ::GetMinuteOfWeek(ToLocalTime(time));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// weekly schedule in local wall-clock time, compiled into a sorted index of transitions
+//
+// a rule is one or more day specs followed by a time range, e.g. "Mon-Fri 08:00-19:00", "Sat Sun 10:00-12:00" or
+// "daily 23:00-01:00"; days are Mon..Sun, ranges of them (which may wrap, as in Fri-Mon) or "daily"
+// a range whose end is not after its begin runs past midnight into the next day; 24:00 is the end of the day
+//
+// the rules are merged into disjoint intervals of the week and kept as the minutes at which the state flips, so both
+// IsActive and GetNextTransition are a binary search
+// wall-clock times are converted with the local time zone at each call, so a DST change or a new zone needs no
+// recompilation; the state always follows the wall clock, so a transition skipped by DST happens at the jump, and the
+// transitions of a repeated hour happen twice
+class Schedule {
+public:
+  using Clock = std::chrono::system_clock;
+
+  static constexpr int MinutesPerDay = 24 * 60;
+  static constexpr int MinutesPerWeek = 7 * MinutesPerDay;
+
+  // [begin, end) in minutes since Monday 00:00; end may be MinutesPerWeek
+  struct Interval {
+    int begin;
+    int end;
+  };
+
+private:
+  std::vector<Interval> mIntervals;
+  // minutes of the week at which the state flips, ascending and within [0, MinutesPerWeek)
+  std::vector<int> mTransitions;
+  // the state at the very end of the week, which carries over into minute 0 unless a transition lies there
+  bool mActiveAtWeekEnd = false;
+
+  // the state of the wall-clock time of time
+  bool IsActiveAt(Clock::time_point time) const;
+
+public:
+  // the intervals of a rule, split at the end of the week; nullopt if it does not parse
+  static std::optional<std::vector<Interval>> ParseRule(std::string_view rule);
+
+  void Add(const std::vector<Interval>& intervals);
+  // builds the index; required after Add and before the queries
+  void Compile();
+  bool IsEmpty() const;
+  std::size_t GetTransitionCount() const;
+
+  // minuteOfWeek is in [0, MinutesPerWeek)
+  bool IsActive(int minuteOfWeek) const;
+  // minutes from minuteOfWeek to the next transition after it, at most one week; nullopt if the state never changes
+  std::optional<int> GetMinutesToNextTransition(int minuteOfWeek) const;
+
+  bool IsActive(Clock::time_point now) const;
+  // the first instant after now at which IsActive(time) differs from IsActive(now); nullopt if there is none
+  std::optional<Clock::time_point> GetNextTransition(Clock::time_point now) const;
+
+  // minutes since Monday 00:00 of the local time of time
+  static int GetMinuteOfWeek(Clock::time_point time);
+};
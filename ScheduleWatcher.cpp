@@ -0,0 +1,130 @@
+#include "ScheduleWatcher.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std::literals;
+
+namespace {
+  constexpr auto ZoneFilename = "localtime"sv;
+}
+
+ScheduleWatcher::ScheduleWatcher(Schedule schedule, const std::filesystem::path& zoneDirectory) :
+  mSchedule(std::move(schedule)),
+  mZoneDirectory(zoneDirectory)
+{
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "epoll_create1 failed");
+  }
+
+  mTimerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd < 0) {
+    const int error = errno;
+    close(mEpollFd);
+    throw std::system_error(std::error_code(error, std::system_category()), "timerfd_create failed");
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = mTimerFd;
+  epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &event);
+
+  // /etc/localtime is usually replaced rather than written, so its directory is watched
+  mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mInotifyFd >= 0 && inotify_add_watch(mInotifyFd, mZoneDirectory.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE) < 0) {
+    close(mInotifyFd);
+    mInotifyFd = -1;
+  }
+  if (mInotifyFd >= 0) {
+    event.data.fd = mInotifyFd;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mInotifyFd, &event);
+  }
+
+  Update();
+}
+
+ScheduleWatcher::~ScheduleWatcher() {
+  if (mInotifyFd >= 0) {
+    close(mInotifyFd);
+  }
+  close(mTimerFd);
+  close(mEpollFd);
+}
+
+int ScheduleWatcher::GetFd() const {
+  return mEpollFd;
+}
+
+void ScheduleWatcher::Update() {
+  const auto now = Schedule::Clock::now();
+  mActive = mSchedule.IsActive(now);
+  mNextTransition = mSchedule.GetNextTransition(now);
+
+  // cancelled (read fails with ECANCELED) whenever the clock is set, so the next read re-evaluates
+  itimerspec spec{};
+  if (mNextTransition) {
+    const auto sinceEpoch = mNextTransition.value().time_since_epoch();
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch);
+    spec.it_value.tv_sec = static_cast<time_t>(seconds.count());
+    spec.it_value.tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch - seconds).count());
+  }
+  timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr);
+}
+
+bool ScheduleWatcher::ReadEvents() {
+  const bool wasActive = mActive;
+
+  epoll_event events[2];
+  const int count = epoll_wait(mEpollFd, events, 2, 0);
+  bool changed = false;
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.fd == mTimerFd) {
+      std::uint64_t expirations;
+      changed |= read(mTimerFd, &expirations, sizeof(expirations)) == sizeof(expirations) || errno == ECANCELED;
+      continue;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    bool zoneChanged = false;
+    ssize_t length;
+    while ((length = read(mInotifyFd, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t offset = 0; offset < length; ) {
+        const auto event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        if (event->len > 0 && std::string_view(event->name) == ZoneFilename) {
+          zoneChanged = true;
+        }
+        offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+      }
+    }
+    if (zoneChanged) {
+      // localtime_r does not look at the zone again by itself
+      tzset();
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    Update();
+  }
+  return mActive != wasActive;
+}
+
+bool ScheduleWatcher::IsActive() const {
+  return mActive;
+}
+
+std::optional<Schedule::Clock::time_point> ScheduleWatcher::GetNextTransition() const {
+  return mNextTransition;
+}
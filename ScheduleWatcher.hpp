@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include "Schedule.hpp"
+
+// follows a Schedule in real time without polling: a CLOCK_REALTIME timer is armed for exactly the next transition
+//
+// the timer is cancelled when the clock is set, and <zoneDirectory>/localtime is watched with inotify, so a clock
+// change or a new time zone re-evaluates the schedule at once; DST needs nothing, as it is part of the transition times
+class ScheduleWatcher {
+  Schedule mSchedule;
+  std::filesystem::path mZoneDirectory;
+  // holds the timer and the inotify descriptor, see GetFd()
+  int mEpollFd = -1;
+  int mTimerFd = -1;
+  int mInotifyFd = -1;
+  bool mActive = false;
+  std::optional<Schedule::Clock::time_point> mNextTransition;
+
+  // evaluates the schedule as of now and arms the timer for the next transition
+  void Update();
+
+public:
+  // schedule must be compiled; throws std::system_error if the timer cannot be created
+  // without inotify, time zone changes are only noticed at the next transition
+  explicit ScheduleWatcher(Schedule schedule, const std::filesystem::path& zoneDirectory = "/etc");
+  ~ScheduleWatcher();
+
+  ScheduleWatcher(const ScheduleWatcher&) = delete;
+  ScheduleWatcher& operator=(const ScheduleWatcher&) = delete;
+
+  // readable at a transition, a clock change or a time zone change
+  int GetFd() const;
+  // handles pending events without blocking; returns true if IsActive() changed
+  bool ReadEvents();
+
+  bool IsActive() const;
+  std::optional<Schedule::Clock::time_point> GetNextTransition() const;
+};
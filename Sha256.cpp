@@ -0,0 +1,165 @@
+#include "Sha256.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace Sha256 {
+  namespace {
+    constexpr std::array<std::uint32_t, 64> RoundConstants = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    constexpr std::array<std::uint32_t, 8> InitialState = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    constexpr std::uint32_t RotateRight(std::uint32_t value, int bits) {
+      return (value >> bits) | (value << (32 - bits));
+    }
+  }
+
+  Hasher::Hasher() :
+    mState(InitialState)
+  {}
+
+  void Hasher::Compress(const std::uint8_t* block) {
+    std::uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = static_cast<std::uint32_t>(block[i * 4]) << 24 | static_cast<std::uint32_t>(block[i * 4 + 1]) << 16 | static_cast<std::uint32_t>(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+      const auto s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const auto s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = mState;
+    for (int i = 0; i < 64; i++) {
+      const auto s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+      const auto choice = (e & f) ^ (~e & g);
+      const auto t1 = h + s1 + choice + RoundConstants[i] + w[i];
+      const auto s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+      const auto majority = (a & b) ^ (a & c) ^ (b & c);
+      const auto t2 = s0 + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    mState[0] += a;
+    mState[1] += b;
+    mState[2] += c;
+    mState[3] += d;
+    mState[4] += e;
+    mState[5] += f;
+    mState[6] += g;
+    mState[7] += h;
+  }
+
+  void Hasher::Update(std::string_view data) {
+    mLength += data.size();
+    auto bytes = reinterpret_cast<const std::uint8_t*>(data.data());
+    auto size = data.size();
+    if (mBlockSize != 0) {
+      const auto take = std::min(size, BlockSize - mBlockSize);
+      std::memcpy(mBlock.data() + mBlockSize, bytes, take);
+      mBlockSize += take;
+      bytes += take;
+      size -= take;
+      if (mBlockSize < BlockSize) {
+        return;
+      }
+      Compress(mBlock.data());
+      mBlockSize = 0;
+    }
+    for (; size >= BlockSize; bytes += BlockSize, size -= BlockSize) {
+      Compress(bytes);
+    }
+    std::memcpy(mBlock.data(), bytes, size);
+    mBlockSize = size;
+  }
+
+  Digest Hasher::Finish() {
+    const auto bitLength = mLength * 8;
+    mBlock[mBlockSize++] = 0x80;
+    if (mBlockSize > BlockSize - sizeof(std::uint64_t)) {
+      std::memset(mBlock.data() + mBlockSize, 0, BlockSize - mBlockSize);
+      Compress(mBlock.data());
+      mBlockSize = 0;
+    }
+    std::memset(mBlock.data() + mBlockSize, 0, BlockSize - sizeof(std::uint64_t) - mBlockSize);
+    for (std::size_t i = 0; i < sizeof(std::uint64_t); i++) {
+      mBlock[BlockSize - 1 - i] = static_cast<std::uint8_t>(bitLength >> (i * 8));
+    }
+    Compress(mBlock.data());
+
+    Digest digest;
+    for (std::size_t i = 0; i < mState.size(); i++) {
+      digest[i * 4] = static_cast<std::uint8_t>(mState[i] >> 24);
+      digest[i * 4 + 1] = static_cast<std::uint8_t>(mState[i] >> 16);
+      digest[i * 4 + 2] = static_cast<std::uint8_t>(mState[i] >> 8);
+      digest[i * 4 + 3] = static_cast<std::uint8_t>(mState[i]);
+    }
+    return digest;
+  }
+
+  Digest Hash(std::string_view data) {
+    Hasher hasher;
+    hasher.Update(data);
+    return hasher.Finish();
+  }
+
+  Digest Hmac(std::string_view key, std::string_view message) {
+    // keys longer than a block are hashed first
+    std::array<std::uint8_t, BlockSize> block{};
+    if (key.size() > BlockSize) {
+      const auto digest = Hash(key);
+      std::memcpy(block.data(), digest.data(), digest.size());
+    } else {
+      std::memcpy(block.data(), key.data(), key.size());
+    }
+
+    std::array<std::uint8_t, BlockSize> pad;
+    for (std::size_t i = 0; i < BlockSize; i++) {
+      pad[i] = block[i] ^ 0x36;
+    }
+    Hasher inner;
+    inner.Update(std::string_view(reinterpret_cast<const char*>(pad.data()), pad.size()));
+    inner.Update(message);
+    const auto innerDigest = inner.Finish();
+
+    for (std::size_t i = 0; i < BlockSize; i++) {
+      pad[i] = block[i] ^ 0x5c;
+    }
+    Hasher outer;
+    outer.Update(std::string_view(reinterpret_cast<const char*>(pad.data()), pad.size()));
+    outer.Update(AsString(innerDigest));
+    return outer.Finish();
+  }
+
+  bool Equal(const Digest& digest, std::string_view data) {
+    if (data.size() != digest.size()) {
+      return false;
+    }
+    std::uint8_t difference = 0;
+    for (std::size_t i = 0; i < digest.size(); i++) {
+      difference |= digest[i] ^ static_cast<std::uint8_t>(data[i]);
+    }
+    return difference == 0;
+  }
+} // namespace Sha256
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// SHA-256 (FIPS 180-4) and HMAC-SHA256 (RFC 2104), enough to authenticate fleet connections without a crypto library
+namespace Sha256 {
+  constexpr std::size_t DigestSize = 32;
+  constexpr std::size_t BlockSize = 64;
+
+  using Digest = std::array<std::uint8_t, DigestSize>;
+
+  class Hasher {
+    std::array<std::uint32_t, 8> mState;
+    std::array<std::uint8_t, BlockSize> mBlock{};
+    std::size_t mBlockSize = 0;
+    std::uint64_t mLength = 0;
+
+    void Compress(const std::uint8_t* block);
+
+  public:
+    Hasher();
+
+    void Update(std::string_view data);
+    // the hasher must not be used afterwards
+    Digest Finish();
+  };
+
+  Digest Hash(std::string_view data);
+  Digest Hmac(std::string_view key, std::string_view message);
+
+  // compares in time independent of where they differ, so that timing does not tell how much of a MAC was right
+  bool Equal(const Digest& digest, std::string_view data);
+
+  inline std::string_view AsString(const Digest& digest) {
+    return std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size());
+  }
+} // namespace Sha256
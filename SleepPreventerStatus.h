@@ -0,0 +1,71 @@
+/* reader API of the status page the daemon publishes in shared memory
+ * the page is guarded by a seqlock: after sleeppreventer_status_open, reading a snapshot makes no syscalls unless it
+ * keeps meeting an update in progress, when it yields to let the daemon finish
+ * usable from C and C++; link against the SleepPreventerStatus library */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLEEPPREVENTER_STATUS_MAGIC "SPSTATUS"
+#define SLEEPPREVENTER_STATUS_VERSION 1
+
+/* bits of sleeppreventer_status.state, the same as in the IPC protocol and the journal */
+#define SLEEPPREVENTER_STATE_ENABLE 0x01
+#define SLEEPPREVENTER_STATE_SYSTEM_FLAG 0x02
+#define SLEEPPREVENTER_STATE_DISPLAY_FLAG 0x04
+/* what is held from the system: sleep, and display-off */
+#define SLEEPPREVENTER_STATE_ACTIVE_SYSTEM 0x08
+#define SLEEPPREVENTER_STATE_ACTIVE_DISPLAY 0x10
+
+/* layout of the page; all integers are native endian
+ * sequence is odd while the daemon writes, and every field is read and written with atomic loads and stores */
+struct sleeppreventer_status_page {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint64_t sequence;
+  uint64_t generation;
+  int64_t update_time;
+  uint32_t pid;
+  uint32_t lease_count;
+  uint8_t state;
+  uint8_t running;
+  uint8_t reserved[14];
+};
+
+/* a consistent snapshot of the page */
+struct sleeppreventer_status {
+  /* bumped by every update */
+  uint64_t generation;
+  /* unix time of the last update in nanoseconds */
+  int64_t update_time;
+  uint32_t pid;
+  uint32_t lease_count;
+  uint8_t state;
+  /* 0 once the daemon has stopped; reopen the page to follow the next instance */
+  uint8_t running;
+};
+
+/* writes the path the daemon publishes to, like snprintf: $SLEEPPREVENTER_STATUS, else SleepPreventer.status in
+ * $XDG_RUNTIME_DIR, else /dev/shm/SleepPreventer.<uid>.status
+ * returns the length of the whole path, or -1 */
+int sleeppreventer_status_get_default_path(char* buffer, size_t size);
+
+/* maps the page read-only; the default path if path is NULL
+ * returns NULL and sets errno on failure, EPROTO if the file is not a status page of this version */
+const struct sleeppreventer_status_page* sleeppreventer_status_open(const char* path);
+
+/* copies a consistent snapshot
+ * returns 0, or -1 with errno EAGAIN if the daemon never finished an update, e.g. because it died while writing */
+int sleeppreventer_status_read(const struct sleeppreventer_status_page* page, struct sleeppreventer_status* status);
+
+void sleeppreventer_status_close(const struct sleeppreventer_status_page* page);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,120 @@
+#include "StatusPage.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SleepPreventerStatus.h"
+
+namespace StatusPage {
+  namespace {
+    std::int64_t GetUnixTime() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+  }
+
+  template <typename Update>
+  void Writer::Write(Update update) {
+    auto& sequence = AsAtomic(mPage->sequence);
+    // odd even if an earlier instance died in the middle of a write
+    const auto begin = sequence.load(std::memory_order_relaxed) | 1;
+    sequence.store(begin, std::memory_order_relaxed);
+    // readers which see any of the stores below also see the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+
+    update();
+    auto& generation = AsAtomic(mPage->generation);
+    generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    AsAtomic(mPage->update_time).store(GetUnixTime(), std::memory_order_relaxed);
+
+    sequence.store(begin + 1, std::memory_order_release);
+  }
+
+  std::unique_ptr<Writer> Writer::Open(const std::filesystem::path& path) {
+    // a page left behind by an instance which crashed is taken over
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::system_error(std::error_code(errno, std::system_category()), "open failed");
+    }
+    if (ftruncate(fd, sizeof(Page)) != 0) {
+      const int error = errno;
+      close(fd);
+      throw std::system_error(std::error_code(error, std::system_category()), "ftruncate failed");
+    }
+    const auto mapping = mmap(nullptr, sizeof(Page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      throw std::system_error(std::error_code(error, std::system_category()), "mmap failed");
+    }
+
+    std::unique_ptr<Writer> writer(new Writer());
+    writer->mPage = static_cast<Page*>(mapping);
+    writer->mPath = path;
+
+    auto& page = *writer->mPage;
+    std::lock_guard lock(writer->mMutex);
+    writer->Write([&] {
+      AsAtomic(page.version).store(SLEEPPREVENTER_STATUS_VERSION, std::memory_order_relaxed);
+      AsAtomic(page.size).store(sizeof(Page), std::memory_order_relaxed);
+      AsAtomic(page.pid).store(static_cast<std::uint32_t>(getpid()), std::memory_order_relaxed);
+      AsAtomic(page.lease_count).store(0, std::memory_order_relaxed);
+      AsAtomic(page.state).store(0, std::memory_order_relaxed);
+      AsAtomic(page.running).store(1, std::memory_order_relaxed);
+    });
+    // readers check the magic once when they map the page, so it goes last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(page.magic, SLEEPPREVENTER_STATUS_MAGIC, sizeof(page.magic));
+    return writer;
+  }
+
+  Writer::~Writer() {
+    {
+      std::lock_guard lock(mMutex);
+      Write([&] {
+        AsAtomic(mPage->running).store(0, std::memory_order_relaxed);
+      });
+    }
+    std::error_code error;
+    std::filesystem::remove(mPath, error);
+    munmap(mPage, sizeof(Page));
+  }
+
+  void Writer::SetState(std::uint8_t state) {
+    std::lock_guard lock(mMutex);
+    Write([&] {
+      AsAtomic(mPage->state).store(state, std::memory_order_relaxed);
+    });
+  }
+
+  void Writer::SetLeaseCount(std::uint32_t count) {
+    std::lock_guard lock(mMutex);
+    Write([&] {
+      AsAtomic(mPage->lease_count).store(count, std::memory_order_relaxed);
+    });
+  }
+
+  std::filesystem::path GetDefaultPath() {
+    char buffer[256];
+    const int length = sleeppreventer_status_get_default_path(buffer, sizeof(buffer));
+    if (length < 0) {
+      return {};
+    }
+    if (static_cast<std::size_t>(length) < sizeof(buffer)) {
+      return buffer;
+    }
+    std::string path(static_cast<std::size_t>(length), '\0');
+    sleeppreventer_status_get_default_path(path.data(), path.size() + 1);
+    return path;
+  }
+}
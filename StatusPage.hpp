@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+
+#include "SleepPreventerStatus.h"
+
+// writer side of the shared-memory status page, see SleepPreventerStatus.h for the layout and the reader API
+// each update is a seqlock write: the sequence is made odd, the fields are stored, and the sequence is made even again
+namespace StatusPage {
+  using Page = sleeppreventer_status_page;
+
+  static_assert(sizeof(Page) == 64, "the status page is one cache line");
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint8_t>::is_always_lock_free,
+    "the status page is shared with other processes, so its atomics must not take locks");
+
+  // fields of the page accessed as atomics; the page is shared, so std::atomic cannot be placed in it directly
+  template <typename T>
+  std::atomic<T>& AsAtomic(T& field) {
+    return *reinterpret_cast<std::atomic<T>*>(&field);
+  }
+
+  template <typename T>
+  const std::atomic<T>& AsAtomic(const T& field) {
+    return *reinterpret_cast<const std::atomic<T>*>(&field);
+  }
+
+  class Writer {
+    std::mutex mMutex;
+    Page* mPage = nullptr;
+    std::filesystem::path mPath;
+
+    Writer() = default;
+    // one seqlock write; the caller holds mMutex and updates the fields in between
+    template <typename Update>
+    void Write(Update update);
+
+  public:
+    // creates or takes over the page at path, and marks it running with no state
+    // throws std::system_error
+    static std::unique_ptr<Writer> Open(const std::filesystem::path& path);
+    // marks the page stopped and removes the file; readers which still map it see running 0
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // IPC::StateBits
+    void SetState(std::uint8_t state);
+    void SetLeaseCount(std::uint32_t count);
+  };
+
+  // see sleeppreventer_status_get_default_path
+  std::filesystem::path GetDefaultPath();
+} // namespace StatusPage
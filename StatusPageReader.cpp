@@ -0,0 +1,111 @@
+// the reader API of SleepPreventerStatus.h
+// it uses nothing of the C++ runtime, so that C programs can link the library without libstdc++
+
+#include "SleepPreventerStatus.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "StatusPage.hpp"
+
+namespace {
+  // an update takes well under a microsecond, so a reader which keeps meeting one spins only briefly, then yields in
+  // case the writer was preempted on the same CPU
+  constexpr int SpinAttempts = 1000;
+  // a sequence which stays odd this long belongs to a writer that died
+  constexpr int MaxYields = 10000;
+}
+
+int sleeppreventer_status_get_default_path(char* buffer, size_t size) {
+  if (const auto path = std::getenv("SLEEPPREVENTER_STATUS"); path != nullptr && path[0] != '\0') {
+    return std::snprintf(buffer, size, "%s", path);
+  }
+  if (const auto dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && dir[0] != '\0') {
+    return std::snprintf(buffer, size, "%s/SleepPreventer.status", dir);
+  }
+  return std::snprintf(buffer, size, "/dev/shm/SleepPreventer.%u.status", static_cast<unsigned>(getuid()));
+}
+
+const sleeppreventer_status_page* sleeppreventer_status_open(const char* path) {
+  char defaultPath[256];
+  if (path == nullptr) {
+    const int length = sleeppreventer_status_get_default_path(defaultPath, sizeof(defaultPath));
+    if (length < 0 || static_cast<size_t>(length) >= sizeof(defaultPath)) {
+      errno = ENAMETOOLONG;
+      return nullptr;
+    }
+    path = defaultPath;
+  }
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(sleeppreventer_status_page)) {
+    const int error = errno;
+    close(fd);
+    errno = error != 0 ? error : EPROTO;
+    return nullptr;
+  }
+  const auto mapping = mmap(nullptr, sizeof(sleeppreventer_status_page), PROT_READ, MAP_SHARED, fd, 0);
+  const int error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    return nullptr;
+  }
+
+  const auto page = static_cast<const sleeppreventer_status_page*>(mapping);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (std::memcmp(page->magic, SLEEPPREVENTER_STATUS_MAGIC, sizeof(page->magic)) != 0 ||
+      StatusPage::AsAtomic(page->version).load(std::memory_order_relaxed) != SLEEPPREVENTER_STATUS_VERSION) {
+    munmap(mapping, sizeof(sleeppreventer_status_page));
+    errno = EPROTO;
+    return nullptr;
+  }
+  return page;
+}
+
+int sleeppreventer_status_read(const sleeppreventer_status_page* page, sleeppreventer_status* status) {
+  using StatusPage::AsAtomic;
+  const auto& sequence = AsAtomic(page->sequence);
+  for (int attempt = 0; attempt < SpinAttempts + MaxYields; attempt++) {
+    if (attempt >= SpinAttempts) {
+      sched_yield();
+    }
+    const auto begin = sequence.load(std::memory_order_acquire);
+    if (begin & 1) {
+      continue;
+    }
+    status->generation = AsAtomic(page->generation).load(std::memory_order_relaxed);
+    status->update_time = AsAtomic(page->update_time).load(std::memory_order_relaxed);
+    status->pid = AsAtomic(page->pid).load(std::memory_order_relaxed);
+    status->lease_count = AsAtomic(page->lease_count).load(std::memory_order_relaxed);
+    status->state = AsAtomic(page->state).load(std::memory_order_relaxed);
+    status->running = AsAtomic(page->running).load(std::memory_order_relaxed);
+    // the loads above happen before the sequence is checked again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == begin) {
+      return 0;
+    }
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+void sleeppreventer_status_close(const sleeppreventer_status_page* page) {
+  if (page != nullptr) {
+    munmap(const_cast<sleeppreventer_status_page*>(page), sizeof(sleeppreventer_status_page));
+  }
+}
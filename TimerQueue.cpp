@@ -0,0 +1,190 @@
+#include "TimerQueue.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+TimerQueue::TimerQueue() {
+  // steady_clock is CLOCK_MONOTONIC, so deadlines can be armed as absolute times
+  mFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mFd < 0) {
+    throw std::system_error(std::error_code(errno, std::system_category()), "timerfd_create failed");
+  }
+}
+
+TimerQueue::~TimerQueue() {
+  close(mFd);
+}
+
+int TimerQueue::GetFd() const {
+  return mFd;
+}
+
+bool TimerQueue::IsEarlier(const HeapEntry& a, const HeapEntry& b) {
+  return a.deadline != b.deadline ? a.deadline < b.deadline : a.sequence < b.sequence;
+}
+
+void TimerQueue::Place(std::size_t index, const HeapEntry& entry) {
+  mHeap[index] = entry;
+  mSlots[entry.slot].index = index;
+}
+
+void TimerQueue::SiftUp(std::size_t index) {
+  const auto entry = mHeap[index];
+  while (index > 0) {
+    const auto parent = (index - 1) / 2;
+    if (!IsEarlier(entry, mHeap[parent])) {
+      break;
+    }
+    Place(index, mHeap[parent]);
+    index = parent;
+  }
+  Place(index, entry);
+}
+
+void TimerQueue::SiftDown(std::size_t index) {
+  const auto entry = mHeap[index];
+  const auto size = mHeap.size();
+  while (true) {
+    auto child = index * 2 + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size && IsEarlier(mHeap[child + 1], mHeap[child])) {
+      child++;
+    }
+    if (!IsEarlier(mHeap[child], entry)) {
+      break;
+    }
+    Place(index, mHeap[child]);
+    index = child;
+  }
+  Place(index, entry);
+}
+
+void TimerQueue::RemoveAt(std::size_t index) {
+  const auto last = mHeap.size() - 1;
+  if (index != last) {
+    const auto moved = mHeap[last];
+    const bool up = IsEarlier(moved, mHeap[index]);
+    mHeap.pop_back();
+    Place(index, moved);
+    if (up) {
+      SiftUp(index);
+    } else {
+      SiftDown(index);
+    }
+  } else {
+    mHeap.pop_back();
+  }
+}
+
+void TimerQueue::Rearm() {
+  const auto next = GetNextDeadline();
+  // Expire rearms once when it is done
+  if (mExpiring || next == mArmedDeadline) {
+    return;
+  }
+
+  itimerspec spec{};
+  if (next) {
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(next.value().time_since_epoch());
+    // a zero it_value would disarm
+    const auto nanoseconds = std::max<std::int64_t>(sinceEpoch.count(), 1);
+    spec.it_value.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+  }
+  timerfd_settime(mFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  mArmedDeadline = next;
+  mArmCount++;
+}
+
+void TimerQueue::ReleaseSlot(std::uint32_t slot) {
+  auto& timer = mSlots[slot];
+  timer.active = false;
+  timer.generation++;
+  timer.callback = nullptr;
+  mFreeSlots.push_back(slot);
+}
+
+TimerQueue::TimerId TimerQueue::Schedule(Clock::time_point deadline, Callback callback) {
+  std::uint32_t slot;
+  if (!mFreeSlots.empty()) {
+    slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+  } else {
+    slot = static_cast<std::uint32_t>(mSlots.size());
+    // generations start at 1 so that no id is 0
+    mSlots.push_back({0, 1, false, nullptr});
+  }
+
+  auto& timer = mSlots[slot];
+  timer.index = mHeap.size();
+  timer.active = true;
+  timer.callback = std::move(callback);
+  mHeap.push_back({deadline, mNextSequence++, slot});
+  SiftUp(mHeap.size() - 1);
+  Rearm();
+  return static_cast<TimerId>(timer.generation) << 32 | slot;
+}
+
+bool TimerQueue::Cancel(TimerId id) {
+  const auto slot = static_cast<std::uint32_t>(id);
+  if (slot >= mSlots.size() || !mSlots[slot].active || mSlots[slot].generation != static_cast<std::uint32_t>(id >> 32)) {
+    return false;
+  }
+  RemoveAt(mSlots[slot].index);
+  ReleaseSlot(slot);
+  Rearm();
+  return true;
+}
+
+std::size_t TimerQueue::Expire(Clock::time_point now) {
+  std::size_t count = 0;
+  mExpiring = true;
+  while (!mHeap.empty() && mHeap.front().deadline <= now) {
+    const auto slot = mHeap.front().slot;
+    RemoveAt(0);
+    const auto id = static_cast<TimerId>(mSlots[slot].generation) << 32 | slot;
+    auto callback = std::move(mSlots[slot].callback);
+    ReleaseSlot(slot);
+
+    callback(id);
+    count++;
+  }
+  mExpiring = false;
+  Rearm();
+  return count;
+}
+
+std::size_t TimerQueue::ReadEvents() {
+  std::uint64_t expirations;
+  if (read(mFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+    // the expiration consumed the armed deadline
+    mArmedDeadline.reset();
+  }
+  return Expire(Clock::now());
+}
+
+std::size_t TimerQueue::GetCount() const {
+  return mHeap.size();
+}
+
+std::optional<TimerQueue::Clock::time_point> TimerQueue::GetNextDeadline() const {
+  if (mHeap.empty()) {
+    return std::nullopt;
+  }
+  return mHeap.front().deadline;
+}
+
+std::uint64_t TimerQueue::GetArmCount() const {
+  return mArmCount;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+// pending expirations in a binary min-heap behind a single timerfd
+// the timerfd is armed for the earliest deadline only, and disarmed while nothing is pending,
+// so an idle queue never wakes its owner up
+// Schedule and Cancel are O(log n); timers with the same deadline expire in the order they were scheduled
+class TimerQueue {
+public:
+  using Clock = std::chrono::steady_clock;
+  using TimerId = std::uint64_t;
+  using Callback = std::function<void(TimerId id)>;
+
+private:
+  struct HeapEntry {
+    Clock::time_point deadline;
+    // tie breaker, so equal deadlines expire in scheduling order
+    std::uint64_t sequence;
+    std::uint32_t slot;
+  };
+
+  // timers live in reusable slots; an id is the slot number with the slot's generation in the upper half,
+  // so a stale id never matches a newer timer in the same slot
+  struct Timer {
+    std::size_t index;
+    std::uint32_t generation;
+    bool active;
+    Callback callback;
+  };
+
+  int mFd = -1;
+  std::vector<HeapEntry> mHeap;
+  std::vector<Timer> mSlots;
+  std::vector<std::uint32_t> mFreeSlots;
+  std::uint64_t mNextSequence = 0;
+  std::optional<Clock::time_point> mArmedDeadline;
+  std::uint64_t mArmCount = 0;
+  bool mExpiring = false;
+
+  static bool IsEarlier(const HeapEntry& a, const HeapEntry& b);
+  void Place(std::size_t index, const HeapEntry& entry);
+  void SiftUp(std::size_t index);
+  void SiftDown(std::size_t index);
+  void RemoveAt(std::size_t index);
+  void ReleaseSlot(std::uint32_t slot);
+  void Rearm();
+
+public:
+  // throws std::system_error
+  TimerQueue();
+  ~TimerQueue();
+
+  TimerQueue(const TimerQueue&) = delete;
+  TimerQueue& operator=(const TimerQueue&) = delete;
+
+  // readable when the earliest deadline has passed
+  int GetFd() const;
+
+  TimerId Schedule(Clock::time_point deadline, Callback callback);
+  // returns false if the timer has already expired or was cancelled
+  bool Cancel(TimerId id);
+
+  // runs the callback of every timer due at now, earliest first, and returns how many ran
+  // callbacks may schedule and cancel timers; new timers already due run in the same call
+  // taking now as a parameter lets callers drive the queue with a virtual clock
+  std::size_t Expire(Clock::time_point now);
+  // drains the timerfd and expires against Clock::now()
+  std::size_t ReadEvents();
+
+  std::size_t GetCount() const;
+  std::optional<Clock::time_point> GetNextDeadline() const;
+  // number of timerfd_settime calls so far
+  std::uint64_t GetArmCount() const;
+};
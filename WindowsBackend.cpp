@@ -0,0 +1,35 @@
+#include "PreventerBackend.hpp"
+
+#include <memory>
+
+#include <Windows.h>
+
+namespace Preventer {
+  namespace {
+    // NOTE: SetThreadExecutionState is per-thread; Apply and Release must be called from the thread running the message loop
+    class WindowsBackend : public Backend {
+    public:
+      bool Apply(bool systemRequired, bool displayRequired) override {
+        EXECUTION_STATE flags = ES_CONTINUOUS;
+
+        if (systemRequired) {
+          flags |= ES_SYSTEM_REQUIRED;
+        }
+
+        if (displayRequired) {
+          flags |= ES_DISPLAY_REQUIRED;
+        }
+
+        return SetThreadExecutionState(flags) != 0;
+      }
+
+      void Release() override {
+        SetThreadExecutionState(ES_CONTINUOUS);
+      }
+    };
+  }
+
+  std::unique_ptr<Backend> CreateDefaultBackend() {
+    return std::make_unique<WindowsBackend>();
+  }
+}